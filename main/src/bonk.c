@@ -5,8 +5,9 @@
 #include <esp_log.h>
 #include <esp_timer.h>
 
-#include "main.h"
+#include "render.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define BONK_MAX_INTENSITY_THRESHOLD	20000
 #define BONK_DURATION_MS		1000
@@ -52,7 +53,7 @@ static void bonk_tx_bonk(int64_t timestamp, uint32_t magnitude) {
 		}
 	};
 
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_REALTIME, 0, 1);
 }
 
 static void process_bonk(bonk_t *bonk, int64_t timestamp, uint32_t magnitude) {
@@ -63,7 +64,7 @@ static void process_bonk(bonk_t *bonk, int64_t timestamp, uint32_t magnitude) {
 	bonk->bonk_write_pos %= ARRAY_SIZE(bonk->bonks);
 }
 
-static void bonk_tx_config(bonk_t *bonk) {
+static void bonk_tx_config(bonk_t *bonk, unsigned int repeats) {
 	bonk_packet_t packet = {
 		WIRELESS_PACKET_TYPE_BONK,
 		BONK_PACKET_TYPE_CONFIG,
@@ -80,21 +81,20 @@ static void bonk_tx_config(bonk_t *bonk) {
 		}
 	};
 	shared_config_hdr_init(&bonk->shared_cfg, &packet.config.shared_cfg_hdr);
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_NORMAL,
+			  WIRELESS_TX_FLAG_SUPERSEDE, repeats);
 	shared_config_tx_done(&bonk->shared_cfg);
 }
 
 static void config_changed(bonk_t *bonk) {
 	shared_config_update_local(&bonk->shared_cfg);
 
-	for (int i = 0; i < SHARED_CONFIG_TX_TIMES; i++) {
-		bonk_tx_config(bonk);
-	}
+	bonk_tx_config(bonk, SHARED_CONFIG_TX_TIMES);
 }
 
 static void config_update(bonk_t *bonk) {
 	if (shared_config_should_tx(&bonk->shared_cfg)) {
-		bonk_tx_config(bonk);
+		bonk_tx_config(bonk, 1);
 	}
 }
 
@@ -122,6 +122,9 @@ static void update_magnitude(bonk_t *bonk) {
 		}
 	}
 
+	if (magnitude && !bonk->magnitude) {
+		render_request_frame();
+	}
 	bonk->magnitude = magnitude;
 }
 
@@ -151,9 +154,22 @@ static void bonk_update(void *priv);
 static void bonk_update(void *priv) {
 	bonk_t *bonk = priv;
 	bonk_update_(bonk);
-	scheduler_schedule_task_relative(&bonk->update_task, bonk_update, bonk, MS_TO_US(20));
 }
 
+static bool bonk_is_active(const render_frame_t *frame, void *ctx) {
+	const bonk_t *bonk = ctx;
+	return bonk->enable && bonk_get_intensity(bonk);
+}
+
+static void bonk_apply(render_frame_t *frame, void *ctx) {
+	const bonk_t *bonk = ctx;
+	uint32_t intensity = bonk_get_intensity(bonk);
+	uint32_t brightness = intensity * HSV_VAL_MAX / BONK_MAX_INTENSITY;
+	frame->hsv.v = MIN((uint32_t)frame->hsv.v + brightness, HSV_VAL_MAX);
+}
+
+static esp_err_t bonk_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
 void bonk_init(bonk_t *bonk, lis3dh_t *accel) {
 	memset(bonk, 0, sizeof(*bonk));
 	bonk->accel = accel;
@@ -166,8 +182,13 @@ void bonk_init(bonk_t *bonk, lis3dh_t *accel) {
 	bonk->enable_decay = true;
 	bonk->enable_delay = true;
 
-	scheduler_task_init(&bonk->update_task);
-	scheduler_schedule_task_relative(&bonk->update_task, bonk_update, bonk, MS_TO_US(100));
+	scheduler_task_init(&bonk->update_task, "bonk");
+	scheduler_task_set_slack(&bonk->update_task, MS_TO_US(5));
+	scheduler_schedule_periodic(&bonk->update_task, bonk_update, bonk, MS_TO_US(100), MS_TO_US(20),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("bonk", RENDER_PRIORITY_BONK, bonk_apply, bonk_is_active, NULL, bonk);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_BONK, bonk_rx, bonk,
+				  WIRELESS_HANDLER_FLAG_NEIGHBOUR | WIRELESS_HANDLER_FLAG_REALTIME);
 }
 
 static void rx_bonk(bonk_t *bonk, const wireless_packet_t *packet, const bonk_packet_t *bonk_packet, const neighbour_t *neigh) {
@@ -194,10 +215,11 @@ static void rx_config(bonk_t *bonk, const wireless_packet_t *packet, const bonk_
 	}
 }
 
-void bonk_rx(bonk_t *bonk, const wireless_packet_t *packet, const neighbour_t *neigh) {
+static esp_err_t bonk_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	bonk_t *bonk = ctx;
 	if (packet->len < sizeof(bonk_packet_t)) {
 		ESP_LOGE(TAG, "Short packet received. Expected %zu bytes but got %u bytes", sizeof(bonk_packet_t), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 
 	bonk_packet_t bonk_packet;
@@ -205,25 +227,19 @@ void bonk_rx(bonk_t *bonk, const wireless_packet_t *packet, const neighbour_t *n
 	switch (bonk_packet.bonk_packet_type) {
 	case BONK_PACKET_TYPE_BONK:
 		rx_bonk(bonk, packet, &bonk_packet, neigh);
-		post_event(EVENT_LED);
+		render_request_frame();
 		break;
 	case BONK_PACKET_TYPE_CONFIG:
 		rx_config(bonk, packet, &bonk_packet);
 	}
+
+	return ESP_OK;
 }
 
 unsigned int bonk_get_intensity(const bonk_t *bonk) {
 	return bonk->magnitude * BONK_MAX_INTENSITY / BONK_MAX_INTENSITY_THRESHOLD;
 }
 
-void bonk_apply(bonk_t *bonk, color_hsv_t *color) {
-	if (bonk->enable) {
-		uint32_t intensity = bonk_get_intensity(bonk);
-		uint32_t brightness = intensity * HSV_VAL_MAX / BONK_MAX_INTENSITY;
-		color->v = MIN((uint32_t)color->v + brightness, HSV_VAL_MAX);
-	}
-}
-
 void bonk_set_enable(bonk_t *bonk, bool enable) {
 	if (bonk->enable != enable) {
 		bonk->enable = enable;
@@ -35,9 +35,7 @@ typedef struct bonk {
 } bonk_t;
 
 void bonk_init(bonk_t *bonk, lis3dh_t *accel);
-void bonk_rx(bonk_t *bonk, const wireless_packet_t *packet, const neighbour_t *neigh);
 unsigned int bonk_get_intensity(const bonk_t *bonk);
-void bonk_apply(bonk_t *bonk, color_hsv_t *color);
 void bonk_set_enable(bonk_t *bonk, bool enable);
 void bonk_set_decay_enable(bonk_t *bonk, bool enable);
 void bonk_set_delay_enable(bonk_t *bonk, bool enable);
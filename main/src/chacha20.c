@@ -22,25 +22,27 @@ static uint32_t pack4(const uint8_t *a)
 	return res;
 }
 
-static void chacha20_init_block(chacha20_ctx_t *ctx, const uint8_t key[32], const uint8_t nonce[12])
+void chacha20_key_init(chacha20_key_t *key_state, const uint8_t key[32])
 {
 	const uint8_t *magic_constant = (uint8_t*)"expand 32-byte k";
 
-	memcpy(ctx->key, key, sizeof(ctx->key));
-	memcpy(ctx->nonce, nonce, sizeof(ctx->nonce));
+	key_state->state[0] = pack4(magic_constant + 0 * 4);
+	key_state->state[1] = pack4(magic_constant + 1 * 4);
+	key_state->state[2] = pack4(magic_constant + 2 * 4);
+	key_state->state[3] = pack4(magic_constant + 3 * 4);
+	key_state->state[4] = pack4(key + 0 * 4);
+	key_state->state[5] = pack4(key + 1 * 4);
+	key_state->state[6] = pack4(key + 2 * 4);
+	key_state->state[7] = pack4(key + 3 * 4);
+	key_state->state[8] = pack4(key + 4 * 4);
+	key_state->state[9] = pack4(key + 5 * 4);
+	key_state->state[10] = pack4(key + 6 * 4);
+	key_state->state[11] = pack4(key + 7 * 4);
+}
 
-	ctx->state[0] = pack4(magic_constant + 0 * 4);
-	ctx->state[1] = pack4(magic_constant + 1 * 4);
-	ctx->state[2] = pack4(magic_constant + 2 * 4);
-	ctx->state[3] = pack4(magic_constant + 3 * 4);
-	ctx->state[4] = pack4(key + 0 * 4);
-	ctx->state[5] = pack4(key + 1 * 4);
-	ctx->state[6] = pack4(key + 2 * 4);
-	ctx->state[7] = pack4(key + 3 * 4);
-	ctx->state[8] = pack4(key + 4 * 4);
-	ctx->state[9] = pack4(key + 5 * 4);
-	ctx->state[10] = pack4(key + 6 * 4);
-	ctx->state[11] = pack4(key + 7 * 4);
+static void chacha20_init_block(chacha20_ctx_t *ctx, const chacha20_key_t *key_state, const uint8_t nonce[12])
+{
+	memcpy(ctx->state, key_state->state, sizeof(key_state->state));
 	// 64 bit counter initialized to zero by default.
 	ctx->state[12] = 0;
 	ctx->state[13] = pack4(nonce + 0 * 4);
@@ -100,22 +102,138 @@ static void chacha20_block_next(chacha20_ctx_t *ctx)
 	}
 }
 
-void chacha20_init(chacha20_ctx_t *ctx, const uint8_t key[32], const uint8_t nonce[12], uint64_t counter)
+/*
+ * Four consecutive keystream blocks at once. Lanes are interleaved, so
+ * each step of the rounds is a loop over the four blocks the compiler
+ * can vectorize.
+ */
+static void chacha20_quaterround4(uint32_t x[16][4], unsigned int a, unsigned int b, unsigned int c, unsigned int d)
 {
-	memset(ctx, 0, sizeof(chacha20_ctx_t));
+	int l;
+
+	for (l = 0; l < 4; l++) {
+		x[a][l] += x[b][l]; x[d][l] = rotl32(x[d][l] ^ x[a][l], 16);
+		x[c][l] += x[d][l]; x[b][l] = rotl32(x[b][l] ^ x[c][l], 12);
+		x[a][l] += x[b][l]; x[d][l] = rotl32(x[d][l] ^ x[a][l], 8);
+		x[c][l] += x[d][l]; x[b][l] = rotl32(x[b][l] ^ x[c][l], 7);
+	}
+}
+
+static void chacha20_block4_next(chacha20_ctx_t *ctx, uint32_t keystream32[4][16])
+{
+	uint32_t input[16][4];
+	uint32_t x[16][4];
+	uint64_t counter = ((uint64_t)ctx->state[13] << 32) | ctx->state[12];
+	int i, l;
+
+	for (i = 0; i < 16; i++) {
+		for (l = 0; l < 4; l++) {
+			input[i][l] = ctx->state[i];
+		}
+	}
+	for (l = 0; l < 4; l++) {
+		input[12][l] = (uint32_t)(counter + l);
+		input[13][l] = (uint32_t)((counter + l) >> 32);
+	}
+	memcpy(x, input, sizeof(x));
+
+	for (i = 0; i < 10; i++) {
+		chacha20_quaterround4(x, 0, 4, 8, 12);
+		chacha20_quaterround4(x, 1, 5, 9, 13);
+		chacha20_quaterround4(x, 2, 6, 10, 14);
+		chacha20_quaterround4(x, 3, 7, 11, 15);
+		chacha20_quaterround4(x, 0, 5, 10, 15);
+		chacha20_quaterround4(x, 1, 6, 11, 12);
+		chacha20_quaterround4(x, 2, 7, 8, 13);
+		chacha20_quaterround4(x, 3, 4, 9, 14);
+	}
+
+	for (l = 0; l < 4; l++) {
+		for (i = 0; i < 16; i++) {
+			keystream32[l][i] = x[i][l] + input[i][l];
+		}
+	}
+
+	counter += 4;
+	ctx->state[12] = (uint32_t)counter;
+	ctx->state[13] = (uint32_t)(counter >> 32);
+}
 
-	chacha20_init_block(ctx, key, nonce);
+void chacha20_init_key(chacha20_ctx_t *ctx, const chacha20_key_t *key_state, const uint8_t nonce[12], uint64_t counter)
+{
+	chacha20_init_block(ctx, key_state, nonce);
 	chacha20_block_set_counter(ctx, counter);
 
 	ctx->counter = counter;
 	ctx->position = 64;
 }
 
+void chacha20_init(chacha20_ctx_t *ctx, const uint8_t key[32], const uint8_t nonce[12], uint64_t counter)
+{
+	chacha20_key_t key_state;
+
+	chacha20_key_init(&key_state, key);
+	chacha20_init_key(ctx, &key_state, nonce, counter);
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// XOR whole blocks a word at a time. Keystream words are little endian already.
+static void chacha20_xor_blocks(uint8_t *dst, const uint8_t *src, const uint32_t *keystream32, size_t n_bytes)
+{
+	size_t i;
+
+	if (((uintptr_t)dst | (uintptr_t)src) & 3) {
+		const uint8_t *keystream8 = (const uint8_t*)keystream32;
+
+		for (i = 0; i < n_bytes; i++) {
+			dst[i] = src[i] ^ keystream8[i];
+		}
+		return;
+	}
+
+	uint8_t *dst32 = __builtin_assume_aligned(dst, 4);
+	const uint8_t *src32 = __builtin_assume_aligned(src, 4);
+	for (i = 0; i < n_bytes / 4; i++) {
+		uint32_t word;
+
+		memcpy(&word, src32 + i * 4, sizeof(word));
+		word ^= keystream32[i];
+		memcpy(dst32 + i * 4, &word, sizeof(word));
+	}
+}
+#endif
+
 void chacha20_xor(chacha20_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t n_bytes)
 {
 	size_t i;
 	uint8_t *keystream8 = (uint8_t*)ctx->keystream32;
 
+	// Use up keystream left over from the previous call first
+	while (n_bytes && ctx->position < 64) {
+		*dst++ = *src++ ^ keystream8[ctx->position++];
+		n_bytes--;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (n_bytes >= 4 * CHACHA20_BLOCK_SIZE) {
+		uint32_t keystream4[4][16];
+
+		chacha20_block4_next(ctx, keystream4);
+		chacha20_xor_blocks(dst, src, &keystream4[0][0], sizeof(keystream4));
+		dst += sizeof(keystream4);
+		src += sizeof(keystream4);
+		n_bytes -= sizeof(keystream4);
+	}
+
+	while (n_bytes >= CHACHA20_BLOCK_SIZE) {
+		chacha20_block_next(ctx);
+		chacha20_xor_blocks(dst, src, ctx->keystream32, CHACHA20_BLOCK_SIZE);
+		dst += CHACHA20_BLOCK_SIZE;
+		src += CHACHA20_BLOCK_SIZE;
+		n_bytes -= CHACHA20_BLOCK_SIZE;
+	}
+#endif
+
 	for (i = 0; i < n_bytes; i++) {
 		if (ctx->position >= 64) {
 			chacha20_block_next(ctx);
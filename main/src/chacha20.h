@@ -4,18 +4,25 @@
 #include <stdint.h>
 
 #define CHACHA20_KEY_SIZE	32
+#define CHACHA20_BLOCK_SIZE	64
+
+// Constants and key words of the initial state, packed once per key
+typedef struct chacha20_key {
+	uint32_t state[12];
+} chacha20_key_t;
 
 typedef struct chacha20_ctx {
 	uint32_t keystream32[16];
 	size_t position;
 
-	uint8_t key[32];
 	uint8_t nonce[12];
 	uint64_t counter;
 
 	uint32_t state[16];
 } chacha20_ctx_t;
 
+void chacha20_key_init(chacha20_key_t *key_state, const uint8_t key[32]);
+void chacha20_init_key(chacha20_ctx_t *ctx, const chacha20_key_t *key_state, const uint8_t nonce[12], uint64_t counter);
 void chacha20_init(chacha20_ctx_t *ctx, const uint8_t key[32], const uint8_t nonce[12], uint64_t counter);
 void chacha20_xor(chacha20_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t n_bytes);
 
@@ -0,0 +1,178 @@
+#include "color_correction.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <sdkconfig.h>
+
+#include "embedded_files.h"
+#include "settings.h"
+#include "util.h"
+
+#define DEFAULT_LUT_SIZE	16
+
+typedef struct color_lut {
+	const rgb16_t *table;
+	unsigned int size;
+	// log2 of input steps per grid cell
+	unsigned int shift;
+} color_lut_t;
+
+static const color_lut_t color_luts[] = {
+	{ (const rgb16_t *)EMBEDDED_FILE_PTR(colorcal_16x16x16_12bit_bin), 16, 12 },
+	{ (const rgb16_t *)EMBEDDED_FILE_PTR(colorcal_32x32x32_12bit_bin), 32, 11 },
+};
+
+static const char *TAG = "color_correction";
+
+typedef struct color_correction {
+	const color_lut_t *lut;
+	const rgb16_t *table;
+	rgb16_t *ram_table;
+} color_correction_t;
+
+static color_correction_t color_correction = { &color_luts[0], NULL, NULL };
+
+static inline unsigned int lut_index(unsigned int n, unsigned int r, unsigned int g, unsigned int b) {
+	return (g * n + b) * n + r;
+}
+
+static const color_lut_t *find_lut(unsigned int size) {
+	for (int i = 0; i < ARRAY_SIZE(color_luts); i++) {
+		if (color_luts[i].size == size) {
+			return &color_luts[i];
+		}
+	}
+	return NULL;
+}
+
+static void select_lut(const color_lut_t *lut) {
+	const rgb16_t *table = lut->table;
+#ifdef CONFIG_BK_COLORCAL_COPY_TO_RAM
+	free(color_correction.ram_table);
+	color_correction.ram_table = NULL;
+	size_t table_size = lut->size * lut->size * lut->size * sizeof(rgb16_t);
+	rgb16_t *ram_table = heap_caps_malloc(table_size, MALLOC_CAP_INTERNAL);
+	if (ram_table) {
+		memcpy(ram_table, lut->table, table_size);
+		color_correction.ram_table = ram_table;
+		table = ram_table;
+	} else {
+		ESP_LOGW(TAG, "Failed to allocate %u bytes for color correction table, using flash", (unsigned int)table_size);
+	}
+#endif
+	color_correction.lut = lut;
+	color_correction.table = table;
+}
+
+void color_correction_init(void) {
+	unsigned int size = settings_get_color_correction_lut_size(DEFAULT_LUT_SIZE);
+	const color_lut_t *lut = find_lut(size);
+	if (!lut) {
+		ESP_LOGW(TAG, "Invalid LUT size %u in settings, using %u", size, DEFAULT_LUT_SIZE);
+		lut = find_lut(DEFAULT_LUT_SIZE);
+	}
+	select_lut(lut);
+}
+
+/*
+ * Splits an input component into grid cell index and offset into the cell.
+ * Grid point i sits at input i << shift, so the topmost one is at 61440
+ * for the 16^3 table and at 63488 for the 32^3 table. There is no grid
+ * point at 65535. Inputs above the topmost point stay in the last cell
+ * with an offset of more than one cell, which extrapolates its slope
+ * linearly by up to 1/15 (16^3) or 1/31 (32^3) of the input range.
+ */
+static unsigned int split_component(const color_lut_t *lut, uint16_t val, int32_t *frac) {
+	unsigned int idx = MIN(val >> lut->shift, lut->size - 2);
+	*frac = val - (idx << lut->shift);
+	return idx;
+}
+
+/*
+ * Clamps to 0..COLOR_CORRECTION_OUTPUT_MAX. Extrapolation past the last
+ * grid point and tables that are not monotonic can leave that range, the
+ * LED output cannot represent anything outside it.
+ */
+static uint16_t interpolate(int32_t c0, int32_t c1, int32_t c2, int32_t c3,
+			    int32_t f1, int32_t f2, int32_t f3, unsigned int shift) {
+	int32_t val = (c0 << shift) + (c1 - c0) * f1 + (c2 - c1) * f2 + (c3 - c2) * f3;
+	val = (val + (1 << (shift - 1))) >> shift;
+	return MIN(MAX(val, 0), COLOR_CORRECTION_OUTPUT_MAX);
+}
+
+/*
+ * Tetrahedral interpolation. The cell is split into six tetrahedra along
+ * its main diagonal. Walking from the cell origin along the axes in order
+ * of decreasing offset visits the four corners of the tetrahedron that
+ * contains the input color.
+ */
+void color_correction_apply(const rgb16_t *in, rgb16_t *out) {
+	const color_lut_t *lut = color_correction.lut;
+	const rgb16_t *table = color_correction.table;
+	unsigned int n = lut->size;
+	int32_t fr, fg, fb;
+	unsigned int r = split_component(lut, in->r, &fr);
+	unsigned int g = split_component(lut, in->g, &fg);
+	unsigned int b = split_component(lut, in->b, &fb);
+
+	unsigned int idx1, idx2;
+	int32_t f1, f2, f3;
+	if (fr >= fg) {
+		if (fg >= fb) {
+			idx1 = lut_index(n, r + 1, g, b);
+			idx2 = lut_index(n, r + 1, g + 1, b);
+			f1 = fr; f2 = fg; f3 = fb;
+		} else if (fr >= fb) {
+			idx1 = lut_index(n, r + 1, g, b);
+			idx2 = lut_index(n, r + 1, g, b + 1);
+			f1 = fr; f2 = fb; f3 = fg;
+		} else {
+			idx1 = lut_index(n, r, g, b + 1);
+			idx2 = lut_index(n, r + 1, g, b + 1);
+			f1 = fb; f2 = fr; f3 = fg;
+		}
+	} else {
+		if (fr >= fb) {
+			idx1 = lut_index(n, r, g + 1, b);
+			idx2 = lut_index(n, r + 1, g + 1, b);
+			f1 = fg; f2 = fr; f3 = fb;
+		} else if (fg >= fb) {
+			idx1 = lut_index(n, r, g + 1, b);
+			idx2 = lut_index(n, r, g + 1, b + 1);
+			f1 = fg; f2 = fb; f3 = fr;
+		} else {
+			idx1 = lut_index(n, r, g, b + 1);
+			idx2 = lut_index(n, r, g + 1, b + 1);
+			f1 = fb; f2 = fg; f3 = fr;
+		}
+	}
+
+	const rgb16_t *c0 = &table[lut_index(n, r, g, b)];
+	const rgb16_t *c1 = &table[idx1];
+	const rgb16_t *c2 = &table[idx2];
+	const rgb16_t *c3 = &table[lut_index(n, r + 1, g + 1, b + 1)];
+	out->r = interpolate(c0->r, c1->r, c2->r, c3->r, f1, f2, f3, lut->shift);
+	out->g = interpolate(c0->g, c1->g, c2->g, c3->g, f1, f2, f3, lut->shift);
+	out->b = interpolate(c0->b, c1->b, c2->b, c3->b, f1, f2, f3, lut->shift);
+}
+
+esp_err_t color_correction_set_lut_size(unsigned int size) {
+	const color_lut_t *lut = find_lut(size);
+	if (!lut) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if (lut != color_correction.lut) {
+		select_lut(lut);
+	}
+	settings_set_color_correction_lut_size(size);
+	return ESP_OK;
+}
+
+unsigned int color_correction_get_lut_size(void) {
+	return color_correction.lut->size;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <esp_err.h>
+
+#include "color.h"
+
+// Corrected output is in 1/16th steps of a single LED channel, 16 LEDs at 255 max. Results are clamped to it.
+#define COLOR_CORRECTION_OUTPUT_MAX	4080
+
+void color_correction_init(void);
+void color_correction_apply(const rgb16_t *in, rgb16_t *out);
+esp_err_t color_correction_set_lut_size(unsigned int size);
+unsigned int color_correction_get_lut_size(void);
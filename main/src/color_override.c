@@ -2,9 +2,10 @@
 
 #include <esp_log.h>
 
-#include "main.h"
 #include "neighbour.h"
+#include "render.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define COLOR_OVERRIDE_MAX_DURATION_MS	10000
 #define COLOR_OVERRIDE_MAX_FUTURE_MS	10000
@@ -26,6 +27,7 @@ typedef struct color_override {
 	rgb16_t color;
 	color_override_entry_t remote_overrides[100];
 	unsigned int remote_override_write_idx;
+	int64_t timestamp_last_stop_global_us;
 } color_override_t;
 
 static const char *TAG = "color_override";
@@ -34,14 +36,15 @@ static color_override_t color_override = { 0 };
 
 void color_override_set_enable(bool enable) {
 	color_override.enabled = enable;
+	render_request_frame();
 }
 
 void color_override_set_color(const rgb16_t *rgb) {
 	color_override.color = *rgb;
+	render_request_frame();
 }
 
-const color_override_entry_t *find_active_remote_override(void) {
-	int64_t now_global = neighbour_get_global_clock();
+static const color_override_entry_t *find_active_remote_override(int64_t now_global) {
 	int64_t start_max = 0;
 	color_override_entry_t *most_recent_entry = NULL;
 	for (unsigned int i = 0; i < ARRAY_SIZE(color_override.remote_overrides); i++) {
@@ -57,17 +60,56 @@ const color_override_entry_t *find_active_remote_override(void) {
 	return most_recent_entry;
 }
 
-void color_override_apply(rgb16_t *rgb) {
+static bool color_override_is_active(const render_frame_t *frame, void *ctx) {
+	return color_override.enabled ||
+	       frame->global_clock_us <= color_override.timestamp_last_stop_global_us;
+}
+
+static int64_t color_override_next_frame(const render_frame_t *frame, void *ctx) {
+	if (color_override.enabled ||
+	    frame->global_clock_us > color_override.timestamp_last_stop_global_us) {
+		return RENDER_NEXT_FRAME_NONE;
+	}
+
+	// Next start or end of a scheduled remote override
+	int64_t next_global = INT64_MAX;
+	for (unsigned int i = 0; i < ARRAY_SIZE(color_override.remote_overrides); i++) {
+		const color_override_entry_t *entry = &color_override.remote_overrides[i];
+		if (entry->timestamp_start_global_us > frame->global_clock_us) {
+			next_global = MIN(next_global, entry->timestamp_start_global_us);
+		}
+		if (entry->timestamp_stop_global_us >= frame->global_clock_us) {
+			next_global = MIN(next_global, entry->timestamp_stop_global_us + 1);
+		}
+	}
+
+	if (next_global == INT64_MAX) {
+		return RENDER_NEXT_FRAME_NONE;
+	}
+	return render_global_to_local_us(frame, next_global);
+}
+
+static void color_override_apply(render_frame_t *frame, void *ctx) {
 	if (color_override.enabled) {
-		*rgb = color_override.color;
+		frame->rgb = color_override.color;
 	} else {
-		const color_override_entry_t *entry = find_active_remote_override();
+		const color_override_entry_t *entry = find_active_remote_override(frame->global_clock_us);
 		if (entry) {
-			*rgb = entry->color;
+			frame->rgb = entry->color;
 		}
 	}
 }
 
+static esp_err_t color_override_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
+void color_override_init(void) {
+	render_layer_register("color_override", RENDER_PRIORITY_COLOR_OVERRIDE,
+			      color_override_apply, color_override_is_active,
+			      color_override_next_frame, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_COLOR_OVERRIDE, color_override_rx, NULL,
+				  WIRELESS_HANDLER_FLAG_REALTIME);
+}
+
 static void add_override(const color_override_packet_t *override_packet) {
 	int64_t now_global = neighbour_get_global_clock();
 	int64_t us_until_start = override_packet->entry.timestamp_start_global_us - now_global;
@@ -79,22 +121,26 @@ static void add_override(const color_override_packet_t *override_packet) {
 		unsigned int override_idx = color_override.remote_override_write_idx;
 		color_override.remote_overrides[override_idx++] = override_packet->entry;
 		color_override.remote_override_write_idx = override_idx % ARRAY_SIZE(color_override.remote_overrides);
+		color_override.timestamp_last_stop_global_us = MAX(color_override.timestamp_last_stop_global_us,
+								   override_packet->entry.timestamp_stop_global_us);
 	}
 }
 
-void color_override_rx(wireless_packet_t *packet) {
+static esp_err_t color_override_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	color_override_packet_t override_packet;
 	if (packet->len < sizeof(override_packet)) {
 		ESP_LOGD(TAG, "Received short packet! Expecting %u bytes but got only %u bytes",
 			 sizeof(override_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&override_packet, packet->data, sizeof(override_packet));
 	if (wireless_is_broadcast_address(override_packet.addr) ||
 	    wireless_is_local_address(override_packet.addr)) {
 		add_override(&override_packet);
-		post_event(EVENT_LED);
+		render_request_frame();
 	}
+
+	return ESP_OK;
 }
 
 void color_override_tx(const rgb16_t *color, int64_t time_start_global_us, int64_t time_stop_global_us, const uint8_t *address) {
@@ -111,8 +157,9 @@ void color_override_tx(const rgb16_t *color, int64_t time_start_global_us, int64
 	if (wireless_is_broadcast_address(override_packet.addr) ||
 	    wireless_is_local_address(override_packet.addr)) {
 		add_override(&override_packet);
+		render_request_frame();
 	}
-	wireless_broadcast((const uint8_t *)&override_packet, sizeof(override_packet));
+	wireless_tx_queue(&override_packet, sizeof(override_packet), WIRELESS_TX_PRIORITY_REALTIME, 0, 1);
 }
 
 void color_override_broadcast(const rgb16_t *color, int64_t time_start_global_us, int64_t time_stop_global_us) {
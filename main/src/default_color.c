@@ -5,8 +5,10 @@
 #include <esp_err.h>
 #include <esp_log.h>
 
+#include "render.h"
 #include "scheduler.h"
 #include "shared_config.h"
+#include "wireless_tx.h"
 
 typedef struct default_color {
 	color_hsv_t default_color;
@@ -27,53 +29,65 @@ static default_color_t default_color = {
 	.shared_cfg = { 0 }
 };
 
-static void default_color_tx(void) {
+static void default_color_tx(unsigned int repeats) {
 	default_color_config_packet_t packet = {
 		.packet_type = WIRELESS_PACKET_TYPE_DEFAULT_COLOR,
 		.default_color = default_color.default_color
 	};
 	shared_config_hdr_init(&default_color.shared_cfg, &packet.shared_cfg_hdr);
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_NORMAL,
+			  WIRELESS_TX_FLAG_SUPERSEDE, repeats);
 	shared_config_tx_done(&default_color.shared_cfg);
 }
 
 static void config_changed(void) {
 	shared_config_update_local(&default_color.shared_cfg);
 
-	for (int i = 0; i < SHARED_CONFIG_TX_TIMES; i++) {
-		default_color_tx();
-	}
+	default_color_tx(SHARED_CONFIG_TX_TIMES);
 }
 
 static void default_color_update(void *priv);
 static void default_color_update(void *priv) {
 	if (shared_config_should_tx(&default_color.shared_cfg)) {
-		default_color_tx();
+		default_color_tx(1);
 	}
-	scheduler_schedule_task_relative(&default_color.update_task, default_color_update, NULL, MS_TO_US(1000));
 }
 
-void default_color_init() {
-	scheduler_task_init(&default_color.update_task);
-	scheduler_schedule_task_relative(&default_color.update_task, default_color_update, NULL, MS_TO_US(1000));
+static void default_color_apply(render_frame_t *frame, void *ctx) {
+	frame->hsv = default_color.default_color;
 }
 
-void default_color_apply(color_hsv_t *color) {
-	*color = default_color.default_color;
+// Static color, changes request a frame through shared_config
+static int64_t default_color_next_frame(const render_frame_t *frame, void *ctx) {
+	return RENDER_NEXT_FRAME_NONE;
 }
 
-void default_color_rx(const wireless_packet_t *packet) {
+static esp_err_t default_color_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
+void default_color_init() {
+	scheduler_task_init(&default_color.update_task, "default_color");
+	scheduler_task_set_slack(&default_color.update_task, MS_TO_US(100));
+	scheduler_schedule_periodic(&default_color.update_task, default_color_update, NULL, MS_TO_US(1000), MS_TO_US(1000),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("default_color", RENDER_PRIORITY_DEFAULT_COLOR, default_color_apply, NULL,
+			      default_color_next_frame, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_DEFAULT_COLOR, default_color_rx, NULL, 0);
+}
+
+static esp_err_t default_color_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	default_color_config_packet_t config_packet;
 	if (packet->len < sizeof(config_packet)) {
 		ESP_LOGD(TAG, "Received short packet, expected %u bytes but got only %u bytes",
 		         sizeof(config_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&config_packet, packet->data, sizeof(config_packet));
 
 	if (shared_config_update_remote(&default_color.shared_cfg, &config_packet.shared_cfg_hdr)) {
 		default_color.default_color = config_packet.default_color;
 	}
+
+	return ESP_OK;
 }
 
 void default_color_set_color(const color_hsv_t *color) {
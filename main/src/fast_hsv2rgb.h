@@ -24,6 +24,7 @@
 #ifndef __HSV_FAST_HSV2RGB_H__
 #define __HSV_FAST_HSV2RGB_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "color.h"
@@ -38,6 +39,19 @@ extern "C" {
 
 void fast_hsv2rgb_32bit(uint16_t h, uint16_t s, uint16_t v, uint16_t *r, uint16_t *g , uint16_t *b);
 
+/*
+ * Batch conversion of n colors, struct-of-arrays in and out. Results are
+ * bit-identical to fast_hsv2rgb_32bit(). The _scalar and _vector kernels
+ * are exposed for comparison, fast_hsv2rgb_32bit_batch() picks the
+ * vector kernel and converts the remainder with the scalar kernel.
+ */
+void fast_hsv2rgb_32bit_batch(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+                              uint16_t *r, uint16_t *g, uint16_t *b, size_t n);
+void fast_hsv2rgb_32bit_batch_scalar(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+                                     uint16_t *r, uint16_t *g, uint16_t *b, size_t n);
+void fast_hsv2rgb_32bit_batch_vector(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+                                     uint16_t *r, uint16_t *g, uint16_t *b, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
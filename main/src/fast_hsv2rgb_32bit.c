@@ -59,3 +59,140 @@ void fast_hsv2rgb_32bit(uint16_t h, uint16_t s, uint16_t v, uint16_t *r, uint16_
   d += (1ULL << 29) - 1;	// Error correction
   *r = d >> 29;
 }
+
+/*
+ * Batch conversion
+ *
+ * Same arithmetic as above without branches and without the 64 bit
+ * multiply. Mid level v * x with x < 2^29 is split into
+ *   a = v * (x >> 13)                   < 2^32 since x >> 13 <= 65527
+ *   b = v * (x & 0x1fff) + (1 << 29) - 1 < 2^30
+ * and (v * x + (1 << 29) - 1) >> 29 == (a + (b >> 13)) >> 16.
+ *
+ * Channel assignment per sextant:
+ * 	sext.	r	g	b
+ *	0	top	mid	bot
+ *	1	mid	top	bot
+ *	2	bot	top	mid
+ *	3	bot	mid	top
+ *	4	mid	bot	top
+ *	5	top	bot	mid
+ */
+#define HSV_BATCH_R_TOP(sext)	((sext) == 0 || (sext) == 5)
+#define HSV_BATCH_R_MID(sext)	((sext) == 1 || (sext) == 4)
+#define HSV_BATCH_G_TOP(sext)	((sext) == 1 || (sext) == 2)
+#define HSV_BATCH_G_MID(sext)	((sext) == 0 || (sext) == 3)
+#define HSV_BATCH_B_TOP(sext)	((sext) == 3 || (sext) == 4)
+#define HSV_BATCH_B_MID(sext)	((sext) == 2 || (sext) == 5)
+
+static inline uint32_t hsv_select(uint32_t is_top, uint32_t is_mid, uint32_t top, uint32_t mid, uint32_t bot)
+{
+  uint32_t mask_top = -is_top;
+  uint32_t mask_mid = -is_mid;
+  return (top & mask_top) | (mid & mask_mid) | (bot & ~(mask_top | mask_mid));
+}
+
+static inline void hsv2rgb_branchless(uint32_t h, uint32_t s, uint32_t v, uint16_t *r, uint16_t *g, uint16_t *b)
+{
+  uint32_t sextant = h >> 13;
+  sextant = sextant > 5 ? 5 : sextant;
+
+  uint32_t top = v;
+  uint32_t bot = (v * (HSV_SAT_MAX - s) + HSV_SAT_MAX) >> 16;
+
+  // 8191 - h_fraction for even sextants, h_fraction for odd sextants
+  uint32_t k = (h & 0x1fff) ^ (((sextant & 1) - 1) & 0x1fff);
+  uint32_t x = (8191UL << 16) - s * k;
+  uint32_t a = v * (x >> 13);
+  uint32_t lo = v * (x & 0x1fff) + (1UL << 29) - 1;
+  uint32_t mid = (a + (lo >> 13)) >> 16;
+
+  // Grayscale if s == 0
+  uint32_t mono = -(uint32_t)(s == 0);
+  bot = (bot & ~mono) | (v & mono);
+  mid = (mid & ~mono) | (v & mono);
+
+  *r = hsv_select(HSV_BATCH_R_TOP(sextant), HSV_BATCH_R_MID(sextant), top, mid, bot);
+  *g = hsv_select(HSV_BATCH_G_TOP(sextant), HSV_BATCH_G_MID(sextant), top, mid, bot);
+  *b = hsv_select(HSV_BATCH_B_TOP(sextant), HSV_BATCH_B_MID(sextant), top, mid, bot);
+}
+
+void fast_hsv2rgb_32bit_batch_scalar(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+                                     uint16_t *r, uint16_t *g, uint16_t *b, size_t n)
+{
+  for(size_t i = 0; i < n; i++) {
+    hsv2rgb_branchless(h[i], s[i], v[i], &r[i], &g[i], &b[i]);
+  }
+}
+
+#define HSV_VECTOR_LANES	4
+
+typedef uint16_t hsv_vec_u16_t __attribute__((vector_size(HSV_VECTOR_LANES * sizeof(uint16_t))));
+typedef uint32_t hsv_vec_u32_t __attribute__((vector_size(HSV_VECTOR_LANES * sizeof(uint32_t))));
+
+static inline hsv_vec_u32_t hsv_vec_load(const uint16_t *src)
+{
+  hsv_vec_u16_t vec;
+  __builtin_memcpy(&vec, src, sizeof(vec));
+  return __builtin_convertvector(vec, hsv_vec_u32_t);
+}
+
+static inline void hsv_vec_store(uint16_t *dst, hsv_vec_u32_t vec)
+{
+  hsv_vec_u16_t vec16 = __builtin_convertvector(vec, hsv_vec_u16_t);
+  __builtin_memcpy(dst, &vec16, sizeof(vec16));
+}
+
+static inline hsv_vec_u32_t hsv_vec_select(hsv_vec_u32_t mask_top, hsv_vec_u32_t mask_mid,
+                                           hsv_vec_u32_t top, hsv_vec_u32_t mid, hsv_vec_u32_t bot)
+{
+  return (top & mask_top) | (mid & mask_mid) | (bot & ~(mask_top | mask_mid));
+}
+
+void fast_hsv2rgb_32bit_batch_vector(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+                                     uint16_t *r, uint16_t *g, uint16_t *b, size_t n)
+{
+  size_t i;
+
+  for(i = 0; i + HSV_VECTOR_LANES <= n; i += HSV_VECTOR_LANES) {
+    hsv_vec_u32_t vh = hsv_vec_load(&h[i]);
+    hsv_vec_u32_t vs = hsv_vec_load(&s[i]);
+    hsv_vec_u32_t vv = hsv_vec_load(&v[i]);
+
+    hsv_vec_u32_t sextant = vh >> 13;
+    hsv_vec_u32_t clamp = (hsv_vec_u32_t)(sextant > 5);
+    sextant = (sextant & ~clamp) | (5 & clamp);
+
+    hsv_vec_u32_t top = vv;
+    hsv_vec_u32_t bot = (vv * (HSV_SAT_MAX - vs) + HSV_SAT_MAX) >> 16;
+
+    hsv_vec_u32_t k = (vh & 0x1fff) ^ (((sextant & 1) - 1) & 0x1fff);
+    hsv_vec_u32_t x = (8191UL << 16) - vs * k;
+    hsv_vec_u32_t a = vv * (x >> 13);
+    hsv_vec_u32_t lo = vv * (x & 0x1fff) + ((1UL << 29) - 1);
+    hsv_vec_u32_t mid = (a + (lo >> 13)) >> 16;
+
+    hsv_vec_u32_t mono = (hsv_vec_u32_t)(vs == 0);
+    bot = (bot & ~mono) | (vv & mono);
+    mid = (mid & ~mono) | (vv & mono);
+
+    hsv_vec_u32_t r_top = (hsv_vec_u32_t)((sextant == 0) | (sextant == 5));
+    hsv_vec_u32_t r_mid = (hsv_vec_u32_t)((sextant == 1) | (sextant == 4));
+    hsv_vec_u32_t g_top = (hsv_vec_u32_t)((sextant == 1) | (sextant == 2));
+    hsv_vec_u32_t g_mid = (hsv_vec_u32_t)((sextant == 0) | (sextant == 3));
+    hsv_vec_u32_t b_top = (hsv_vec_u32_t)((sextant == 3) | (sextant == 4));
+    hsv_vec_u32_t b_mid = (hsv_vec_u32_t)((sextant == 2) | (sextant == 5));
+
+    hsv_vec_store(&r[i], hsv_vec_select(r_top, r_mid, top, mid, bot));
+    hsv_vec_store(&g[i], hsv_vec_select(g_top, g_mid, top, mid, bot));
+    hsv_vec_store(&b[i], hsv_vec_select(b_top, b_mid, top, mid, bot));
+  }
+
+  fast_hsv2rgb_32bit_batch_scalar(&h[i], &s[i], &v[i], &r[i], &g[i], &b[i], n - i);
+}
+
+void fast_hsv2rgb_32bit_batch(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+                              uint16_t *r, uint16_t *g, uint16_t *b, size_t n)
+{
+  fast_hsv2rgb_32bit_batch_vector(h, s, v, r, g, b, n);
+}
@@ -0,0 +1,56 @@
+#include "hmac_sha1.h"
+
+#include <string.h>
+
+#define HMAC_IPAD	0x36
+#define HMAC_OPAD	0x5c
+
+static void hash_pad_block(mbedtls_sha1_context *sha1, const uint8_t *key_block, uint8_t pad) {
+	uint8_t block[HMAC_SHA1_BLOCK_SIZE];
+	for (int i = 0; i < sizeof(block); i++) {
+		block[i] = key_block[i] ^ pad;
+	}
+	mbedtls_sha1_init(sha1);
+	mbedtls_sha1_starts(sha1);
+	mbedtls_sha1_update(sha1, block, sizeof(block));
+	memset(block, 0, sizeof(block));
+}
+
+void hmac_sha1_key_init(hmac_sha1_key_t *key, const uint8_t *key_data, size_t len) {
+	uint8_t key_block[HMAC_SHA1_BLOCK_SIZE] = { 0 };
+	if (len > sizeof(key_block)) {
+		// Keys longer than a block are hashed first (RFC 2104)
+		mbedtls_sha1(key_data, len, key_block);
+	} else {
+		memcpy(key_block, key_data, len);
+	}
+
+	hash_pad_block(&key->inner, key_block, HMAC_IPAD);
+	hash_pad_block(&key->outer, key_block, HMAC_OPAD);
+	memset(key_block, 0, sizeof(key_block));
+}
+
+void hmac_sha1_key_free(hmac_sha1_key_t *key) {
+	mbedtls_sha1_free(&key->inner);
+	mbedtls_sha1_free(&key->outer);
+}
+
+void hmac_sha1_start(hmac_sha1_ctx_t *ctx, const hmac_sha1_key_t *key) {
+	mbedtls_sha1_init(&ctx->sha1);
+	mbedtls_sha1_clone(&ctx->sha1, &key->inner);
+	ctx->key = key;
+}
+
+void hmac_sha1_update(hmac_sha1_ctx_t *ctx, const uint8_t *data, size_t len) {
+	mbedtls_sha1_update(&ctx->sha1, data, len);
+}
+
+void hmac_sha1_finish(hmac_sha1_ctx_t *ctx, uint8_t digest[HMAC_SHA1_DIGEST_SIZE]) {
+	uint8_t inner_digest[HMAC_SHA1_DIGEST_SIZE];
+	mbedtls_sha1_finish(&ctx->sha1, inner_digest);
+
+	mbedtls_sha1_clone(&ctx->sha1, &ctx->key->outer);
+	mbedtls_sha1_update(&ctx->sha1, inner_digest, sizeof(inner_digest));
+	mbedtls_sha1_finish(&ctx->sha1, digest);
+	mbedtls_sha1_free(&ctx->sha1);
+}
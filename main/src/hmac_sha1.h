@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mbedtls/sha1.h>
+
+#define HMAC_SHA1_DIGEST_SIZE	20
+#define HMAC_SHA1_BLOCK_SIZE	64
+
+/*
+ * SHA-1 states after absorbing the ipad and opad key blocks, computed
+ * once per key. Each HMAC computation starts from a copy, so the key
+ * is never hashed again. Computations only read the key, but it must
+ * not be freed or initialized again while any of them is in progress.
+ */
+typedef struct hmac_sha1_key {
+	mbedtls_sha1_context inner;
+	mbedtls_sha1_context outer;
+} hmac_sha1_key_t;
+
+typedef struct hmac_sha1_ctx {
+	mbedtls_sha1_context sha1;
+	const hmac_sha1_key_t *key;
+} hmac_sha1_ctx_t;
+
+void hmac_sha1_key_init(hmac_sha1_key_t *key, const uint8_t *key_data, size_t len);
+void hmac_sha1_key_free(hmac_sha1_key_t *key);
+void hmac_sha1_start(hmac_sha1_ctx_t *ctx, const hmac_sha1_key_t *key);
+void hmac_sha1_update(hmac_sha1_ctx_t *ctx, const uint8_t *data, size_t len);
+void hmac_sha1_finish(hmac_sha1_ctx_t *ctx, uint8_t digest[HMAC_SHA1_DIGEST_SIZE]);
@@ -0,0 +1,162 @@
+#include "led_output.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+#include "perf.h"
+#include "util.h"
+#include "ws2812.h"
+
+#define NUM_BUFFERS	2
+
+#define BYTES_DATA	(LED_OUTPUT_NUM_LEDS * WS2812_BYTES_PER_LED)
+// >= 250 bits of reset, rounded up to keep LED data word aligned
+#define BYTES_RESET	32
+#define BYTES_BUFFER	(BYTES_RESET + BYTES_DATA + BYTES_RESET)
+
+static const char *TAG = "led_output";
+
+typedef struct led_output {
+	spi_device_handle_t dev;
+	uint8_t *buffers[NUM_BUFFERS];
+	spi_transaction_t xfers[NUM_BUFFERS];
+	unsigned int next_buffer;
+	unsigned int num_pending;
+	led_output_stats_t stats;
+} led_output_t;
+
+static led_output_t led_output = { 0 };
+
+#define GLOBAL_BRIGHT(comp) ((comp) > LED_OUTPUT_NUM_LEDS ? (comp) >> 4 : 0)
+#define LOCAL_BRIGHT(comp, i_) (GLOBAL_BRIGHT(comp) + (((i_ < (comp - (GLOBAL_BRIGHT(comp) << 4)))) ? 1 : 0))
+
+static void leds_set_color(uint32_t *data, const rgb16_t *color) {
+//	int led_map[LED_OUTPUT_NUM_LEDS] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+/*
+	int led_map[LED_OUTPUT_NUM_LEDS] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	for (int i = 0; i < LED_OUTPUT_NUM_LEDS; i++) {
+		uint8_t local_r = MIN(LOCAL_BRIGHT(color->r, led_map[i]), 255);
+		uint8_t local_g = MIN(LOCAL_BRIGHT(color->g, led_map[i]), 255);
+		uint8_t local_b = MIN(LOCAL_BRIGHT(color->b, led_map[i]), 255);
+		data = ws2812_encode(data, local_r, local_g, local_b);
+	}
+*/
+
+	uint16_t r_corrected = color->r;
+	uint16_t g_corrected = color->g;
+	uint16_t b_corrected = color->b;
+	for (int i = 0; i < LED_OUTPUT_NUM_LEDS; i++) {
+		uint8_t local_r = MIN(r_corrected, 255);
+		uint8_t local_g = MIN(g_corrected, 255);
+		uint8_t local_b = MIN(b_corrected, 255);
+		data = ws2812_encode(data, local_r, local_g, local_b);
+		r_corrected -= local_r;
+		g_corrected -= local_g;
+		b_corrected -= local_b;
+	}
+}
+
+static esp_err_t reap_transfer(TickType_t timeout) {
+	spi_transaction_t *xfer;
+	esp_err_t err = spi_device_get_trans_result(led_output.dev, &xfer, timeout);
+	if (!err) {
+		led_output.num_pending--;
+	}
+	return err;
+}
+
+esp_err_t led_output_init(spi_host_device_t host) {
+	spi_device_interface_config_t dev_cfg = {
+		.command_bits = 0,
+		.address_bits = 0,
+		.dummy_bits = 0,
+		.mode = 0,
+		.duty_cycle_pos = 0,
+		.cs_ena_pretrans = 0,
+		.cs_ena_posttrans = 0,
+		.clock_speed_hz = 3000000,
+		.input_delay_ns = 0,
+		.spics_io_num = -1,
+		.flags = SPI_DEVICE_BIT_LSBFIRST,
+		.queue_size = NUM_BUFFERS,
+	};
+	esp_err_t err = spi_bus_add_device(host, &dev_cfg, &led_output.dev);
+	if (err) {
+		ESP_LOGE(TAG, "Failed to add LED SPI device: %d", err);
+		return err;
+	}
+
+	ESP_LOGI(TAG, "Allocating %d x %u bytes of DMA memory", NUM_BUFFERS, (unsigned int)BYTES_BUFFER);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		uint8_t *buffer = heap_caps_malloc(BYTES_BUFFER, MALLOC_CAP_DMA);
+		if (!buffer) {
+			ESP_LOGE(TAG, "Failed to allocate LED DMA buffer");
+			return ESP_ERR_NO_MEM;
+		}
+		memset(buffer, 0, BYTES_BUFFER);
+		led_output.buffers[i] = buffer;
+		led_output.xfers[i] = (spi_transaction_t){
+			.length = BYTES_BUFFER * 8,
+			.rxlength = 0,
+			.tx_buffer = buffer,
+			.rx_buffer = NULL
+		};
+	}
+
+	ws2812_init();
+	return ESP_OK;
+}
+
+/*
+ * Encodes color into the next free buffer and queues it for transmission.
+ * Blocks only if all buffers are still in flight.
+ */
+esp_err_t led_output_show(const rgb16_t *color) {
+	while (led_output.num_pending && !reap_transfer(0));
+	if (led_output.num_pending == NUM_BUFFERS) {
+		led_output.stats.frames_waited++;
+		uint32_t cycles_start = perf_get_cycles();
+		reap_transfer(portMAX_DELAY);
+		perf_stage_end(PERF_STAGE_SPI_WAIT, cycles_start);
+	}
+
+	unsigned int buffer_idx = led_output.next_buffer;
+	uint32_t cycles_start = perf_get_cycles();
+	leds_set_color((uint32_t *)(led_output.buffers[buffer_idx] + BYTES_RESET), color);
+	perf_stage_end(PERF_STAGE_ENCODE, cycles_start);
+	esp_err_t err = spi_device_queue_trans(led_output.dev, &led_output.xfers[buffer_idx], 0);
+	if (err) {
+		return err;
+	}
+	led_output.num_pending++;
+	led_output.next_buffer = (buffer_idx + 1) % NUM_BUFFERS;
+	led_output.stats.frames++;
+	return ESP_OK;
+}
+
+// Waits for all queued frames to be transmitted
+void led_output_flush(void) {
+	if (!led_output.num_pending) {
+		return;
+	}
+
+	uint32_t cycles_start = perf_get_cycles();
+	while (led_output.num_pending) {
+		reap_transfer(portMAX_DELAY);
+	}
+	perf_stage_end(PERF_STAGE_SPI_WAIT, cycles_start);
+}
+
+void led_output_get_stats(led_output_stats_t *stats) {
+	*stats = led_output.stats;
+}
+
+void led_output_print_stats(void) {
+	printf("Frames: %lu\r\n", (unsigned long)led_output.stats.frames);
+	printf("Frames waited for SPI: %lu\r\n", (unsigned long)led_output.stats.frames_waited);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <driver/spi_master.h>
+#include <esp_err.h>
+
+#include "color.h"
+
+#define LED_OUTPUT_NUM_LEDS	16
+
+typedef struct led_output_stats {
+	uint32_t frames;
+	uint32_t frames_waited;
+} led_output_stats_t;
+
+esp_err_t led_output_init(spi_host_device_t host);
+esp_err_t led_output_show(const rgb16_t *color);
+void led_output_flush(void);
+void led_output_get_stats(led_output_stats_t *stats);
+void led_output_print_stats(void);
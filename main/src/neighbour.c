@@ -1,5 +1,6 @@
 #include "neighbour.h"
 
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -16,6 +17,7 @@
 #include "status_leds.h"
 #include "util.h"
 #include "wireless.h"
+#include "wireless_tx.h"
 
 #define NEIGHBOUR_TTL_US			30000000UL
 #define NEIGHBOUR_ADV_INTERVAL_US		 3000000UL
@@ -23,6 +25,14 @@
 #define NEIGHBOUR_MAX_RSSI_REPORTS			64
 #define NEIGHBOUR_RSSI_REPORT_ALLOCATION_BLOCK_SIZE	 8
 #define NEIGHBOUR_MAX_REPORTS_PER_PACKET		 8
+#define NEIGHBOUR_MAX_NEIGHBOURS			64
+#define NEIGHBOUR_HASH_TABLE_BITS			 7
+#define NEIGHBOUR_HASH_TABLE_SIZE			BIT(NEIGHBOUR_HASH_TABLE_BITS)
+#define NEIGHBOUR_HASH_SLOT_EMPTY			0xff
+
+// Linear probing stays short with the table at most half full
+static_assert(NEIGHBOUR_HASH_TABLE_SIZE >= NEIGHBOUR_MAX_NEIGHBOURS * 2);
+static_assert(NEIGHBOUR_MAX_NEIGHBOURS < NEIGHBOUR_HASH_SLOT_EMPTY);
 
 static const char *TAG = "neighbour";
 
@@ -30,6 +40,11 @@ typedef struct neighbours {
 	int64_t last_adv_timestamp;
 	int64_t local_to_global_time_offset;
 	list_head_t neighbours;
+	list_head_t free_neighbours;
+	unsigned int num_neighbours;
+	neighbour_t slab[NEIGHBOUR_MAX_NEIGHBOURS];
+	// Slab indices of all known neighbours, keyed by address
+	uint8_t hash_table[NEIGHBOUR_HASH_TABLE_SIZE];
 	scheduler_task_t housekeeping_task;
 	neighbour_t *clock_source;
 	portMUX_TYPE lock;
@@ -41,17 +56,63 @@ typedef struct neighbours {
 
 static neighbours_t neighbours;
 
+static unsigned int hash_address(const uint8_t *address) {
+	// The vendor prefix is the same for all nodes, only the lower bytes differ
+	uint32_t addr_low = (uint32_t)address[2] << 24 | (uint32_t)address[3] << 16 |
+			    (uint32_t)address[4] << 8 | (uint32_t)address[5];
+
+	return (uint32_t)(addr_low * 2654435761UL) >> (32 - NEIGHBOUR_HASH_TABLE_BITS);
+}
+
+static unsigned int next_hash_slot(unsigned int slot) {
+	return (slot + 1) % NEIGHBOUR_HASH_TABLE_SIZE;
+}
+
 static neighbour_t *find_neighbour(const uint8_t *address) {
-	neighbour_t *neigh;
-	LIST_FOR_EACH_ENTRY(neigh, &neighbours.neighbours, list) {
+	unsigned int slot = hash_address(address);
+	while (neighbours.hash_table[slot] != NEIGHBOUR_HASH_SLOT_EMPTY) {
+		neighbour_t *neigh = &neighbours.slab[neighbours.hash_table[slot]];
 		if (!memcmp(address, neigh->address, sizeof(neigh->address))) {
 			return neigh;
 		}
+		slot = next_hash_slot(slot);
 	}
 
 	return NULL;
 }
 
+static void hash_insert(const neighbour_t *neigh) {
+	unsigned int slot = hash_address(neigh->address);
+	while (neighbours.hash_table[slot] != NEIGHBOUR_HASH_SLOT_EMPTY) {
+		slot = next_hash_slot(slot);
+	}
+	neighbours.hash_table[slot] = neigh - neighbours.slab;
+}
+
+/*
+ * Removes a neighbour from the hash table. Instead of leaving a tombstone
+ * the following entries of the probe sequence are shifted back into the
+ * hole, keeping lookups short however often neighbours come and go.
+ */
+static void hash_remove(const neighbour_t *neigh) {
+	unsigned int hole = hash_address(neigh->address);
+	while (&neighbours.slab[neighbours.hash_table[hole]] != neigh) {
+		hole = next_hash_slot(hole);
+	}
+
+	for (unsigned int slot = next_hash_slot(hole);
+	     neighbours.hash_table[slot] != NEIGHBOUR_HASH_SLOT_EMPTY;
+	     slot = next_hash_slot(slot)) {
+		unsigned int home = hash_address(neighbours.slab[neighbours.hash_table[slot]].address);
+		// Entry may move if the hole lies between its home slot and its current slot
+		if ((slot - home) % NEIGHBOUR_HASH_TABLE_SIZE >= (slot - hole) % NEIGHBOUR_HASH_TABLE_SIZE) {
+			neighbours.hash_table[hole] = neighbours.hash_table[slot];
+			hole = slot;
+		}
+	}
+	neighbours.hash_table[hole] = NEIGHBOUR_HASH_SLOT_EMPTY;
+}
+
 const neighbour_t *neighbour_find_by_address(const uint8_t *address) {
 	return find_neighbour(address);
 }
@@ -95,19 +156,72 @@ static void update_clock_source(void) {
 	neighbours.clock_source = neigh_src;
 }
 
+static void delete_neighbour(neighbour_t *neigh) {
+	taskENTER_CRITICAL(&neighbours.lock);
+	hash_remove(neigh);
+	LIST_DELETE(&neigh->list);
+	neighbours.num_neighbours--;
+	if (neigh == neighbours.clock_source) {
+		neighbours.clock_source = NULL;
+		update_clock_source();
+	}
+	taskEXIT_CRITICAL(&neighbours.lock);
+	free(neigh->neighbour_rssi_reports);
+	neigh->neighbour_rssi_reports = NULL;
+	LIST_APPEND(&neigh->list, &neighbours.free_neighbours);
+}
+
+/*
+ * With the slab exhausted the neighbour we have not heard from for the
+ * longest time makes room. The clock source is kept to avoid jumps of the
+ * global clock.
+ *
+ * RSSI is deliberately not considered. The RSSI of a neighbour that went
+ * quiet is as old as its last packet, and weak neighbours at the edge of
+ * the group are still members that advertise regularly. Evicting them
+ * would only have them re-added, evicting the next one, on their next
+ * advertisement. Advertisement timestamps are in microseconds, ties do not
+ * happen in practice.
+ */
+static void evict_neighbour(void) {
+	neighbour_t *neigh;
+	neighbour_t *oldest = NULL;
+	LIST_FOR_EACH_ENTRY(neigh, &neighbours.neighbours, list) {
+		if (neigh == neighbours.clock_source) {
+			continue;
+		}
+		if (!oldest || neigh->last_local_adv_rx_timestamp_us < oldest->last_local_adv_rx_timestamp_us) {
+			oldest = neigh;
+		}
+	}
+
+	ESP_LOGW(TAG, "Neighbour table full, evicting "MACSTR, MAC2STR(oldest->address));
+	delete_neighbour(oldest);
+}
+
+static neighbour_t *alloc_neighbour(void) {
+	if (LIST_IS_EMPTY(&neighbours.free_neighbours)) {
+		evict_neighbour();
+	}
+
+	neighbour_t *neigh = LIST_GET_ENTRY(neighbours.free_neighbours.next, neighbour_t, list);
+	LIST_DELETE(&neigh->list);
+	memset(neigh, 0, sizeof(*neigh));
+	INIT_LIST_HEAD(neigh->list);
+	return neigh;
+}
+
 esp_err_t neighbour_update(const uint8_t *address, int64_t timestamp_us, const neighbour_advertisement_t *adv) {
 	neighbour_t *neigh = find_neighbour(address);
 	if (!neigh) {
 		ESP_LOGI(TAG, "New neighbour "MACSTR, MAC2STR(address));
-		neigh = calloc(1, sizeof(neighbour_t));
-		if (!neigh) {
-			return ESP_ERR_NO_MEM;
-		}
-		INIT_LIST_HEAD(neigh->list);
+		neigh = alloc_neighbour();
 		memcpy(neigh->address, address, sizeof(neigh->address));
 		neigh->local_to_remote_time_offset = 0;
 		taskENTER_CRITICAL(&neighbours.lock);
+		hash_insert(neigh);
 		LIST_APPEND(&neigh->list, &neighbours.neighbours);
+		neighbours.num_neighbours++;
 		taskEXIT_CRITICAL(&neighbours.lock);
 	}
 
@@ -118,7 +232,7 @@ esp_err_t neighbour_update(const uint8_t *address, int64_t timestamp_us, const n
 	return ESP_OK;
 }
 
-esp_err_t neighbour_rx(const wireless_packet_t *packet) {
+static esp_err_t neighbour_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	neighbour_advertisement_t adv;
 	if (packet->len < sizeof(adv)) {
 		ESP_LOGD(TAG, "Got short advertisement packet, expected %u bytes but got only %u bytes",
@@ -220,7 +334,7 @@ esp_err_t neighbour_update_rssi_reports(const uint8_t *address, const neighbour_
 	return ESP_OK;
 }
 
-esp_err_t neighbour_rx_rssi_info(const wireless_packet_t *packet) {
+static esp_err_t neighbour_rx_rssi_info(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	neighbour_rssi_info_packet_t info;
 	if (packet->len < sizeof(info)) {
 		ESP_LOGD(TAG, "Got short advertisement rssi, expected %u bytes but got only %u bytes",
@@ -283,9 +397,10 @@ static esp_err_t send_next_rssi_report(void) {
 	full_rssi_report_packet.info.num_rssi_reports = num_neighbours;
 
 	// Send the report
-	esp_err_t err = wireless_broadcast((const uint8_t *)&full_rssi_report_packet,
-					   sizeof(full_rssi_report_packet.info) +
-					   sizeof(neighbour_rssi_info_t) * (size_t)reports_in_packet);
+	esp_err_t err = wireless_tx_queue(&full_rssi_report_packet,
+					  sizeof(full_rssi_report_packet.info) +
+					  sizeof(neighbour_rssi_info_t) * (size_t)reports_in_packet,
+					  WIRELESS_TX_PRIORITY_BULK, 0, 1);
 	if (err) {
 		return err;
 	}
@@ -306,15 +421,7 @@ static void neighbour_housekeeping(void *priv) {
 		int64_t age = now - neigh->last_local_adv_rx_timestamp_us;
 		if (age > NEIGHBOUR_TTL_US) {
 			ESP_LOGI(TAG, "Neighbour "MACSTR" TTL exceeded, deleting", MAC2STR(neigh->address));
-			taskENTER_CRITICAL(&neighbours.lock);
-			LIST_DELETE(&neigh->list);
-			if (neigh == neighbours.clock_source) {
-				neighbours.clock_source = NULL;
-				update_clock_source();
-			}
-			taskEXIT_CRITICAL(&neighbours.lock);
-			free(neigh->neighbour_rssi_reports);
-			free(neigh);
+			delete_neighbour(neigh);
 		} else {
 			neigh->local_to_remote_time_offset = now - get_uptime_us(neigh, now);
 		}
@@ -329,7 +436,7 @@ static void neighbour_housekeeping(void *priv) {
 			global_clock
 		};
 
-		wireless_broadcast((uint8_t *)&adv, sizeof(adv));
+		wireless_tx_queue(&adv, sizeof(adv), WIRELESS_TX_PRIORITY_REALTIME, 0, 1);
 		neighbours.last_adv_timestamp = now;
 	}
 
@@ -347,8 +454,6 @@ static void neighbour_housekeeping(void *priv) {
 	} else {
 		status_led_set_blink(STATUS_LED_GREEN, 1000);
 	}
-
-	scheduler_schedule_task_relative(&neighbours.housekeeping_task, neighbour_housekeeping, NULL, MS_TO_US(2000));
 }
 
 void neighbour_init() {
@@ -357,9 +462,19 @@ void neighbour_init() {
 	neighbours.lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
 	neighbours.rssi_report_lock = xSemaphoreCreateMutexStatic(&neighbours.rssi_report_lock_buffer);
 	INIT_LIST_HEAD(neighbours.neighbours);
-	scheduler_task_init(&neighbours.housekeeping_task);
-	scheduler_schedule_task_relative(&neighbours.housekeeping_task, neighbour_housekeeping, NULL, MS_TO_US(0));
+	INIT_LIST_HEAD(neighbours.free_neighbours);
+	for (int i = 0; i < ARRAY_SIZE(neighbours.slab); i++) {
+		LIST_APPEND_TAIL(&neighbours.slab[i].list, &neighbours.free_neighbours);
+	}
+	memset(neighbours.hash_table, NEIGHBOUR_HASH_SLOT_EMPTY, sizeof(neighbours.hash_table));
+	neighbours.num_neighbours = 0;
+	scheduler_task_init(&neighbours.housekeeping_task, "neighbour_housekeeping");
+	scheduler_task_set_slack(&neighbours.housekeeping_task, MS_TO_US(200));
+	scheduler_schedule_periodic(&neighbours.housekeeping_task, neighbour_housekeeping, NULL, MS_TO_US(0), MS_TO_US(2000),
+				    SCHEDULER_PERIODIC_SKIP);
 	neighbours.rssi_report_index = 0;
+	wireless_register_handler(WIRELESS_PACKET_TYPE_NEIGHBOUR_ADVERTISEMENT, neighbour_rx, NULL, 0);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_NEIGHBOUR_RSSI_REPORT, neighbour_rx_rssi_info, NULL, 0);
 }
 
 int64_t neighbour_get_global_clock_and_source(neighbour_t **src) {
@@ -401,15 +516,44 @@ bool neighbour_has_neighbours(void) {
 	return !LIST_IS_EMPTY(&neighbours.neighbours);
 }
 
+/*
+ * Anti-replay check against the window of a neighbour. Returns
+ * ESP_ERR_NOT_FOUND for unknown senders and ESP_ERR_INVALID_STATE for
+ * duplicate or too old packets. Called from the WiFi task only, which
+ * makes it the sole user of the replay windows.
+ */
+esp_err_t neighbour_replay_check(const uint8_t *address, uint32_t random_id, uint32_t packet_cnt, uint32_t timestamp) {
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+	taskENTER_CRITICAL(&neighbours.lock);
+	const neighbour_t *neigh = find_neighbour(address);
+	if (neigh) {
+		err = replay_window_check(&neigh->replay_window, random_id, packet_cnt, timestamp) ?
+			ESP_OK : ESP_ERR_INVALID_STATE;
+	}
+	taskEXIT_CRITICAL(&neighbours.lock);
+	return err;
+}
+
+// Records an authenticated packet in the replay window of a neighbour, WiFi task only
+esp_err_t neighbour_replay_update(const uint8_t *address, uint32_t random_id, uint32_t packet_cnt, uint32_t timestamp) {
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+	taskENTER_CRITICAL(&neighbours.lock);
+	neighbour_t *neigh = find_neighbour(address);
+	if (neigh) {
+		replay_window_update(&neigh->replay_window, random_id, packet_cnt, timestamp);
+		err = ESP_OK;
+	}
+	taskEXIT_CRITICAL(&neighbours.lock);
+	return err;
+}
+
 void neighbour_print_list(void) {
 	printf("Address             Uptime       Age      RSSI     SoC    Time to empty   Firmware hash   Firmware version   OTA status\r\n");
 	printf("========================================================================================================================\r\n");
 	//      aa:bb:cc:dd:ee:ff   xxxxxxxxms   xxxxxms  -90dBm   100%   65535min        <short hash>    <firmware version>
 	neighbour_t *neigh;
 	int64_t now = esp_timer_get_time();
-	unsigned int num_neighbours = 0;
 	LIST_FOR_EACH_ENTRY(neigh, &neighbours.neighbours, list) {
-		num_neighbours++;
 		bool neigh_status_valid = !!neigh->last_status.packet_type;
 		uint64_t age_ms = now - neigh->last_local_adv_rx_timestamp_us;
 		bool firmware_str_valid = !!neigh->last_static_info.packet_type;
@@ -442,7 +586,7 @@ void neighbour_print_list(void) {
 			       ota_status);
 		}
 	}
-	printf("Have %u neigbours\r\n", num_neighbours);
+	printf("Have %u of %u neigbours\r\n", neighbours.num_neighbours, NEIGHBOUR_MAX_NEIGHBOURS);
 }
 
 void neighbour_update_status(const neighbour_t *neigh, const neighbour_status_packet_t *status) {
@@ -7,6 +7,7 @@
 #include <esp_now.h>
 
 #include "list.h"
+#include "replay_window.h"
 #include "wireless.h"
 
 typedef struct neighbour_advertisement {
@@ -51,6 +52,7 @@ typedef struct neighbour_ota_info {
 } neighbour_ota_info_t;
 
 typedef struct neighbour {
+	// Entry in the neighbour list, or the free list while the slab entry is unused
 	list_head_t list;
 	uint8_t address[ESP_NOW_ETH_ALEN];
 	int64_t last_local_adv_rx_timestamp_us;
@@ -62,14 +64,14 @@ typedef struct neighbour {
 	int rssi;
 	unsigned int num_rssi_reports;
 	neighbour_rssi_info_t *neighbour_rssi_reports;
+	// Owned by the WiFi task, see neighbour_replay_check()
+	replay_window_t replay_window;
 } neighbour_t;
 
 /* Non-threaded functions */
 void neighbour_init(void);
 const neighbour_t *neighbour_find_by_address(const uint8_t *address);
 esp_err_t neighbour_update(const uint8_t *address, int64_t timestamp_us, const neighbour_advertisement_t *adv);
-esp_err_t neighbour_rx(const wireless_packet_t *packet);
-esp_err_t neighbour_rx_rssi_info(const wireless_packet_t *packet);
 int64_t neighbour_get_global_clock_and_source(neighbour_t **src);
 esp_err_t neighbour_update_rssi(const uint8_t *address, int rssi);
 int64_t neighbour_remote_to_local_time(const neighbour_t *neigh, int64_t remote_timestamp);
@@ -85,3 +87,5 @@ void neighbour_put_rssi_reports(void);
 /* Threadsafe functions */
 int64_t neighbour_get_global_clock();
 bool neighbour_has_neighbours(void);
+esp_err_t neighbour_replay_check(const uint8_t *address, uint32_t random_id, uint32_t packet_cnt, uint32_t timestamp);
+esp_err_t neighbour_replay_update(const uint8_t *address, uint32_t random_id, uint32_t packet_cnt, uint32_t timestamp);
@@ -9,6 +9,7 @@
 
 #include "scheduler.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define STATIC_INFO_TX_INTERVAL_MS	60000
 
@@ -21,16 +22,18 @@ typedef struct neighbour_static_info {
 
 static neighbour_static_info_t neighbour_static_info = { 0 };
 
-void neighbour_static_info_rx(const wireless_packet_t *packet, const neighbour_t *neigh) {
+static esp_err_t neighbour_static_info_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	if (packet->len < sizeof(neighbour_static_info_packet_t)) {
 		ESP_LOGI(TAG, "Short packet received, expected %u bytes but got %u bytes", sizeof(neighbour_static_info_packet_t), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	neighbour_static_info_packet_t static_info;
 	memcpy(&static_info, packet->data, sizeof(neighbour_static_info_packet_t));
 	if (neigh) {
 		neighbour_update_static_info(neigh, &static_info);
 	}
+
+	return ESP_OK;
 }
 
 static void neighbour_static_info_update(void *arg);
@@ -43,15 +46,17 @@ static void neighbour_static_info_update(void *arg) {
 		const esp_app_desc_t *app_desc = esp_app_get_description();
 		memcpy(info.firmware_version, app_desc->version, sizeof(info.firmware_version));
 		memcpy(info.firmware_sha256_hash, app_desc->app_elf_sha256, sizeof(info.firmware_sha256_hash));
-		wireless_broadcast((const uint8_t *)&info, sizeof(info));
+		wireless_tx_queue(&info, sizeof(info), WIRELESS_TX_PRIORITY_BULK, WIRELESS_TX_FLAG_SUPERSEDE, 1);
 		neighbour_static_info.last_tx_timestamp = now;
 	}
-	scheduler_schedule_task_relative(&neighbour_static_info.update_task, neighbour_static_info_update, NULL, MS_TO_US(1000));
 }
 
 void neighbour_static_info_init(void) {
-	scheduler_task_init(&neighbour_static_info.update_task);
-	scheduler_schedule_task_relative(&neighbour_static_info.update_task, neighbour_static_info_update, NULL, 0);
+	scheduler_task_init(&neighbour_static_info.update_task, "neighbour_static_info");
+	scheduler_task_set_slack(&neighbour_static_info.update_task, MS_TO_US(100));
+	scheduler_schedule_periodic(&neighbour_static_info.update_task, neighbour_static_info_update, NULL, 0, MS_TO_US(1000),
+				    SCHEDULER_PERIODIC_SKIP);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO, neighbour_static_info_rx, NULL, WIRELESS_HANDLER_FLAG_NEIGHBOUR);
 }
 
 void neighbour_static_info_get_ap_ssid(const neighbour_t *neigh, char *buf, size_t len) {
@@ -8,6 +8,7 @@
 
 #include "scheduler.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define NEIGHBOUR_STATUS_INTERVAL_MS	10000
 
@@ -21,10 +22,10 @@ static const char *TAG = "node_status";
 
 neighbour_status_t neighbour_status = { 0 };
 
-void neighbour_status_rx(const wireless_packet_t *packet, const neighbour_t *neigh) {
+static esp_err_t neighbour_status_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	if (packet->len < sizeof(neighbour_status_packet_t)) {
 		ESP_LOGD(TAG, "Short packet received, expected %u bytes but got %u bytes", sizeof(neighbour_status_packet_t), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	neighbour_status_packet_t status;
 	memcpy(&status, packet->data, sizeof(neighbour_status_packet_t));
@@ -45,6 +46,8 @@ void neighbour_status_rx(const wireless_packet_t *packet, const neighbour_t *nei
 			 (int)status.battery_time_to_empty_min, (int)status.battery_full_charge_capacity_mah,
 			 (int)status.battery_soh_percent);
 	}
+
+	return ESP_OK;
 }
 
 static esp_err_t neighbour_status_update_(void) {
@@ -61,7 +64,7 @@ static esp_err_t neighbour_status_update_(void) {
 		status.battery_time_to_empty_min = MAX(bq27546_get_time_to_empty_min(neighbour_status.gauge), -1);
 		status.battery_full_charge_capacity_mah = MAX(bq27546_get_full_charge_capacity_mah(neighbour_status.gauge), -1);
 		status.battery_soh_percent = MAX(bq27546_get_state_of_health_percent(neighbour_status.gauge), -1);
-		wireless_broadcast((const uint8_t *)&status, sizeof(status));
+		wireless_tx_queue(&status, sizeof(status), WIRELESS_TX_PRIORITY_BULK, WIRELESS_TX_FLAG_SUPERSEDE, 1);
 		neighbour_status.timestamp_last_status_tx_us = now;
 	}
 
@@ -71,11 +74,13 @@ static esp_err_t neighbour_status_update_(void) {
 static void neighbour_status_update(void *arg);
 static void neighbour_status_update(void *arg) {
 	neighbour_status_update_();
-	scheduler_schedule_task_relative(&neighbour_status.update_task, neighbour_status_update, NULL, MS_TO_US(1000));
 }
 
 void neighbour_status_init(bq27546_t *battery_gauge) {
 	neighbour_status.gauge = battery_gauge;
-	scheduler_task_init(&neighbour_status.update_task);
-	scheduler_schedule_task_relative(&neighbour_status.update_task, neighbour_status_update, NULL, 0);
+	scheduler_task_init(&neighbour_status.update_task, "neighbour_status");
+	scheduler_task_set_slack(&neighbour_status.update_task, MS_TO_US(100));
+	scheduler_schedule_periodic(&neighbour_status.update_task, neighbour_status_update, NULL, 0, MS_TO_US(1000),
+				    SCHEDULER_PERIODIC_SKIP);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, neighbour_status_rx, NULL, WIRELESS_HANDLER_FLAG_NEIGHBOUR);
 }
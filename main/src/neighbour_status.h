@@ -7,4 +7,3 @@
 #include "wireless.h"
 
 void neighbour_status_init(bq27546_t *battery_gauge);
-void neighbour_status_rx(const wireless_packet_t *packet, const neighbour_t *neigh);
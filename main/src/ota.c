@@ -20,9 +20,11 @@
 
 #include "neighbour.h"
 #include "neighbour_static_info.h"
+#include "render.h"
 #include "scheduler.h"
 #include "tcp_client.h"
 #include "tcp_memory_server.h"
+#include "wireless_tx.h"
 
 #define OTA_UPDATE_SERVE_INTERVAL_MS	10000
 #define OTA_UPDATE_DOWNLOAD_STALL_MS	5000
@@ -119,7 +121,8 @@ static void ota_announce_serve(void) {
 		ota_packet.packet_type = WIRELESS_PACKET_TYPE_OTA;
 		ota_packet.ota_packet_type = OTA_PACKET_TYPE_INIT;
 		ota_packet.init.firmware_size = ota.firmware_size;
-		wireless_broadcast((const uint8_t *)&ota_packet, sizeof(ota_packet));
+		wireless_tx_queue(&ota_packet, sizeof(ota_packet), WIRELESS_TX_PRIORITY_BULK,
+				  WIRELESS_TX_FLAG_SUPERSEDE, 1);
 		ota.last_tx_timestamp_us = now;
 	}
 }
@@ -253,7 +256,8 @@ static esp_err_t ota_supervise_download_progress() {
 		ota_packet.ota_packet_type = OTA_PACKET_TYPE_PROGRESS;
 		ota_packet.progress.download_size = ota.update_size;
 		ota_packet.progress.download_progress = ota.bytes_transfered;
-		wireless_broadcast((const uint8_t *)&ota_packet, sizeof(ota_packet));
+		wireless_tx_queue(&ota_packet, sizeof(ota_packet), WIRELESS_TX_PRIORITY_BULK,
+				  WIRELESS_TX_FLAG_SUPERSEDE, 1);
 		ota.last_tx_timestamp_us = now;
 	}
 
@@ -313,12 +317,39 @@ static esp_err_t ota_update_() {
 	return ESP_OK;
 }
 
+static bool ota_indicate_update_is_active(const render_frame_t *frame, void *ctx) {
+	return ota.state == OTA_STATE_DOWNLOAD_IN_PROGRESS;
+}
+
+static int64_t ota_indicate_update_next_frame(const render_frame_t *frame, void *ctx) {
+	if (!ota_indicate_update_is_active(frame, ctx)) {
+		return RENDER_NEXT_FRAME_NONE;
+	}
+	return render_next_blink_us(frame, MS_TO_US(OTA_UPDATE_BLINK_INTERVAL_MS));
+}
+
+static void ota_indicate_update(render_frame_t *frame, void *ctx) {
+	int32_t now_ms = frame->global_clock_us / 1000LL;
+	unsigned int cycle_ms = now_ms % (OTA_UPDATE_BLINK_INTERVAL_MS * 2);
+
+	if (cycle_ms >= OTA_UPDATE_BLINK_INTERVAL_MS) {
+		frame->hsv.h = 26788;
+		frame->hsv.s = 41680;
+//		frame->hsv.v = 64224;
+	} else {
+		frame->hsv.h = 47595;
+		frame->hsv.s = 19792;
+//		frame->hsv.v = 62979;
+	}
+}
+
 static void ota_update(void *arg);
 static void ota_update(void *arg) {
 	ota_update_();
-	scheduler_schedule_task_relative(&ota.update_task, ota_update, NULL, MS_TO_US(1000));
 }
 
+static esp_err_t ota_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
 esp_err_t ota_init() {
 	memset(&ota, 0, sizeof(ota));
 	ota.tcp_client_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
@@ -352,8 +383,13 @@ esp_err_t ota_init() {
 		return err;
 	}
 
-	scheduler_task_init(&ota.update_task);
-	scheduler_schedule_task_relative(&ota.update_task, ota_update, NULL, 0);
+	scheduler_task_init(&ota.update_task, "ota");
+	scheduler_task_set_slack(&ota.update_task, MS_TO_US(100));
+	scheduler_schedule_periodic(&ota.update_task, ota_update, NULL, 0, MS_TO_US(1000),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("ota", RENDER_PRIORITY_OTA, ota_indicate_update, ota_indicate_update_is_active,
+			      ota_indicate_update_next_frame, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_OTA, ota_rx, NULL, WIRELESS_HANDLER_FLAG_NEIGHBOUR);
 
 	return ESP_OK;
 }
@@ -396,7 +432,7 @@ static esp_err_t handle_ota_progress_packet(const ota_packet_t *ota_packet, cons
 	return ESP_OK;
 }
 
-esp_err_t ota_rx(const wireless_packet_t *packet, const neighbour_t *neigh) {
+static esp_err_t ota_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	ota_packet_t ota_packet;
 	if (packet->len < sizeof(ota_packet)) {
 		ESP_LOGD(TAG, "Got short OTA packet, expected %u bytes but got only %u bytes",
@@ -438,24 +474,6 @@ esp_err_t ota_serve_update(bool serve) {
 	return ESP_OK;
 }
 
-void ota_indicate_update(color_hsv_t *color) {
-	if (ota.state == OTA_STATE_DOWNLOAD_IN_PROGRESS) {
-		int64_t now = neighbour_get_global_clock();
-		int32_t now_ms = now / 1000LL;
-		unsigned int cycle_ms = now_ms % (OTA_UPDATE_BLINK_INTERVAL_MS * 2);
-
-		if (cycle_ms >= OTA_UPDATE_BLINK_INTERVAL_MS) {
-			color->h = 26788;
-			color->s = 41680;
-//			color->v = 64224;
-		} else {
-			color->h = 47595;
-			color->s = 19792;
-//			color->v = 62979;
-		}
-	}
-}
-
 const char *ota_state_to_string(ota_state_t state) {
 	if (state >= ARRAY_SIZE(ota_state_strings)) {
 		return "<invalid>";
@@ -10,9 +10,7 @@
 #include "wireless.h"
 
 esp_err_t ota_init(void);
-esp_err_t ota_rx(const wireless_packet_t *packet, const neighbour_t *neigh);
 esp_err_t ota_serve_update(bool serve);
-void ota_indicate_update(color_hsv_t *color);
 void ota_print_status(void);
 void ota_set_ignore_version(bool ignore_version);
 ssize_t ota_neighbour_info_to_string(const neighbour_ota_info_t *info, char *dst, size_t len);
@@ -0,0 +1,87 @@
+#include "perf.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+#ifdef ESP_PLATFORM
+#define PERF_UNIT	"cycles"
+#else
+#define PERF_UNIT	"ns"
+#endif
+
+static const char *stage_names[PERF_NUM_STAGES] = {
+	[PERF_STAGE_EFFECTS] = "effects",
+	[PERF_STAGE_HSV2RGB] = "hsv2rgb",
+	[PERF_STAGE_COLOR_CORRECTION] = "color_correction",
+	[PERF_STAGE_ENCODE] = "encode",
+	[PERF_STAGE_SPI_WAIT] = "spi_wait",
+	[PERF_STAGE_PACKET_DISPATCH] = "packet_dispatch",
+};
+
+static perf_histogram_t perf_histograms[PERF_NUM_STAGES];
+
+static unsigned int get_bucket(uint32_t cycles) {
+	if (!cycles) {
+		return 0;
+	}
+	return 32 - __builtin_clz(cycles);
+}
+
+void perf_record(perf_stage_t stage, uint32_t cycles) {
+	perf_histogram_t *hist = &perf_histograms[stage];
+	if (!hist->count || cycles < hist->min) {
+		hist->min = cycles;
+	}
+	hist->max = MAX(hist->max, cycles);
+	hist->total += cycles;
+	hist->count++;
+	hist->buckets[get_bucket(cycles)]++;
+}
+
+void perf_get_histogram(perf_stage_t stage, perf_histogram_t *hist) {
+	*hist = perf_histograms[stage];
+}
+
+/*
+ * Returns the upper bound of the bucket containing the given percentile,
+ * clamped to the largest sample recorded. Buckets span a factor of two,
+ * so this is a bound that can be up to twice the actual percentile.
+ */
+uint32_t perf_histogram_percentile(const perf_histogram_t *hist, unsigned int percent) {
+	if (!hist->count) {
+		return 0;
+	}
+
+	uint64_t rank = DIV_ROUND_UP((uint64_t)hist->count * percent, 100);
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			uint32_t upper = i ? (uint32_t)((1ULL << i) - 1) : 0;
+			return MIN(upper, hist->max);
+		}
+	}
+	return hist->max;
+}
+
+void perf_reset(void) {
+	memset(perf_histograms, 0, sizeof(perf_histograms));
+}
+
+void perf_print(void) {
+	// Percentiles come from log2 buckets, P99 is an upper bound up to 2x the real value
+	printf("Stage              Count      Min        Avg        P99 <=     Max (%s)\r\n", PERF_UNIT);
+	for (int i = 0; i < PERF_NUM_STAGES; i++) {
+		const perf_histogram_t *hist = &perf_histograms[i];
+		unsigned long avg = hist->count ? hist->total / hist->count : 0;
+		printf("%-18s %-10lu %-10lu %-10lu %-10lu %-10lu\r\n",
+		       stage_names[i],
+		       (unsigned long)hist->count,
+		       (unsigned long)hist->min,
+		       avg,
+		       (unsigned long)perf_histogram_percentile(hist, 99),
+		       (unsigned long)hist->max);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_cpu.h>
+#else
+#include <time.h>
+#endif
+
+// One bucket per possible bit length of a 32 bit sample
+#define PERF_HISTOGRAM_BUCKETS	33
+
+typedef enum perf_stage {
+	PERF_STAGE_EFFECTS = 0,
+	PERF_STAGE_HSV2RGB,
+	PERF_STAGE_COLOR_CORRECTION,
+	PERF_STAGE_ENCODE,
+	PERF_STAGE_SPI_WAIT,
+	PERF_STAGE_PACKET_DISPATCH,
+	PERF_NUM_STAGES
+} perf_stage_t;
+
+// Bucket i counts samples in [2^(i - 1), 2^i), bucket 0 counts zero length samples
+typedef struct perf_histogram {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t buckets[PERF_HISTOGRAM_BUCKETS];
+} perf_histogram_t;
+
+/*
+ * CPU cycles on target, nanoseconds on host builds.
+ * Only differences between two readings are meaningful.
+ */
+static inline uint32_t perf_get_cycles(void) {
+#ifdef ESP_PLATFORM
+	return esp_cpu_get_cycle_count();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000UL + (uint32_t)ts.tv_nsec;
+#endif
+}
+
+void perf_record(perf_stage_t stage, uint32_t cycles);
+
+static inline void perf_stage_end(perf_stage_t stage, uint32_t cycles_start) {
+	perf_record(stage, perf_get_cycles() - cycles_start);
+}
+
+void perf_get_histogram(perf_stage_t stage, perf_histogram_t *hist);
+uint32_t perf_histogram_percentile(const perf_histogram_t *hist, unsigned int percent);
+void perf_reset(void);
+void perf_print(void);
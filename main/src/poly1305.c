@@ -0,0 +1,186 @@
+/*
+ * Poly1305 one-time authenticator (RFC 8439), 32 bit implementation
+ * based on public domain poly1305-donna. Uses 26 bit limbs, no 64 bit
+ * multiplications of 64 bit operands.
+ */
+
+#include <string.h>
+
+#include "poly1305.h"
+
+#define LIMB_MASK	0x3ffffff
+
+static uint32_t pack4(const uint8_t *a)
+{
+	uint32_t res = 0;
+
+	res |= (uint32_t)a[0] << 0 * 8;
+	res |= (uint32_t)a[1] << 1 * 8;
+	res |= (uint32_t)a[2] << 2 * 8;
+	res |= (uint32_t)a[3] << 3 * 8;
+	return res;
+}
+
+static void unpack4(uint8_t *a, uint32_t val)
+{
+	a[0] = val >> 0 * 8;
+	a[1] = val >> 1 * 8;
+	a[2] = val >> 2 * 8;
+	a[3] = val >> 3 * 8;
+}
+
+void poly1305_init(poly1305_ctx_t *ctx, const uint8_t key[POLY1305_KEY_SIZE])
+{
+	memset(ctx, 0, sizeof(poly1305_ctx_t));
+
+	// r &= 0xffffffc0ffffffc0ffffffc0fffffff
+	ctx->r[0] = (pack4(key + 0)) & 0x3ffffff;
+	ctx->r[1] = (pack4(key + 3) >> 2) & 0x3ffff03;
+	ctx->r[2] = (pack4(key + 6) >> 4) & 0x3ffc0ff;
+	ctx->r[3] = (pack4(key + 9) >> 6) & 0x3f03fff;
+	ctx->r[4] = (pack4(key + 12) >> 8) & 0x00fffff;
+
+	ctx->pad[0] = pack4(key + 16);
+	ctx->pad[1] = pack4(key + 20);
+	ctx->pad[2] = pack4(key + 24);
+	ctx->pad[3] = pack4(key + 28);
+}
+
+static void poly1305_blocks(poly1305_ctx_t *ctx, const uint8_t *data, size_t n_bytes)
+{
+	const uint32_t hibit = ctx->final ? 0 : (1UL << 24);
+	const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2], r3 = ctx->r[3], r4 = ctx->r[4];
+	const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+
+	while (n_bytes >= POLY1305_BLOCK_SIZE) {
+		uint64_t d0, d1, d2, d3, d4;
+		uint32_t c;
+
+		// h += m[i]
+		h0 += (pack4(data + 0)) & LIMB_MASK;
+		h1 += (pack4(data + 3) >> 2) & LIMB_MASK;
+		h2 += (pack4(data + 6) >> 4) & LIMB_MASK;
+		h3 += (pack4(data + 9) >> 6) & LIMB_MASK;
+		h4 += (pack4(data + 12) >> 8) | hibit;
+
+		// h *= r
+		d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+		d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+		d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+		d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+		d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+		// (partial) h %= p
+		c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & LIMB_MASK;
+		d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & LIMB_MASK;
+		d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & LIMB_MASK;
+		d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & LIMB_MASK;
+		d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & LIMB_MASK;
+		h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+		h1 += c;
+
+		data += POLY1305_BLOCK_SIZE;
+		n_bytes -= POLY1305_BLOCK_SIZE;
+	}
+
+	ctx->h[0] = h0;
+	ctx->h[1] = h1;
+	ctx->h[2] = h2;
+	ctx->h[3] = h3;
+	ctx->h[4] = h4;
+}
+
+void poly1305_update(poly1305_ctx_t *ctx, const uint8_t *data, size_t n_bytes)
+{
+	// Complete a partial block first
+	if (ctx->leftover) {
+		size_t want = POLY1305_BLOCK_SIZE - ctx->leftover;
+		if (want > n_bytes) {
+			want = n_bytes;
+		}
+		memcpy(ctx->buffer + ctx->leftover, data, want);
+		data += want;
+		n_bytes -= want;
+		ctx->leftover += want;
+		if (ctx->leftover < POLY1305_BLOCK_SIZE) {
+			return;
+		}
+		poly1305_blocks(ctx, ctx->buffer, POLY1305_BLOCK_SIZE);
+		ctx->leftover = 0;
+	}
+
+	if (n_bytes >= POLY1305_BLOCK_SIZE) {
+		size_t full_blocks_len = n_bytes & ~(size_t)(POLY1305_BLOCK_SIZE - 1);
+		poly1305_blocks(ctx, data, full_blocks_len);
+		data += full_blocks_len;
+		n_bytes -= full_blocks_len;
+	}
+
+	if (n_bytes) {
+		memcpy(ctx->buffer + ctx->leftover, data, n_bytes);
+		ctx->leftover += n_bytes;
+	}
+}
+
+void poly1305_finish(poly1305_ctx_t *ctx, uint8_t tag[POLY1305_TAG_SIZE])
+{
+	uint32_t h0, h1, h2, h3, h4, c;
+	uint32_t g0, g1, g2, g3, g4;
+	uint32_t mask;
+	uint64_t f;
+
+	// Process the final, padded block
+	if (ctx->leftover) {
+		ctx->buffer[ctx->leftover++] = 1;
+		memset(ctx->buffer + ctx->leftover, 0, POLY1305_BLOCK_SIZE - ctx->leftover);
+		ctx->final = true;
+		poly1305_blocks(ctx, ctx->buffer, POLY1305_BLOCK_SIZE);
+	}
+
+	// Fully carry h
+	h0 = ctx->h[0]; h1 = ctx->h[1]; h2 = ctx->h[2]; h3 = ctx->h[3]; h4 = ctx->h[4];
+	c = h1 >> 26; h1 &= LIMB_MASK;
+	h2 += c; c = h2 >> 26; h2 &= LIMB_MASK;
+	h3 += c; c = h3 >> 26; h3 &= LIMB_MASK;
+	h4 += c; c = h4 >> 26; h4 &= LIMB_MASK;
+	h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+	h1 += c;
+
+	// Compute h - p
+	g0 = h0 + 5; c = g0 >> 26; g0 &= LIMB_MASK;
+	g1 = h1 + c; c = g1 >> 26; g1 &= LIMB_MASK;
+	g2 = h2 + c; c = g2 >> 26; g2 &= LIMB_MASK;
+	g3 = h3 + c; c = g3 >> 26; g3 &= LIMB_MASK;
+	g4 = h4 + c - (1UL << 26);
+
+	// Select h if h < p, or h - p if h >= p, without branching
+	mask = (g4 >> 31) - 1;
+	g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	// h %= 2^128
+	h0 = h0 | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	// tag = (h + pad) % 2^128
+	f = (uint64_t)h0 + ctx->pad[0]; h0 = (uint32_t)f;
+	f = (uint64_t)h1 + ctx->pad[1] + (f >> 32); h1 = (uint32_t)f;
+	f = (uint64_t)h2 + ctx->pad[2] + (f >> 32); h2 = (uint32_t)f;
+	f = (uint64_t)h3 + ctx->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+	unpack4(tag + 0, h0);
+	unpack4(tag + 4, h1);
+	unpack4(tag + 8, h2);
+	unpack4(tag + 12, h3);
+
+	// Key material must not outlive the tag computation
+	memset(ctx, 0, sizeof(poly1305_ctx_t));
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define POLY1305_KEY_SIZE	32
+#define POLY1305_TAG_SIZE	16
+#define POLY1305_BLOCK_SIZE	16
+
+typedef struct poly1305_ctx {
+	uint32_t r[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+	size_t leftover;
+	uint8_t buffer[POLY1305_BLOCK_SIZE];
+	bool final;
+} poly1305_ctx_t;
+
+void poly1305_init(poly1305_ctx_t *ctx, const uint8_t key[POLY1305_KEY_SIZE]);
+void poly1305_update(poly1305_ctx_t *ctx, const uint8_t *data, size_t n_bytes);
+void poly1305_finish(poly1305_ctx_t *ctx, uint8_t tag[POLY1305_TAG_SIZE]);
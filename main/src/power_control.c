@@ -11,9 +11,11 @@
 #include <esp_timer.h>
 
 #include "debounce.h"
+#include "render.h"
 #include "scheduler.h"
 #include "shared_config.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define GPIO_POWER_ON	10
 #define GPIO_CHARGE_EN	 1
@@ -68,7 +70,7 @@ static const char *TAG = "power_control";
 
 static power_control_t power_control = { 0 };
 
-static void power_control_tx(void) {
+static void power_control_tx(unsigned int repeats) {
 	power_control_packet_t packet = {
 		WIRELESS_PACKET_TYPE_POWER_CONTROL,
 		.flags =
@@ -77,24 +79,23 @@ static void power_control_tx(void) {
 		.battery_discharge_soc = power_control.battery_discharge_soc
 	};
 	shared_config_hdr_init(&power_control.shared_cfg, &packet.shared_cfg_hdr);
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_NORMAL,
+			  WIRELESS_TX_FLAG_SUPERSEDE, repeats);
 	shared_config_tx_done(&power_control.shared_cfg);
 }
 
 static void config_changed(void) {
 	shared_config_update_local(&power_control.shared_cfg);
 
-	for (int i = 0; i < SHARED_CONFIG_TX_TIMES; i++) {
-		power_control_tx();
-	}
+	power_control_tx(SHARED_CONFIG_TX_TIMES);
 }
 
-void power_control_rx(const wireless_packet_t *packet) {
+static esp_err_t power_control_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	power_control_packet_t config_packet;
 	if (packet->len < sizeof(config_packet)) {
 		ESP_LOGD(TAG, "Received short packet, expected %u bytes but got only %u bytes",
 		         sizeof(config_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&config_packet, packet->data, sizeof(config_packet));
 
@@ -107,6 +108,8 @@ void power_control_rx(const wireless_packet_t *packet) {
 			power_control.battery_discharge_soc = target_soc;
 		}
 	}
+
+	return ESP_OK;
 }
 
 static void force_input_current_limit(void) {
@@ -237,6 +240,7 @@ static void battery_storage_update(void) {
 static void power_control_update(void *arg) {
 	bool power_switch_state = gpio_get_level(GPIO_POWER_ON) || power_control.ignore_power_switch;
 	debounce_bool_update(&power_control.power_switch_debounce, power_switch_state);
+	power_state_t power_state = power_control.power_state;
 	switch (power_control.power_state) {
 	case POWER_STATE_ON:
 		if (debounce_bool_get_value(&power_control.power_switch_debounce) == DEBOUNCE_FALSE) {
@@ -265,6 +269,10 @@ static void power_control_update(void *arg) {
 		}
 	}
 
+	if (power_control.power_state != power_state) {
+		render_request_frame();
+	}
+
 	uint64_t now = esp_timer_get_time();
 	uint64_t ms_since_last_watchdog_reset = (now - power_control.timestamp_charger_watchdog_reset) / 1000LL;
 	if (ms_since_last_watchdog_reset >= CHARGER_WATCHDOG_RESET_INTERVAL_MS) {
@@ -275,9 +283,22 @@ static void power_control_update(void *arg) {
 	}
 
 	if (shared_config_should_tx(&power_control.shared_cfg)) {
-		power_control_tx();
+		power_control_tx(1);
 	}
-	scheduler_schedule_task_relative(&power_control.update_task, power_control_update, NULL, MS_TO_US(250));
+}
+
+static bool power_off_is_active(const render_frame_t *frame, void *ctx) {
+	return power_control_is_powered_off();
+}
+
+static void power_off_apply(render_frame_t *frame, void *ctx) {
+	frame->rgb.r = 0;
+	frame->rgb.g = 0;
+	frame->rgb.b = 0;
+}
+
+static int64_t power_off_next_frame(const render_frame_t *frame, void *ctx) {
+	return RENDER_NEXT_FRAME_NONE;
 }
 
 esp_err_t power_control_init(bq24295_t *charger, bq27546_t *gauge) {
@@ -356,8 +377,13 @@ esp_err_t power_control_init(bq24295_t *charger, bq27546_t *gauge) {
 	debounce_bool_init(&power_control.power_switch_debounce, 3);
 	debounce_bool_init(&power_control.power_good_debounce, 5);
 
-	scheduler_task_init(&power_control.update_task);
-	scheduler_schedule_task_relative(&power_control.update_task, power_control_update, NULL, MS_TO_US(100));
+	scheduler_task_init(&power_control.update_task, "power_control");
+	scheduler_task_set_slack(&power_control.update_task, MS_TO_US(50));
+	scheduler_schedule_periodic(&power_control.update_task, power_control_update, NULL, MS_TO_US(100), MS_TO_US(250),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("power_off", RENDER_PRIORITY_POWER_CONTROL, power_off_apply, power_off_is_active,
+			      power_off_next_frame, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_POWER_CONTROL, power_control_rx, NULL, 0);
 	return ESP_OK;
 }
 
@@ -7,7 +7,6 @@
 #include "wireless.h"
 
 esp_err_t power_control_init(bq24295_t *charger, bq27546_t *gauge);
-void power_control_rx(const wireless_packet_t *packet);
 void power_control_set_ignore_power_switch(bool ignore);
 bool power_control_is_powered_off(void);
 void power_control_set_battery_storage_mode_enable(bool enable);
@@ -7,9 +7,11 @@
 #include <esp_log.h>
 #include <esp_timer.h>
 
+#include "render.h"
 #include "scheduler.h"
 #include "shared_config.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define HUE_CYCLE_TIME_MS	10000
 
@@ -50,7 +52,7 @@ static rainbow_fade_t rainbow_fade = {
 	}
 };
 
-static void rainbow_fade_tx(void) {
+static void rainbow_fade_tx(unsigned int repeats) {
 	rainbow_fade_config_packet_t packet = {
 		.packet_type = WIRELESS_PACKET_TYPE_RAINBOW_FADE,
 		.hue_cycle_time_ms = rainbow_fade.hue_cycle_time_ms,
@@ -63,51 +65,56 @@ static void rainbow_fade_tx(void) {
 		.delay_model_delay_limit_us = rainbow_fade.delay_model.delay_limit_us
 	};
 	shared_config_hdr_init(&rainbow_fade.shared_cfg, &packet.shared_cfg_hdr);
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_NORMAL,
+			  WIRELESS_TX_FLAG_SUPERSEDE, repeats);
 	shared_config_tx_done(&rainbow_fade.shared_cfg);
 }
 
 static void config_changed(void) {
 	shared_config_update_local(&rainbow_fade.shared_cfg);
 
-	for (int i = 0; i < SHARED_CONFIG_TX_TIMES; i++) {
-		rainbow_fade_tx();
-	}
+	rainbow_fade_tx(SHARED_CONFIG_TX_TIMES);
 }
 
 static void rainbow_fade_update(void *priv);
 static void rainbow_fade_update(void *priv) {
 	if (shared_config_should_tx(&rainbow_fade.shared_cfg)) {
-		rainbow_fade_tx();
+		rainbow_fade_tx(1);
 	}
-	scheduler_schedule_task_relative(&rainbow_fade.update_task, rainbow_fade_update, NULL, MS_TO_US(1000));
 }
 
-void rainbow_fade_init() {
-	scheduler_task_init(&rainbow_fade.update_task);
-	scheduler_schedule_task_relative(&rainbow_fade.update_task, rainbow_fade_update, NULL, MS_TO_US(1000));
+static bool rainbow_fade_is_active(const render_frame_t *frame, void *ctx) {
+	return rainbow_fade.enable;
 }
 
-void rainbow_fade_apply(color_hsv_t *color) {
-	if (rainbow_fade.enable) {
-		neighbour_t *clock_source;
-		int64_t now = neighbour_get_global_clock_and_source(&clock_source);
-		if (rainbow_fade.enable_phase_shift && clock_source) {
-			now -= neighbour_calculate_rssi_delay(&rainbow_fade.delay_model, clock_source);
-		}
-		int64_t cycle_val = now / 1000 * HSV_HUE_STEPS / (int64_t)rainbow_fade.hue_cycle_time_ms;
-		uint16_t hue_delta = cycle_val % HSV_HUE_STEPS;
-
-		color->h = (color->h + hue_delta) % HSV_HUE_STEPS;
+static void rainbow_fade_apply(render_frame_t *frame, void *ctx) {
+	int64_t now = frame->global_clock_us;
+	if (rainbow_fade.enable_phase_shift && frame->clock_source) {
+		now -= neighbour_calculate_rssi_delay(&rainbow_fade.delay_model, frame->clock_source);
 	}
+	int64_t cycle_val = now / 1000 * HSV_HUE_STEPS / (int64_t)rainbow_fade.hue_cycle_time_ms;
+	uint16_t hue_delta = cycle_val % HSV_HUE_STEPS;
+
+	frame->hsv.h = (frame->hsv.h + hue_delta) % HSV_HUE_STEPS;
+}
+
+static esp_err_t rainbow_fade_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
+void rainbow_fade_init() {
+	scheduler_task_init(&rainbow_fade.update_task, "rainbow_fade");
+	scheduler_task_set_slack(&rainbow_fade.update_task, MS_TO_US(100));
+	scheduler_schedule_periodic(&rainbow_fade.update_task, rainbow_fade_update, NULL, MS_TO_US(1000), MS_TO_US(1000),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("rainbow_fade", RENDER_PRIORITY_RAINBOW_FADE, rainbow_fade_apply, rainbow_fade_is_active, NULL, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_RAINBOW_FADE, rainbow_fade_rx, NULL, 0);
 }
 
-void rainbow_fade_rx(const wireless_packet_t *packet) {
+static esp_err_t rainbow_fade_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	rainbow_fade_config_packet_t config_packet;
 	if (packet->len < sizeof(config_packet)) {
 		ESP_LOGD(TAG, "Received short packet, expected %u bytes but got only %u bytes",
 		         sizeof(config_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&config_packet, packet->data, sizeof(config_packet));
 
@@ -120,6 +127,8 @@ void rainbow_fade_rx(const wireless_packet_t *packet) {
 		rainbow_fade.delay_model.us_delay_per_rssi_step = config_packet.delay_model_us_delay_per_rssi_step;
 		rainbow_fade.delay_model.delay_limit_us = config_packet.delay_model_delay_limit_us;
 	}
+
+	return ESP_OK;
 }
 
 void rainbow_fade_set_cycle_time(unsigned long cycle_time_ms) {
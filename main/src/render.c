@@ -0,0 +1,239 @@
+#include "render.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "fast_hsv2rgb.h"
+#include "main.h"
+#include "perf.h"
+#include "scheduler.h"
+#include "util.h"
+
+#define FRAME_INTERVAL_MS	10
+#define KEEPALIVE_INTERVAL_MS	1000
+
+typedef struct render_layer {
+	const char *name;
+	render_apply_f apply;
+	render_is_active_f is_active;
+	render_next_frame_f next_frame;
+	void *ctx;
+	uint32_t invocations;
+	uint64_t cycles_total;
+	uint32_t cycles_max;
+} render_layer_t;
+
+typedef struct render {
+	render_layer_t layers[RENDER_NUM_PRIORITIES];
+	uint32_t registered_mask;
+	uint32_t active_mask;
+	bool pacing_enable;
+	int64_t timestamp_last_frame_us;
+	int64_t timestamp_last_output_us;
+	rgb16_t last_output;
+	int64_t timestamp_next_frame_us;
+	render_stats_t stats;
+	scheduler_task_t frame_task;
+} render_t;
+
+static const char *TAG = "render";
+
+/*
+ * A batch of one runs the branch-free kernel, which avoids the 64 bit
+ * multiply of fast_hsv2rgb_32bit() and takes the same time for every hue.
+ */
+static void hsv2rgb_apply(render_frame_t *frame, void *ctx) {
+	uint16_t r, g, b;
+	fast_hsv2rgb_32bit_batch(&frame->hsv.h, &frame->hsv.s, &frame->hsv.v, &r, &g, &b, 1);
+	frame->rgb.r = r;
+	frame->rgb.g = g;
+	frame->rgb.b = b;
+}
+
+static int64_t hsv2rgb_next_frame(const render_frame_t *frame, void *ctx) {
+	return RENDER_NEXT_FRAME_NONE;
+}
+
+static render_t render = {
+	.layers = {
+		[RENDER_PRIORITY_HSV2RGB] = {
+			.name = "hsv2rgb",
+			.apply = hsv2rgb_apply,
+			.next_frame = hsv2rgb_next_frame
+		}
+	},
+	.registered_mask = BIT(RENDER_PRIORITY_HSV2RGB),
+	.pacing_enable = true
+};
+
+static void render_frame_task(void *arg) {
+	post_event(EVENT_LED);
+}
+
+void render_init(void) {
+	scheduler_task_init(&render.frame_task, "render_frame");
+	scheduler_task_set_slack(&render.frame_task, MS_TO_US(2));
+	scheduler_schedule_task_relative(&render.frame_task, render_frame_task, NULL, MS_TO_US(FRAME_INTERVAL_MS));
+}
+
+// Renders a new frame as soon as possible, e.g. after input or config changes
+void render_request_frame(void) {
+	post_event(EVENT_LED);
+}
+
+esp_err_t render_layer_register(const char *name, render_priority_t priority,
+				render_apply_f apply, render_is_active_f is_active,
+				render_next_frame_f next_frame, void *ctx) {
+	if (priority >= RENDER_NUM_PRIORITIES || priority == RENDER_PRIORITY_HSV2RGB || !apply) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	render_layer_t *layer = &render.layers[priority];
+	if (layer->apply) {
+		ESP_LOGE(TAG, "Priority %d already taken by layer %s", priority, layer->name);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	layer->name = name;
+	layer->apply = apply;
+	layer->is_active = is_active;
+	layer->next_frame = next_frame;
+	layer->ctx = ctx;
+	render.registered_mask |= BIT(priority);
+	return ESP_OK;
+}
+
+static void run_layers(render_frame_t *frame, uint32_t mask) {
+	uint32_t cycles_effects = 0;
+	while (mask) {
+		unsigned int priority = __builtin_ctz(mask);
+		render_layer_t *layer = &render.layers[priority];
+		mask &= mask - 1;
+
+		uint32_t cycles_start = perf_get_cycles();
+		layer->apply(frame, layer->ctx);
+		uint32_t cycles = perf_get_cycles() - cycles_start;
+		layer->invocations++;
+		layer->cycles_total += cycles;
+		layer->cycles_max = MAX(layer->cycles_max, cycles);
+		if (priority == RENDER_PRIORITY_HSV2RGB) {
+			perf_record(PERF_STAGE_HSV2RGB, cycles);
+		} else {
+			cycles_effects += cycles;
+		}
+	}
+	perf_record(PERF_STAGE_EFFECTS, cycles_effects);
+}
+
+static int64_t get_next_frame(const render_frame_t *frame, uint32_t active_mask) {
+	int64_t next_frame_us = frame->now_us + MS_TO_US(KEEPALIVE_INTERVAL_MS);
+	uint32_t registered_mask = render.registered_mask;
+	while (registered_mask) {
+		unsigned int priority = __builtin_ctz(registered_mask);
+		const render_layer_t *layer = &render.layers[priority];
+		registered_mask &= registered_mask - 1;
+
+		if (layer->next_frame) {
+			next_frame_us = MIN(next_frame_us, layer->next_frame(frame, layer->ctx));
+		} else if (active_mask & BIT(priority)) {
+			// Animating, needs every frame
+			return frame->now_us;
+		}
+	}
+	return next_frame_us;
+}
+
+/*
+ * Renders a frame through all active layers. Each layer's is_active
+ * callback is evaluated once per frame, before any layer is applied.
+ * Returns true if the frame needs to be sent to the LEDs.
+ */
+bool render_frame(rgb16_t *rgb) {
+	render_frame_t frame = {
+		.now_us = esp_timer_get_time(),
+		.hsv = { 0, HSV_SAT_MAX, HSV_VAL_MAX / 2 },
+		.rgb = { 0, 0, 0 }
+	};
+	frame.global_clock_us = neighbour_get_global_clock_and_source(&frame.clock_source);
+
+	uint32_t active_mask = 0;
+	uint32_t registered_mask = render.registered_mask;
+	while (registered_mask) {
+		unsigned int priority = __builtin_ctz(registered_mask);
+		const render_layer_t *layer = &render.layers[priority];
+		registered_mask &= registered_mask - 1;
+
+		if (!layer->is_active || layer->is_active(&frame, layer->ctx)) {
+			active_mask |= BIT(priority);
+		}
+	}
+	render.active_mask = active_mask;
+
+	run_layers(&frame, active_mask);
+	*rgb = frame.rgb;
+
+	render.stats.frames_rendered++;
+	if (render.timestamp_last_frame_us) {
+		int64_t frame_slots = (frame.now_us - render.timestamp_last_frame_us) / MS_TO_US(FRAME_INTERVAL_MS);
+		if (frame_slots > 1) {
+			render.stats.frames_skipped += frame_slots - 1;
+			render.stats.spi_transfers_saved += frame_slots - 1;
+		}
+	}
+	render.timestamp_last_frame_us = frame.now_us;
+
+	int64_t next_frame_us = frame.now_us;
+	bool output = true;
+	if (render.pacing_enable) {
+		next_frame_us = get_next_frame(&frame, active_mask);
+		if (!memcmp(&frame.rgb, &render.last_output, sizeof(frame.rgb)) &&
+		    frame.now_us - render.timestamp_last_output_us < MS_TO_US(KEEPALIVE_INTERVAL_MS)) {
+			render.stats.spi_transfers_saved++;
+			output = false;
+		}
+	}
+	next_frame_us = MAX(next_frame_us, frame.now_us + MS_TO_US(FRAME_INTERVAL_MS));
+	render.timestamp_next_frame_us = next_frame_us;
+	scheduler_schedule_task(&render.frame_task, render_frame_task, NULL, next_frame_us);
+
+	if (output) {
+		render.last_output = frame.rgb;
+		render.timestamp_last_output_us = frame.now_us;
+	}
+	return output;
+}
+
+void render_set_pacing_enable(bool enable) {
+	render.pacing_enable = enable;
+	render_request_frame();
+}
+
+void render_get_stats(render_stats_t *stats) {
+	*stats = render.stats;
+}
+
+void render_print_layers(void) {
+	int64_t now = esp_timer_get_time();
+	printf("Frame pacing: %s\r\n", render.pacing_enable ? "on" : "off");
+	printf("Next frame in: %lld ms\r\n", (long long)((render.timestamp_next_frame_us - now) / 1000LL));
+	printf("Frames rendered: %lu\r\n", (unsigned long)render.stats.frames_rendered);
+	printf("Frames skipped: %lu\r\n", (unsigned long)render.stats.frames_skipped);
+	printf("SPI transfers saved: %lu\r\n", (unsigned long)render.stats.spi_transfers_saved);
+	printf("Prio Name                 Active Calls      Avg cycles Max cycles\r\n");
+	for (int i = 0; i < ARRAY_SIZE(render.layers); i++) {
+		const render_layer_t *layer = &render.layers[i];
+		if (!layer->apply) {
+			continue;
+		}
+
+		unsigned long avg_cycles = layer->invocations ? layer->cycles_total / layer->invocations : 0;
+		printf("%4d %-20s %-6s %-10lu %-10lu %-10lu\r\n",
+		       i, layer->name,
+		       (render.active_mask & BIT(i)) ? "yes" : "no",
+		       (unsigned long)layer->invocations,
+		       avg_cycles,
+		       (unsigned long)layer->cycles_max);
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include "color.h"
+#include "neighbour.h"
+
+/*
+ * Layers are applied in order of ascending priority. Layers below
+ * RENDER_PRIORITY_HSV2RGB work on the HSV color, layers above it on
+ * the RGB color.
+ */
+typedef enum render_priority {
+	RENDER_PRIORITY_DEFAULT_COLOR = 0,
+	RENDER_PRIORITY_RAINBOW_FADE,
+	RENDER_PRIORITY_BONK,
+	RENDER_PRIORITY_SQUISH,
+	RENDER_PRIORITY_STATE_OF_CHARGE,
+	RENDER_PRIORITY_OTA,
+	RENDER_PRIORITY_UID,
+	RENDER_PRIORITY_HSV2RGB,
+	RENDER_PRIORITY_COLOR_OVERRIDE,
+	RENDER_PRIORITY_POWER_CONTROL,
+	RENDER_NUM_PRIORITIES
+} render_priority_t;
+
+typedef struct render_frame {
+	// Time snapshot shared by all layers
+	int64_t now_us;
+	int64_t global_clock_us;
+	neighbour_t *clock_source;
+	color_hsv_t hsv;
+	rgb16_t rgb;
+} render_frame_t;
+
+#define RENDER_NEXT_FRAME_NONE	INT64_MAX
+
+typedef struct render_stats {
+	uint32_t frames_rendered;
+	uint32_t frames_skipped;
+	uint32_t spi_transfers_saved;
+} render_stats_t;
+
+typedef void (*render_apply_f)(render_frame_t *frame, void *ctx);
+typedef bool (*render_is_active_f)(const render_frame_t *frame, void *ctx);
+/*
+ * Returns the local time in us at which the layer needs the next frame,
+ * RENDER_NEXT_FRAME_NONE if its output does not change on its own.
+ * Active layers without a next_frame callback get a frame every frame
+ * interval, inactive layers without a next_frame callback never.
+ */
+typedef int64_t (*render_next_frame_f)(const render_frame_t *frame, void *ctx);
+
+// Converts a global clock timestamp into local time for next_frame callbacks
+static inline int64_t render_global_to_local_us(const render_frame_t *frame, int64_t global_us) {
+	return frame->now_us + (global_us - frame->global_clock_us);
+}
+
+// Local time of the next toggle of a blink pattern running on the global clock
+static inline int64_t render_next_blink_us(const render_frame_t *frame, int64_t interval_us) {
+	int64_t global_next_us = (frame->global_clock_us / interval_us + 1) * interval_us;
+	return render_global_to_local_us(frame, global_next_us);
+}
+
+void render_init(void);
+esp_err_t render_layer_register(const char *name, render_priority_t priority,
+				render_apply_f apply, render_is_active_f is_active,
+				render_next_frame_f next_frame, void *ctx);
+bool render_frame(rgb16_t *rgb);
+void render_request_frame(void);
+void render_set_pacing_enable(bool enable);
+void render_get_stats(render_stats_t *stats);
+void render_print_layers(void);
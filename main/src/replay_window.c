@@ -0,0 +1,78 @@
+#include "replay_window.h"
+
+// Sequence numbers less than half the sequence space ahead are newer
+#define SEQ_HALF_RANGE	((REPLAY_WINDOW_SEQ_MASK >> 1) + 1)
+
+static bool is_same_session(const replay_window_t *window, uint32_t random_id) {
+	return window->initialized && window->random_id == random_id;
+}
+
+// Header timestamps are milliseconds of the global clock and wrap, compare like sequence numbers
+static bool is_newer_timestamp(const replay_window_t *window, uint32_t timestamp) {
+	return (int32_t)(timestamp - window->last_timestamp) > 0;
+}
+
+static uint32_t seq_ahead(const replay_window_t *window, uint32_t seq) {
+	return (seq - window->highest_seq) & REPLAY_WINDOW_SEQ_MASK;
+}
+
+static uint32_t seq_behind(const replay_window_t *window, uint32_t seq) {
+	return (window->highest_seq - seq) & REPLAY_WINDOW_SEQ_MASK;
+}
+
+/*
+ * Returns true if seq has not been seen before and is recent enough to
+ * be tracked by the window. Does not modify the window, call
+ * replay_window_update() once the packet has been authenticated.
+ */
+bool replay_window_check(const replay_window_t *window, uint32_t random_id, uint32_t seq, uint32_t timestamp) {
+	if (!window->initialized) {
+		return true;
+	}
+	if (!is_same_session(window, random_id)) {
+		return is_newer_timestamp(window, timestamp);
+	}
+
+	seq &= REPLAY_WINDOW_SEQ_MASK;
+	uint32_t ahead = seq_ahead(window, seq);
+	if (ahead && ahead < SEQ_HALF_RANGE) {
+		return true;
+	}
+
+	uint32_t behind = seq_behind(window, seq);
+	if (behind >= REPLAY_WINDOW_SIZE) {
+		return false;
+	}
+	return !(window->bitmap & (1ULL << behind));
+}
+
+void replay_window_update(replay_window_t *window, uint32_t random_id, uint32_t seq, uint32_t timestamp) {
+	seq &= REPLAY_WINDOW_SEQ_MASK;
+	if (!is_same_session(window, random_id)) {
+		if (window->initialized && !is_newer_timestamp(window, timestamp)) {
+			return;
+		}
+		window->random_id = random_id;
+		window->highest_seq = seq;
+		window->last_timestamp = timestamp;
+		window->bitmap = 1;
+		window->initialized = true;
+		return;
+	}
+
+	if (is_newer_timestamp(window, timestamp)) {
+		window->last_timestamp = timestamp;
+	}
+
+	uint32_t ahead = seq_ahead(window, seq);
+	if (ahead && ahead < SEQ_HALF_RANGE) {
+		window->bitmap = ahead < REPLAY_WINDOW_SIZE ? window->bitmap << ahead : 0;
+		window->bitmap |= 1;
+		window->highest_seq = seq;
+	} else {
+		uint32_t behind = seq_behind(window, seq);
+		if (behind < REPLAY_WINDOW_SIZE) {
+			window->bitmap |= 1ULL << behind;
+		}
+	}
+}
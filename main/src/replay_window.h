@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REPLAY_WINDOW_SIZE	64
+// Packet counters are 31 bit, bit 31 is used as a flag in the wireless header
+#define REPLAY_WINDOW_SEQ_MASK	0x7fffffffUL
+
+/*
+ * IPsec style anti-replay window over the sequence numbers of a single
+ * sender. A change of random_id means the sender restarted and resets
+ * the window, but only if the header timestamp is newer than any
+ * accepted before. Without that, recorded packets of the previous
+ * session would each start a new session and be accepted again.
+ */
+typedef struct replay_window {
+	uint64_t bitmap;
+	uint32_t random_id;
+	uint32_t highest_seq;
+	// Newest header timestamp accepted from the sender, any session
+	uint32_t last_timestamp;
+	bool initialized;
+} replay_window_t;
+
+bool replay_window_check(const replay_window_t *window, uint32_t random_id, uint32_t seq, uint32_t timestamp);
+void replay_window_update(replay_window_t *window, uint32_t random_id, uint32_t seq, uint32_t timestamp);
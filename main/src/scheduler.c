@@ -3,73 +3,225 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_timer.h>
 
 #include "main.h"
+#include "perf.h"
+#include "util.h"
+
+// Enough for all tasks of the firmware, more are added in powers of two
+#define SCHEDULER_MIN_HEAP_CAPACITY	32
 
 typedef struct scheduler {
-	struct list_head tasks;
+	/*
+	 * Binary min-heap ordered by deadline, FIFO for equal deadlines. A
+	 * task is queued at most once, so the heap grows with the registry
+	 * and can not overflow.
+	 */
+	scheduler_task_t **heap;
+	unsigned int heap_capacity;
+	unsigned int num_tasks;
+	struct list_head registered_tasks;
+	unsigned int num_registered_tasks;
+	uint32_t seq;
+	bool running;
 	esp_timer_handle_t timer;
 	bool timer_running;
 	int64_t timer_deadline_us;
-	struct list_head tasks_schedule;
-	struct list_head tasks_abort;
+	uint32_t wakeups;
+	int64_t timestamp_init_us;
 } scheduler_t;
 
 static const char *TAG = "scheduler";
 
-static scheduler_t scheduler_g;
+static scheduler_t scheduler_g = {
+	.registered_tasks = { &scheduler_g.registered_tasks, &scheduler_g.registered_tasks }
+};
 
 void scheduler_timer_cb(void *arg) {
 	scheduler_t *scheduler = arg;
 
 	scheduler->timer_running = false;
+	scheduler->wakeups++;
 	post_event(EVENT_SCHEDULER);
 }
 
-static void start_timer_for_task(scheduler_task_t *task) {
+static bool task_before(const scheduler_task_t *a, const scheduler_task_t *b) {
+	if (a->deadline_us != b->deadline_us) {
+		return a->deadline_us < b->deadline_us;
+	}
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void heap_set(scheduler_t *scheduler, unsigned int idx, scheduler_task_t *task) {
+	scheduler->heap[idx] = task;
+	task->heap_idx = idx;
+}
+
+static void heap_sift_up(scheduler_t *scheduler, unsigned int idx) {
+	scheduler_task_t *task = scheduler->heap[idx];
+	while (idx) {
+		unsigned int parent = (idx - 1) / 2;
+		if (!task_before(task, scheduler->heap[parent])) {
+			break;
+		}
+		heap_set(scheduler, idx, scheduler->heap[parent]);
+		idx = parent;
+	}
+	heap_set(scheduler, idx, task);
+}
+
+static void heap_sift_down(scheduler_t *scheduler, unsigned int idx) {
+	scheduler_task_t *task = scheduler->heap[idx];
+	while (1) {
+		unsigned int child = idx * 2 + 1;
+		if (child >= scheduler->num_tasks) {
+			break;
+		}
+		if (child + 1 < scheduler->num_tasks &&
+		    task_before(scheduler->heap[child + 1], scheduler->heap[child])) {
+			child++;
+		}
+		if (!task_before(scheduler->heap[child], task)) {
+			break;
+		}
+		heap_set(scheduler, idx, scheduler->heap[child]);
+		idx = child;
+	}
+	heap_set(scheduler, idx, task);
+}
+
+static void heap_remove(scheduler_t *scheduler, scheduler_task_t *task) {
+	unsigned int idx = task->heap_idx;
+	scheduler_task_t *last = scheduler->heap[--scheduler->num_tasks];
+	task->heap_idx = SCHEDULER_TASK_NOT_QUEUED;
+	if (last == task) {
+		return;
+	}
+
+	heap_set(scheduler, idx, last);
+	if (idx && task_before(last, scheduler->heap[(idx - 1) / 2])) {
+		heap_sift_up(scheduler, idx);
+	} else {
+		heap_sift_down(scheduler, idx);
+	}
+}
+
+static void start_timer(int64_t deadline_us) {
 	scheduler_t *scheduler = &scheduler_g;
 	int64_t now = esp_timer_get_time();
 
-	scheduler->timer_deadline_us = task->deadline_us;
+	scheduler->timer_deadline_us = deadline_us;
 	scheduler->timer_running = true;
-	esp_timer_start_once(scheduler->timer, task->deadline_us > now ? task->deadline_us - now : 0);
+	esp_timer_start_once(scheduler->timer, deadline_us > now ? deadline_us - now : 0);
+}
+
+/*
+ * Latest point in time satisfying all tasks, the smallest deadline plus
+ * slack. Subtrees with deadlines past the current best can be skipped
+ * since slack is never negative.
+ */
+static int64_t find_latest_wakeup(const scheduler_t *scheduler, unsigned int idx, int64_t best_us) {
+	if (idx >= scheduler->num_tasks) {
+		return best_us;
+	}
+
+	const scheduler_task_t *task = scheduler->heap[idx];
+	if (task->deadline_us >= best_us) {
+		return best_us;
+	}
+	best_us = MIN(best_us, task->deadline_us + task->slack_us);
+	best_us = find_latest_wakeup(scheduler, idx * 2 + 1, best_us);
+	return find_latest_wakeup(scheduler, idx * 2 + 2, best_us);
 }
 
+/*
+ * Reprograms the timer only if the wakeup moved before the pending timer.
+ * A timer firing too early just causes an early or empty run. On wakeup
+ * all tasks with expired deadlines run, so tasks whose slack windows
+ * overlap share a single wakeup.
+ */
 static void recalc_timer(void) {
 	scheduler_t *scheduler = &scheduler_g;
 
-	if (!LIST_IS_EMPTY(&scheduler->tasks)) {
-		scheduler_task_t *task = LIST_GET_ENTRY(scheduler->tasks.next, scheduler_task_t, list);
+	if (scheduler->num_tasks && !scheduler->running) {
+		int64_t wakeup_us = find_latest_wakeup(scheduler, 0, INT64_MAX);
 
-		if (scheduler->timer_deadline_us > task->deadline_us && scheduler->timer_running) {
+		if (scheduler->timer_running && scheduler->timer_deadline_us > wakeup_us) {
 			esp_timer_stop(scheduler->timer);
 			scheduler->timer_running = false;
 		}
 		if (!scheduler->timer_running) {
-			start_timer_for_task(task);
+			start_timer(wakeup_us);
 		}
 	}
 }
 
+static void enqueue_task(scheduler_task_t *task) {
+	scheduler_t *scheduler = &scheduler_g;
+
+	task->seq = scheduler->seq++;
+	if (task->heap_idx == SCHEDULER_TASK_NOT_QUEUED) {
+		heap_set(scheduler, scheduler->num_tasks++, task);
+		heap_sift_up(scheduler, task->heap_idx);
+	} else {
+		// Deadline may have moved in either direction
+		heap_sift_up(scheduler, task->heap_idx);
+		heap_sift_down(scheduler, task->heap_idx);
+	}
+	recalc_timer();
+}
+
+static void run_task(scheduler_task_t *task, int64_t deadline_us) {
+	scheduler_task_stats_t *stats = &task->stats;
+	int64_t lateness_us = esp_timer_get_time() - deadline_us;
+
+	uint32_t cycles_start = perf_get_cycles();
+	task->cb(task->ctx);
+	uint32_t cycles = perf_get_cycles() - cycles_start;
+
+	stats->invocations++;
+	stats->cycles_total += cycles;
+	stats->cycles_max = MAX(stats->cycles_max, cycles);
+	stats->lateness_total_us += lateness_us;
+	stats->lateness_max_us = MAX(stats->lateness_max_us, lateness_us);
+}
+
 void scheduler_run() {
 	scheduler_t *scheduler = &scheduler_g;
+	int64_t now = esp_timer_get_time();
 
-	int64_t now;
-	scheduler_task_t *cursor;
-	struct list_head *next;
-
-	now = esp_timer_get_time();
-	LIST_FOR_EACH_ENTRY_SAFE(cursor, next, &scheduler->tasks, list) {
-		if (now >= cursor->deadline_us) {
-			LIST_DELETE(&cursor->list);
-			cursor->cb(cursor->ctx);
-		} else {
+	/*
+	 * Limit the number of callbacks per pass so a task rescheduling itself
+	 * into the past can not starve the main loop. Remaining due tasks
+	 * are run on the next pass, the timer fires immediately for them.
+	 */
+	unsigned int budget = scheduler->num_tasks;
+	scheduler->running = true;
+	while (scheduler->num_tasks && budget--) {
+		scheduler_task_t *task = scheduler->heap[0];
+		if (now < task->deadline_us) {
 			break;
 		}
+		heap_remove(scheduler, task);
+		int64_t deadline_us = task->deadline_us;
+		if (task->period_us) {
+			// Requeue before running, the callback may cancel or reschedule
+			task->deadline_us += task->period_us;
+			if (task->policy == SCHEDULER_PERIODIC_SKIP && task->deadline_us <= now) {
+				int64_t periods_missed = (now - task->deadline_us) / task->period_us + 1;
+				task->deadline_us += periods_missed * task->period_us;
+			}
+			enqueue_task(task);
+		}
+		run_task(task, deadline_us);
 	}
+	scheduler->running = false;
 	recalc_timer();
 }
 
@@ -82,35 +234,42 @@ void scheduler_init() {
 		.skip_unhandled_events = true
 	};
 
-	INIT_LIST_HEAD(scheduler->tasks);
+	scheduler->num_tasks = 0;
+	scheduler->timestamp_init_us = esp_timer_get_time();
 	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &scheduler->timer));
 	scheduler->timer_running = false;
 }
 
-void scheduler_task_init(scheduler_task_t *task) {
-	INIT_LIST_HEAD(task->list);
-}
-
-static void enqueue_task(scheduler_task_t *task) {
+/*
+ * Must be called exactly once per task before it is scheduled. Makes room
+ * for the task in the heap, running out of memory here is fatal.
+ */
+void scheduler_task_init(scheduler_task_t *task, const char *name) {
 	scheduler_t *scheduler = &scheduler_g;
-	struct list_head *prior_deadline = &scheduler->tasks;
-	scheduler_task_t *cursor;
 
-	LIST_FOR_EACH_ENTRY(cursor, &scheduler->tasks, list) {
-		if (cursor->deadline_us > task->deadline_us) {
-			break;
+	task->name = name;
+	task->heap_idx = SCHEDULER_TASK_NOT_QUEUED;
+	task->period_us = 0;
+	task->slack_us = 0;
+	memset(&task->stats, 0, sizeof(task->stats));
+
+	if (scheduler->num_registered_tasks == scheduler->heap_capacity) {
+		unsigned int capacity = MAX(scheduler->heap_capacity * 2, SCHEDULER_MIN_HEAP_CAPACITY);
+		scheduler_task_t **heap = realloc(scheduler->heap, capacity * sizeof(*heap));
+		if (!heap) {
+			ESP_LOGE(TAG, "Out of memory registering task %s", name);
+			ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
 		}
-		prior_deadline = &cursor->list;
+		scheduler->heap = heap;
+		scheduler->heap_capacity = capacity;
 	}
-	if (!LIST_IS_EMPTY(&task->list)) {
-		LIST_DELETE(&task->list);
-	}
-	LIST_APPEND(&task->list, prior_deadline);
-	recalc_timer();
+	LIST_APPEND_TAIL(&task->registry, &scheduler->registered_tasks);
+	scheduler->num_registered_tasks++;
 }
 
 void scheduler_schedule_task(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t deadline_us) {
 	task->deadline_us = deadline_us;
+	task->period_us = 0;
 	task->cb = cb;
 	task->ctx = ctx;
 	enqueue_task(task);
@@ -121,3 +280,79 @@ void scheduler_schedule_task_relative(scheduler_task_t *task, scheduler_cb_f cb,
 
 	scheduler_schedule_task(task, cb, ctx, now + timeout_us);
 }
+
+/*
+ * Runs cb every period_us, starting delay_us from now. Deadlines advance
+ * by exactly one period from the previous deadline, so callback runtime
+ * and main loop latency do not accumulate.
+ */
+void scheduler_schedule_periodic(scheduler_task_t *task, scheduler_cb_f cb, void *ctx,
+				 int64_t delay_us, int64_t period_us, scheduler_periodic_policy_t policy) {
+	scheduler_schedule_task_relative(task, cb, ctx, delay_us);
+	task->period_us = period_us;
+	task->policy = policy;
+}
+
+void scheduler_cancel(scheduler_task_t *task) {
+	scheduler_t *scheduler = &scheduler_g;
+
+	task->period_us = 0;
+	if (task->heap_idx != SCHEDULER_TASK_NOT_QUEUED) {
+		heap_remove(scheduler, task);
+	}
+}
+
+/*
+ * Allows the task to run up to slack_us after its deadline, so its wakeup
+ * can be shared with other tasks.
+ */
+void scheduler_task_set_slack(scheduler_task_t *task, int64_t slack_us) {
+	task->slack_us = slack_us;
+	if (task->heap_idx != SCHEDULER_TASK_NOT_QUEUED) {
+		recalc_timer();
+	}
+}
+
+void scheduler_print_stats(void) {
+	scheduler_t *scheduler = &scheduler_g;
+	unsigned int num_tasks = scheduler->num_registered_tasks;
+	scheduler_task_t **tasks = malloc(num_tasks * sizeof(*tasks));
+	if (!tasks) {
+		printf("Out of memory\r\n");
+		return;
+	}
+
+	// Insertion sort by total runtime, descending
+	unsigned int num_sorted = 0;
+	scheduler_task_t *cursor;
+	LIST_FOR_EACH_ENTRY(cursor, &scheduler->registered_tasks, registry) {
+		unsigned int pos = num_sorted++;
+		while (pos && tasks[pos - 1]->stats.cycles_total < cursor->stats.cycles_total) {
+			tasks[pos] = tasks[pos - 1];
+			pos--;
+		}
+		tasks[pos] = cursor;
+	}
+
+	int64_t uptime_ms = (esp_timer_get_time() - scheduler->timestamp_init_us) / 1000LL;
+	printf("Timer wakeups: %lu (%lu.%02lu/s)\r\n",
+	       (unsigned long)scheduler->wakeups,
+	       uptime_ms ? (unsigned long)(scheduler->wakeups * 1000ULL / uptime_ms) : 0,
+	       uptime_ms ? (unsigned long)(scheduler->wakeups * 100000ULL / uptime_ms % 100) : 0);
+	printf("Name                     Calls      Total cycles Avg cycles Max cycles Avg late us Max late us\r\n");
+	for (unsigned int i = 0; i < num_tasks; i++) {
+		const scheduler_task_t *task = tasks[i];
+		const scheduler_task_stats_t *stats = &task->stats;
+		unsigned long avg_cycles = stats->invocations ? stats->cycles_total / stats->invocations : 0;
+		long avg_lateness_us = stats->invocations ? stats->lateness_total_us / stats->invocations : 0;
+		printf("%-24s %-10lu %-12llu %-10lu %-10lu %-11ld %-11ld\r\n",
+		       task->name,
+		       (unsigned long)stats->invocations,
+		       (unsigned long long)stats->cycles_total,
+		       avg_cycles,
+		       (unsigned long)stats->cycles_max,
+		       avg_lateness_us,
+		       (long)stats->lateness_max_us);
+	}
+	free(tasks);
+}
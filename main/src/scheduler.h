@@ -5,17 +5,47 @@
 
 #include "list.h"
 
+#define SCHEDULER_TASK_NOT_QUEUED	-1
+
 typedef void (*scheduler_cb_f)(void *ctx);
 
+typedef enum scheduler_periodic_policy {
+	// Run once for every missed period, back to back
+	SCHEDULER_PERIODIC_CATCH_UP = 0,
+	// Drop missed periods, stay aligned to the original period grid
+	SCHEDULER_PERIODIC_SKIP
+} scheduler_periodic_policy_t;
+
+typedef struct scheduler_task_stats {
+	uint32_t invocations;
+	uint64_t cycles_total;
+	uint32_t cycles_max;
+	int64_t lateness_total_us;
+	int64_t lateness_max_us;
+} scheduler_task_stats_t;
+
 typedef struct scheduler_task {
-	struct list_head list;
+	// All tasks passed to scheduler_task_init(), queued or not
+	struct list_head registry;
+	const char *name;
+	int heap_idx;
+	uint32_t seq;
 	int64_t deadline_us;
+	int64_t period_us;
+	int64_t slack_us;
+	scheduler_periodic_policy_t policy;
 	scheduler_cb_f cb;
 	void *ctx;
+	scheduler_task_stats_t stats;
 } scheduler_task_t;
 
 void scheduler_init(void);
 void scheduler_run(void);
-void scheduler_task_init(scheduler_task_t *task);
+void scheduler_task_init(scheduler_task_t *task, const char *name);
 void scheduler_schedule_task(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t deadline_us);
 void scheduler_schedule_task_relative(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t timeout_us);
+void scheduler_schedule_periodic(scheduler_task_t *task, scheduler_cb_f cb, void *ctx,
+				 int64_t delay_us, int64_t period_us, scheduler_periodic_policy_t policy);
+void scheduler_cancel(scheduler_task_t *task);
+void scheduler_task_set_slack(scheduler_task_t *task, int64_t slack_us);
+void scheduler_print_stats(void);
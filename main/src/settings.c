@@ -148,3 +148,11 @@ void settings_set_usb_enable_override(bool enable) {
 bool settings_get_usb_enable_override(void) {
 	return nvs_get_bool("usb_en_override", false);
 }
+
+void settings_set_color_correction_lut_size(unsigned int size) {
+	nvs_set_uint("colorcal_lut", size);
+}
+
+unsigned int settings_get_color_correction_lut_size(unsigned int default_size) {
+	return nvs_get_uint("colorcal_lut", default_size);
+}
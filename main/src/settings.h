@@ -9,3 +9,6 @@ bool settings_get_usb_enable(void);
 
 void settings_set_usb_enable_override(bool enable);
 bool settings_get_usb_enable_override(void);
+
+void settings_set_color_correction_lut_size(unsigned int size);
+unsigned int settings_get_color_correction_lut_size(unsigned int default_size);
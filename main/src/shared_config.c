@@ -5,6 +5,7 @@
 #include <esp_timer.h>
 
 #include "neighbour.h"
+#include "render.h"
 
 bool shared_config_update_remote(shared_config_t *config, const void *hdr) {
 	shared_config_hdr_t cfg_hdr;
@@ -17,12 +18,14 @@ bool shared_config_update_remote(shared_config_t *config, const void *hdr) {
 	bool cfg_update = cfg_hdr.config_timestamp_global > config->config_timestamp_global;
 	if (cfg_update) {
 		config->config_timestamp_global = cfg_hdr.config_timestamp_global;
+		render_request_frame();
 	}
 	return cfg_update;
 }
 
 void shared_config_update_local(shared_config_t *config) {
 	config->config_timestamp_global = neighbour_get_global_clock();
+	render_request_frame();
 }
 
 bool shared_config_should_tx(shared_config_t *config) {
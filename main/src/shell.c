@@ -8,18 +8,26 @@
 #include <esp_system.h>
 #include <argtable3/argtable3.h>
 
+#include "color_correction.h"
 #include "color_override.h"
 #include "default_color.h"
+#include "led_output.h"
 #include "neighbour.h"
 #include "node_info.h"
 #include "ota.h"
+#include "perf.h"
 #include "power_control.h"
 #include "rainbow_fade.h"
+#include "render.h"
+#include "scheduler.h"
 #include "state_of_charge.h"
 #include "uid.h"
 #include "usb.h"
 #include "util.h"
 #include "wireless.h"
+#include "wireless_frag.h"
+#include "wireless_ratelimit.h"
+#include "wireless_tx.h"
 
 static const char *TAG = "repl";
 
@@ -54,6 +62,76 @@ static int list_neighbours(int argc, char **argv) {
 	return 0;
 }
 
+static struct {
+	struct arg_str *what;
+	struct arg_end *end;
+} led_args;
+
+static int led(int argc, char **argv) {
+	int errors = arg_parse(argc, argv, (void **)&led_args);
+	if (errors) {
+		arg_print_errors(stderr, led_args.end, argv[0]);
+		return 1;
+	}
+
+	if (strcmp(led_args.what->sval[0], "stats")) {
+		fprintf(stderr, "Unknown led report '%s'\r\n", led_args.what->sval[0]);
+		return 1;
+	}
+
+	main_loop_lock();
+	led_output_print_stats();
+	main_loop_unlock();
+	return 0;
+}
+
+static struct {
+	struct arg_str *what;
+	struct arg_end *end;
+} perf_args;
+
+static int perf(int argc, char **argv) {
+	int errors = arg_parse(argc, argv, (void **)&perf_args);
+	if (errors) {
+		arg_print_errors(stderr, perf_args.end, argv[0]);
+		return 1;
+	}
+
+	if (strcmp(perf_args.what->sval[0], "frame")) {
+		fprintf(stderr, "Unknown perf report '%s'\r\n", perf_args.what->sval[0]);
+		return 1;
+	}
+
+	main_loop_lock();
+	perf_print();
+	perf_reset();
+	main_loop_unlock();
+	return 0;
+}
+
+static struct {
+	struct arg_str *what;
+	struct arg_end *end;
+} sched_args;
+
+static int sched(int argc, char **argv) {
+	int errors = arg_parse(argc, argv, (void **)&sched_args);
+	if (errors) {
+		arg_print_errors(stderr, sched_args.end, argv[0]);
+		return 1;
+	}
+
+	if (strcmp(sched_args.what->sval[0], "stats")) {
+		fprintf(stderr, "Unknown sched report '%s'\r\n", sched_args.what->sval[0]);
+		return 1;
+	}
+
+	main_loop_lock();
+	scheduler_print_stats();
+	main_loop_unlock();
+	return 0;
+}
+
 static int parse_mac_address(const char *str, uint8_t *address) {
 	int num_bytes_out = 0;
 	while (*str && num_bytes_out < ESP_NOW_ETH_ALEN) {
@@ -177,9 +255,9 @@ static int uid(int argc, char **argv) {
 		return 1;
 	}
 
+	main_loop_lock();
 	uid_enable(address, enable);
-	uid_enable(address, enable);
-	uid_enable(address, enable);
+	main_loop_unlock();
 
 	return 0;
 }
@@ -204,8 +282,47 @@ static int rainbow_fade(int argc, char **argv) {
 		return 1;
 	}
 
+	main_loop_lock();
 	rainbow_fade_set_enable(enable);
+	main_loop_unlock();
+
+	return 0;
+}
 
+static struct {
+	struct arg_str *what;
+	struct arg_str *enable;
+	struct arg_end *end;
+} render_args;
+
+static int render(int argc, char **argv) {
+	render_args.enable->sval[0] = "";
+	int errors = arg_parse(argc, argv, (void **)&render_args);
+	if (errors) {
+		arg_print_errors(stderr, render_args.end, argv[0]);
+		return 1;
+	}
+
+	const char *what = render_args.what->sval[0];
+	if (!strcmp(what, "layers")) {
+		main_loop_lock();
+		render_print_layers();
+		main_loop_unlock();
+	} else if (!strcmp(what, "pacing")) {
+		bool enable;
+		int err = parse_on_off(render_args.enable->sval[0], &enable);
+		if (err) {
+			fprintf(stderr, "'%s' is neither on nor off\r\n", render_args.enable->sval[0]);
+			return 1;
+		}
+
+		main_loop_lock();
+		render_set_pacing_enable(enable);
+		main_loop_unlock();
+	} else {
+		fprintf(stderr, "Unknown render command '%s'\r\n", what);
+		return 1;
+	}
 	return 0;
 }
 
@@ -229,7 +346,9 @@ static int rainbow_fade_rssi_delay(int argc, char **argv) {
 		return 1;
 	}
 
+	main_loop_lock();
 	rainbow_fade_set_phase_shift_enable(enable);
+	main_loop_unlock();
 
 	return 0;
 }
@@ -279,7 +398,9 @@ static int rainbow_fade_rssi_delay_model(int argc, char **argv) {
 		return err;
 	}
 
+	main_loop_lock();
 	rainbow_fade_set_rssi_delay_model(&delay_model);
+	main_loop_unlock();
 
 	return 0;
 }
@@ -302,7 +423,43 @@ static int rainbow_fade_cycle_time(int argc, char **argv) {
 		return 1;
 	}
 
+	main_loop_lock();
 	rainbow_fade_set_cycle_time(cycle_time_ms);
+	main_loop_unlock();
+
+	return 0;
+}
+
+static struct {
+	struct arg_str *what;
+	struct arg_int *size;
+	struct arg_end *end;
+} color_correction_args;
+
+static int color_correction(int argc, char **argv) {
+	int errors = arg_parse(argc, argv, (void **)&color_correction_args);
+	if (errors) {
+		arg_print_errors(stderr, color_correction_args.end, argv[0]);
+		return 1;
+	}
+
+	if (strcmp(color_correction_args.what->sval[0], "lut")) {
+		fprintf(stderr, "Unknown color_correction command '%s'\r\n", color_correction_args.what->sval[0]);
+		return 1;
+	}
+	if (!color_correction_args.size->count) {
+		fprintf(stderr, "Table size missing\r\n");
+		return 1;
+	}
+
+	int size = *color_correction_args.size->ival;
+	main_loop_lock();
+	esp_err_t err = color_correction_set_lut_size(size);
+	main_loop_unlock();
+	if (err) {
+		fprintf(stderr, "No color correction table with size %d\r\n", size);
+		return 1;
+	}
 
 	return 0;
 }
@@ -725,6 +882,57 @@ static int wireless_encryption(int argc, char **argv) {
 	return 0;
 }
 
+static struct {
+	struct arg_str *what;
+	struct arg_str *enable;
+	struct arg_end *end;
+} wireless_args;
+
+static int wireless(int argc, char **argv) {
+	wireless_args.enable->sval[0] = "";
+	int errors = arg_parse(argc, argv, (void **)&wireless_args);
+	if (errors) {
+		arg_print_errors(stderr, wireless_args.end, argv[0]);
+		return 1;
+	}
+
+	const char *what = wireless_args.what->sval[0];
+	if (!strcmp(what, "stats")) {
+		main_loop_lock();
+		wireless_print_rx_stats();
+		wireless_tx_print_stats();
+		wireless_frag_print_stats();
+		main_loop_unlock();
+		return 0;
+	}
+	if (!strcmp(what, "offenders")) {
+		main_loop_lock();
+		wireless_ratelimit_print_offenders();
+		main_loop_unlock();
+		return 0;
+	}
+	if (strcmp(what, "aead") && strcmp(what, "aggregation")) {
+		fprintf(stderr, "Unknown wireless command '%s'\r\n", what);
+		return 1;
+	}
+
+	bool enable;
+	int err = parse_on_off(wireless_args.enable->sval[0], &enable);
+	if (err) {
+		fprintf(stderr, "'%s' is neither on nor off\r\n", wireless_args.enable->sval[0]);
+		return 1;
+	}
+
+	if (!strcmp(what, "aead")) {
+		wireless_set_aead_enable(enable);
+	} else {
+		main_loop_lock();
+		wireless_tx_set_aggregation_enable(enable);
+		main_loop_unlock();
+	}
+	return 0;
+}
+
 static struct {
 	struct arg_str *disable;
 	struct arg_end *end;
@@ -944,6 +1152,49 @@ esp_err_t shell_init(bonk_t *bonk_) {
 		    "List wireless neighbours",
 		    list_neighbours);
 
+	led_args.what = arg_str1(NULL, NULL, "stats", "Report to print");
+	led_args.end = arg_end(1);
+
+	ADD_COMMAND_ARGS("led",
+			 "Show LED output statistics",
+			 led,
+			 &led_args);
+
+	render_args.what = arg_str1(NULL, NULL, "layers|pacing", "Show layers and their cost, or switch frame pacing");
+	render_args.enable = arg_str0(NULL, NULL, "on|off", "Disable/enable demand-driven frame pacing");
+	render_args.end = arg_end(2);
+
+	ADD_COMMAND_ARGS("render",
+			 "Show render layers or enable/disable demand-driven LED frame pacing",
+			 render,
+			 &render_args);
+
+	wireless_args.what = arg_str1(NULL, NULL, "stats|offenders|aead|aggregation", "Report to print or feature to switch");
+	wireless_args.enable = arg_str0(NULL, NULL, "on|off",
+					"Disable/enable ChaCha20-Poly1305 or aggregation of sent packets");
+	wireless_args.end = arg_end(2);
+
+	ADD_COMMAND_ARGS("wireless",
+			 "Show wireless statistics or rate limit offenders, enable/disable AEAD or TX aggregation",
+			 wireless,
+			 &wireless_args);
+
+	perf_args.what = arg_str1(NULL, NULL, "frame", "Report to print");
+	perf_args.end = arg_end(1);
+
+	ADD_COMMAND_ARGS("perf",
+			 "Print and reset render pipeline stage timings",
+			 perf,
+			 &perf_args);
+
+	sched_args.what = arg_str1(NULL, NULL, "stats", "Report to print");
+	sched_args.end = arg_end(1);
+
+	ADD_COMMAND_ARGS("sched",
+			 "Show scheduler task runtime and lateness",
+			 sched,
+			 &sched_args);
+
 	ADD_COMMAND("serve_ota",
 		    "Serve own firmware via OTA update to neighbours",
 		    serve_ota);
@@ -1021,6 +1272,15 @@ esp_err_t shell_init(bonk_t *bonk_) {
 			 rainbow_fade_cycle_time,
 			 &rainbow_fade_cycle_time_args);
 
+	color_correction_args.what = arg_str1(NULL, NULL, "lut", "Setting to change");
+	color_correction_args.size = arg_int0(NULL, NULL, "16|32", "Color correction table size");
+	color_correction_args.end = arg_end(2);
+
+	ADD_COMMAND_ARGS("color_correction",
+			 "Select color correction table",
+			 color_correction,
+			 &color_correction_args);
+
 	color_override_args.enable = arg_str1(NULL, NULL, "on|off", "Disable/enable local color override");
 	color_override_args.end = arg_end(1);
 
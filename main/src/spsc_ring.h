@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of pointers.
+ * The size must be a power of two. Only the producer may call
+ * spsc_ring_push(), only the consumer spsc_ring_pop().
+ */
+typedef struct spsc_ring {
+	void **slots;
+	uint32_t mask;
+	// Written by the producer only
+	uint32_t head;
+	// Written by the consumer only
+	uint32_t tail;
+} spsc_ring_t;
+
+static inline void spsc_ring_init(spsc_ring_t *ring, void **slots, uint32_t size) {
+	ring->slots = slots;
+	ring->mask = size - 1;
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+static inline bool spsc_ring_push(spsc_ring_t *ring, void *ptr) {
+	uint32_t head = ring->head;
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > ring->mask) {
+		return false;
+	}
+
+	ring->slots[head & ring->mask] = ptr;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static inline void *spsc_ring_pop(spsc_ring_t *ring) {
+	uint32_t tail = ring->tail;
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return NULL;
+	}
+
+	void *ptr = ring->slots[tail & ring->mask];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return ptr;
+}
+
+static inline unsigned int spsc_ring_count(const spsc_ring_t *ring) {
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
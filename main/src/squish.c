@@ -6,6 +6,8 @@
 #include <esp_timer.h>
 
 #include "neighbour_rssi_delay_model.h"
+#include "render.h"
+#include "wireless_tx.h"
 
 #define NUM_PRESSURE_SAMPLES_DISCARD	 5
 #define NUM_PRESSURE_SAMPLES_INIT	20
@@ -55,7 +57,7 @@ static void squish_tx(squish_t *squish) {
 		.timestamp_us = esp_timer_get_time(),
 		.squish = squish->local_squishedness
 	};
-	wireless_broadcast((const uint8_t *)&squish_packet, sizeof(squish_packet));
+	wireless_tx_queue(&squish_packet, sizeof(squish_packet), WIRELESS_TX_PRIORITY_REALTIME, 0, 1);
 }
 
 static void squish_tx_peak(squish_t *squish) {
@@ -130,7 +132,11 @@ static esp_err_t squish_update_(squish_t *squish) {
 		squish->pressure_at_rest_milli += pressure_adjust;
 	}
 	squish_tx_delayed(squish);
-	squish->squishedness = MAX(squish->local_squishedness, squish_calculate_remote(squish));
+	uint16_t squishedness = MAX(squish->local_squishedness, squish_calculate_remote(squish));
+	if (squishedness && !squish->squishedness) {
+		render_request_frame();
+	}
+	squish->squishedness = squishedness;
 	squish->timestamp_last_update_us = now;
 	return ESP_OK;
 }
@@ -139,17 +145,16 @@ static void squish_update(void *arg);
 static void squish_update(void *arg) {
 	squish_t *squish = arg;
 	squish_update_(squish);
-	scheduler_schedule_task_relative(&squish->update_task, squish_update, squish, MS_TO_US(20));
 }
 
-void squish_init(squish_t *squish, spl06_t *baro) {
-	memset(squish, 0, sizeof(*squish));
-	squish->baro = baro;
-	scheduler_task_init(&squish->update_task);
-	scheduler_schedule_task_relative(&squish->update_task, squish_update, squish, MS_TO_US(100));
+static bool squish_is_active(const render_frame_t *frame, void *ctx) {
+	const squish_t *squish = ctx;
+	return squish->squishedness;
 }
 
-void squish_apply(const squish_t *squish, color_hsv_t *color) {
+static void squish_apply(render_frame_t *frame, void *ctx) {
+	const squish_t *squish = ctx;
+	color_hsv_t *color = &frame->hsv;
 	/*
 	 * Squishing is a three step process:
 	 *  1. Desaturate current color to white (0 - 1/5 squish)
@@ -197,11 +202,26 @@ void squish_apply(const squish_t *squish, color_hsv_t *color) {
 	}
 }
 
-void squish_rx(squish_t *squish, const wireless_packet_t *packet, const neighbour_t *neigh) {
+static esp_err_t squish_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
+void squish_init(squish_t *squish, spl06_t *baro) {
+	memset(squish, 0, sizeof(*squish));
+	squish->baro = baro;
+	scheduler_task_init(&squish->update_task, "squish");
+	scheduler_task_set_slack(&squish->update_task, MS_TO_US(5));
+	scheduler_schedule_periodic(&squish->update_task, squish_update, squish, MS_TO_US(100), MS_TO_US(20),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("squish", RENDER_PRIORITY_SQUISH, squish_apply, squish_is_active, NULL, squish);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_SQUISH, squish_rx, squish,
+				  WIRELESS_HANDLER_FLAG_NEIGHBOUR | WIRELESS_HANDLER_FLAG_REALTIME);
+}
+
+static esp_err_t squish_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	squish_t *squish = ctx;
 	squish_packet_t squish_packet;
 	if (packet->len < sizeof(squish_packet)) {
 		ESP_LOGD(TAG, "Received short packet. Expected %u bytes but got %u bytes", sizeof(squish_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&squish_packet, packet->data, sizeof(squish_packet));
 	int64_t timestamp_us = packet->rx_timestamp;
@@ -215,4 +235,6 @@ void squish_rx(squish_t *squish, const wireless_packet_t *packet, const neighbou
 	remote_squish->squish = squish_packet.squish;
 	squish->remote_squish_write_pos++;
 	squish->remote_squish_write_pos %= ARRAY_SIZE(squish->remote_squishes);
+
+	return ESP_OK;
 }
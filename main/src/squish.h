@@ -32,5 +32,3 @@ typedef struct squish {
 } squish_t;
 
 void squish_init(squish_t *squish, spl06_t *baro);
-void squish_apply(const squish_t *squish, color_hsv_t *color);
-void squish_rx(squish_t *squish, const wireless_packet_t *packet, const neighbour_t *neigh);
@@ -6,9 +6,11 @@
 #include <esp_log.h>
 #include <esp_timer.h>
 
+#include "render.h"
 #include "scheduler.h"
 #include "shared_config.h"
 #include "util.h"
+#include "wireless_tx.h"
 
 #define SOC_DISPLAY_DURATION_MS	3000
 
@@ -32,67 +34,85 @@ static const char *TAG = "state_of_charge";
 
 static state_of_charge_t state_of_charge;
 
-static void state_of_charge_tx(void) {
+static void state_of_charge_tx(unsigned int repeats) {
 	state_of_charge_config_packet_t packet = {
 		.packet_type = WIRELESS_PACKET_TYPE_STATE_OF_CHARGE,
 		.flags = state_of_charge.enable ? FLAG_ENABLE_SOC_DISPLAY : 0
 	};
 	shared_config_hdr_init(&state_of_charge.shared_cfg, &packet.shared_cfg_hdr);
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_NORMAL,
+			  WIRELESS_TX_FLAG_SUPERSEDE, repeats);
 	shared_config_tx_done(&state_of_charge.shared_cfg);
 }
 
 static void config_changed(void) {
 	shared_config_update_local(&state_of_charge.shared_cfg);
 
-	for (int i = 0; i < SHARED_CONFIG_TX_TIMES; i++) {
-		state_of_charge_tx();
-	}
+	state_of_charge_tx(SHARED_CONFIG_TX_TIMES);
 }
 
 static void state_of_charge_update(void *priv);
 static void state_of_charge_update(void *priv) {
 	if (shared_config_should_tx(&state_of_charge.shared_cfg)) {
-		state_of_charge_tx();
+		state_of_charge_tx(1);
+	}
+}
+
+static bool state_of_charge_is_active(const render_frame_t *frame, void *ctx) {
+	return (frame->now_us - state_of_charge.timestamp_init <= MS_TO_US(SOC_DISPLAY_DURATION_MS)) ||
+	       state_of_charge.enable;
+}
+
+static int64_t state_of_charge_next_frame(const render_frame_t *frame, void *ctx) {
+	int64_t timestamp_display_end = state_of_charge.timestamp_init + MS_TO_US(SOC_DISPLAY_DURATION_MS);
+	if (!state_of_charge.enable && frame->now_us <= timestamp_display_end) {
+		// Render the frame dropping back to the underlying color
+		return timestamp_display_end + 1;
 	}
-	scheduler_schedule_task_relative(&state_of_charge.update_task, state_of_charge_update, NULL, MS_TO_US(1000));
+	return RENDER_NEXT_FRAME_NONE;
 }
 
+static void state_of_charge_apply(render_frame_t *frame, void *ctx) {
+	if (state_of_charge.soc >= 0) {
+		// Red to Green
+		int32_t hue = HSV_HUE_MAX * 120L * (int32_t)state_of_charge.soc / 360 / 100;
+		frame->hsv.h = hue;
+	} else {
+		// Blue
+		frame->hsv.h = HSV_HUE_MAX * 240L / 360;
+	}
+}
+
+static esp_err_t state_of_charge_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
 void state_of_charge_init(bq27546_t *gauge) {
 	state_of_charge.soc = bq27546_get_state_of_charge_percent(gauge);
 	state_of_charge.timestamp_init = esp_timer_get_time();
 	state_of_charge.enable = false;
-	scheduler_task_init(&state_of_charge.update_task);
-	scheduler_schedule_task_relative(&state_of_charge.update_task, state_of_charge_update, NULL, MS_TO_US(1000));
+	scheduler_task_init(&state_of_charge.update_task, "state_of_charge");
+	scheduler_task_set_slack(&state_of_charge.update_task, MS_TO_US(100));
+	scheduler_schedule_periodic(&state_of_charge.update_task, state_of_charge_update, NULL, MS_TO_US(1000), MS_TO_US(1000),
+				    SCHEDULER_PERIODIC_SKIP);
+	render_layer_register("state_of_charge", RENDER_PRIORITY_STATE_OF_CHARGE,
+			      state_of_charge_apply, state_of_charge_is_active,
+			      state_of_charge_next_frame, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_STATE_OF_CHARGE, state_of_charge_rx, NULL, 0);
 }
 
-void state_of_charge_rx(const wireless_packet_t *packet) {
+static esp_err_t state_of_charge_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	state_of_charge_config_packet_t config_packet;
 	if (packet->len < sizeof(config_packet)) {
 		ESP_LOGD(TAG, "Received short packet, expected %u bytes but got only %u bytes",
 		         sizeof(config_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&config_packet, packet->data, sizeof(config_packet));
 
 	if (shared_config_update_remote(&state_of_charge.shared_cfg, &config_packet.shared_cfg_hdr)) {
 		state_of_charge.enable = !!(config_packet.flags & FLAG_ENABLE_SOC_DISPLAY);
 	}
-}
 
-void state_of_charge_apply(color_hsv_t *color) {
-	int64_t now = esp_timer_get_time();
-	if ((now - state_of_charge.timestamp_init <= MS_TO_US(SOC_DISPLAY_DURATION_MS)) ||
-	    state_of_charge.enable) {
-		if (state_of_charge.soc >= 0) {
-			// Red to Green
-			int32_t hue = HSV_HUE_MAX * 120L * (int32_t)state_of_charge.soc / 360 / 100;
-			color->h = hue;
-		} else {
-			// Blue
-			color->h = HSV_HUE_MAX * 240L / 360;
-		}
-	}
+	return ESP_OK;
 }
 
 void state_of_charge_set_display_enable(bool enable) {
@@ -7,8 +7,12 @@
 #include <esp_mac.h>
 
 #include "neighbour.h"
+#include "render.h"
+#include "util.h"
+#include "wireless_tx.h"
 
 #define UID_BLINK_INTERVAL_MS 500
+#define UID_TX_TIMES 3
 
 typedef struct uid_packet {
 	uint8_t packet_type;
@@ -29,10 +33,10 @@ void uid_enable(const uint8_t *address, bool enable) {
 	ESP_LOGD(TAG, "%s UID on "MACSTR,
 		 enable ? "enabling" : "disabling",
 		 MAC2STR(uid_packet.node_address));
-	wireless_broadcast((const uint8_t *)&uid_packet, sizeof(uid_packet));
+	wireless_tx_queue(&uid_packet, sizeof(uid_packet), WIRELESS_TX_PRIORITY_NORMAL, 0, UID_TX_TIMES);
 }
 
-esp_err_t uid_rx(const wireless_packet_t *packet) {
+static esp_err_t uid_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	uid_packet_t uid_packet;
 	if (packet->len < sizeof(uid_packet)) {
 		ESP_LOGD(TAG, "Short uid packet received. Expected %u byte but got only %u bytes\n",
@@ -48,23 +52,39 @@ esp_err_t uid_rx(const wireless_packet_t *packet) {
 	const uint8_t *bcast_address = wireless_get_broadcast_address();
 	if (!memcmp(mac_address, uid_packet.node_address, sizeof(uid_packet.node_address)) ||
 	    !memcmp(bcast_address, uid_packet.node_address, sizeof(uid_packet.node_address))) {
-		uid_enabled = !!uid_packet.enable;
+		if (uid_enabled != !!uid_packet.enable) {
+			uid_enabled = !!uid_packet.enable;
+			render_request_frame();
+		}
 	}
 
 	return ESP_OK;
 }
 
-void uid_apply(color_hsv_t *color) {
-	if (uid_enabled) {
-		int64_t now = neighbour_get_global_clock();
-		int32_t now_ms = now / 1000LL;
-		unsigned int cycle_ms = now_ms % (UID_BLINK_INTERVAL_MS * 2);
-
-		color->s = 0;
-		if (cycle_ms >= UID_BLINK_INTERVAL_MS) {
-			color->v = HSV_VAL_MAX;
-		} else {
-			color->v = 0;
-		}
+static bool uid_is_active(const render_frame_t *frame, void *ctx) {
+	return uid_enabled;
+}
+
+static int64_t uid_next_frame(const render_frame_t *frame, void *ctx) {
+	if (!uid_enabled) {
+		return RENDER_NEXT_FRAME_NONE;
+	}
+	return render_next_blink_us(frame, MS_TO_US(UID_BLINK_INTERVAL_MS));
+}
+
+static void uid_apply(render_frame_t *frame, void *ctx) {
+	int32_t now_ms = frame->global_clock_us / 1000LL;
+	unsigned int cycle_ms = now_ms % (UID_BLINK_INTERVAL_MS * 2);
+
+	frame->hsv.s = 0;
+	if (cycle_ms >= UID_BLINK_INTERVAL_MS) {
+		frame->hsv.v = HSV_VAL_MAX;
+	} else {
+		frame->hsv.v = 0;
 	}
 }
+
+void uid_init(void) {
+	render_layer_register("uid", RENDER_PRIORITY_UID, uid_apply, uid_is_active, uid_next_frame, NULL);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_UID, uid_rx, NULL, 0);
+}
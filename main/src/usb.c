@@ -7,6 +7,7 @@
 #include "settings.h"
 #include "scheduler.h"
 #include "shared_config.h"
+#include "wireless_tx.h"
 
 #define FLAG_USB_ENABLE BIT(0)
 
@@ -31,39 +32,42 @@ static void usb_enable_update(void) {
 	}
 }
 
-static void usb_config_tx(void) {
+static void usb_config_tx(unsigned int repeats) {
 	usb_config_packet_t packet = {
 		.packet_type = WIRELESS_PACKET_TYPE_USB_CONFIG,
 		.flags = usb_enable ? FLAG_USB_ENABLE : 0
 	};
 	shared_config_hdr_init(&usb_shared_cfg, &packet.shared_cfg_hdr);
-	wireless_broadcast((const uint8_t *)&packet, sizeof(packet));
+	wireless_tx_queue(&packet, sizeof(packet), WIRELESS_TX_PRIORITY_NORMAL,
+			  WIRELESS_TX_FLAG_SUPERSEDE, repeats);
 	shared_config_tx_done(&usb_shared_cfg);
 }
 
 static void config_changed(void) {
 	shared_config_update_local(&usb_shared_cfg);
 
-	for (int i = 0; i < SHARED_CONFIG_TX_TIMES; i++) {
-		usb_config_tx();
-	}
+	usb_config_tx(SHARED_CONFIG_TX_TIMES);
 }
 
 static void usb_update(void *arg);
 static void usb_update(void *arg) {
 	if (shared_config_should_tx(&usb_shared_cfg)) {
-		usb_config_tx();
+		usb_config_tx(1);
 	}
-	scheduler_schedule_task_relative(&usb_update_task, usb_update, NULL, MS_TO_US(10000));
 }
 
+static esp_err_t usb_config_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
 void usb_init() {
 	usb_enable = settings_get_usb_enable();
 	usb_enable_override = settings_get_usb_enable_override();
 	usb_enable_update();
 
-	scheduler_task_init(&usb_update_task);
-	scheduler_schedule_task_relative(&usb_update_task, usb_update, NULL, MS_TO_US(100));
+	scheduler_task_init(&usb_update_task, "usb");
+	scheduler_task_set_slack(&usb_update_task, MS_TO_US(1000));
+	scheduler_schedule_periodic(&usb_update_task, usb_update, NULL, MS_TO_US(100), MS_TO_US(10000),
+				    SCHEDULER_PERIODIC_SKIP);
+	wireless_register_handler(WIRELESS_PACKET_TYPE_USB_CONFIG, usb_config_rx, NULL, 0);
 }
 
 static void usb_set_enable_(bool enable) {
@@ -92,15 +96,17 @@ void usb_set_enable_override(bool enable) {
 	}
 }
 
-void usb_config_rx(const wireless_packet_t *packet) {
+static esp_err_t usb_config_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
 	usb_config_packet_t config_packet;
 	if (packet->len < sizeof(config_packet)) {
 		ESP_LOGD(TAG, "Received short packet, expected %u bytes but got only %u bytes",
 		         sizeof(config_packet), packet->len);
-		return;
+		return ESP_ERR_INVALID_ARG;
 	}
 	memcpy(&config_packet, packet->data, sizeof(config_packet));
 	if (shared_config_update_remote(&usb_shared_cfg, &config_packet.shared_cfg_hdr)) {
 		usb_set_enable_(!!(config_packet.flags & FLAG_USB_ENABLE));
 	}
+
+	return ESP_OK;
 }
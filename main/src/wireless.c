@@ -1,5 +1,7 @@
 #include "wireless.h"
 
+#include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
@@ -10,19 +12,31 @@
 #include <esp_netif.h>
 #include <esp_random.h>
 #include <esp_timer.h>
-#include <mbedtls/md.h>
 #include <nvs_flash.h>
 #include <sdkconfig.h>
 
 #include "embedded_files.h"
+#include "hmac_sha1.h"
 #include "main.h"
 #include "neighbour.h"
+#include "perf.h"
+#include "poly1305.h"
+#include "spsc_ring.h"
 #include "util.h"
-
-#define WIRELESS_RX_QUEUE_SIZE		8
-#define WIRELESS_HMAC_CTX_CNT		3
+#include "wireless_ratelimit.h"
+
+/*
+ * Realtime packets may use bulk buffers, too. Queue sizes must be powers
+ * of two and hold all buffers that can carry packets of their class.
+ */
+#define WIRELESS_RX_POOL_SIZE_REALTIME	8
+#define WIRELESS_RX_POOL_SIZE_BULK	16
+#define WIRELESS_RX_QUEUE_SIZE_REALTIME	32
+#define WIRELESS_RX_QUEUE_SIZE_BULK	16
 #define WIRELESS_REPLAY_AGE_LIMIT_MS	100
 #define WIRELESS_REPLAY_BUFFER_SIZE	100
+// Set in the packet counter of packets using ChaCha20-Poly1305 instead of ChaCha20 + HMAC-SHA1
+#define WIRELESS_PACKET_CNT_FLAG_AEAD	(1UL << 31)
 
 typedef struct wireless_packet_hdr {
 	union {
@@ -33,9 +47,18 @@ typedef struct wireless_packet_hdr {
 		};
 		uint8_t data[12];
 	} nonce;
+	// Truncated HMAC-SHA1 or Poly1305 tag, depending on WIRELESS_PACKET_CNT_FLAG_AEAD
 	uint8_t short_hmac[8];
 } wireless_packet_hdr_t;
 
+static_assert(sizeof(wireless_packet_hdr_t) + WIRELESS_MAX_PACKET_SIZE <= ESP_NOW_MAX_DATA_LEN);
+
+typedef struct wireless_handler {
+	wireless_rx_handler_f fn;
+	void *ctx;
+	unsigned int flags;
+} wireless_handler_t;
+
 typedef struct wireless_hmac_entry {
 	int64_t timestamp_ms;
 	uint8_t short_hmac[8];
@@ -48,80 +71,57 @@ static const uint8_t wireless_broadcast_address[ESP_NOW_ETH_ALEN] = {
 };
 
 static uint8_t wireless_encryption_key[WIRELESS_ENCRYPTION_KEY_SIZE];
+// Packed once per key instead of once per packet
+static chacha20_key_t wireless_chacha20_key;
+static hmac_sha1_key_t wireless_hmac_key;
+/*
+ * Held while the WiFi task or the main loop use the keys above and while
+ * they are replaced. Key changes are rare, the lock is uncontended otherwise.
+ */
+static SemaphoreHandle_t wireless_key_lock;
+static StaticSemaphore_t wireless_key_lock_buffer;
 static uint32_t wireless_random_id;
 static uint32_t wireless_packet_tx_cnt = 0;
 
 static bool wireless_encryption_enabled = true;
+#ifdef CONFIG_BK_WIRELESS_AEAD
+static bool wireless_aead_enabled = true;
+#else
+static bool wireless_aead_enabled = false;
+#endif
 static bool replay_protection_enabled = true;
-static mbedtls_md_context_t wireless_hmac_ctx[WIRELESS_HMAC_CTX_CNT];
-static bool wireless_hmac_map[WIRELESS_HMAC_CTX_CNT] = { 0 };
-static SemaphoreHandle_t wireless_hmac_lock;
-static StaticSemaphore_t wireless_hmac_lock_buffer;
-static portMUX_TYPE wireless_hmac_spinlock = portMUX_INITIALIZER_UNLOCKED;
 static size_t replay_buffer_read = 0;
 static size_t replay_buffer_write = 0;
 static wireless_hmac_entry_t wireless_replay_buffer[WIRELESS_REPLAY_BUFFER_SIZE] = { 0 };
 
 static char ap_password[WIRELESS_AP_PASSWORD_LENGTH + 1] = { 0 };
 
-static QueueHandle_t rx_queue;
+static wireless_packet_t rx_packet_pool_realtime[WIRELESS_RX_POOL_SIZE_REALTIME];
+static wireless_packet_t rx_packet_pool_bulk[WIRELESS_RX_POOL_SIZE_BULK];
+// Free buffers, filled by the main loop, drained by the WiFi task
+static void *rx_free_slots_realtime[WIRELESS_RX_POOL_SIZE_REALTIME];
+static void *rx_free_slots_bulk[WIRELESS_RX_POOL_SIZE_BULK];
+static spsc_ring_t rx_free_rings[WIRELESS_NUM_RX_CLASSES];
+// Buffer taken by the WiFi task but not queued, reused for the next packet
+static wireless_packet_t *rx_spare_packets[WIRELESS_NUM_RX_CLASSES];
+// Received packets, filled by the WiFi task, drained by the main loop
+static void *rx_queue_slots_realtime[WIRELESS_RX_QUEUE_SIZE_REALTIME];
+static void *rx_queue_slots_bulk[WIRELESS_RX_QUEUE_SIZE_BULK];
+static spsc_ring_t rx_queue_rings[WIRELESS_NUM_RX_CLASSES];
+static wireless_rx_stats_t rx_stats = { 0 };
+static wireless_handler_t rx_handlers[WIRELESS_NUM_PACKET_TYPES] = { 0 };
 static bool scan_done = false;
 static bool sta_connected = false;
 static esp_netif_t *ap_netif = NULL;
 static esp_netif_t *sta_netif = NULL;
 static uint8_t ap_mac_address[ESP_NOW_ETH_ALEN];
 
-static int hmac_take(void) {
-	int idx = -1;
-	xSemaphoreTake(wireless_hmac_lock, portMAX_DELAY);
-	taskENTER_CRITICAL(&wireless_hmac_spinlock);
-	for (int i = 0; i < WIRELESS_HMAC_CTX_CNT; i++) {
-		if (!wireless_hmac_map[i]) {
-			wireless_hmac_map[i] = true;
-			idx = i;
-			break;
-		}
-	}
-	taskEXIT_CRITICAL(&wireless_hmac_spinlock);
-	return idx;
-}
-
-static void hmac_put(int hmac_idx) {
-	taskENTER_CRITICAL(&wireless_hmac_spinlock);
-	wireless_hmac_map[hmac_idx] = false;
-	taskEXIT_CRITICAL(&wireless_hmac_spinlock);
-	xSemaphoreGive(wireless_hmac_lock);
-}
-
-static void hmac_ctx_reinit(void) {
-	for (int i = 0; i < WIRELESS_HMAC_CTX_CNT; i++) {
-		xSemaphoreTake(wireless_hmac_lock, portMAX_DELAY);
-	}
-	for (int i = 0; i < WIRELESS_HMAC_CTX_CNT; i++) {
-		mbedtls_md_context_t *hmac = &wireless_hmac_ctx[i];
-		mbedtls_md_init(hmac);
-		mbedtls_md_setup(hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA1), 1);
-		mbedtls_md_hmac_starts(hmac, wireless_encryption_key, WIRELESS_ENCRYPTION_KEY_SIZE);
-	}
-	for (int i = 0; i < WIRELESS_HMAC_CTX_CNT; i++) {
-		xSemaphoreGive(wireless_hmac_lock);
-	}
-}
-
-static void hmac_ctx_init(void) {
-	wireless_hmac_lock = xSemaphoreCreateCountingStatic(WIRELESS_HMAC_CTX_CNT, WIRELESS_HMAC_CTX_CNT, &wireless_hmac_lock_buffer);
-	hmac_ctx_reinit();
-}
-
 static void packet_generate_hmac(uint8_t *dst, const uint8_t *src, size_t len) {
-	int idx = hmac_take();
-	ESP_ERROR_CHECK(idx < 0);
-	mbedtls_md_context_t *hmac = &wireless_hmac_ctx[idx];
-	mbedtls_md_hmac_update(hmac, ap_mac_address, sizeof(ap_mac_address));
-	mbedtls_md_hmac_update(hmac, src, len);
-	mbedtls_md_hmac_finish(hmac, dst);
-	mbedtls_md_hmac_reset(hmac);
-	hmac_put(idx);
+	hmac_sha1_ctx_t hmac;
+	hmac_sha1_start(&hmac, &wireless_hmac_key);
+	hmac_sha1_update(&hmac, ap_mac_address, sizeof(ap_mac_address));
+	hmac_sha1_update(&hmac, src, len);
+	hmac_sha1_finish(&hmac, dst);
 }
 
 static bool packet_validate_timestamp(const wireless_packet_hdr_t *hdr) {
@@ -132,11 +132,8 @@ static bool packet_validate_timestamp(const wireless_packet_hdr_t *hdr) {
 	return hdr->nonce.timestamp + WIRELESS_REPLAY_AGE_LIMIT_MS > now_ms_ish;
 }
 
-static bool packet_check_replay(const wireless_packet_hdr_t *hdr) {
-	if (!replay_protection_enabled) {
-		return true;
-	}
-
+// Fallback for senders that are not (yet) known neighbours
+static bool packet_check_replay_buffer(const wireless_packet_hdr_t *hdr) {
 	int64_t now_ms = esp_timer_get_time() / 1000LL;
 	size_t idx = replay_buffer_read;
 	bool replay_detected = false;
@@ -173,79 +170,341 @@ static void push_hmac_to_replay_buffer(const wireless_packet_hdr_t *hdr) {
 	}
 }
 
+static bool packet_check_replay(const wireless_packet_hdr_t *hdr, const uint8_t *peer_address) {
+	if (!replay_protection_enabled) {
+		return true;
+	}
+
+	esp_err_t err = neighbour_replay_check(peer_address, hdr->nonce.random_id, hdr->nonce.packet_cnt,
+					       hdr->nonce.timestamp);
+	if (err == ESP_ERR_NOT_FOUND) {
+		return packet_check_replay_buffer(hdr);
+	}
+	return !err;
+}
+
+static void packet_record_replay(const wireless_packet_hdr_t *hdr, const uint8_t *peer_address) {
+	esp_err_t err = neighbour_replay_update(peer_address, hdr->nonce.random_id, hdr->nonce.packet_cnt,
+						hdr->nonce.timestamp);
+	if (err == ESP_ERR_NOT_FOUND) {
+		push_hmac_to_replay_buffer(hdr);
+	}
+}
+
 static bool packet_validate_hmac(const uint8_t *data, size_t data_len, const uint8_t *peer_address, const wireless_packet_hdr_t *hdr) {
-	int idx = hmac_take();
-	ESP_ERROR_CHECK(idx < 0);
-	mbedtls_md_context_t *hmac = &wireless_hmac_ctx[idx];
-	mbedtls_md_hmac_update(hmac, peer_address, ESP_NOW_ETH_ALEN);
-	mbedtls_md_hmac_update(hmac, data, data_len);
-	uint8_t digest[20];
-	mbedtls_md_hmac_finish(hmac, digest);
-	mbedtls_md_hmac_reset(hmac);
-	hmac_put(idx);
+	hmac_sha1_ctx_t hmac;
+	hmac_sha1_start(&hmac, &wireless_hmac_key);
+	hmac_sha1_update(&hmac, peer_address, ESP_NOW_ETH_ALEN);
+	hmac_sha1_update(&hmac, data, data_len);
+	uint8_t digest[HMAC_SHA1_DIGEST_SIZE];
+	hmac_sha1_finish(&hmac, digest);
 	return !memcmp(digest, hdr->short_hmac, sizeof(hdr->short_hmac));
 }
 
+static bool packet_is_aead(const wireless_packet_hdr_t *hdr) {
+	return hdr->nonce.packet_cnt & WIRELESS_PACKET_CNT_FLAG_AEAD;
+}
+
 static void packet_crypt(uint8_t *dst, const uint8_t *src, size_t len, const wireless_packet_hdr_t *hdr) {
 	chacha20_ctx_t chacha20;
-	chacha20_init(&chacha20, wireless_encryption_key, hdr->nonce.data, 0);
+	// AEAD packets reserve the first keystream block for the Poly1305 key
+	chacha20_init_key(&chacha20, &wireless_chacha20_key, hdr->nonce.data, packet_is_aead(hdr) ? 1 : 0);
 	chacha20_xor(&chacha20, dst, src, len);
 }
 
+/*
+ * ChaCha20-Poly1305 tag as in RFC 8439, with the sender address as
+ * associated data, truncated to the size of the header tag field.
+ */
+static void packet_generate_aead_tag(uint8_t *dst, const uint8_t *ciphertext, size_t len, const uint8_t *address,
+				     const wireless_packet_hdr_t *hdr) {
+	static const uint8_t zero_pad[POLY1305_BLOCK_SIZE] = { 0 };
+	uint8_t poly1305_key[POLY1305_KEY_SIZE] = { 0 };
+	chacha20_ctx_t chacha20;
+	chacha20_init_key(&chacha20, &wireless_chacha20_key, hdr->nonce.data, 0);
+	chacha20_xor_inplace(&chacha20, poly1305_key, sizeof(poly1305_key));
+
+	uint8_t lengths[16] = { 0 };
+	lengths[0] = ESP_NOW_ETH_ALEN;
+	lengths[8] = len & 0xff;
+	lengths[9] = len >> 8;
+
+	poly1305_ctx_t poly1305;
+	poly1305_init(&poly1305, poly1305_key);
+	poly1305_update(&poly1305, address, ESP_NOW_ETH_ALEN);
+	poly1305_update(&poly1305, zero_pad, POLY1305_BLOCK_SIZE - ESP_NOW_ETH_ALEN);
+	poly1305_update(&poly1305, ciphertext, len);
+	poly1305_update(&poly1305, zero_pad, (POLY1305_BLOCK_SIZE - len % POLY1305_BLOCK_SIZE) % POLY1305_BLOCK_SIZE);
+	poly1305_update(&poly1305, lengths, sizeof(lengths));
+	uint8_t tag[POLY1305_TAG_SIZE];
+	poly1305_finish(&poly1305, tag);
+	memcpy(dst, tag, sizeof(hdr->short_hmac));
+}
+
+static bool packet_validate_aead_tag(const uint8_t *ciphertext, size_t len, const uint8_t *peer_address,
+				     const wireless_packet_hdr_t *hdr) {
+	uint8_t tag[sizeof(hdr->short_hmac)];
+	packet_generate_aead_tag(tag, ciphertext, len, peer_address, hdr);
+	return !memcmp(tag, hdr->short_hmac, sizeof(hdr->short_hmac));
+}
+
+/*
+ * Checks that need neither a buffer nor any crypto. They run first, so
+ * that malformed, stale and replayed frames are dropped as cheaply as
+ * possible. WiFi task only.
+ */
+static bool rx_packet_precheck(const esp_now_recv_info_t *info, const uint8_t *data, int data_len,
+			       int64_t rx_timestamp, wireless_ratelimit_source_t **source) {
+	int hdr_len = wireless_encryption_enabled ? sizeof(wireless_packet_hdr_t) : 0;
+	if (data_len <= hdr_len || data_len > hdr_len + WIRELESS_MAX_PACKET_SIZE) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_LENGTH]++;
+		return false;
+	}
+
+	if (!wireless_ratelimit_admit(info->src_addr, rx_timestamp, source)) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_RATELIMIT]++;
+		return false;
+	}
+
+	if (!wireless_encryption_enabled) {
+		return true;
+	}
+
+	wireless_packet_hdr_t hdr;
+	memcpy(&hdr, data, sizeof(wireless_packet_hdr_t));
+	if (!packet_validate_timestamp(&hdr)) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_TIMESTAMP]++;
+		return false;
+	}
+	if (!packet_check_replay(&hdr, info->src_addr)) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_REPLAY]++;
+		return false;
+	}
+
+	return true;
+}
+
+// Authenticates and decrypts a frame that passed rx_packet_precheck()
 static bool rx_packet_encrypted(wireless_packet_t *packet, const esp_now_recv_info_t *info, const uint8_t *data, int data_len) {
-	if (data_len >= sizeof(wireless_packet_hdr_t) &&
-	    data_len <= WIRELESS_MAX_PACKET_SIZE - sizeof(wireless_packet_hdr_t)) {
-		wireless_packet_hdr_t hdr;
-		memcpy(&hdr, data, sizeof(wireless_packet_hdr_t));
-		const uint8_t *payload = data + sizeof(wireless_packet_hdr_t);
-		size_t payload_len = data_len - sizeof(wireless_packet_hdr_t);
-		packet_crypt(packet->data, payload, payload_len, &hdr);
-		bool is_valid = packet_validate_timestamp(&hdr) &&
-				packet_check_replay(&hdr) &&
-				packet_validate_hmac(packet->data, payload_len, info->src_addr, &hdr);
+	wireless_packet_hdr_t hdr;
+	memcpy(&hdr, data, sizeof(wireless_packet_hdr_t));
+	const uint8_t *payload = data + sizeof(wireless_packet_hdr_t);
+	size_t payload_len = data_len - sizeof(wireless_packet_hdr_t);
+	bool is_valid;
+	xSemaphoreTake(wireless_key_lock, portMAX_DELAY);
+	if (packet_is_aead(&hdr)) {
+		// Authenticate the ciphertext, only decrypt packets that pass
+		is_valid = packet_validate_aead_tag(payload, payload_len, info->src_addr, &hdr);
 		if (is_valid) {
-			push_hmac_to_replay_buffer(&hdr);
-			packet->len = payload_len;
-			return true;
+			packet_crypt(packet->data, payload, payload_len, &hdr);
 		}
+	} else {
+		// The HMAC covers the plaintext, legacy packets must be decrypted first
+		packet_crypt(packet->data, payload, payload_len, &hdr);
+		is_valid = packet_validate_hmac(packet->data, payload_len, info->src_addr, &hdr);
 	}
+	xSemaphoreGive(wireless_key_lock);
 
-	return false;
+	if (!is_valid) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_AUTH]++;
+		return false;
+	}
+
+	packet_record_replay(&hdr, info->src_addr);
+	packet->len = payload_len;
+	return true;
 }
 
 static bool rx_packet_plain(wireless_packet_t *packet, const uint8_t *data, int data_len) {
-	if (data_len > 0 && data_len <= WIRELESS_MAX_PACKET_SIZE) {
-		memcpy(packet->data, data, data_len);
-		packet->len = data_len;
-		return true;
+	memcpy(packet->data, data, data_len);
+	packet->len = data_len;
+	return true;
+}
+
+static unsigned int stats_type_idx(uint8_t packet_type) {
+	return MIN(packet_type, WIRELESS_NUM_PACKET_TYPES);
+}
+
+static wireless_rx_class_t get_rx_class(uint8_t packet_type) {
+	if (packet_type < ARRAY_SIZE(rx_handlers) &&
+	    (rx_handlers[packet_type].flags & WIRELESS_HANDLER_FLAG_REALTIME)) {
+		return WIRELESS_RX_CLASS_REALTIME;
+	}
+	return WIRELESS_RX_CLASS_BULK;
+}
+
+/*
+ * Class of a frame that is not authenticated yet. Encrypted frames are
+ * classified by their sender, decrypting the type of an unauthenticated
+ * frame would hand out ChaCha20 work to anyone.
+ */
+static wireless_rx_class_t peek_rx_class(const wireless_ratelimit_source_t *source, const uint8_t *data, int64_t now_us) {
+	if (!wireless_encryption_enabled) {
+		return get_rx_class(data[0]);
+	}
+	return wireless_ratelimit_is_realtime_source(source, now_us) ? WIRELESS_RX_CLASS_REALTIME : WIRELESS_RX_CLASS_BULK;
+}
+
+// Pool a buffer belongs to, not the class of the packet it carries
+static wireless_rx_class_t get_pool_class(const wireless_packet_t *packet) {
+	if (packet >= rx_packet_pool_realtime &&
+	    packet < rx_packet_pool_realtime + ARRAY_SIZE(rx_packet_pool_realtime)) {
+		return WIRELESS_RX_CLASS_REALTIME;
+	}
+	return WIRELESS_RX_CLASS_BULK;
+}
+
+// WiFi task only
+static wireless_packet_t *take_rx_buffer(wireless_rx_class_t pool_class) {
+	wireless_packet_t *packet = rx_spare_packets[pool_class];
+	if (packet) {
+		rx_spare_packets[pool_class] = NULL;
+		return packet;
 	}
+	return spsc_ring_pop(&rx_free_rings[pool_class]);
+}
 
-	return false;
+/*
+ * WiFi task only. The WiFi task must not push to the free rings, the
+ * main loop is their only producer.
+ */
+static void put_rx_buffer(wireless_packet_t *packet) {
+	rx_spare_packets[get_pool_class(packet)] = packet;
+}
+
+/*
+ * Next type/length/value sub-message of an aggregate frame, starting at
+ * *pos. Returns ESP_ERR_NOT_FOUND at the end of the frame.
+ */
+static esp_err_t aggregate_next(const wireless_packet_t *packet, unsigned int *pos, uint8_t *packet_type,
+				const uint8_t **value, uint8_t *value_len) {
+	if (*pos >= packet->len) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (packet->len - *pos < 2) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	*packet_type = packet->data[(*pos)++];
+	*value_len = packet->data[(*pos)++];
+	if (*value_len > packet->len - *pos) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if (*packet_type == WIRELESS_PACKET_TYPE_AGGREGATE) {
+		// No nesting
+		return ESP_ERR_INVALID_ARG;
+	}
+	*value = &packet->data[*pos];
+	*pos += *value_len;
+	return ESP_OK;
+}
+
+/*
+ * Charges a packet to the budget of its type. Sub-messages of aggregates
+ * are charged to their own types, so aggregating does not get around the
+ * type budgets. An aggregate is dropped as a whole if any sub-message is
+ * over budget. Aggregates are queued as bulk, senders never aggregate
+ * realtime priority packets. WiFi task only.
+ */
+static bool rx_admit_types(wireless_ratelimit_source_t *source, const wireless_packet_t *packet, int64_t now_us) {
+	if (packet->data[0] != WIRELESS_PACKET_TYPE_AGGREGATE) {
+		return wireless_ratelimit_admit_type(source, packet->data[0],
+						     get_rx_class(packet->data[0]) == WIRELESS_RX_CLASS_REALTIME, now_us);
+	}
+
+	unsigned int pos = 1;
+	uint8_t packet_type;
+	const uint8_t *value;
+	uint8_t value_len;
+	while (!aggregate_next(packet, &pos, &packet_type, &value, &value_len)) {
+		if (!wireless_ratelimit_admit_type(source, packet_type,
+						   get_rx_class(packet_type) == WIRELESS_RX_CLASS_REALTIME, now_us)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool aggregate_is_valid(const wireless_packet_t *packet) {
+	unsigned int pos = 1;
+	uint8_t packet_type;
+	const uint8_t *value;
+	uint8_t value_len;
+	esp_err_t err;
+	do {
+		err = aggregate_next(packet, &pos, &packet_type, &value, &value_len);
+	} while (!err);
+	return err == ESP_ERR_NOT_FOUND;
 }
 
 static void recv_cb(const esp_now_recv_info_t *info, const uint8_t *data, int data_len) {
 	int64_t rx_timestamp = esp_timer_get_time();
 
 	ESP_LOGD(TAG, "Received %d bytes", data_len);
-	wireless_packet_t packet = {
-		.rx_timestamp = rx_timestamp
-	};
+	wireless_ratelimit_source_t *source;
+	if (!rx_packet_precheck(info, data, data_len, rx_timestamp, &source)) {
+		return;
+	}
+
+	wireless_packet_t *packet = take_rx_buffer(WIRELESS_RX_CLASS_BULK);
+	if (!packet) {
+		// Reserved buffers are for realtime traffic only
+		if (peek_rx_class(source, data, rx_timestamp) == WIRELESS_RX_CLASS_REALTIME) {
+			packet = take_rx_buffer(WIRELESS_RX_CLASS_REALTIME);
+		}
+		if (!packet) {
+			// Type of encrypted frames is unknown until they are decrypted
+			uint8_t packet_type = wireless_encryption_enabled ? WIRELESS_NUM_PACKET_TYPES : data[0];
+			rx_stats.pool_exhausted[stats_type_idx(packet_type)]++;
+			ESP_LOGW(TAG, "RX packet pool exhausted. Dropping packet");
+			return;
+		}
+	}
+	packet->rx_timestamp = rx_timestamp;
 
 	bool packet_valid;
 	if (wireless_encryption_enabled) {
-		packet_valid = rx_packet_encrypted(&packet, info, data, data_len);
+		packet_valid = rx_packet_encrypted(packet, info, data, data_len);
 	} else {
-		packet_valid = rx_packet_plain(&packet, data, data_len);
+		packet_valid = rx_packet_plain(packet, data, data_len);
 	}
 
-	if (packet_valid) {
-		memcpy(packet.src_addr, info->src_addr, sizeof(packet.src_addr));
-		if (xQueueSend(rx_queue, &packet, 0) != pdTRUE) {
-			ESP_LOGW(TAG, "RX queue overflow. Dropping packet");
-		} else {
-			ESP_LOGD(TAG, "Packet queued, %u bytes", packet.len);
-			post_event(EVENT_WIRELESS);
-		}
+	if (!packet_valid) {
+		put_rx_buffer(packet);
+		return;
+	}
+
+	wireless_rx_class_t rx_class = get_rx_class(packet->data[0]);
+	if (rx_class == WIRELESS_RX_CLASS_BULK && get_pool_class(packet) == WIRELESS_RX_CLASS_REALTIME) {
+		/*
+		 * Realtime source sent bulk traffic while the bulk pool was
+		 * empty. Hand the reserved buffer back instead of queuing.
+		 */
+		rx_stats.pool_exhausted[stats_type_idx(packet->data[0])]++;
+		put_rx_buffer(packet);
+		return;
+	}
+
+	if (packet->data[0] == WIRELESS_PACKET_TYPE_AGGREGATE && !aggregate_is_valid(packet)) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_AGGREGATE]++;
+		put_rx_buffer(packet);
+		return;
+	}
+
+	if (!rx_admit_types(source, packet, rx_timestamp)) {
+		rx_stats.rejected[WIRELESS_RX_REJECT_RATELIMIT_TYPE]++;
+		put_rx_buffer(packet);
+		return;
+	}
+
+	rx_stats.packets_received++;
+	memcpy(packet->src_addr, info->src_addr, sizeof(packet->src_addr));
+	if (!spsc_ring_push(&rx_queue_rings[rx_class], packet)) {
+		rx_stats.queue_overflow[stats_type_idx(packet->data[0])]++;
+		ESP_LOGW(TAG, "RX queue overflow. Dropping packet");
+		put_rx_buffer(packet);
+	} else {
+		ESP_LOGD(TAG, "Packet queued, %u bytes", packet->len);
+		post_event(EVENT_WIRELESS);
 	}
 }
 
@@ -275,6 +534,28 @@ static void generate_psk(char *dst, size_t len) {
 	}
 }
 
+// Splits an aggregate frame and dispatches its sub-messages as packets of their own
+static esp_err_t wireless_rx_aggregate(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	wireless_packet_t sub_packet = {
+		.rx_timestamp = packet->rx_timestamp
+	};
+	memcpy(sub_packet.src_addr, packet->src_addr, sizeof(sub_packet.src_addr));
+
+	unsigned int pos = 1;
+	uint8_t packet_type;
+	const uint8_t *value;
+	uint8_t value_len;
+	esp_err_t err;
+	while (!(err = aggregate_next(packet, &pos, &packet_type, &value, &value_len))) {
+		sub_packet.data[0] = packet_type;
+		memcpy(&sub_packet.data[1], value, value_len);
+		sub_packet.len = value_len + 1;
+		wireless_dispatch(&sub_packet);
+	}
+
+	return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+}
+
 esp_err_t wireless_init() {
 	esp_err_t err = nvs_flash_init();
 	if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -392,15 +673,24 @@ esp_err_t wireless_init() {
 		return err;
 	}
 
+	wireless_key_lock = xSemaphoreCreateMutexStatic(&wireless_key_lock_buffer);
 	const uint8_t *default_wireless_encryption_key = EMBEDDED_FILE_PTR(wireless_key);
 	memcpy(wireless_encryption_key, default_wireless_encryption_key, WIRELESS_ENCRYPTION_KEY_SIZE);
+	chacha20_key_init(&wireless_chacha20_key, wireless_encryption_key);
+	hmac_sha1_key_init(&wireless_hmac_key, wireless_encryption_key, WIRELESS_ENCRYPTION_KEY_SIZE);
 	wireless_random_id = esp_random();
-	hmac_ctx_init();
 
-	rx_queue = xQueueCreate(WIRELESS_RX_QUEUE_SIZE, sizeof(wireless_packet_t));
-	if (!rx_queue) {
-		return ESP_ERR_NO_MEM;
+	spsc_ring_init(&rx_queue_rings[WIRELESS_RX_CLASS_REALTIME], rx_queue_slots_realtime, ARRAY_SIZE(rx_queue_slots_realtime));
+	spsc_ring_init(&rx_queue_rings[WIRELESS_RX_CLASS_BULK], rx_queue_slots_bulk, ARRAY_SIZE(rx_queue_slots_bulk));
+	spsc_ring_init(&rx_free_rings[WIRELESS_RX_CLASS_REALTIME], rx_free_slots_realtime, ARRAY_SIZE(rx_free_slots_realtime));
+	spsc_ring_init(&rx_free_rings[WIRELESS_RX_CLASS_BULK], rx_free_slots_bulk, ARRAY_SIZE(rx_free_slots_bulk));
+	for (int i = 0; i < ARRAY_SIZE(rx_packet_pool_realtime); i++) {
+		spsc_ring_push(&rx_free_rings[WIRELESS_RX_CLASS_REALTIME], &rx_packet_pool_realtime[i]);
 	}
+	for (int i = 0; i < ARRAY_SIZE(rx_packet_pool_bulk); i++) {
+		spsc_ring_push(&rx_free_rings[WIRELESS_RX_CLASS_BULK], &rx_packet_pool_bulk[i]);
+	}
+	wireless_register_handler(WIRELESS_PACKET_TYPE_AGGREGATE, wireless_rx_aggregate, NULL, 0);
 
 	return esp_now_register_recv_cb(recv_cb);
 }
@@ -414,14 +704,23 @@ static esp_err_t broadcast_encrypted(const uint8_t *data, size_t len) {
 		uint8_t data[sizeof(wireless_packet_hdr_t) + WIRELESS_MAX_PACKET_SIZE];
 	} packet;
 	packet.hdr.nonce.timestamp = (uint64_t)neighbour_get_global_clock() >> 10;
-	packet.hdr.nonce.packet_cnt = wireless_packet_tx_cnt++;
+	packet.hdr.nonce.packet_cnt = wireless_packet_tx_cnt++ & ~WIRELESS_PACKET_CNT_FLAG_AEAD;
+	if (wireless_aead_enabled) {
+		packet.hdr.nonce.packet_cnt |= WIRELESS_PACKET_CNT_FLAG_AEAD;
+	}
 	packet.hdr.nonce.random_id = wireless_random_id;
 
+	xSemaphoreTake(wireless_key_lock, portMAX_DELAY);
 	packet_crypt(packet.payload, data, len, &packet.hdr);
 
-	uint8_t hmac[20];
-	packet_generate_hmac(hmac, data, len);
-	memcpy(packet.hdr.short_hmac, hmac, sizeof(packet.hdr.short_hmac));
+	if (wireless_aead_enabled) {
+		packet_generate_aead_tag(packet.hdr.short_hmac, packet.payload, len, ap_mac_address, &packet.hdr);
+	} else {
+		uint8_t hmac[20];
+		packet_generate_hmac(hmac, data, len);
+		memcpy(packet.hdr.short_hmac, hmac, sizeof(packet.hdr.short_hmac));
+	}
+	xSemaphoreGive(wireless_key_lock);
 
 	return esp_now_send(wireless_broadcast_address, packet.data, sizeof(wireless_packet_hdr_t) + len);
 }
@@ -434,8 +733,118 @@ esp_err_t wireless_broadcast(const uint8_t *data, size_t len) {
 	}
 }
 
-QueueHandle_t wireless_get_rx_queue() {
-	return rx_queue;
+/*
+ * Returns the next received packet or NULL, realtime packets first. The
+ * packet is borrowed from the RX pool and must be handed back with
+ * wireless_packet_release().
+ */
+wireless_packet_t *wireless_rx_dequeue(void) {
+	wireless_packet_t *packet = spsc_ring_pop(&rx_queue_rings[WIRELESS_RX_CLASS_REALTIME]);
+	if (!packet) {
+		packet = spsc_ring_pop(&rx_queue_rings[WIRELESS_RX_CLASS_BULK]);
+	}
+	return packet;
+}
+
+void wireless_packet_release(wireless_packet_t *packet) {
+	spsc_ring_push(&rx_free_rings[get_pool_class(packet)], packet);
+}
+
+esp_err_t wireless_register_handler(uint8_t packet_type, wireless_rx_handler_f fn, void *ctx, unsigned int flags) {
+	if (packet_type >= ARRAY_SIZE(rx_handlers) || !fn) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (rx_handlers[packet_type].fn) {
+		ESP_LOGE(TAG, "Handler for packet type %u already registered", packet_type);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	rx_handlers[packet_type] = (wireless_handler_t){
+		.fn = fn,
+		.ctx = ctx,
+		.flags = flags
+	};
+	return ESP_OK;
+}
+
+void wireless_dispatch(const wireless_packet_t *packet) {
+	if (!packet->len) {
+		return;
+	}
+
+	uint8_t packet_type = packet->data[0];
+	wireless_type_stats_t *stats = &rx_stats.dispatch[stats_type_idx(packet_type)];
+	stats->packets++;
+	stats->bytes += packet->len;
+	if (packet_type >= ARRAY_SIZE(rx_handlers) || !rx_handlers[packet_type].fn) {
+		ESP_LOGD(TAG, "Unknown packet type 0x%02x", packet_type);
+		stats->rejected++;
+		return;
+	}
+
+	const wireless_handler_t *handler = &rx_handlers[packet_type];
+	wireless_latency_stats_t *latency = &rx_stats.latency[get_rx_class(packet_type)];
+	int64_t latency_us = esp_timer_get_time() - packet->rx_timestamp;
+	latency->packets++;
+	latency->latency_total_us += latency_us;
+	latency->latency_max_us = MAX(latency->latency_max_us, latency_us);
+
+	uint32_t cycles_start = perf_get_cycles();
+	const neighbour_t *neigh = NULL;
+	if (handler->flags & WIRELESS_HANDLER_FLAG_NEIGHBOUR) {
+		neigh = neighbour_find_by_address(packet->src_addr);
+	}
+	esp_err_t err = handler->fn(packet, neigh, handler->ctx);
+	stats->handler_cycles += perf_get_cycles() - cycles_start;
+	if (err) {
+		stats->rejected++;
+	}
+}
+
+void wireless_get_rx_stats(wireless_rx_stats_t *stats) {
+	*stats = rx_stats;
+}
+
+void wireless_print_rx_stats(void) {
+	printf("Packets received: %lu\r\n", (unsigned long)rx_stats.packets_received);
+	printf("Rejected: %lu length, %lu rate limit, %lu timestamp, %lu replay, %lu authentication, "
+	       "%lu malformed aggregate, %lu type rate limit\r\n",
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_LENGTH],
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_RATELIMIT],
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_TIMESTAMP],
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_REPLAY],
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_AUTH],
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_AGGREGATE],
+	       (unsigned long)rx_stats.rejected[WIRELESS_RX_REJECT_RATELIMIT_TYPE]);
+	for (int i = 0; i < WIRELESS_NUM_RX_CLASSES; i++) {
+		const wireless_latency_stats_t *latency = &rx_stats.latency[i];
+		long avg_latency_us = latency->packets ? latency->latency_total_us / latency->packets : 0;
+		printf("%s: %u queued, %u free buffers, latency avg %ld us, max %ld us\r\n",
+		       i == WIRELESS_RX_CLASS_REALTIME ? "Realtime" : "Bulk",
+		       spsc_ring_count(&rx_queue_rings[i]),
+		       spsc_ring_count(&rx_free_rings[i]) + (rx_spare_packets[i] ? 1 : 0),
+		       avg_latency_us, (long)latency->latency_max_us);
+	}
+	printf("Type Packets    Bytes      Avg cycles Rejected   Pool exhausted Queue overflow\r\n");
+	for (int i = 0; i < ARRAY_SIZE(rx_stats.dispatch); i++) {
+		const wireless_type_stats_t *stats = &rx_stats.dispatch[i];
+		if (!stats->packets && !rx_stats.pool_exhausted[i] && !rx_stats.queue_overflow[i]) {
+			continue;
+		}
+		if (i == WIRELESS_NUM_PACKET_TYPES) {
+			printf("%-4s ", "?");
+		} else {
+			printf("%-4d ", i);
+		}
+		unsigned long avg_cycles = stats->packets ? stats->handler_cycles / stats->packets : 0;
+		printf("%-10lu %-10llu %-10lu %-10lu %-14lu %-14lu\r\n",
+		       (unsigned long)stats->packets,
+		       (unsigned long long)stats->bytes,
+		       avg_cycles,
+		       (unsigned long)stats->rejected,
+		       (unsigned long)rx_stats.pool_exhausted[i],
+		       (unsigned long)rx_stats.queue_overflow[i]);
+	}
 }
 
 esp_err_t wireless_scan_aps(void) {
@@ -532,6 +941,14 @@ void wireless_set_encryption_enable(bool enable) {
 	wireless_encryption_enabled = enable;
 }
 
+/*
+ * Selects ChaCha20-Poly1305 for transmitted packets. Reception accepts
+ * both modes regardless, so mixed fleets keep working during rollout.
+ */
+void wireless_set_aead_enable(bool enable) {
+	wireless_aead_enabled = enable;
+}
+
 void wireless_set_replay_protection_enable(bool enable) {
 	replay_protection_enabled = enable;
 }
@@ -540,7 +957,11 @@ esp_err_t wireless_set_encryption_key(const uint8_t *key, unsigned int len) {
 	if (len != WIRELESS_ENCRYPTION_KEY_SIZE) {
 		return ESP_ERR_INVALID_ARG;
 	}
+	xSemaphoreTake(wireless_key_lock, portMAX_DELAY);
 	memcpy(wireless_encryption_key, key, len);
-	hmac_ctx_reinit();
+	chacha20_key_init(&wireless_chacha20_key, wireless_encryption_key);
+	hmac_sha1_key_free(&wireless_hmac_key);
+	hmac_sha1_key_init(&wireless_hmac_key, wireless_encryption_key, WIRELESS_ENCRYPTION_KEY_SIZE);
+	xSemaphoreGive(wireless_key_lock);
 	return ESP_OK;
 }
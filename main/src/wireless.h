@@ -4,9 +4,6 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
-
 #include <esp_err.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
@@ -14,7 +11,8 @@
 
 #include "chacha20.h"
 
-#define WIRELESS_MAX_PACKET_SIZE	128
+// ESP-NOW frame limit of 250 bytes minus the 20 byte packet header
+#define WIRELESS_MAX_PACKET_SIZE	230
 #define WIRELESS_AP_PASSWORD_LENGTH	 16
 #define WIRELESS_ENCRYPTION_KEY_SIZE	CHACHA20_KEY_SIZE
 
@@ -32,7 +30,12 @@ typedef enum wireless_packet_type {
 	WIRELESS_PACKET_TYPE_DEFAULT_COLOR = 10,
 	WIRELESS_PACKET_TYPE_STATE_OF_CHARGE = 11,
 	WIRELESS_PACKET_TYPE_USB_CONFIG = 12,
-	WIRELESS_PACKET_TYPE_NEIGHBOUR_RSSI_REPORT = 13
+	WIRELESS_PACKET_TYPE_NEIGHBOUR_RSSI_REPORT = 13,
+	// Several packets packed as type, length, value sub-messages
+	WIRELESS_PACKET_TYPE_AGGREGATE = 14,
+	// Part of a message larger than a single packet, see wireless_frag.h
+	WIRELESS_PACKET_TYPE_FRAGMENT = 15,
+	WIRELESS_NUM_PACKET_TYPES
 } wireless_packet_type_t;
 
 typedef uint8_t wireless_address_t[ESP_NOW_ETH_ALEN];
@@ -44,9 +47,70 @@ typedef struct wireless_packet {
 	uint8_t data[WIRELESS_MAX_PACKET_SIZE];
 } wireless_packet_t;
 
+// Handler needs the sending neighbour, looked up before the handler runs
+#define WIRELESS_HANDLER_FLAG_NEIGHBOUR	(1 << 0)
+// Latency sensitive, queued and dispatched ahead of bulk traffic
+#define WIRELESS_HANDLER_FLAG_REALTIME	(1 << 1)
+
+typedef enum wireless_rx_class {
+	WIRELESS_RX_CLASS_REALTIME = 0,
+	WIRELESS_RX_CLASS_BULK,
+	WIRELESS_NUM_RX_CLASSES
+} wireless_rx_class_t;
+
+typedef struct neighbour neighbour_t;
+
+/*
+ * Called from the main loop for each received packet of the registered
+ * type. neigh is only looked up with WIRELESS_HANDLER_FLAG_NEIGHBOUR and
+ * may be NULL for unknown senders. Errors count as rejected packets.
+ */
+typedef esp_err_t (*wireless_rx_handler_f)(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx);
+
+typedef struct wireless_type_stats {
+	uint32_t packets;
+	uint64_t bytes;
+	uint64_t handler_cycles;
+	uint32_t rejected;
+} wireless_type_stats_t;
+
+// Time from reception in the WiFi task until the handler runs
+typedef struct wireless_latency_stats {
+	uint32_t packets;
+	int64_t latency_total_us;
+	int64_t latency_max_us;
+} wireless_latency_stats_t;
+
+// Receive checks a frame can fail, in the order they are applied
+typedef enum wireless_rx_reject {
+	WIRELESS_RX_REJECT_LENGTH = 0,
+	WIRELESS_RX_REJECT_RATELIMIT,
+	WIRELESS_RX_REJECT_TIMESTAMP,
+	WIRELESS_RX_REJECT_REPLAY,
+	WIRELESS_RX_REJECT_AUTH,
+	WIRELESS_RX_REJECT_AGGREGATE,
+	WIRELESS_RX_REJECT_RATELIMIT_TYPE,
+	WIRELESS_NUM_RX_REJECT_STAGES
+} wireless_rx_reject_t;
+
+typedef struct wireless_rx_stats {
+	uint32_t packets_received;
+	uint32_t rejected[WIRELESS_NUM_RX_REJECT_STAGES];
+	// Indexed by packet type, last entry counts unknown types
+	uint32_t pool_exhausted[WIRELESS_NUM_PACKET_TYPES + 1];
+	uint32_t queue_overflow[WIRELESS_NUM_PACKET_TYPES + 1];
+	wireless_type_stats_t dispatch[WIRELESS_NUM_PACKET_TYPES + 1];
+	wireless_latency_stats_t latency[WIRELESS_NUM_RX_CLASSES];
+} wireless_rx_stats_t;
+
 esp_err_t wireless_init();
 esp_err_t wireless_broadcast(const uint8_t *data, size_t len);
-QueueHandle_t wireless_get_rx_queue(void);
+wireless_packet_t *wireless_rx_dequeue(void);
+void wireless_packet_release(wireless_packet_t *packet);
+esp_err_t wireless_register_handler(uint8_t packet_type, wireless_rx_handler_f fn, void *ctx, unsigned int flags);
+void wireless_dispatch(const wireless_packet_t *packet);
+void wireless_get_rx_stats(wireless_rx_stats_t *stats);
+void wireless_print_rx_stats(void);
 
 esp_err_t wireless_scan_aps(void);
 bool wireless_is_scan_done(void);
@@ -64,5 +128,6 @@ const uint8_t *wireless_get_broadcast_address(void);
 bool wireless_is_broadcast_address(const uint8_t *addr);
 bool wireless_is_local_address(const uint8_t *addr);
 void wireless_set_encryption_enable(bool enable);
+void wireless_set_aead_enable(bool enable);
 void wireless_set_replay_protection_enable(bool enable);
 esp_err_t wireless_set_encryption_key(const uint8_t *key, unsigned int len);
@@ -0,0 +1,301 @@
+#include "wireless_frag.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#include "util.h"
+
+#define FRAG_MAX_PAYLOAD_SIZE	(WIRELESS_MAX_PACKET_SIZE - sizeof(wireless_frag_hdr_t))
+#define FRAG_MAX_FRAGMENTS	DIV_ROUND_UP(WIRELESS_FRAG_MAX_MESSAGE_SIZE, FRAG_MAX_PAYLOAD_SIZE)
+/*
+ * Recently completed messages, to drop late duplicates of their fragments.
+ * Late duplicates can not arrive after the reassembly timeout either.
+ */
+#define FRAG_NUM_RECENT_MESSAGES	8
+
+typedef struct wireless_frag_hdr {
+	uint8_t packet_type;
+	uint16_t message_id;
+	uint8_t fragment_index;
+	uint8_t num_fragments;
+	uint16_t message_len;
+} __attribute__((packed)) wireless_frag_hdr_t;
+
+typedef struct wireless_frag_packet {
+	wireless_frag_hdr_t hdr;
+	uint8_t payload[WIRELESS_MAX_PACKET_SIZE - sizeof(wireless_frag_hdr_t)];
+} __attribute__((packed)) wireless_frag_packet_t;
+
+typedef struct wireless_frag_message_id {
+	uint8_t src_addr[ESP_NOW_ETH_ALEN];
+	uint16_t message_id;
+} wireless_frag_message_id_t;
+
+typedef struct wireless_frag_recent_message {
+	wireless_frag_message_id_t id;
+	int64_t timestamp_us;
+} wireless_frag_recent_message_t;
+
+typedef struct wireless_frag_reassembly {
+	bool used;
+	wireless_frag_message_id_t id;
+	uint8_t num_fragments;
+	uint16_t message_len;
+	uint32_t fragments_received;
+	int64_t timestamp_first_rx_us;
+	uint8_t data[WIRELESS_FRAG_MAX_MESSAGE_SIZE];
+} wireless_frag_reassembly_t;
+
+typedef struct wireless_frag_handler {
+	wireless_frag_handler_f fn;
+	void *ctx;
+} wireless_frag_handler_t;
+
+typedef struct wireless_frag {
+	uint16_t tx_message_id;
+	wireless_frag_reassembly_t reassembly[WIRELESS_FRAG_NUM_REASSEMBLY_BUFFERS];
+	wireless_frag_recent_message_t recent[FRAG_NUM_RECENT_MESSAGES];
+	unsigned int recent_write_pos;
+	wireless_frag_handler_t handlers[WIRELESS_NUM_PACKET_TYPES];
+	wireless_frag_stats_t stats;
+} wireless_frag_t;
+
+static_assert(FRAG_MAX_FRAGMENTS <= 32);
+// Messages are only queued as a whole
+static_assert(FRAG_MAX_FRAGMENTS <= WIRELESS_TX_QUEUE_SIZE);
+
+static const char *TAG = "wireless_frag";
+
+static wireless_frag_t wireless_frag = { 0 };
+
+static bool message_id_equal(const wireless_frag_message_id_t *a, const wireless_frag_message_id_t *b) {
+	return a->message_id == b->message_id &&
+	       !memcmp(a->src_addr, b->src_addr, sizeof(a->src_addr));
+}
+
+static bool is_recent_message(const wireless_frag_message_id_t *id, int64_t now) {
+	for (int i = 0; i < ARRAY_SIZE(wireless_frag.recent); i++) {
+		const wireless_frag_recent_message_t *recent = &wireless_frag.recent[i];
+		if (recent->timestamp_us &&
+		    now - recent->timestamp_us <= MS_TO_US(WIRELESS_FRAG_REASSEMBLY_TIMEOUT_MS) &&
+		    message_id_equal(&recent->id, id)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void add_recent_message(const wireless_frag_message_id_t *id, int64_t now) {
+	wireless_frag.recent[wireless_frag.recent_write_pos] = (wireless_frag_recent_message_t){
+		.id = *id,
+		.timestamp_us = now
+	};
+	wireless_frag.recent_write_pos++;
+	wireless_frag.recent_write_pos %= ARRAY_SIZE(wireless_frag.recent);
+}
+
+static void expire_reassembly(int64_t now) {
+	for (int i = 0; i < ARRAY_SIZE(wireless_frag.reassembly); i++) {
+		wireless_frag_reassembly_t *reassembly = &wireless_frag.reassembly[i];
+		if (reassembly->used &&
+		    now - reassembly->timestamp_first_rx_us > MS_TO_US(WIRELESS_FRAG_REASSEMBLY_TIMEOUT_MS)) {
+			reassembly->used = false;
+			wireless_frag.stats.messages_timed_out++;
+		}
+	}
+}
+
+/*
+ * Reassembly buffer for a message, a new one if this is its first
+ * fragment. With all buffers busy the oldest partial message is dropped.
+ */
+static wireless_frag_reassembly_t *get_reassembly(const wireless_frag_message_id_t *id,
+						  const wireless_frag_hdr_t *hdr, int64_t now) {
+	wireless_frag_reassembly_t *free_reassembly = NULL;
+	wireless_frag_reassembly_t *oldest = NULL;
+	for (int i = 0; i < ARRAY_SIZE(wireless_frag.reassembly); i++) {
+		wireless_frag_reassembly_t *reassembly = &wireless_frag.reassembly[i];
+		if (!reassembly->used) {
+			free_reassembly = free_reassembly ? free_reassembly : reassembly;
+			continue;
+		}
+		if (message_id_equal(&reassembly->id, id)) {
+			return reassembly;
+		}
+		if (!oldest || reassembly->timestamp_first_rx_us < oldest->timestamp_first_rx_us) {
+			oldest = reassembly;
+		}
+	}
+
+	wireless_frag_reassembly_t *reassembly = free_reassembly;
+	if (!reassembly) {
+		reassembly = oldest;
+		wireless_frag.stats.messages_evicted++;
+	}
+	reassembly->used = true;
+	reassembly->id = *id;
+	reassembly->num_fragments = hdr->num_fragments;
+	reassembly->message_len = hdr->message_len;
+	reassembly->fragments_received = 0;
+	reassembly->timestamp_first_rx_us = now;
+	return reassembly;
+}
+
+static bool fragment_is_valid(const wireless_frag_hdr_t *hdr, size_t payload_len) {
+	if (!hdr->message_len || hdr->message_len > WIRELESS_FRAG_MAX_MESSAGE_SIZE ||
+	    hdr->num_fragments != DIV_ROUND_UP(hdr->message_len, FRAG_MAX_PAYLOAD_SIZE) ||
+	    hdr->fragment_index >= hdr->num_fragments) {
+		return false;
+	}
+
+	// All fragments but the last are full
+	size_t expected_len = FRAG_MAX_PAYLOAD_SIZE;
+	if (hdr->fragment_index == hdr->num_fragments - 1) {
+		expected_len = hdr->message_len - hdr->fragment_index * FRAG_MAX_PAYLOAD_SIZE;
+	}
+	return payload_len == expected_len;
+}
+
+static void deliver_message(const wireless_frag_reassembly_t *reassembly) {
+	uint8_t message_type = reassembly->data[0];
+	if (message_type >= ARRAY_SIZE(wireless_frag.handlers) || !wireless_frag.handlers[message_type].fn) {
+		ESP_LOGD(TAG, "No handler for message type %u", message_type);
+		return;
+	}
+
+	const wireless_frag_handler_t *handler = &wireless_frag.handlers[message_type];
+	esp_err_t err = handler->fn(reassembly->id.src_addr, reassembly->data, reassembly->message_len, handler->ctx);
+	if (err) {
+		ESP_LOGD(TAG, "Handler for message type %u failed: %d", message_type, err);
+	}
+}
+
+static esp_err_t wireless_frag_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	wireless_frag_hdr_t hdr;
+	if (packet->len < sizeof(hdr)) {
+		wireless_frag.stats.fragments_invalid++;
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memcpy(&hdr, packet->data, sizeof(hdr));
+	const uint8_t *payload = packet->data + sizeof(hdr);
+	size_t payload_len = packet->len - sizeof(hdr);
+	if (!fragment_is_valid(&hdr, payload_len)) {
+		wireless_frag.stats.fragments_invalid++;
+		return ESP_ERR_INVALID_ARG;
+	}
+	wireless_frag.stats.fragments_received++;
+
+	int64_t now = esp_timer_get_time();
+	wireless_frag_message_id_t id = { .message_id = hdr.message_id };
+	memcpy(id.src_addr, packet->src_addr, sizeof(id.src_addr));
+	if (is_recent_message(&id, now)) {
+		wireless_frag.stats.fragments_duplicate++;
+		return ESP_OK;
+	}
+
+	expire_reassembly(now);
+	wireless_frag_reassembly_t *reassembly = get_reassembly(&id, &hdr, now);
+	if (reassembly->num_fragments != hdr.num_fragments || reassembly->message_len != hdr.message_len) {
+		// Sender reused the message ID, start over
+		wireless_frag.stats.messages_evicted++;
+		reassembly->used = false;
+		reassembly = get_reassembly(&id, &hdr, now);
+	}
+
+	uint32_t fragment_bit = 1UL << hdr.fragment_index;
+	if (reassembly->fragments_received & fragment_bit) {
+		wireless_frag.stats.fragments_duplicate++;
+		return ESP_OK;
+	}
+	memcpy(&reassembly->data[hdr.fragment_index * FRAG_MAX_PAYLOAD_SIZE], payload, payload_len);
+	reassembly->fragments_received |= fragment_bit;
+
+	if (reassembly->fragments_received == (1ULL << reassembly->num_fragments) - 1) {
+		wireless_frag.stats.messages_reassembled++;
+		add_recent_message(&reassembly->id, now);
+		reassembly->used = false;
+		deliver_message(reassembly);
+	}
+
+	return ESP_OK;
+}
+
+void wireless_frag_init(void) {
+	// Message IDs must not repeat the ones used before a reboot
+	wireless_frag.tx_message_id = esp_random();
+	wireless_register_handler(WIRELESS_PACKET_TYPE_FRAGMENT, wireless_frag_rx, NULL, 0);
+}
+
+esp_err_t wireless_frag_register_handler(uint8_t message_type, wireless_frag_handler_f fn, void *ctx) {
+	if (message_type >= ARRAY_SIZE(wireless_frag.handlers)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	wireless_frag.handlers[message_type].fn = fn;
+	wireless_frag.handlers[message_type].ctx = ctx;
+	return ESP_OK;
+}
+
+/*
+ * Splits a message of up to WIRELESS_FRAG_MAX_MESSAGE_SIZE bytes into
+ * fragments and queues them for broadcast. Its first byte is the message
+ * type used to find the handler on the receiving side. Messages are
+ * queued as a whole or not at all, ESP_ERR_NO_MEM if the TX queue can not
+ * take all fragments.
+ */
+esp_err_t wireless_frag_send(const void *data, size_t len, wireless_tx_priority_t priority) {
+	if (!len || len > WIRELESS_FRAG_MAX_MESSAGE_SIZE) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	unsigned int num_fragments = DIV_ROUND_UP(len, FRAG_MAX_PAYLOAD_SIZE);
+	if (wireless_tx_get_free_slots() < num_fragments) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	const uint8_t *data8 = data;
+	wireless_frag_packet_t packet = {
+		.hdr = {
+			.packet_type = WIRELESS_PACKET_TYPE_FRAGMENT,
+			.message_id = wireless_frag.tx_message_id++,
+			.num_fragments = num_fragments,
+			.message_len = len
+		}
+	};
+	for (unsigned int i = 0; i < packet.hdr.num_fragments; i++) {
+		size_t offset = i * FRAG_MAX_PAYLOAD_SIZE;
+		size_t payload_len = MIN(len - offset, FRAG_MAX_PAYLOAD_SIZE);
+		packet.hdr.fragment_index = i;
+		memcpy(packet.payload, &data8[offset], payload_len);
+		esp_err_t err = wireless_tx_queue(&packet, sizeof(packet.hdr) + payload_len, priority, 0, 1);
+		if (err) {
+			return err;
+		}
+	}
+
+	wireless_frag.stats.messages_sent++;
+	return ESP_OK;
+}
+
+void wireless_frag_get_stats(wireless_frag_stats_t *stats) {
+	*stats = wireless_frag.stats;
+}
+
+void wireless_frag_print_stats(void) {
+	const wireless_frag_stats_t *stats = &wireless_frag.stats;
+	printf("Fragmented messages sent: %lu\r\n", (unsigned long)stats->messages_sent);
+	printf("Fragmented messages reassembled: %lu\r\n", (unsigned long)stats->messages_reassembled);
+	printf("Fragments received: %lu (%lu duplicate, %lu invalid)\r\n",
+	       (unsigned long)stats->fragments_received,
+	       (unsigned long)stats->fragments_duplicate,
+	       (unsigned long)stats->fragments_invalid);
+	printf("Partial messages timed out: %lu, evicted: %lu\r\n",
+	       (unsigned long)stats->messages_timed_out,
+	       (unsigned long)stats->messages_evicted);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include "wireless.h"
+#include "wireless_tx.h"
+
+#define WIRELESS_FRAG_MAX_MESSAGE_SIZE		1024
+#define WIRELESS_FRAG_NUM_REASSEMBLY_BUFFERS	4
+#define WIRELESS_FRAG_REASSEMBLY_TIMEOUT_MS	2000
+
+/*
+ * Called with a fully reassembled message. The first byte of data is the
+ * message type the handler was registered for.
+ */
+typedef esp_err_t (*wireless_frag_handler_f)(const uint8_t *src_addr, const uint8_t *data, size_t len, void *ctx);
+
+typedef struct wireless_frag_stats {
+	uint32_t messages_sent;
+	uint32_t messages_reassembled;
+	uint32_t fragments_received;
+	uint32_t fragments_duplicate;
+	uint32_t fragments_invalid;
+	uint32_t messages_timed_out;
+	uint32_t messages_evicted;
+} wireless_frag_stats_t;
+
+void wireless_frag_init(void);
+esp_err_t wireless_frag_register_handler(uint8_t message_type, wireless_frag_handler_f fn, void *ctx);
+esp_err_t wireless_frag_send(const void *data, size_t len, wireless_tx_priority_t priority);
+void wireless_frag_get_stats(wireless_frag_stats_t *stats);
+void wireless_frag_print_stats(void);
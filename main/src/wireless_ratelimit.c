@@ -0,0 +1,119 @@
+#include "wireless_ratelimit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_mac.h>
+#include <esp_timer.h>
+
+#include "util.h"
+
+/*
+ * Token buckets in their GCRA form: instead of a token count each bucket
+ * stores the time at which it would be full again. A packet is admitted
+ * if that time is at most burst intervals in the future, admitting it
+ * pushes the time out by one interval.
+ */
+#define SOURCE_INTERVAL_US		(1000000 / 100)
+#define SOURCE_BURST			40
+#define TYPE_REALTIME_INTERVAL_US	(1000000 / 60)
+#define TYPE_REALTIME_BURST		20
+#define TYPE_BULK_INTERVAL_US		(1000000 / 20)
+#define TYPE_BULK_BURST			10
+#define REALTIME_SOURCE_HOLD_US		(10 * 1000000)
+
+static wireless_ratelimit_source_t sources[WIRELESS_RATELIMIT_NUM_SOURCES] = { 0 };
+
+static bool bucket_admit(int64_t *tat_us, int64_t interval_us, unsigned int burst, int64_t now_us) {
+	int64_t tat = MAX(*tat_us, now_us);
+	if (tat - now_us > interval_us * (burst - 1)) {
+		return false;
+	}
+	*tat_us = tat + interval_us;
+	return true;
+}
+
+/*
+ * Sources that do not fit the table replace the one seen least recently.
+ * A replaced source starts over with full buckets, so with more active
+ * senders than table entries limiting only becomes more lenient.
+ */
+static wireless_ratelimit_source_t *find_source(const uint8_t *address) {
+	wireless_ratelimit_source_t *oldest = &sources[0];
+	for (int i = 0; i < ARRAY_SIZE(sources); i++) {
+		wireless_ratelimit_source_t *source = &sources[i];
+		if (source->used && !memcmp(source->address, address, sizeof(source->address))) {
+			return source;
+		}
+		if (!source->used ||
+		    (oldest->used && source->last_seen_us < oldest->last_seen_us)) {
+			oldest = source;
+		}
+	}
+
+	memset(oldest, 0, sizeof(*oldest));
+	memcpy(oldest->address, address, sizeof(oldest->address));
+	oldest->used = true;
+	return oldest;
+}
+
+// Per source budget, checked before any crypto work
+bool wireless_ratelimit_admit(const uint8_t *address, int64_t now_us, wireless_ratelimit_source_t **source_out) {
+	wireless_ratelimit_source_t *source = find_source(address);
+	source->last_seen_us = now_us;
+	*source_out = source;
+	if (!bucket_admit(&source->source_tat_us, SOURCE_INTERVAL_US, SOURCE_BURST, now_us)) {
+		source->packets_dropped_source++;
+		source->last_drop_us = now_us;
+		return false;
+	}
+	return true;
+}
+
+// Per packet type budget, checked once the packet type is known
+bool wireless_ratelimit_admit_type(wireless_ratelimit_source_t *source, uint8_t packet_type, bool realtime, int64_t now_us) {
+	int64_t *tat_us = &source->type_tat_us[MIN(packet_type, WIRELESS_NUM_PACKET_TYPES)];
+	bool admitted = realtime ?
+		bucket_admit(tat_us, TYPE_REALTIME_INTERVAL_US, TYPE_REALTIME_BURST, now_us) :
+		bucket_admit(tat_us, TYPE_BULK_INTERVAL_US, TYPE_BULK_BURST, now_us);
+	if (!admitted) {
+		source->packets_dropped_type++;
+		source->last_drop_us = now_us;
+		return false;
+	}
+	source->packets_admitted++;
+	if (realtime) {
+		source->last_realtime_us = now_us;
+	}
+	return true;
+}
+
+/*
+ * Sources that sent admitted realtime packets recently. Lets the receive
+ * path pick a buffer class for a frame that is neither authenticated nor
+ * decrypted yet.
+ */
+bool wireless_ratelimit_is_realtime_source(const wireless_ratelimit_source_t *source, int64_t now_us) {
+	return source->last_realtime_us && now_us - source->last_realtime_us < REALTIME_SOURCE_HOLD_US;
+}
+
+void wireless_ratelimit_print_offenders(void) {
+	int64_t now = esp_timer_get_time();
+	unsigned int num_offenders = 0;
+	printf("Address             Admitted   Dropped (source) Dropped (type) Last drop\r\n");
+	printf("==========================================================================\r\n");
+	for (int i = 0; i < ARRAY_SIZE(sources); i++) {
+		const wireless_ratelimit_source_t *source = &sources[i];
+		if (!source->used || !(source->packets_dropped_source || source->packets_dropped_type)) {
+			continue;
+		}
+		printf(MACSTR"   %-10lu %-16lu %-14lu %lldms ago\r\n",
+		       MAC2STR(source->address),
+		       (unsigned long)source->packets_admitted,
+		       (unsigned long)source->packets_dropped_source,
+		       (unsigned long)source->packets_dropped_type,
+		       (long long)(now - source->last_drop_us) / 1000LL);
+		num_offenders++;
+	}
+	printf("%u offenders\r\n", num_offenders);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_now.h>
+
+#include "wireless.h"
+
+// Room for a large group, the tests model groups of 100 nodes
+#define WIRELESS_RATELIMIT_NUM_SOURCES	128
+
+typedef struct wireless_ratelimit_source {
+	uint8_t address[ESP_NOW_ETH_ALEN];
+	bool used;
+	int64_t last_seen_us;
+	int64_t last_drop_us;
+	// Last authenticated realtime packet, classifies frames before decryption
+	int64_t last_realtime_us;
+	// Theoretical arrival times, see wireless_ratelimit.c
+	int64_t source_tat_us;
+	int64_t type_tat_us[WIRELESS_NUM_PACKET_TYPES + 1];
+	uint32_t packets_admitted;
+	uint32_t packets_dropped_source;
+	uint32_t packets_dropped_type;
+} wireless_ratelimit_source_t;
+
+/* WiFi task only */
+bool wireless_ratelimit_admit(const uint8_t *address, int64_t now_us, wireless_ratelimit_source_t **source);
+bool wireless_ratelimit_admit_type(wireless_ratelimit_source_t *source, uint8_t packet_type, bool realtime, int64_t now_us);
+bool wireless_ratelimit_is_realtime_source(const wireless_ratelimit_source_t *source, int64_t now_us);
+
+void wireless_ratelimit_print_offenders(void);
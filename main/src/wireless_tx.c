@@ -0,0 +1,297 @@
+#include "wireless_tx.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#include "scheduler.h"
+#include "util.h"
+
+// Minimum spacing between any two paced packets
+#define TX_MIN_GAP_US		MS_TO_US(2)
+// Minimum spacing between paced packets of the same type, including repeats
+#define TX_TYPE_INTERVAL_US	MS_TO_US(20)
+// Random extra delay for repeats, avoids lockstep with other nodes
+#define TX_JITTER_US		MS_TO_US(10)
+
+typedef struct wireless_tx_entry {
+	bool used;
+	uint8_t packet_type;
+	wireless_tx_priority_t priority;
+	unsigned int flags;
+	unsigned int repeats;
+	uint32_t seq;
+	int64_t not_before_us;
+	size_t len;
+	uint8_t data[WIRELESS_MAX_PACKET_SIZE];
+} wireless_tx_entry_t;
+
+typedef struct wireless_tx {
+	wireless_tx_entry_t entries[WIRELESS_TX_QUEUE_SIZE];
+	uint32_t seq;
+	int64_t timestamp_last_tx_us;
+	int64_t timestamp_last_tx_type_us[WIRELESS_NUM_PACKET_TYPES + 1];
+	scheduler_task_t pump_task;
+	bool aggregation_enabled;
+	wireless_tx_stats_t stats;
+} wireless_tx_t;
+
+static const char *TAG = "wireless_tx";
+
+static wireless_tx_t wireless_tx = { 0 };
+
+static unsigned int type_idx(uint8_t packet_type) {
+	return MIN(packet_type, WIRELESS_NUM_PACKET_TYPES);
+}
+
+static int64_t get_eligible_time(const wireless_tx_entry_t *entry) {
+	int64_t eligible_us = entry->not_before_us;
+	if (entry->priority != WIRELESS_TX_PRIORITY_REALTIME) {
+		eligible_us = MAX(eligible_us, wireless_tx.timestamp_last_tx_us + TX_MIN_GAP_US);
+		eligible_us = MAX(eligible_us,
+				  wireless_tx.timestamp_last_tx_type_us[type_idx(entry->packet_type)] + TX_TYPE_INTERVAL_US);
+	}
+	return eligible_us;
+}
+
+static bool entry_before(const wireless_tx_entry_t *a, const wireless_tx_entry_t *b) {
+	if (a->priority != b->priority) {
+		return a->priority < b->priority;
+	}
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static wireless_tx_entry_t *find_next_entry(int64_t now) {
+	wireless_tx_entry_t *next = NULL;
+	for (int i = 0; i < ARRAY_SIZE(wireless_tx.entries); i++) {
+		wireless_tx_entry_t *entry = &wireless_tx.entries[i];
+		if (entry->used && get_eligible_time(entry) <= now &&
+		    (!next || entry_before(entry, next))) {
+			next = entry;
+		}
+	}
+	return next;
+}
+
+static void complete_entry(wireless_tx_entry_t *entry, int64_t now) {
+	wireless_tx.timestamp_last_tx_us = now;
+	wireless_tx.timestamp_last_tx_type_us[type_idx(entry->packet_type)] = now;
+
+	if (entry->repeats > 1) {
+		entry->repeats--;
+		entry->not_before_us = now + TX_TYPE_INTERVAL_US + esp_random() % TX_JITTER_US;
+	} else {
+		entry->used = false;
+		wireless_tx.stats.queue_depth--;
+	}
+}
+
+static void send_entry(wireless_tx_entry_t *entry, int64_t now) {
+	esp_err_t err = wireless_broadcast(entry->data, entry->len);
+	if (err) {
+		ESP_LOGD(TAG, "Failed to send packet type %u: %d", entry->packet_type, err);
+		wireless_tx.stats.send_errors++;
+	} else {
+		wireless_tx.stats.packets_sent++;
+	}
+	complete_entry(entry, now);
+}
+
+static size_t aggregate_entry_size(const wireless_tx_entry_t *entry) {
+	// Type and length header plus the payload following the type byte
+	return 2 + entry->len - 1;
+}
+
+/*
+ * Packs first and as many further eligible paced packets as fit into a
+ * single aggregate frame of type/length/value sub-messages. Packets
+ * taken for the frame are parked until it has been sent.
+ */
+static void send_aggregate(wireless_tx_entry_t *first, int64_t now) {
+	wireless_tx_entry_t *batch[WIRELESS_TX_QUEUE_SIZE];
+	unsigned int batch_len = 0;
+	uint8_t frame[WIRELESS_MAX_PACKET_SIZE];
+	size_t frame_len = 0;
+
+	frame[frame_len++] = WIRELESS_PACKET_TYPE_AGGREGATE;
+	wireless_tx_entry_t *entry = first;
+	while (entry && entry->priority != WIRELESS_TX_PRIORITY_REALTIME &&
+	       frame_len + aggregate_entry_size(entry) <= sizeof(frame)) {
+		frame[frame_len++] = entry->packet_type;
+		frame[frame_len++] = entry->len - 1;
+		memcpy(&frame[frame_len], &entry->data[1], entry->len - 1);
+		frame_len += entry->len - 1;
+		entry->not_before_us = INT64_MAX;
+		batch[batch_len++] = entry;
+		entry = find_next_entry(now);
+	}
+
+	if (batch_len < 2) {
+		send_entry(first, now);
+		return;
+	}
+
+	esp_err_t err = wireless_broadcast(frame, frame_len);
+	if (err) {
+		ESP_LOGD(TAG, "Failed to send aggregate of %u packets: %d", batch_len, err);
+		wireless_tx.stats.send_errors++;
+	} else {
+		wireless_tx.stats.packets_sent += batch_len;
+		wireless_tx.stats.packets_aggregated += batch_len;
+		wireless_tx.stats.aggregate_frames_sent++;
+	}
+	for (int i = 0; i < batch_len; i++) {
+		complete_entry(batch[i], now);
+	}
+}
+
+static void wireless_tx_pump(void *arg) {
+	int64_t now = esp_timer_get_time();
+	wireless_tx_entry_t *entry;
+	while ((entry = find_next_entry(now))) {
+		if (wireless_tx.aggregation_enabled && entry->priority != WIRELESS_TX_PRIORITY_REALTIME) {
+			send_aggregate(entry, now);
+		} else {
+			send_entry(entry, now);
+		}
+	}
+
+	int64_t next_tx_us = INT64_MAX;
+	for (int i = 0; i < ARRAY_SIZE(wireless_tx.entries); i++) {
+		const wireless_tx_entry_t *entry = &wireless_tx.entries[i];
+		if (entry->used) {
+			next_tx_us = MIN(next_tx_us, get_eligible_time(entry));
+		}
+	}
+	if (next_tx_us != INT64_MAX) {
+		scheduler_schedule_task(&wireless_tx.pump_task, wireless_tx_pump, NULL, next_tx_us);
+	} else {
+		scheduler_cancel(&wireless_tx.pump_task);
+	}
+}
+
+void wireless_tx_init(void) {
+	// Nothing has been sent yet, the first packet of each type may go out right away
+	wireless_tx.timestamp_last_tx_us = -TX_MIN_GAP_US;
+	for (int i = 0; i < ARRAY_SIZE(wireless_tx.timestamp_last_tx_type_us); i++) {
+		wireless_tx.timestamp_last_tx_type_us[i] = -TX_TYPE_INTERVAL_US;
+	}
+	scheduler_task_init(&wireless_tx.pump_task, "wireless_tx");
+}
+
+static wireless_tx_entry_t *find_superseded_entry(uint8_t packet_type) {
+	for (int i = 0; i < ARRAY_SIZE(wireless_tx.entries); i++) {
+		wireless_tx_entry_t *entry = &wireless_tx.entries[i];
+		if (entry->used && (entry->flags & WIRELESS_TX_FLAG_SUPERSEDE) &&
+		    entry->packet_type == packet_type) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// Free slot or, if the queue is full, the newest entry of lower priority
+static wireless_tx_entry_t *alloc_entry(wireless_tx_priority_t priority) {
+	wireless_tx_entry_t *victim = NULL;
+	for (int i = 0; i < ARRAY_SIZE(wireless_tx.entries); i++) {
+		wireless_tx_entry_t *entry = &wireless_tx.entries[i];
+		if (!entry->used) {
+			wireless_tx.stats.queue_depth++;
+			wireless_tx.stats.queue_depth_max = MAX(wireless_tx.stats.queue_depth_max,
+								wireless_tx.stats.queue_depth);
+			return entry;
+		}
+		if (entry->priority > priority &&
+		    (!victim || entry->priority > victim->priority ||
+		     (entry->priority == victim->priority && entry_before(victim, entry)))) {
+			victim = entry;
+		}
+	}
+
+	if (victim) {
+		wireless_tx.stats.packets_dropped++;
+	}
+	return victim;
+}
+
+/*
+ * Queues a packet for broadcast, sending it right away if pacing allows.
+ * Realtime packets are never delayed by pacing. Packets are sent repeats
+ * times, spaced by the per-type interval plus jitter. Main loop only,
+ * other tasks must hold main_loop_lock().
+ */
+esp_err_t wireless_tx_queue(const void *data, size_t len, wireless_tx_priority_t priority,
+			    unsigned int flags, unsigned int repeats) {
+	if (!len || len > WIRELESS_MAX_PACKET_SIZE || priority >= WIRELESS_TX_NUM_PRIORITIES) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	uint8_t packet_type = ((const uint8_t *)data)[0];
+	wireless_tx_entry_t *entry = NULL;
+	if (flags & WIRELESS_TX_FLAG_SUPERSEDE) {
+		entry = find_superseded_entry(packet_type);
+		if (entry) {
+			wireless_tx.stats.packets_coalesced++;
+			repeats = MAX(repeats, entry->repeats);
+		}
+	}
+	if (!entry) {
+		entry = alloc_entry(priority);
+		if (!entry) {
+			wireless_tx.stats.packets_dropped++;
+			return ESP_ERR_NO_MEM;
+		}
+		entry->seq = wireless_tx.seq++;
+		entry->not_before_us = 0;
+	}
+
+	entry->used = true;
+	entry->packet_type = packet_type;
+	entry->priority = priority;
+	entry->flags = flags;
+	entry->repeats = MAX(repeats, 1);
+	entry->len = len;
+	memcpy(entry->data, data, len);
+	wireless_tx.stats.packets_queued++;
+
+	if (wireless_tx.aggregation_enabled && priority != WIRELESS_TX_PRIORITY_REALTIME) {
+		// Defer to the next scheduler pass to collect the packets queued in this one
+		scheduler_schedule_task(&wireless_tx.pump_task, wireless_tx_pump, NULL, esp_timer_get_time());
+	} else {
+		wireless_tx_pump(NULL);
+	}
+	return ESP_OK;
+}
+
+// Packets that can be queued without dropping any queued packet
+unsigned int wireless_tx_get_free_slots(void) {
+	return WIRELESS_TX_QUEUE_SIZE - wireless_tx.stats.queue_depth;
+}
+
+/*
+ * Aggregate frames are only understood by nodes with aggregation support,
+ * enable once the whole group runs such firmware.
+ */
+void wireless_tx_set_aggregation_enable(bool enable) {
+	wireless_tx.aggregation_enabled = enable;
+}
+
+void wireless_tx_get_stats(wireless_tx_stats_t *stats) {
+	*stats = wireless_tx.stats;
+}
+
+void wireless_tx_print_stats(void) {
+	const wireless_tx_stats_t *stats = &wireless_tx.stats;
+	printf("TX queued: %lu\r\n", (unsigned long)stats->packets_queued);
+	printf("TX sent: %lu\r\n", (unsigned long)stats->packets_sent);
+	printf("TX dropped: %lu\r\n", (unsigned long)stats->packets_dropped);
+	printf("TX coalesced: %lu\r\n", (unsigned long)stats->packets_coalesced);
+	printf("TX send errors: %lu\r\n", (unsigned long)stats->send_errors);
+	printf("TX aggregated: %lu packets in %lu frames\r\n",
+	       (unsigned long)stats->packets_aggregated, (unsigned long)stats->aggregate_frames_sent);
+	printf("TX queue depth: %u (max %u)\r\n", stats->queue_depth, stats->queue_depth_max);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include "wireless.h"
+
+#define WIRELESS_TX_QUEUE_SIZE	16
+
+// Replace a queued packet of the same type that was queued with this flag, too
+#define WIRELESS_TX_FLAG_SUPERSEDE	(1 << 0)
+
+typedef enum wireless_tx_priority {
+	// Timestamped and latency sensitive, never paced
+	WIRELESS_TX_PRIORITY_REALTIME = 0,
+	WIRELESS_TX_PRIORITY_NORMAL,
+	WIRELESS_TX_PRIORITY_BULK,
+	WIRELESS_TX_NUM_PRIORITIES
+} wireless_tx_priority_t;
+
+typedef struct wireless_tx_stats {
+	uint32_t packets_queued;
+	uint32_t packets_sent;
+	uint32_t packets_dropped;
+	uint32_t packets_coalesced;
+	uint32_t send_errors;
+	uint32_t packets_aggregated;
+	uint32_t aggregate_frames_sent;
+	unsigned int queue_depth;
+	unsigned int queue_depth_max;
+} wireless_tx_stats_t;
+
+void wireless_tx_init(void);
+esp_err_t wireless_tx_queue(const void *data, size_t len, wireless_tx_priority_t priority,
+			    unsigned int flags, unsigned int repeats);
+unsigned int wireless_tx_get_free_slots(void);
+void wireless_tx_set_aggregation_enable(bool enable);
+void wireless_tx_get_stats(wireless_tx_stats_t *stats);
+void wireless_tx_print_stats(void);
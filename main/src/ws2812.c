@@ -0,0 +1,67 @@
+#include <stdbool.h>
+
+#include "ws2812.h"
+
+static uint32_t symbol_table[256];
+
+static uint32_t encode_byte(uint8_t val) {
+	uint32_t symbols = 0;
+	for (int i = 0; i < 8; i++) {
+		bool bit = !!(val & (1 << (7 - i)));
+		symbols |= (uint32_t)(bit ? WS2812_SYMBOL_ONE : WS2812_SYMBOL_ZERO) << (i * WS2812_BITS_PER_SYMBOL);
+	}
+	return symbols;
+}
+
+void ws2812_init(void) {
+	for (int i = 0; i < 256; i++) {
+		symbol_table[i] = encode_byte(i);
+	}
+}
+
+/*
+ * Writes the symbols for one LED to dst. dst must be word aligned,
+ * returns a pointer to the first word after the LED.
+ */
+uint32_t *ws2812_encode(uint32_t *dst, uint8_t r, uint8_t g, uint8_t b) {
+	dst[0] = symbol_table[g];
+	dst[1] = symbol_table[r];
+	dst[2] = symbol_table[b];
+	return dst + WS2812_WORDS_PER_LED;
+}
+
+static int decode_byte(const uint8_t *src) {
+	uint8_t val = 0;
+	for (int i = 0; i < 8; i++) {
+		uint8_t symbol = src[i / 2] >> ((i % 2) * WS2812_BITS_PER_SYMBOL) & 0xf;
+		val <<= 1;
+		if (symbol == WS2812_SYMBOL_ONE) {
+			val |= 1;
+		} else if (symbol != WS2812_SYMBOL_ZERO) {
+			return -1;
+		}
+	}
+	return val;
+}
+
+/*
+ * Decodes up to num_leds GRB triplets from an encoded SPI buffer.
+ * Does not depend on the encoding table, so it can be used to check the
+ * encoder. Returns the number of LEDs decoded or -1 on an invalid symbol.
+ */
+ssize_t ws2812_decode(const uint8_t *src, size_t len, uint8_t *grb, size_t num_leds) {
+	size_t decoded = 0;
+	while (decoded < num_leds && len >= WS2812_BYTES_PER_LED) {
+		for (int i = 0; i < 3; i++) {
+			int val = decode_byte(src);
+			if (val < 0) {
+				return -1;
+			}
+			*grb++ = val;
+			src += sizeof(uint32_t);
+		}
+		len -= WS2812_BYTES_PER_LED;
+		decoded++;
+	}
+	return decoded;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// WS2812 bits are sent as 4 bit SPI symbols at 3MHz, LSB first
+#define WS2812_BITS_PER_SYMBOL	4
+#define WS2812_SYMBOL_ZERO	0b0001
+#define WS2812_SYMBOL_ONE	0b0111
+
+// Each LED takes 3 color bytes, each color byte expands to one 32 bit word
+#define WS2812_WORDS_PER_LED	3
+#define WS2812_BYTES_PER_LED	(WS2812_WORDS_PER_LED * sizeof(uint32_t))
+
+void ws2812_init(void);
+uint32_t *ws2812_encode(uint32_t *dst, uint8_t r, uint8_t g, uint8_t b);
+ssize_t ws2812_decode(const uint8_t *src, size_t len, uint8_t *grb, size_t num_leds);
@@ -0,0 +1,45 @@
+/*
+ * Mock clock and single task scheduler. Tasks run only from
+ * mock_scheduler_run_until(), never on their own.
+ */
+#include <stdint.h>
+
+#include <esp_timer.h>
+
+#include "mock_scheduler.h"
+#include "scheduler.h"
+#include "util.h"
+
+int64_t mock_now_us;
+
+static scheduler_task_t *scheduled_task;
+static scheduler_cb_f scheduled_cb;
+static void *scheduled_ctx;
+
+int64_t esp_timer_get_time(void) {
+	return mock_now_us;
+}
+
+void scheduler_task_init(scheduler_task_t *task, const char *name) {
+	task->deadline_us = INT64_MAX;
+}
+
+void scheduler_schedule_task(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t deadline_us) {
+	task->deadline_us = deadline_us;
+	scheduled_task = task;
+	scheduled_cb = cb;
+	scheduled_ctx = ctx;
+}
+
+void scheduler_cancel(scheduler_task_t *task) {
+	task->deadline_us = INT64_MAX;
+}
+
+void mock_scheduler_run_until(int64_t end_us) {
+	while (scheduled_task && scheduled_task->deadline_us <= end_us) {
+		mock_now_us = MAX(mock_now_us, scheduled_task->deadline_us);
+		scheduled_task->deadline_us = INT64_MAX;
+		scheduled_cb(scheduled_ctx);
+	}
+	mock_now_us = end_us;
+}
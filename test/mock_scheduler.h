@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Clock returned by esp_timer_get_time()
+extern int64_t mock_now_us;
+
+/*
+ * Runs the most recently scheduled task whenever it is due, like
+ * scheduler_run() would, then advances the clock to end_us. Enough for
+ * modules with a single task.
+ */
+void mock_scheduler_run_until(int64_t end_us);
@@ -0,0 +1,129 @@
+/*
+ * Plain SHA-1 (FIPS 180-4) behind the mbedtls API, standing in for the
+ * hardware accelerated mbedtls of ESP-IDF in host tests.
+ */
+#include <string.h>
+
+#include <mbedtls/sha1.h>
+
+#define ROL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static uint32_t load_be32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void sha1_block(mbedtls_sha1_context *ctx, const unsigned char *block) {
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++) {
+		w[i] = load_be32(&block[i * 4]);
+	}
+	for (int i = 16; i < 80; i++) {
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+
+	uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3], e = ctx->state[4];
+	for (int i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		uint32_t tmp = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL32(b, 30);
+		b = a;
+		a = tmp;
+	}
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+}
+
+void mbedtls_sha1_init(mbedtls_sha1_context *ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha1_free(mbedtls_sha1_context *ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha1_clone(mbedtls_sha1_context *dst, const mbedtls_sha1_context *src) {
+	*dst = *src;
+}
+
+int mbedtls_sha1_starts(mbedtls_sha1_context *ctx) {
+	static const uint32_t initial_state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	ctx->total[0] = 0;
+	ctx->total[1] = 0;
+	memcpy(ctx->state, initial_state, sizeof(ctx->state));
+	return 0;
+}
+
+int mbedtls_sha1_update(mbedtls_sha1_context *ctx, const unsigned char *input, size_t ilen) {
+	size_t fill = ctx->total[0] % 64;
+	uint32_t total = ctx->total[0] + ilen;
+	ctx->total[1] += total < ctx->total[0];
+	ctx->total[0] = total;
+
+	if (fill && ilen >= 64 - fill) {
+		memcpy(&ctx->buffer[fill], input, 64 - fill);
+		sha1_block(ctx, ctx->buffer);
+		input += 64 - fill;
+		ilen -= 64 - fill;
+		fill = 0;
+	}
+	for (; ilen >= 64; ilen -= 64, input += 64) {
+		sha1_block(ctx, input);
+	}
+	memcpy(&ctx->buffer[fill], input, ilen);
+	return 0;
+}
+
+int mbedtls_sha1_finish(mbedtls_sha1_context *ctx, unsigned char output[20]) {
+	uint64_t bits = ((uint64_t)ctx->total[1] << 32 | ctx->total[0]) * 8;
+	size_t fill = ctx->total[0] % 64;
+	ctx->buffer[fill++] = 0x80;
+	if (fill > 56) {
+		memset(&ctx->buffer[fill], 0, 64 - fill);
+		sha1_block(ctx, ctx->buffer);
+		fill = 0;
+	}
+	memset(&ctx->buffer[fill], 0, 56 - fill);
+	store_be32(&ctx->buffer[56], bits >> 32);
+	store_be32(&ctx->buffer[60], bits);
+	sha1_block(ctx, ctx->buffer);
+
+	for (int i = 0; i < 5; i++) {
+		store_be32(&output[i * 4], ctx->state[i]);
+	}
+	return 0;
+}
+
+int mbedtls_sha1(const unsigned char *input, size_t ilen, unsigned char output[20]) {
+	mbedtls_sha1_context ctx;
+	mbedtls_sha1_init(&ctx);
+	mbedtls_sha1_starts(&ctx);
+	mbedtls_sha1_update(&ctx, input, ilen);
+	mbedtls_sha1_finish(&ctx, output);
+	mbedtls_sha1_free(&ctx);
+	return 0;
+}
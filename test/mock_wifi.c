@@ -0,0 +1,133 @@
+/*
+ * WiFi, netif, NVS and event loop that accept everything. Lets tests
+ * run wireless_init() and drive the ESP-NOW receive callback directly.
+ */
+#include <string.h>
+
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <nvs_flash.h>
+
+#include "mock_wifi.h"
+
+const uint8_t mock_wifi_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+esp_now_recv_cb_t mock_wifi_recv_cb;
+
+const uint8_t mock_wifi_key[32] asm("_binary_wireless_key_start") = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+
+static struct esp_netif_obj {
+	int index;
+} netifs[2] = { { 1 }, { 2 } };
+
+esp_err_t nvs_flash_init(void) {
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_netif_init(void) {
+	return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_ap(void) {
+	return &netifs[0];
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void) {
+	return &netifs[1];
+}
+
+int esp_netif_get_netif_impl_index(esp_netif_t *esp_netif) {
+	return esp_netif->index;
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+					      esp_event_handler_t event_handler, void *event_handler_arg,
+					      esp_event_handler_instance_t *instance) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_country(const wifi_country_t *country) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6]) {
+	memcpy(mac, mock_wifi_mac, sizeof(mock_wifi_mac));
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t ifx, wifi_config_t *conf) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number) {
+	*number = 0;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records) {
+	*number = 0;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_clear_ap_list(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_now_init(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer) {
+	return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+	mock_wifi_recv_cb = cb;
+	return ESP_OK;
+}
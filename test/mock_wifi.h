@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <esp_now.h>
+
+// Address wireless_init() reads as the local AP MAC, also the sender address of wireless_broadcast()
+extern const uint8_t mock_wifi_mac[6];
+// Default wireless key, embedded into the firmware on target
+extern const uint8_t mock_wifi_key[32] asm("_binary_wireless_key_start");
+// Receive callback registered by wireless_init()
+extern esp_now_recv_cb_t mock_wifi_recv_cb;
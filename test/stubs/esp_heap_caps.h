@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DMA		(1 << 3)
+#define MALLOC_CAP_INTERNAL	(1 << 11)
+
+void *heap_caps_malloc(size_t size, uint32_t caps);
@@ -0,0 +1,9 @@
+#pragma once
+
+// Logging is compiled out on the host
+#define ESP_LOG_NOP(tag, fmt, ...) do { (void)(tag); } while (0)
+#define ESP_LOGE ESP_LOG_NOP
+#define ESP_LOGW ESP_LOG_NOP
+#define ESP_LOGI ESP_LOG_NOP
+#define ESP_LOGD ESP_LOG_NOP
+#define ESP_LOGV ESP_LOG_NOP
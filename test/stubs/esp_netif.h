@@ -0,0 +1,10 @@
+#pragma once
+
+#include <esp_err.h>
+
+typedef struct esp_netif_obj esp_netif_t;
+
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_ap(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+int esp_netif_get_netif_impl_index(esp_netif_t *esp_netif);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_wifi_types.h>
+
+#define ESP_NOW_ETH_ALEN	6
+#define ESP_NOW_MAX_DATA_LEN	250
+
+typedef struct esp_now_recv_info {
+	uint8_t *src_addr;
+	uint8_t *des_addr;
+} esp_now_recv_info_t;
+
+typedef struct esp_now_peer_info {
+	uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+	uint8_t channel;
+	wifi_interface_t ifidx;
+	bool encrypt;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t *info, const uint8_t *data, int data_len);
+
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len);
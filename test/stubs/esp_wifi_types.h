@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	WIFI_IF_STA = 0,
+	WIFI_IF_AP
+} wifi_interface_t;
+
+typedef enum {
+	WIFI_MODE_NULL = 0,
+	WIFI_MODE_STA,
+	WIFI_MODE_AP,
+	WIFI_MODE_APSTA
+} wifi_mode_t;
+
+typedef enum {
+	WIFI_AUTH_OPEN = 0,
+	WIFI_AUTH_WPA2_PSK = 3
+} wifi_auth_mode_t;
+
+typedef enum {
+	WIFI_FAST_SCAN = 0,
+	WIFI_ALL_CHANNEL_SCAN
+} wifi_scan_method_t;
+
+typedef enum {
+	WIFI_SCAN_TYPE_ACTIVE = 0,
+	WIFI_SCAN_TYPE_PASSIVE
+} wifi_scan_type_t;
+
+typedef enum {
+	WIFI_SECOND_CHAN_NONE = 0
+} wifi_second_chan_t;
+
+typedef enum {
+	WIFI_STORAGE_FLASH = 0,
+	WIFI_STORAGE_RAM
+} wifi_storage_t;
+
+typedef enum {
+	WIFI_COUNTRY_POLICY_AUTO = 0,
+	WIFI_COUNTRY_POLICY_MANUAL
+} wifi_country_policy_t;
+
+typedef enum {
+	WIFI_EVENT_SCAN_DONE = 1,
+	WIFI_EVENT_STA_CONNECTED = 4,
+	WIFI_EVENT_STA_DISCONNECTED = 5
+} wifi_event_t;
+
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t ssid[33];
+	int8_t rssi;
+} wifi_ap_record_t;
+
+typedef struct {
+	char cc[3];
+	uint8_t schan;
+	uint8_t nchan;
+	wifi_country_policy_t policy;
+} wifi_country_t;
+
+typedef struct {
+	uint8_t channel;
+	wifi_scan_type_t scan_type;
+} wifi_scan_config_t;
+
+typedef union {
+	struct {
+		uint8_t ssid[32];
+		uint8_t password[64];
+		uint8_t channel;
+		wifi_auth_mode_t authmode;
+		uint8_t max_connection;
+		uint16_t beacon_interval;
+	} ap;
+	struct {
+		uint8_t ssid[32];
+		uint8_t password[64];
+		wifi_scan_method_t scan_method;
+		bool bssid_set;
+		uint8_t channel;
+	} sta;
+} wifi_config_t;
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host tests are single threaded, critical sections are no-ops
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	0
+#define taskENTER_CRITICAL(mux)		(void)(mux)
+#define taskEXIT_CRITICAL(mux)		(void)(mux)
+#define portMAX_DELAY			0xffffffffUL
+
+typedef uint32_t TickType_t;
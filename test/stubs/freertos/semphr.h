@@ -0,0 +1,19 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+typedef struct { int unused; } StaticSemaphore_t;
+
+// Host tests are single threaded, locks always succeed
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+	return buffer;
+}
+
+static inline int xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+	return 1;
+}
+
+static inline int xSemaphoreGive(SemaphoreHandle_t sem) {
+	return 1;
+}
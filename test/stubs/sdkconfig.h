@@ -0,0 +1,3 @@
+#pragma once
+
+#define CONFIG_BK_WLAN_CHANNEL 6
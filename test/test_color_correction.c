@@ -0,0 +1,354 @@
+/*
+ * Accuracy and throughput of the tetrahedral color correction. The
+ * firmware is checked against a floating point tetrahedral reference on
+ * random and smooth LUTs, the deviation from trilinear interpolation is
+ * reported for comparison.
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "color.h"
+#include "color_correction.h"
+#include "util.h"
+
+#include "test.h"
+
+#define NUM_SAMPLES		200000
+#define BENCH_CONVERSIONS	2000000
+
+/* Mocks */
+rgb16_t lut_16[16 * 16 * 16] asm("_binary_colorcal_16x16x16_12bit_bin_start");
+rgb16_t lut_32[32 * 32 * 32] asm("_binary_colorcal_32x32x32_12bit_bin_start");
+
+static unsigned int lut_size_setting = 16;
+
+unsigned int settings_get_color_correction_lut_size(unsigned int default_size) {
+	return lut_size_setting;
+}
+
+void settings_set_color_correction_lut_size(unsigned int size) {
+	lut_size_setting = size;
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t rand_u32(void) {
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+static uint16_t rand_u16(void) {
+	return (rand_u32() >> 4) & 0xffff;
+}
+
+static rgb16_t *lut_table(unsigned int n) {
+	return n == 16 ? lut_16 : lut_32;
+}
+
+static unsigned int lut_shift(unsigned int n) {
+	return n == 16 ? 12 : 11;
+}
+
+static uint16_t get_channel(const rgb16_t *color, int ch) {
+	return ch == 0 ? color->r : ch == 1 ? color->g : color->b;
+}
+
+static double table_channel(unsigned int n, const unsigned int *idx, int ch) {
+	// Same layout as the firmware, red varies fastest
+	const rgb16_t *entry = &lut_table(n)[(idx[1] * n + idx[2]) * n + idx[0]];
+	return get_channel(entry, ch);
+}
+
+// Grid cell and offset in cell units, extrapolating above the last grid point
+static void split(unsigned int n, const rgb16_t *in, unsigned int *idx, double *frac) {
+	unsigned int shift = lut_shift(n);
+	for (int i = 0; i < 3; i++) {
+		uint16_t val = get_channel(in, i);
+		idx[i] = MIN(val >> shift, n - 2);
+		frac[i] = (double)(val - (idx[i] << shift)) / (1 << shift);
+	}
+}
+
+static double clamp_output(double val) {
+	return MIN(MAX(val, 0), COLOR_CORRECTION_OUTPUT_MAX);
+}
+
+static double reference_tetrahedral(unsigned int n, const rgb16_t *in, int ch) {
+	unsigned int idx[3];
+	double frac[3];
+	split(n, in, idx, frac);
+
+	// Axes by decreasing offset
+	int order[3] = { 0, 1, 2 };
+	for (int i = 0; i < 3; i++) {
+		for (int j = i + 1; j < 3; j++) {
+			if (frac[order[j]] > frac[order[i]]) {
+				SWAP(order[i], order[j]);
+			}
+		}
+	}
+
+	unsigned int corner[3] = { idx[0], idx[1], idx[2] };
+	double prev = table_channel(n, corner, ch);
+	double val = prev;
+	for (int i = 0; i < 3; i++) {
+		corner[order[i]]++;
+		double next = table_channel(n, corner, ch);
+		val += (next - prev) * frac[order[i]];
+		prev = next;
+	}
+	return clamp_output(val);
+}
+
+static double reference_trilinear(unsigned int n, const rgb16_t *in, int ch) {
+	unsigned int idx[3];
+	double frac[3];
+	split(n, in, idx, frac);
+
+	double val = 0;
+	for (int corner = 0; corner < 8; corner++) {
+		unsigned int pos[3];
+		double weight = 1;
+		for (int i = 0; i < 3; i++) {
+			bool upper = corner & (1 << i);
+			pos[i] = idx[i] + upper;
+			weight *= upper ? frac[i] : 1 - frac[i];
+		}
+		val += weight * table_channel(n, pos, ch);
+	}
+	return clamp_output(val);
+}
+
+static void fill_random(unsigned int n) {
+	rgb16_t *table = lut_table(n);
+	for (unsigned int i = 0; i < n * n * n; i++) {
+		table[i].r = rand_u32() % (COLOR_CORRECTION_OUTPUT_MAX + 1);
+		table[i].g = rand_u32() % (COLOR_CORRECTION_OUTPUT_MAX + 1);
+		table[i].b = rand_u32() % (COLOR_CORRECTION_OUTPUT_MAX + 1);
+	}
+}
+
+// Gamma curve with some crosstalk between channels, like a real calibration
+static void fill_smooth(unsigned int n) {
+	rgb16_t *table = lut_table(n);
+	for (unsigned int g = 0; g < n; g++) {
+		for (unsigned int b = 0; b < n; b++) {
+			for (unsigned int r = 0; r < n; r++) {
+				double lr = pow((double)r / (n - 1), 2.2);
+				double lg = pow((double)g / (n - 1), 2.2);
+				double lb = pow((double)b / (n - 1), 2.2);
+				rgb16_t *entry = &table[(g * n + b) * n + r];
+				entry->r = lround(COLOR_CORRECTION_OUTPUT_MAX * (0.9 * lr + 0.1 * lg));
+				entry->g = lround(COLOR_CORRECTION_OUTPUT_MAX * (0.05 * lr + 0.85 * lg + 0.1 * lb));
+				entry->b = lround(COLOR_CORRECTION_OUTPUT_MAX * (0.1 * lg + 0.9 * lb));
+			}
+		}
+	}
+}
+
+typedef struct error_stats {
+	double max;
+	double total;
+	unsigned long count;
+} error_stats_t;
+
+static void add_error(error_stats_t *stats, double error) {
+	stats->max = MAX(stats->max, fabs(error));
+	stats->total += fabs(error);
+	stats->count++;
+}
+
+static void check_sample(unsigned int n, const rgb16_t *in, error_stats_t *tetrahedral, error_stats_t *trilinear) {
+	rgb16_t out;
+	color_correction_apply(in, &out);
+	for (int ch = 0; ch < 3; ch++) {
+		double val = get_channel(&out, ch);
+		add_error(tetrahedral, val - reference_tetrahedral(n, in, ch));
+		add_error(trilinear, val - reference_trilinear(n, in, ch));
+	}
+}
+
+// Returns the mean deviation from trilinear interpolation
+static double check_accuracy(const char *name, unsigned int n) {
+	CHECK_EQ(color_correction_set_lut_size(n), ESP_OK);
+	error_stats_t tetrahedral = { 0 };
+	error_stats_t trilinear = { 0 };
+
+	// Grid points are exact, including the last one
+	unsigned int shift = lut_shift(n);
+	for (unsigned int i = 0; i < n; i++) {
+		rgb16_t in = { i << shift, (n - 1 - i) << shift, ((i * 5) % n) << shift };
+		rgb16_t out;
+		color_correction_apply(&in, &out);
+		unsigned int idx[3] = { i, n - 1 - i, (i * 5) % n };
+		for (int ch = 0; ch < 3; ch++) {
+			CHECK_EQ(get_channel(&out, ch), table_channel(n, idx, ch));
+		}
+	}
+
+	for (unsigned int i = 0; i < NUM_SAMPLES; i++) {
+		rgb16_t in = { rand_u16(), rand_u16(), rand_u16() };
+		check_sample(n, &in, &tetrahedral, &trilinear);
+	}
+	// Corners of the input range, the top one extrapolates
+	for (unsigned int i = 0; i < 8; i++) {
+		rgb16_t in = { i & 1 ? 0xffff : 0, i & 2 ? 0xffff : 0, i & 4 ? 0xffff : 0 };
+		check_sample(n, &in, &tetrahedral, &trilinear);
+	}
+
+	printf("    %-12s %2u^3: max %.2f mean %.3f vs. tetrahedral, max %.1f mean %.2f vs. trilinear\n",
+	       name, n, tetrahedral.max, tetrahedral.total / tetrahedral.count,
+	       trilinear.max, trilinear.total / trilinear.count);
+	// Fixed point offsets are exact, only the final rounding remains
+	CHECK(tetrahedral.max <= 0.5);
+	return trilinear.total / trilinear.count;
+}
+
+static void test_random_lut(void) {
+	fill_random(16);
+	fill_random(32);
+	check_accuracy("random LUT", 16);
+	check_accuracy("random LUT", 32);
+}
+
+static void test_smooth_lut(void) {
+	fill_smooth(16);
+	fill_smooth(32);
+	CHECK(check_accuracy("smooth LUT", 16) < 1.0);
+	CHECK(check_accuracy("smooth LUT", 32) < 1.0);
+}
+
+static void test_extrapolation_clamps(void) {
+	// Linear ramp ending at the output limit, extrapolating past it must clamp
+	for (unsigned int g = 0; g < 16; g++) {
+		for (unsigned int b = 0; b < 16; b++) {
+			for (unsigned int r = 0; r < 16; r++) {
+				rgb16_t *entry = &lut_16[(g * 16 + b) * 16 + r];
+				entry->r = r * COLOR_CORRECTION_OUTPUT_MAX / 15;
+				entry->g = g * COLOR_CORRECTION_OUTPUT_MAX / 15;
+				entry->b = 0;
+			}
+		}
+	}
+	CHECK_EQ(color_correction_set_lut_size(16), ESP_OK);
+	rgb16_t in = { 0xffff, 15 << 12, 0xffff };
+	rgb16_t out;
+	color_correction_apply(&in, &out);
+	CHECK_EQ(out.r, COLOR_CORRECTION_OUTPUT_MAX);
+	CHECK_EQ(out.g, COLOR_CORRECTION_OUTPUT_MAX);
+	CHECK_EQ(out.b, 0);
+
+	// Below the top grid point the ramp is followed exactly
+	in = (rgb16_t){ 14 << 12, 7 << 12, 0 };
+	color_correction_apply(&in, &out);
+	CHECK_EQ(out.r, 14 * COLOR_CORRECTION_OUTPUT_MAX / 15);
+	CHECK_EQ(out.g, 7 * COLOR_CORRECTION_OUTPUT_MAX / 15);
+}
+
+// apply_color_correction_per_channel() as it was in main.c, for the benchmark
+#define REFERENCE_TABLE_SIZE	16UL
+#define REFERENCE_LOOKUP_DIV	((1 << 16) / REFERENCE_TABLE_SIZE)
+
+static void reference_lookup_color(const rgb16_t *in, rgb16_t *out) {
+	uint32_t idx = ((in->g * REFERENCE_TABLE_SIZE) + in->b) * REFERENCE_TABLE_SIZE + in->r;
+	*out = lut_16[idx];
+}
+
+static int32_t reference_neighbour(uint16_t ref, uint16_t min) {
+	return MIN(MAX((int)ref + (ref == min ? 1 : -1), 0), REFERENCE_TABLE_SIZE - 1);
+}
+
+static uint16_t reference_ref(uint16_t val) {
+	return MIN(val / REFERENCE_LOOKUP_DIV + DIV_ROUND(val % REFERENCE_LOOKUP_DIV, REFERENCE_LOOKUP_DIV),
+		   REFERENCE_TABLE_SIZE - 1);
+}
+
+static void reference_apply(const rgb16_t *in, rgb16_t *out) {
+	rgb16_t color_min_lookup = {
+		in->r / REFERENCE_LOOKUP_DIV, in->g / REFERENCE_LOOKUP_DIV, in->b / REFERENCE_LOOKUP_DIV
+	};
+	rgb16_t color_ref_lookup = { reference_ref(in->r), reference_ref(in->g), reference_ref(in->b) };
+	rgb16_t color_lookup_r = {
+		reference_neighbour(color_ref_lookup.r, color_min_lookup.r), color_ref_lookup.g, color_ref_lookup.b
+	};
+	rgb16_t color_lookup_g = {
+		color_ref_lookup.r, reference_neighbour(color_ref_lookup.g, color_min_lookup.g), color_ref_lookup.b
+	};
+	rgb16_t color_lookup_b = {
+		color_ref_lookup.r, color_ref_lookup.g, reference_neighbour(color_ref_lookup.b, color_min_lookup.b)
+	};
+	rgb16_t color_ref = {
+		color_ref_lookup.r * REFERENCE_LOOKUP_DIV,
+		color_ref_lookup.g * REFERENCE_LOOKUP_DIV,
+		color_ref_lookup.b * REFERENCE_LOOKUP_DIV
+	};
+	rgb16_t color_max = {
+		color_lookup_r.r * REFERENCE_LOOKUP_DIV,
+		color_lookup_g.g * REFERENCE_LOOKUP_DIV,
+		color_lookup_b.b * REFERENCE_LOOKUP_DIV
+	};
+	rgb16_t ref, cr, cg, cb;
+	reference_lookup_color(&color_ref_lookup, &ref);
+	reference_lookup_color(&color_lookup_r, &cr);
+	reference_lookup_color(&color_lookup_g, &cg);
+	reference_lookup_color(&color_lookup_b, &cb);
+
+	int32_t delta_in[3] = {
+		(int32_t)in->r - color_ref.r, (int32_t)in->g - color_ref.g, (int32_t)in->b - color_ref.b
+	};
+	int32_t delta_ref[3] = {
+		(int32_t)color_max.r - color_ref.r, (int32_t)color_max.g - color_ref.g, (int32_t)color_max.b - color_ref.b
+	};
+	const rgb16_t *corrected[3] = { &cr, &cg, &cb };
+	rgb16_t color_out = ref;
+	for (int i = 0; i < 3; i++) {
+		if (delta_ref[i]) {
+			color_out.r += DIV_ROUND(((int32_t)corrected[i]->r - ref.r) * delta_in[i], delta_ref[i]);
+			color_out.g += DIV_ROUND(((int32_t)corrected[i]->g - ref.g) * delta_in[i], delta_ref[i]);
+			color_out.b += DIV_ROUND(((int32_t)corrected[i]->b - ref.b) * delta_in[i], delta_ref[i]);
+		}
+	}
+	*out = color_out;
+}
+
+typedef void (*apply_f)(const rgb16_t *in, rgb16_t *out);
+
+static rgb16_t bench_inputs[4096];
+
+static double bench(apply_f apply) {
+	uint32_t checksum = 0;
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < BENCH_CONVERSIONS; i++) {
+		rgb16_t out;
+		apply(&bench_inputs[i % ARRAY_SIZE(bench_inputs)], &out);
+		checksum += out.r + out.g + out.b;
+	}
+	int64_t elapsed_ns = test_get_time_ns() - start_ns;
+	__asm__ volatile("" : : "r"(checksum));
+	return BENCH_CONVERSIONS * 1e9 / elapsed_ns;
+}
+
+static void test_benchmark(void) {
+	fill_smooth(16);
+	fill_smooth(32);
+	for (int i = 0; i < ARRAY_SIZE(bench_inputs); i++) {
+		bench_inputs[i] = (rgb16_t){ rand_u16(), rand_u16(), rand_u16() };
+	}
+	printf("    per-channel (old) 16^3: %6.1f M conversions/s\n", bench(reference_apply) / 1e6);
+	CHECK_EQ(color_correction_set_lut_size(16), ESP_OK);
+	printf("    tetrahedral       16^3: %6.1f M conversions/s\n", bench(color_correction_apply) / 1e6);
+	CHECK_EQ(color_correction_set_lut_size(32), ESP_OK);
+	printf("    tetrahedral       32^3: %6.1f M conversions/s\n", bench(color_correction_apply) / 1e6);
+}
+
+int main(void) {
+	color_correction_init();
+	CHECK_EQ(color_correction_get_lut_size(), 16);
+	TEST_RUN(test_random_lut);
+	TEST_RUN(test_smooth_lut);
+	TEST_RUN(test_extrapolation_clamps);
+	TEST_RUN(test_benchmark);
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Checks ChaCha20 and Poly1305 against the RFC 8439 test vectors, the
+ * four block ChaCha20 path against the single block one, and measures
+ * ChaCha20 per packet cost.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chacha20.h"
+#include "poly1305.h"
+#include "util.h"
+
+#include "test.h"
+
+// Several four block batches plus a partial one
+#define MULTI_BLOCK_LEN		(9 * CHACHA20_BLOCK_SIZE + 17)
+#define BENCH_TOTAL_BYTES	(1 << 24)
+
+// RFC 8439 section 2.4.2
+static const uint8_t chacha20_key[CHACHA20_KEY_SIZE] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+static const uint8_t chacha20_nonce[12] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00
+};
+static const char chacha20_plaintext[] =
+	"Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+	"sunscreen would be it.";
+static const uint8_t chacha20_ciphertext[] = {
+	0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+	0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+	0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+	0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+	0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+	0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+	0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+	0x87, 0x4d
+};
+
+// RFC 8439 section 2.5.2
+static const uint8_t poly1305_key[POLY1305_KEY_SIZE] = {
+	0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+	0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+};
+static const char poly1305_message[] = "Cryptographic Forum Research Group";
+static const uint8_t poly1305_tag[POLY1305_TAG_SIZE] = {
+	0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9
+};
+
+#define PLAINTEXT_LEN	(sizeof(chacha20_plaintext) - 1)
+
+static void test_chacha20_vector(void) {
+	static_assert(PLAINTEXT_LEN == sizeof(chacha20_ciphertext));
+	uint8_t ciphertext[PLAINTEXT_LEN];
+	chacha20_ctx_t ctx;
+	chacha20_init(&ctx, chacha20_key, chacha20_nonce, 1);
+	chacha20_xor(&ctx, ciphertext, (const uint8_t *)chacha20_plaintext, PLAINTEXT_LEN);
+	CHECK(!memcmp(ciphertext, chacha20_ciphertext, sizeof(ciphertext)));
+
+	// Same result from the key state packed once
+	chacha20_key_t key_state;
+	chacha20_key_init(&key_state, chacha20_key);
+	chacha20_init_key(&ctx, &key_state, chacha20_nonce, 1);
+	chacha20_xor_inplace(&ctx, ciphertext, sizeof(ciphertext));
+	CHECK(!memcmp(ciphertext, chacha20_plaintext, sizeof(ciphertext)));
+}
+
+static void test_chacha20_split_calls(void) {
+	// Word-wise and multi-block paths must agree with byte-wise continuation
+	static const size_t splits[] = { 1, 3, 4, 7, 16, 63, 64, 65, 100 };
+	for (int i = 0; i < ARRAY_SIZE(splits); i++) {
+		uint8_t ciphertext[PLAINTEXT_LEN];
+		chacha20_ctx_t ctx;
+		chacha20_init(&ctx, chacha20_key, chacha20_nonce, 1);
+		size_t pos = 0;
+		while (pos < PLAINTEXT_LEN) {
+			size_t len = MIN(splits[i], PLAINTEXT_LEN - pos);
+			chacha20_xor(&ctx, &ciphertext[pos], (const uint8_t *)&chacha20_plaintext[pos], len);
+			pos += len;
+		}
+		CHECK(!memcmp(ciphertext, chacha20_ciphertext, sizeof(ciphertext)));
+	}
+}
+
+static void test_chacha20_unaligned(void) {
+	uint8_t src[PLAINTEXT_LEN + 3];
+	uint8_t dst[PLAINTEXT_LEN + 3];
+	memcpy(&src[1], chacha20_plaintext, PLAINTEXT_LEN);
+	chacha20_ctx_t ctx;
+	chacha20_init(&ctx, chacha20_key, chacha20_nonce, 1);
+	chacha20_xor(&ctx, &dst[3], &src[1], PLAINTEXT_LEN);
+	CHECK(!memcmp(&dst[3], chacha20_ciphertext, PLAINTEXT_LEN));
+}
+
+static uint32_t rand_state = 1;
+
+static uint8_t rand_byte(void) {
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 16;
+}
+
+// Byte at a time, only ever uses chacha20_block_next()
+static void reference_xor(chacha20_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		chacha20_xor(ctx, &dst[i], &src[i], 1);
+	}
+}
+
+static void test_chacha20_multi_block(void) {
+	static uint8_t plaintext[MULTI_BLOCK_LEN + 3];
+	static uint8_t ciphertext[MULTI_BLOCK_LEN + 3];
+	static uint8_t reference[MULTI_BLOCK_LEN];
+	for (int i = 0; i < sizeof(plaintext); i++) {
+		plaintext[i] = rand_byte();
+	}
+
+	// Initial counters including one that carries out of the 32 bit block counter
+	static const uint64_t counters[] = { 0, 1, 0xfffffffe };
+	// Leading bytes from a previous call shift the batches off the block boundary
+	static const size_t leads[] = { 0, 1, 63, 64, 65 };
+	for (int ci = 0; ci < ARRAY_SIZE(counters); ci++) {
+		for (int li = 0; li < ARRAY_SIZE(leads); li++) {
+			for (size_t misalign = 0; misalign < 4; misalign += 3) {
+				size_t lead = leads[li];
+				chacha20_ctx_t ctx;
+				chacha20_init(&ctx, chacha20_key, chacha20_nonce, counters[ci]);
+				reference_xor(&ctx, reference, plaintext, MULTI_BLOCK_LEN);
+
+				chacha20_init(&ctx, chacha20_key, chacha20_nonce, counters[ci]);
+				uint8_t *dst = &ciphertext[misalign];
+				chacha20_xor(&ctx, dst, plaintext, lead);
+				chacha20_xor(&ctx, &dst[lead], &plaintext[lead], MULTI_BLOCK_LEN - lead);
+				CHECK(!memcmp(dst, reference, MULTI_BLOCK_LEN));
+			}
+		}
+	}
+
+	// In place over the batch path
+	chacha20_ctx_t ctx;
+	memcpy(ciphertext, plaintext, MULTI_BLOCK_LEN);
+	chacha20_init(&ctx, chacha20_key, chacha20_nonce, 1);
+	chacha20_xor_inplace(&ctx, ciphertext, MULTI_BLOCK_LEN);
+	chacha20_init(&ctx, chacha20_key, chacha20_nonce, 1);
+	reference_xor(&ctx, reference, plaintext, MULTI_BLOCK_LEN);
+	CHECK(!memcmp(ciphertext, reference, MULTI_BLOCK_LEN));
+}
+
+static void test_poly1305_vector(void) {
+	uint8_t tag[POLY1305_TAG_SIZE];
+	poly1305_ctx_t ctx;
+	poly1305_init(&ctx, poly1305_key);
+	poly1305_update(&ctx, (const uint8_t *)poly1305_message, sizeof(poly1305_message) - 1);
+	poly1305_finish(&ctx, tag);
+	CHECK(!memcmp(tag, poly1305_tag, sizeof(tag)));
+}
+
+static void test_poly1305_split_updates(void) {
+	size_t len = sizeof(poly1305_message) - 1;
+	for (size_t split = 1; split < len; split++) {
+		uint8_t tag[POLY1305_TAG_SIZE];
+		poly1305_ctx_t ctx;
+		poly1305_init(&ctx, poly1305_key);
+		poly1305_update(&ctx, (const uint8_t *)poly1305_message, split);
+		poly1305_update(&ctx, (const uint8_t *)&poly1305_message[split], len - split);
+		poly1305_finish(&ctx, tag);
+		CHECK(!memcmp(tag, poly1305_tag, sizeof(tag)));
+	}
+}
+
+typedef void (*xor_f)(chacha20_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len);
+
+// Per packet cost including the nonce setup from a packed key
+static double bench(xor_f fn, const chacha20_key_t *key_state, size_t len) {
+	static uint8_t buf[MULTI_BLOCK_LEN];
+	unsigned int rounds = BENCH_TOTAL_BYTES / len;
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < rounds; i++) {
+		chacha20_ctx_t ctx;
+		chacha20_init_key(&ctx, key_state, chacha20_nonce, 1);
+		fn(&ctx, buf, buf, len);
+		__asm__ volatile("" : : "r"(buf) : "memory");
+	}
+	return (double)(test_get_time_ns() - start_ns) / rounds;
+}
+
+static void test_benchmark(void) {
+	static const size_t lengths[] = { 16, 64, 128, 230, 512 };
+	chacha20_key_t key_state;
+	chacha20_key_init(&key_state, chacha20_key);
+	printf("    Bytes  bytewise    chacha20_xor (ns/packet)\n");
+	for (int i = 0; i < ARRAY_SIZE(lengths); i++) {
+		printf("    %-6zu %-11.0f %-11.0f\n", lengths[i],
+		       bench(reference_xor, &key_state, lengths[i]), bench(chacha20_xor, &key_state, lengths[i]));
+	}
+}
+
+int main(void) {
+	TEST_RUN(test_chacha20_vector);
+	TEST_RUN(test_chacha20_split_calls);
+	TEST_RUN(test_chacha20_unaligned);
+	TEST_RUN(test_chacha20_multi_block);
+	TEST_RUN(test_poly1305_vector);
+	TEST_RUN(test_poly1305_split_updates);
+	TEST_RUN(test_benchmark);
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Checks HMAC-SHA1 with precomputed key states against the RFC 2202 test
+ * vectors and compares its speed with hashing the key for every message.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "hmac_sha1.h"
+#include "util.h"
+
+#include "test.h"
+
+#define BENCH_TOTAL_BYTES	(1 << 22)
+
+typedef struct hmac_vector {
+	uint8_t key[80];
+	size_t key_len;
+	uint8_t data[80];
+	size_t data_len;
+	uint8_t digest[HMAC_SHA1_DIGEST_SIZE];
+} hmac_vector_t;
+
+#define REPEAT10(x)	x, x, x, x, x, x, x, x, x, x
+#define REPEAT20(x)	REPEAT10(x), REPEAT10(x)
+#define REPEAT50(x)	REPEAT20(x), REPEAT20(x), REPEAT10(x)
+#define REPEAT80(x)	REPEAT20(x), REPEAT20(x), REPEAT20(x), REPEAT20(x)
+#define STR(s)		.data = s, .data_len = sizeof(s) - 1
+
+// RFC 2202 section 3
+static const hmac_vector_t vectors[] = {
+	{
+		.key = { REPEAT20(0x0b) }, .key_len = 20,
+		STR("Hi There"),
+		.digest = { 0xb6, 0x17, 0x31, 0x86, 0x55, 0x05, 0x72, 0x64, 0xe2, 0x8b,
+			    0xc0, 0xb6, 0xfb, 0x37, 0x8c, 0x8e, 0xf1, 0x46, 0xbe, 0x00 }
+	},
+	{
+		.key = "Jefe", .key_len = 4,
+		STR("what do ya want for nothing?"),
+		.digest = { 0xef, 0xfc, 0xdf, 0x6a, 0xe5, 0xeb, 0x2f, 0xa2, 0xd2, 0x74,
+			    0x16, 0xd5, 0xf1, 0x84, 0xdf, 0x9c, 0x25, 0x9a, 0x7c, 0x79 }
+	},
+	{
+		.key = { REPEAT20(0xaa) }, .key_len = 20,
+		.data = { REPEAT50(0xdd) }, .data_len = 50,
+		.digest = { 0x12, 0x5d, 0x73, 0x42, 0xb9, 0xac, 0x11, 0xcd, 0x91, 0xa3,
+			    0x9a, 0xf4, 0x8a, 0xa1, 0x7b, 0x4f, 0x63, 0xf1, 0x75, 0xd3 }
+	},
+	{
+		.key = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+			 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19 }, .key_len = 25,
+		.data = { REPEAT50(0xcd) }, .data_len = 50,
+		.digest = { 0x4c, 0x90, 0x07, 0xf4, 0x02, 0x62, 0x50, 0xc6, 0xbc, 0x84,
+			    0x14, 0xf9, 0xbf, 0x50, 0xc8, 0x6c, 0x2d, 0x72, 0x35, 0xda }
+	},
+	{
+		.key = { REPEAT20(0x0c) }, .key_len = 20,
+		STR("Test With Truncation"),
+		.digest = { 0x4c, 0x1a, 0x03, 0x42, 0x4b, 0x55, 0xe0, 0x7f, 0xe7, 0xf2,
+			    0x7b, 0xe1, 0xd5, 0x8b, 0xb9, 0x32, 0x4a, 0x9a, 0x5a, 0x04 }
+	},
+	{
+		.key = { REPEAT80(0xaa) }, .key_len = 80,
+		STR("Test Using Larger Than Block-Size Key - Hash Key First"),
+		.digest = { 0xaa, 0x4a, 0xe5, 0xe1, 0x52, 0x72, 0xd0, 0x0e, 0x95, 0x70,
+			    0x56, 0x37, 0xce, 0x8a, 0x3b, 0x55, 0xed, 0x40, 0x21, 0x12 }
+	},
+	{
+		.key = { REPEAT80(0xaa) }, .key_len = 80,
+		STR("Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data"),
+		.digest = { 0xe8, 0xe9, 0x9d, 0x0f, 0x45, 0x23, 0x7d, 0x78, 0x6d, 0x6b,
+			    0xba, 0xa7, 0x96, 0x5c, 0x78, 0x08, 0xbb, 0xff, 0x1a, 0x91 }
+	},
+};
+
+// HMAC as it was computed before the key states were kept, hashing the key every time
+static void reference_hmac(const uint8_t *key, size_t key_len, const uint8_t *data, size_t len,
+			   uint8_t digest[HMAC_SHA1_DIGEST_SIZE]) {
+	uint8_t key_block[HMAC_SHA1_BLOCK_SIZE] = { 0 };
+	if (key_len > sizeof(key_block)) {
+		mbedtls_sha1(key, key_len, key_block);
+	} else {
+		memcpy(key_block, key, key_len);
+	}
+
+	uint8_t pad[HMAC_SHA1_BLOCK_SIZE];
+	uint8_t inner_digest[HMAC_SHA1_DIGEST_SIZE];
+	mbedtls_sha1_context sha1;
+	mbedtls_sha1_init(&sha1);
+	for (int i = 0; i < sizeof(pad); i++) {
+		pad[i] = key_block[i] ^ 0x36;
+	}
+	mbedtls_sha1_starts(&sha1);
+	mbedtls_sha1_update(&sha1, pad, sizeof(pad));
+	mbedtls_sha1_update(&sha1, data, len);
+	mbedtls_sha1_finish(&sha1, inner_digest);
+
+	for (int i = 0; i < sizeof(pad); i++) {
+		pad[i] = key_block[i] ^ 0x5c;
+	}
+	mbedtls_sha1_starts(&sha1);
+	mbedtls_sha1_update(&sha1, pad, sizeof(pad));
+	mbedtls_sha1_update(&sha1, inner_digest, sizeof(inner_digest));
+	mbedtls_sha1_finish(&sha1, digest);
+	mbedtls_sha1_free(&sha1);
+}
+
+static void hmac(const hmac_sha1_key_t *key, const uint8_t *data, size_t len, uint8_t digest[HMAC_SHA1_DIGEST_SIZE]) {
+	hmac_sha1_ctx_t ctx;
+	hmac_sha1_start(&ctx, key);
+	hmac_sha1_update(&ctx, data, len);
+	hmac_sha1_finish(&ctx, digest);
+}
+
+static void test_rfc2202_vectors(void) {
+	for (int i = 0; i < ARRAY_SIZE(vectors); i++) {
+		const hmac_vector_t *vector = &vectors[i];
+		uint8_t digest[HMAC_SHA1_DIGEST_SIZE];
+		reference_hmac(vector->key, vector->key_len, vector->data, vector->data_len, digest);
+		CHECK(!memcmp(digest, vector->digest, sizeof(digest)));
+
+		hmac_sha1_key_t key;
+		hmac_sha1_key_init(&key, vector->key, vector->key_len);
+		hmac(&key, vector->data, vector->data_len, digest);
+		CHECK(!memcmp(digest, vector->digest, sizeof(digest)));
+
+		// Key state is left untouched, so it can be used again
+		memset(digest, 0, sizeof(digest));
+		hmac(&key, vector->data, vector->data_len, digest);
+		CHECK(!memcmp(digest, vector->digest, sizeof(digest)));
+		hmac_sha1_key_free(&key);
+	}
+}
+
+static void test_split_updates(void) {
+	const hmac_vector_t *vector = &vectors[ARRAY_SIZE(vectors) - 1];
+	hmac_sha1_key_t key;
+	hmac_sha1_key_init(&key, vector->key, vector->key_len);
+	for (size_t split = 0; split <= vector->data_len; split++) {
+		uint8_t digest[HMAC_SHA1_DIGEST_SIZE];
+		hmac_sha1_ctx_t ctx;
+		hmac_sha1_start(&ctx, &key);
+		hmac_sha1_update(&ctx, vector->data, split);
+		hmac_sha1_update(&ctx, &vector->data[split], vector->data_len - split);
+		hmac_sha1_finish(&ctx, digest);
+		CHECK(!memcmp(digest, vector->digest, sizeof(digest)));
+	}
+	hmac_sha1_key_free(&key);
+}
+
+static double bench(const hmac_sha1_key_t *key, size_t len) {
+	static uint8_t data[256];
+	static const uint8_t key_data[32] = { 0x42 };
+	unsigned int rounds = BENCH_TOTAL_BYTES / len;
+	uint8_t digest[HMAC_SHA1_DIGEST_SIZE];
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < rounds; i++) {
+		if (key) {
+			hmac(key, data, len, digest);
+		} else {
+			reference_hmac(key_data, sizeof(key_data), data, len, digest);
+		}
+		__asm__ volatile("" : : "r"(digest) : "memory");
+	}
+	return (double)(test_get_time_ns() - start_ns) / rounds;
+}
+
+static void test_benchmark(void) {
+	// Sender address plus packet payloads
+	static const size_t lengths[] = { 6 + 16, 6 + 64, 6 + 230 };
+	static const uint8_t key_data[32] = { 0x42 };
+	hmac_sha1_key_t key;
+	hmac_sha1_key_init(&key, key_data, sizeof(key_data));
+	printf("    Bytes  per message key  precomputed key (ns/message)\n");
+	for (int i = 0; i < ARRAY_SIZE(lengths); i++) {
+		printf("    %-6zu %-16.0f %-16.0f\n", lengths[i], bench(NULL, lengths[i]), bench(&key, lengths[i]));
+	}
+	hmac_sha1_key_free(&key);
+}
+
+int main(void) {
+	TEST_RUN(test_rfc2202_vectors);
+	TEST_RUN(test_split_updates);
+	TEST_RUN(test_benchmark);
+	return 0;
+}
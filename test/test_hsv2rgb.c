@@ -0,0 +1,120 @@
+/*
+ * Checks the batch HSV to RGB kernels bit-identical against
+ * fast_hsv2rgb_32bit() and compares their speed.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "fast_hsv2rgb.h"
+#include "util.h"
+
+#include "test.h"
+
+#define NUM_HUES		65536
+// Conversions per benchmark run, spread over batches of the size under test
+#define BENCH_TOTAL_PIXELS	(1 << 24)
+
+// Edges of the multiplications plus a spread over the range
+static const uint16_t sampled_sv[] = {
+	0, 1, 2, 3, 127, 128, 255, 256, 257, 1000, 4095, 4096, 8191, 8192,
+	16384, 21845, 32767, 32768, 43690, 49151, 60000, 65279, 65534, 65535
+};
+
+static uint16_t h[NUM_HUES], s[NUM_HUES], v[NUM_HUES];
+static uint16_t r[NUM_HUES], g[NUM_HUES], b[NUM_HUES];
+static uint16_t ref_r[NUM_HUES], ref_g[NUM_HUES], ref_b[NUM_HUES];
+
+typedef void (*batch_f)(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+			uint16_t *r, uint16_t *g, uint16_t *b, size_t n);
+
+static void batch_reference(const uint16_t *h, const uint16_t *s, const uint16_t *v,
+			    uint16_t *r, uint16_t *g, uint16_t *b, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		fast_hsv2rgb_32bit(h[i], s[i], v[i], &r[i], &g[i], &b[i]);
+	}
+}
+
+static void check_kernel(batch_f fn, size_t offset, size_t n) {
+	memset(r, 0xaa, sizeof(r));
+	memset(g, 0xaa, sizeof(g));
+	memset(b, 0xaa, sizeof(b));
+	fn(&h[offset], &s[offset], &v[offset], &r[offset], &g[offset], &b[offset], n);
+	CHECK(!memcmp(&r[offset], &ref_r[offset], n * sizeof(*r)));
+	CHECK(!memcmp(&g[offset], &ref_g[offset], n * sizeof(*g)));
+	CHECK(!memcmp(&b[offset], &ref_b[offset], n * sizeof(*b)));
+	// Nothing written past the batch
+	if (offset + n < NUM_HUES) {
+		CHECK_EQ(r[offset + n], 0xaaaa);
+	}
+}
+
+static void test_all_hues(void) {
+	// Every hue, including the ones past the last sextant, for each sampled s and v
+	for (int i = 0; i < NUM_HUES; i++) {
+		h[i] = i;
+	}
+	for (int si = 0; si < ARRAY_SIZE(sampled_sv); si++) {
+		for (int vi = 0; vi < ARRAY_SIZE(sampled_sv); vi++) {
+			for (int i = 0; i < NUM_HUES; i++) {
+				s[i] = sampled_sv[si];
+				v[i] = sampled_sv[vi];
+			}
+			batch_reference(h, s, v, ref_r, ref_g, ref_b, NUM_HUES);
+			check_kernel(fast_hsv2rgb_32bit_batch_scalar, 0, NUM_HUES);
+			check_kernel(fast_hsv2rgb_32bit_batch_vector, 0, NUM_HUES);
+			check_kernel(fast_hsv2rgb_32bit_batch, 0, NUM_HUES);
+		}
+	}
+}
+
+static uint32_t rand_state = 1;
+
+static uint16_t rand_u16(void) {
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 12;
+}
+
+static void test_random_and_remainders(void) {
+	for (int i = 0; i < NUM_HUES; i++) {
+		h[i] = rand_u16();
+		s[i] = rand_u16();
+		v[i] = rand_u16();
+	}
+	batch_reference(h, s, v, ref_r, ref_g, ref_b, NUM_HUES);
+	check_kernel(fast_hsv2rgb_32bit_batch, 0, NUM_HUES);
+
+	// Lengths and offsets that leave a scalar remainder or start unaligned
+	for (size_t offset = 0; offset < 4; offset++) {
+		for (size_t n = 0; n <= 9; n++) {
+			check_kernel(fast_hsv2rgb_32bit_batch, offset, n);
+			check_kernel(fast_hsv2rgb_32bit_batch_vector, offset, n);
+		}
+	}
+}
+
+static double bench(batch_f fn, size_t n) {
+	unsigned int rounds = BENCH_TOTAL_PIXELS / n;
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < rounds; i++) {
+		fn(h, s, v, r, g, b, n);
+		__asm__ volatile("" : : "r"(r), "r"(g), "r"(b) : "memory");
+	}
+	return (double)(test_get_time_ns() - start_ns) / ((double)rounds * n);
+}
+
+static void test_benchmark(void) {
+	static const size_t batch_sizes[] = { 16, 256, 65536 };
+	printf("    Pixels  single  scalar  vector (ns/pixel)\n");
+	for (int i = 0; i < ARRAY_SIZE(batch_sizes); i++) {
+		size_t n = batch_sizes[i];
+		printf("    %-7zu %-7.2f %-7.2f %-7.2f\n", n, bench(batch_reference, n),
+		       bench(fast_hsv2rgb_32bit_batch_scalar, n), bench(fast_hsv2rgb_32bit_batch_vector, n));
+	}
+}
+
+int main(void) {
+	TEST_RUN(test_all_hues);
+	TEST_RUN(test_random_and_remainders);
+	TEST_RUN(test_benchmark);
+	return 0;
+}
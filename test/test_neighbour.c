@@ -0,0 +1,202 @@
+/*
+ * Checks the neighbour table lookup and eviction, and compares the hash
+ * table lookup with a linear scan of the neighbour list. The table holds
+ * NEIGHBOUR_MAX_NEIGHBOURS entries, larger groups are benchmarked as the
+ * cost of advertisements that each evict a neighbour.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mock_scheduler.h"
+#include "neighbour.h"
+#include "ota.h"
+#include "scheduler.h"
+#include "status_leds.h"
+#include "util.h"
+#include "wireless.h"
+#include "wireless_tx.h"
+
+#include "test.h"
+
+// Same as in neighbour.c
+#define MAX_NEIGHBOURS		64
+#define BENCH_LOOKUPS		(1 << 22)
+#define BENCH_ADVERTISEMENTS	(1 << 18)
+
+/* Mocks, housekeeping and the wireless side are not exercised */
+void scheduler_schedule_periodic(scheduler_task_t *task, scheduler_cb_f cb, void *ctx,
+				 int64_t delay_us, int64_t period_us, scheduler_periodic_policy_t policy) { }
+
+void scheduler_task_set_slack(scheduler_task_t *task, int64_t slack_us) { }
+
+esp_err_t wireless_register_handler(uint8_t packet_type, wireless_rx_handler_f fn, void *ctx, unsigned int flags) {
+	return ESP_OK;
+}
+
+esp_err_t wireless_tx_queue(const void *data, size_t len, wireless_tx_priority_t priority,
+			    unsigned int flags, unsigned int repeats) {
+	return ESP_OK;
+}
+
+const uint8_t *wireless_get_broadcast_address(void) {
+	static const uint8_t broadcast_address[ESP_NOW_ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	return broadcast_address;
+}
+
+bool wireless_is_broadcast_address(const uint8_t *addr) {
+	return !memcmp(addr, wireless_get_broadcast_address(), ESP_NOW_ETH_ALEN);
+}
+
+bool wireless_is_local_address(const uint8_t *addr) {
+	return false;
+}
+
+void status_led_set_mode(status_led_id_t led_id, status_led_mode_t mode) { }
+
+void status_led_set_blink(status_led_id_t led_id, unsigned int blink_interval_ms) { }
+
+ssize_t ota_neighbour_info_to_string(const neighbour_ota_info_t *info, char *dst, size_t len) {
+	return 0;
+}
+
+static void node_address(uint8_t address[ESP_NOW_ETH_ALEN], unsigned int node) {
+	// Nodes share the vendor prefix
+	address[0] = 0x34;
+	address[1] = 0x85;
+	address[2] = 0x18;
+	address[3] = node >> 16;
+	address[4] = node >> 8;
+	address[5] = node;
+}
+
+static void advertise(unsigned int node, int64_t uptime_us) {
+	uint8_t address[ESP_NOW_ETH_ALEN];
+	node_address(address, node);
+	neighbour_advertisement_t adv = {
+		.packet_type = WIRELESS_PACKET_TYPE_NEIGHBOUR_ADVERTISEMENT,
+		.uptime_us = uptime_us,
+		.global_clock_us = uptime_us
+	};
+	mock_now_us++;
+	CHECK_EQ(neighbour_update(address, mock_now_us, &adv), ESP_OK);
+}
+
+static bool is_known(unsigned int node) {
+	uint8_t address[ESP_NOW_ETH_ALEN];
+	node_address(address, node);
+	const neighbour_t *neigh = neighbour_find_by_address(address);
+	if (neigh) {
+		CHECK(!memcmp(neigh->address, address, sizeof(address)));
+	}
+	return neigh;
+}
+
+static void test_lookup(void) {
+	neighbour_init();
+	CHECK(!neighbour_has_neighbours());
+	for (unsigned int node = 0; node < 10; node++) {
+		advertise(node, 0);
+	}
+	for (unsigned int node = 0; node < 10; node++) {
+		CHECK(is_known(node));
+	}
+	CHECK(!is_known(10));
+
+	// Advertising again updates in place
+	advertise(3, 0);
+	CHECK(is_known(3));
+	CHECK(!is_known(1000));
+}
+
+static void test_eviction(void) {
+	neighbour_init();
+	mock_now_us = MS_TO_US(1000);
+	// The oldest neighbour has been up longest and becomes the clock source
+	advertise(0, MS_TO_US(3600LL * 1000));
+	for (unsigned int node = 1; node < 100; node++) {
+		advertise(node, 0);
+	}
+
+	// Evicted in order of age, except for the clock source
+	CHECK(is_known(0));
+	for (unsigned int node = 1; node < 100 - (MAX_NEIGHBOURS - 1); node++) {
+		CHECK(!is_known(node));
+	}
+	for (unsigned int node = 100 - (MAX_NEIGHBOURS - 1); node < 100; node++) {
+		CHECK(is_known(node));
+	}
+
+	// Heard from again, no longer the oldest
+	advertise(100 - (MAX_NEIGHBOURS - 1), 0);
+	advertise(100, 0);
+	CHECK(is_known(100 - (MAX_NEIGHBOURS - 1)));
+	CHECK(!is_known(100 - (MAX_NEIGHBOURS - 2)));
+}
+
+// Lookup as it was, walking the neighbour list
+static uint8_t list_addresses[MAX_NEIGHBOURS][ESP_NOW_ETH_ALEN];
+
+static int linear_find(const uint8_t *address, unsigned int num_neighbours) {
+	for (unsigned int i = 0; i < num_neighbours; i++) {
+		if (!memcmp(list_addresses[i], address, ESP_NOW_ETH_ALEN)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static double bench_lookup(bool hash, unsigned int num_neighbours) {
+	neighbour_init();
+	for (unsigned int node = 0; node < num_neighbours; node++) {
+		advertise(node, 0);
+		node_address(list_addresses[node], node);
+	}
+
+	uint8_t address[ESP_NOW_ETH_ALEN];
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < BENCH_LOOKUPS; i++) {
+		// Mostly known senders, some unknown ones
+		node_address(address, i % (num_neighbours + num_neighbours / 4));
+		if (hash) {
+			const neighbour_t *neigh = neighbour_find_by_address(address);
+			__asm__ volatile("" : : "r"(neigh) : "memory");
+		} else {
+			int idx = linear_find(address, num_neighbours);
+			__asm__ volatile("" : : "r"(idx) : "memory");
+		}
+	}
+	return (double)(test_get_time_ns() - start_ns) / BENCH_LOOKUPS;
+}
+
+static double bench_churn(unsigned int num_nodes) {
+	neighbour_init();
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < BENCH_ADVERTISEMENTS; i++) {
+		advertise(i % num_nodes, 0);
+	}
+	return (double)(test_get_time_ns() - start_ns) / BENCH_ADVERTISEMENTS;
+}
+
+static void test_benchmark(void) {
+	static const unsigned int table_sizes[] = { 10, MAX_NEIGHBOURS };
+	printf("    Neighbours  list scan  hash (ns/lookup)\n");
+	for (int i = 0; i < ARRAY_SIZE(table_sizes); i++) {
+		printf("    %-11u %-10.1f %-10.1f\n", table_sizes[i],
+		       bench_lookup(false, table_sizes[i]), bench_lookup(true, table_sizes[i]));
+	}
+
+	// Groups beyond the table size evict on every advertisement
+	static const unsigned int group_sizes[] = { 10, 100, 1000 };
+	printf("    Nodes       advertisement (ns)\n");
+	for (int i = 0; i < ARRAY_SIZE(group_sizes); i++) {
+		printf("    %-11u %-10.1f\n", group_sizes[i], bench_churn(group_sizes[i]));
+	}
+}
+
+int main(void) {
+	TEST_RUN(test_lookup);
+	TEST_RUN(test_eviction);
+	TEST_RUN(test_benchmark);
+	return 0;
+}
@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fast_hsv2rgb.h"
+#include "main.h"
+#include "perf.h"
+#include "render.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include "test.h"
+
+#define FRAME_INTERVAL_US	MS_TO_US(10)
+#define KEEPALIVE_INTERVAL_US	MS_TO_US(1000)
+
+/* Mocks */
+static int64_t now_us;
+static int64_t frame_deadline_us = -1;
+static bool frame_requested;
+
+int64_t esp_timer_get_time(void) {
+	return now_us;
+}
+
+void post_event(EventBits_t bits) {
+	if (bits & EVENT_LED) {
+		frame_requested = true;
+	}
+}
+
+void perf_record(perf_stage_t stage, uint32_t cycles) { }
+
+int64_t neighbour_get_global_clock_and_source(neighbour_t **src) {
+	*src = NULL;
+	return now_us;
+}
+
+void scheduler_task_init(scheduler_task_t *task, const char *name) { }
+
+void scheduler_task_set_slack(scheduler_task_t *task, int64_t slack_us) { }
+
+void scheduler_schedule_task(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t deadline_us) {
+	frame_deadline_us = deadline_us;
+}
+
+void scheduler_schedule_task_relative(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t timeout_us) {
+	frame_deadline_us = now_us + timeout_us;
+}
+
+/* Priorities of the layers applied in the last frame, in order */
+static render_priority_t trace[RENDER_NUM_PRIORITIES];
+static unsigned int trace_len;
+
+static void trace_layer(render_priority_t priority) {
+	CHECK(trace_len < ARRAY_SIZE(trace));
+	trace[trace_len++] = priority;
+}
+
+/*
+ * Layers modelled after default_color, an animating effect and power_off.
+ * Like the apply functions of the old main loop, inactive layers leave
+ * the frame alone even when applied.
+ */
+static bool animating;
+static bool powered_off;
+
+static void static_apply(render_frame_t *frame, void *ctx) {
+	trace_layer(RENDER_PRIORITY_DEFAULT_COLOR);
+	frame->hsv.h = 12345;
+}
+
+static int64_t static_next_frame(const render_frame_t *frame, void *ctx) {
+	return RENDER_NEXT_FRAME_NONE;
+}
+
+static void animation_apply(render_frame_t *frame, void *ctx) {
+	if (!animating) {
+		return;
+	}
+	trace_layer(RENDER_PRIORITY_BONK);
+	frame->hsv.h = frame->hsv.h / 2 + frame->now_us / 1000;
+}
+
+static bool animation_is_active(const render_frame_t *frame, void *ctx) {
+	return animating;
+}
+
+static void power_off_apply(render_frame_t *frame, void *ctx) {
+	if (!powered_off) {
+		return;
+	}
+	trace_layer(RENDER_PRIORITY_POWER_CONTROL);
+	memset(&frame->rgb, 0, sizeof(frame->rgb));
+}
+
+static bool power_off_is_active(const render_frame_t *frame, void *ctx) {
+	return powered_off;
+}
+
+static unsigned int frames;
+
+// Main loop stand-in, renders requested frames and frames due until end_us
+static void run_until(int64_t end_us) {
+	while (true) {
+		if (frame_requested) {
+			frame_requested = false;
+		} else if (frame_deadline_us <= end_us) {
+			now_us = frame_deadline_us;
+		} else {
+			break;
+		}
+		rgb16_t rgb;
+		trace_len = 0;
+		render_frame(&rgb);
+		frames++;
+	}
+	now_us = end_us;
+}
+
+static unsigned int frames_in(int64_t duration_us) {
+	unsigned int frames_start = frames;
+	run_until(now_us + duration_us);
+	return frames - frames_start;
+}
+
+static void test_static_output_backs_off(void) {
+	// Settle into the keep-alive rate
+	frames_in(KEEPALIVE_INTERVAL_US * 2);
+	CHECK(frames_in(KEEPALIVE_INTERVAL_US * 10) <= 11);
+	CHECK_EQ(frame_deadline_us - now_us <= KEEPALIVE_INTERVAL_US, 1);
+}
+
+static void test_animation_wakes_immediately(void) {
+	animating = true;
+	render_request_frame();
+	unsigned int frames_start = frames;
+	run_until(now_us);
+	CHECK_EQ(frames - frames_start, 1);
+
+	// Full frame rate while animating
+	CHECK(frames_in(KEEPALIVE_INTERVAL_US) >= KEEPALIVE_INTERVAL_US / FRAME_INTERVAL_US - 1);
+}
+
+static void test_rate_recovers_after_animation(void) {
+	animating = false;
+	render_request_frame();
+	frames_in(KEEPALIVE_INTERVAL_US);
+	CHECK(frames_in(KEEPALIVE_INTERVAL_US * 10) <= 11);
+}
+
+static void test_powered_off_is_static(void) {
+	powered_off = true;
+	render_request_frame();
+	frames_in(KEEPALIVE_INTERVAL_US);
+	CHECK(frames_in(KEEPALIVE_INTERVAL_US * 10) <= 11);
+
+	// Animations below the power off layer still need frames
+	animating = true;
+	render_request_frame();
+	CHECK(frames_in(KEEPALIVE_INTERVAL_US) >= KEEPALIVE_INTERVAL_US / FRAME_INTERVAL_US - 1);
+	animating = false;
+	powered_off = false;
+	render_request_frame();
+	frames_in(KEEPALIVE_INTERVAL_US);
+}
+
+/*
+ * Stand-ins for the remaining layers. Each one applies a different affine
+ * map, so any change in order changes the result.
+ */
+typedef struct golden_layer {
+	const char *name;
+	render_priority_t priority;
+	bool active;
+} golden_layer_t;
+
+static golden_layer_t golden_layers[] = {
+	{ "rainbow_fade", RENDER_PRIORITY_RAINBOW_FADE },
+	{ "squish", RENDER_PRIORITY_SQUISH },
+	{ "state_of_charge", RENDER_PRIORITY_STATE_OF_CHARGE },
+	{ "ota", RENDER_PRIORITY_OTA },
+	{ "uid", RENDER_PRIORITY_UID },
+	{ "color_override", RENDER_PRIORITY_COLOR_OVERRIDE },
+};
+
+static void golden_apply(render_frame_t *frame, void *ctx) {
+	const golden_layer_t *layer = ctx;
+	if (!layer->active) {
+		return;
+	}
+	trace_layer(layer->priority);
+	unsigned int k = layer->priority + 1;
+	if (layer->priority < RENDER_PRIORITY_HSV2RGB) {
+		frame->hsv.h = (frame->hsv.h * 3 + k * 1111) % HSV_HUE_STEPS;
+		frame->hsv.s = frame->hsv.s / 2 + k * 3000;
+		frame->hsv.v = frame->hsv.v / 3 + k * 5000;
+	} else {
+		frame->rgb = (rgb16_t){ frame->rgb.g / 2 + k, frame->rgb.b, frame->rgb.r / 3 + k * 7 };
+	}
+}
+
+static bool golden_is_active(const render_frame_t *frame, void *ctx) {
+	const golden_layer_t *layer = ctx;
+	return layer->active;
+}
+
+static golden_layer_t *golden_layer(render_priority_t priority) {
+	for (int i = 0; i < ARRAY_SIZE(golden_layers); i++) {
+		if (golden_layers[i].priority == priority) {
+			return &golden_layers[i];
+		}
+	}
+	return NULL;
+}
+
+// The EVENT_LED branch of app_main() before the compositor, with its fixed order
+static void baseline_frame(int64_t timestamp_us, rgb16_t *rgb) {
+	render_frame_t frame = {
+		.now_us = timestamp_us,
+		.global_clock_us = timestamp_us,
+		.hsv = { 0, HSV_SAT_MAX, HSV_VAL_MAX / 2 }
+	};
+	static_apply(&frame, NULL);
+	golden_apply(&frame, golden_layer(RENDER_PRIORITY_RAINBOW_FADE));
+	animation_apply(&frame, NULL);
+	golden_apply(&frame, golden_layer(RENDER_PRIORITY_SQUISH));
+	golden_apply(&frame, golden_layer(RENDER_PRIORITY_STATE_OF_CHARGE));
+	golden_apply(&frame, golden_layer(RENDER_PRIORITY_OTA));
+	golden_apply(&frame, golden_layer(RENDER_PRIORITY_UID));
+
+	uint16_t r, g, b;
+	fast_hsv2rgb_32bit(frame.hsv.h, frame.hsv.s, frame.hsv.v, &r, &g, &b);
+	frame.rgb = (rgb16_t){ r, g, b };
+	golden_apply(&frame, golden_layer(RENDER_PRIORITY_COLOR_OVERRIDE));
+	power_off_apply(&frame, NULL);
+	*rgb = frame.rgb;
+}
+
+static void test_golden_layer_order(void) {
+	// Every combination of active layers, at a few points in time
+	unsigned int num_states = 1 << (ARRAY_SIZE(golden_layers) + 2);
+	for (unsigned int state = 0; state < num_states; state++) {
+		for (int i = 0; i < ARRAY_SIZE(golden_layers); i++) {
+			golden_layers[i].active = state & BIT(i);
+		}
+		animating = state & BIT(ARRAY_SIZE(golden_layers));
+		powered_off = state & BIT(ARRAY_SIZE(golden_layers) + 1);
+
+		for (int step = 0; step < 3; step++) {
+			now_us += MS_TO_US(37);
+			rgb16_t expected, rgb;
+			trace_len = 0;
+			baseline_frame(now_us, &expected);
+			unsigned int expected_trace_len = trace_len;
+			render_priority_t expected_trace[RENDER_NUM_PRIORITIES];
+			memcpy(expected_trace, trace, sizeof(trace));
+
+			trace_len = 0;
+			render_frame(&rgb);
+			CHECK(!memcmp(&rgb, &expected, sizeof(rgb)));
+			CHECK_EQ(trace_len, expected_trace_len);
+			CHECK(!memcmp(trace, expected_trace, trace_len * sizeof(*trace)));
+		}
+	}
+	animating = false;
+	powered_off = false;
+}
+
+static void test_stats(void) {
+	render_stats_t stats;
+	render_get_stats(&stats);
+	CHECK_EQ(stats.frames_rendered, frames);
+	CHECK(stats.frames_skipped > stats.frames_rendered);
+	CHECK(stats.spi_transfers_saved >= stats.frames_skipped);
+}
+
+int main(void) {
+	render_init();
+	CHECK_EQ(render_layer_register("static", RENDER_PRIORITY_DEFAULT_COLOR, static_apply, NULL,
+				       static_next_frame, NULL), ESP_OK);
+	CHECK_EQ(render_layer_register("animation", RENDER_PRIORITY_BONK, animation_apply, animation_is_active,
+				       NULL, NULL), ESP_OK);
+	CHECK_EQ(render_layer_register("power_off", RENDER_PRIORITY_POWER_CONTROL, power_off_apply,
+				       power_off_is_active, static_next_frame, NULL), ESP_OK);
+	for (int i = 0; i < ARRAY_SIZE(golden_layers); i++) {
+		golden_layer_t *layer = &golden_layers[i];
+		CHECK_EQ(render_layer_register(layer->name, layer->priority, golden_apply, golden_is_active,
+					       NULL, layer), ESP_OK);
+	}
+
+	TEST_RUN(test_static_output_backs_off);
+	TEST_RUN(test_animation_wakes_immediately);
+	TEST_RUN(test_rate_recovers_after_animation);
+	TEST_RUN(test_powered_off_is_static);
+	TEST_RUN(test_stats);
+	TEST_RUN(test_golden_layer_order);
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "replay_window.h"
+
+#include "test.h"
+
+#define RANDOM_ID	0x12345678UL
+#define TIMESTAMP	100000UL
+
+// Receive path order: check, then record once authenticated
+static bool receive_at(replay_window_t *window, uint32_t random_id, uint32_t seq, uint32_t timestamp) {
+	if (!replay_window_check(window, random_id, seq, timestamp)) {
+		return false;
+	}
+	replay_window_update(window, random_id, seq, timestamp);
+	return true;
+}
+
+// Timestamps only matter across sessions
+static bool receive(replay_window_t *window, uint32_t random_id, uint32_t seq) {
+	return receive_at(window, random_id, seq, TIMESTAMP);
+}
+
+static void test_in_order(void) {
+	replay_window_t window = { 0 };
+	for (uint32_t seq = 0; seq < 1000; seq++) {
+		CHECK(receive(&window, RANDOM_ID, seq));
+	}
+}
+
+static void test_duplicates(void) {
+	replay_window_t window = { 0 };
+	CHECK(receive(&window, RANDOM_ID, 100));
+	CHECK(!receive(&window, RANDOM_ID, 100));
+	CHECK(receive(&window, RANDOM_ID, 101));
+	CHECK(!receive(&window, RANDOM_ID, 100));
+	CHECK(!receive(&window, RANDOM_ID, 101));
+
+	// Check alone must not record the packet
+	CHECK(replay_window_check(&window, RANDOM_ID, 102, TIMESTAMP));
+	CHECK(replay_window_check(&window, RANDOM_ID, 102, TIMESTAMP));
+	CHECK(receive(&window, RANDOM_ID, 102));
+}
+
+static void test_reordering(void) {
+	replay_window_t window = { 0 };
+	CHECK(receive(&window, RANDOM_ID, 1000));
+	// Anything within the window behind the highest packet is still accepted once
+	for (uint32_t seq = 1000 - REPLAY_WINDOW_SIZE + 1; seq < 1000; seq += 2) {
+		CHECK(receive(&window, RANDOM_ID, seq));
+	}
+	for (uint32_t seq = 1000 - REPLAY_WINDOW_SIZE + 1; seq < 1000; seq += 2) {
+		CHECK(!receive(&window, RANDOM_ID, seq));
+	}
+	CHECK(receive(&window, RANDOM_ID, 998));
+
+	// Too old to be tracked
+	CHECK(!receive(&window, RANDOM_ID, 1000 - REPLAY_WINDOW_SIZE));
+
+	// Jumping ahead slides the window, keeping what is still inside
+	CHECK(receive(&window, RANDOM_ID, 1010));
+	CHECK(!receive(&window, RANDOM_ID, 1000));
+	CHECK(!receive(&window, RANDOM_ID, 998));
+	CHECK(receive(&window, RANDOM_ID, 1005));
+	CHECK(!receive(&window, RANDOM_ID, 1010 - REPLAY_WINDOW_SIZE));
+
+	// A jump larger than the window forgets everything before
+	CHECK(receive(&window, RANDOM_ID, 5000));
+	CHECK(!receive(&window, RANDOM_ID, 1010));
+	CHECK(receive(&window, RANDOM_ID, 4999));
+}
+
+static void test_restart(void) {
+	replay_window_t window = { 0 };
+	// The first packet of a sender is accepted whatever its timestamp
+	CHECK(receive_at(&window, RANDOM_ID, 5000, TIMESTAMP));
+	CHECK(receive_at(&window, RANDOM_ID, 5001, TIMESTAMP + 5));
+
+	// Sender rebooted with a new random id and restarted counting
+	CHECK(receive_at(&window, RANDOM_ID + 1, 0, TIMESTAMP + 10));
+	CHECK(!receive_at(&window, RANDOM_ID + 1, 0, TIMESTAMP + 10));
+	CHECK(receive_at(&window, RANDOM_ID + 1, 1, TIMESTAMP + 11));
+
+	// Recorded packets of the old session must not switch back
+	CHECK(!receive_at(&window, RANDOM_ID, 5000, TIMESTAMP));
+	CHECK(!receive_at(&window, RANDOM_ID, 5001, TIMESTAMP + 5));
+	CHECK(!receive_at(&window, RANDOM_ID, 5002, TIMESTAMP + 11));
+	CHECK(receive_at(&window, RANDOM_ID + 1, 2, TIMESTAMP + 12));
+
+	// Nor may an unseen random id with a timestamp that is not newer
+	CHECK(!receive_at(&window, RANDOM_ID + 2, 0, TIMESTAMP + 12));
+	CHECK(!replay_window_check(&window, RANDOM_ID + 2, 0, TIMESTAMP + 12));
+
+	// A rejected session switch leaves the current session intact
+	replay_window_update(&window, RANDOM_ID + 2, 0, TIMESTAMP + 12);
+	CHECK(!receive_at(&window, RANDOM_ID + 1, 2, TIMESTAMP + 12));
+	CHECK(receive_at(&window, RANDOM_ID + 1, 3, TIMESTAMP + 13));
+
+	// Another genuine restart
+	CHECK(receive_at(&window, RANDOM_ID + 2, 0, TIMESTAMP + 20));
+	CHECK(!receive_at(&window, RANDOM_ID + 1, 4, TIMESTAMP + 14));
+}
+
+static void test_restart_timestamp_wrap(void) {
+	replay_window_t window = { 0 };
+	CHECK(receive_at(&window, RANDOM_ID, 100, UINT32_MAX - 5));
+	// Newer across the wrap of the 32 bit millisecond timestamp
+	CHECK(receive_at(&window, RANDOM_ID + 1, 0, 5));
+	CHECK(!receive_at(&window, RANDOM_ID, 101, UINT32_MAX - 4));
+	CHECK(receive_at(&window, RANDOM_ID + 1, 1, 6));
+}
+
+static void test_counter_wrap(void) {
+	replay_window_t window = { 0 };
+	uint32_t seq = REPLAY_WINDOW_SEQ_MASK - 10;
+	for (int i = 0; i < 20; i++) {
+		CHECK(receive(&window, RANDOM_ID, seq));
+		seq = (seq + 1) & REPLAY_WINDOW_SEQ_MASK;
+	}
+	CHECK(!receive(&window, RANDOM_ID, REPLAY_WINDOW_SEQ_MASK));
+	CHECK(!receive(&window, RANDOM_ID, 0));
+	CHECK(receive(&window, RANDOM_ID, 20));
+
+	// Bit 31 is a header flag and not part of the counter
+	CHECK(!receive(&window, RANDOM_ID, 20 | 0x80000000UL));
+	CHECK(receive(&window, RANDOM_ID, 21 | 0x80000000UL));
+	CHECK(!receive(&window, RANDOM_ID, 21));
+}
+
+static void test_far_behind_is_old(void) {
+	replay_window_t window = { 0 };
+	CHECK(receive(&window, RANDOM_ID, 100));
+	// More than half the sequence space ahead counts as behind
+	CHECK(!receive(&window, RANDOM_ID, (100 + (REPLAY_WINDOW_SEQ_MASK >> 1) + 2) & REPLAY_WINDOW_SEQ_MASK));
+	CHECK(receive(&window, RANDOM_ID, (100 + (REPLAY_WINDOW_SEQ_MASK >> 1)) & REPLAY_WINDOW_SEQ_MASK));
+}
+
+int main(void) {
+	TEST_RUN(test_in_order);
+	TEST_RUN(test_duplicates);
+	TEST_RUN(test_reordering);
+	TEST_RUN(test_restart);
+	TEST_RUN(test_restart_timestamp_wrap);
+	TEST_RUN(test_counter_wrap);
+	TEST_RUN(test_far_behind_is_old);
+	return 0;
+}
@@ -0,0 +1,389 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+#include "list.h"
+#include "main.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include "test.h"
+
+// Beyond the initial heap capacity of 32
+#define NUM_MANY_TASKS		100
+#define MAX_BENCH_TASKS		10000
+// Spacing of the first deadlines, keeps one task due per wakeup
+#define BENCH_STAGGER_US	100
+#define BENCH_DISPATCHES	20000
+
+#define COALESCE_DURATION_US	MS_TO_US(60000)
+
+#define DRIFT_PERIODS		1000000
+#define DRIFT_PERIOD_US		1000
+// Main loop latency up to this before each wakeup, plus runtime per callback
+#define DRIFT_MAX_LATENCY_US	400
+#define DRIFT_RUNTIME_US	100
+// Every this many wakeups the main loop stalls for over five periods
+#define DRIFT_STALL_INTERVAL	100000
+#define DRIFT_STALL_US		5500
+
+/* Mocks */
+static int64_t now_us;
+
+int64_t esp_timer_get_time(void) {
+	return now_us;
+}
+
+struct esp_timer {
+	esp_timer_create_args_t args;
+	bool armed;
+	int64_t deadline_us;
+};
+
+static struct esp_timer timer;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle) {
+	timer.args = *create_args;
+	*out_handle = &timer;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+	CHECK(!timer->armed);
+	timer->armed = true;
+	timer->deadline_us = now_us + timeout_us;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+	CHECK(timer->armed);
+	timer->armed = false;
+	return ESP_OK;
+}
+
+void post_event(EventBits_t bits) {
+	CHECK_EQ(bits, EVENT_SCHEDULER);
+}
+
+// Fires the timer and runs the scheduler like the main loop would
+static void run_next_wakeup(void) {
+	CHECK(timer.armed);
+	now_us = MAX(now_us, timer.deadline_us);
+	timer.armed = false;
+	timer.args.callback(timer.args.arg);
+	scheduler_run();
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t rand_u32(void) {
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+static unsigned int num_wakeups;
+static unsigned int num_stalls;
+
+// Like run_next_wakeup(), with main loop latency and occasional stalls
+static void run_next_wakeup_late(void) {
+	int64_t latency_us = rand_u32() % DRIFT_MAX_LATENCY_US;
+	if (++num_wakeups % DRIFT_STALL_INTERVAL == 0) {
+		latency_us += DRIFT_STALL_US;
+		num_stalls++;
+	}
+	CHECK(timer.armed);
+	now_us = MAX(now_us, timer.deadline_us) + latency_us;
+	timer.armed = false;
+	timer.args.callback(timer.args.arg);
+	scheduler_run();
+}
+
+/* Sorted list scheduler as it was before the heap, for comparison */
+typedef struct list_task {
+	struct list_head list;
+	int64_t deadline_us;
+	int64_t period_us;
+} list_task_t;
+
+static DECLARE_LIST_HEAD(list_tasks);
+
+static void list_enqueue(list_task_t *task) {
+	struct list_head *prior_deadline = &list_tasks;
+	list_task_t *cursor;
+
+	LIST_FOR_EACH_ENTRY(cursor, &list_tasks, list) {
+		if (cursor->deadline_us > task->deadline_us) {
+			break;
+		}
+		prior_deadline = &cursor->list;
+	}
+	LIST_APPEND(&task->list, prior_deadline);
+}
+
+static void list_run_next(void) {
+	list_task_t *task = LIST_GET_ENTRY(list_tasks.next, list_task_t, list);
+	now_us = MAX(now_us, task->deadline_us);
+	LIST_DELETE(&task->list);
+	task->deadline_us += task->period_us;
+	list_enqueue(task);
+}
+
+static unsigned int num_runs;
+static unsigned int run_order[NUM_MANY_TASKS];
+
+static void record_run(void *ctx) {
+	CHECK(num_runs < ARRAY_SIZE(run_order));
+	run_order[num_runs++] = (uintptr_t)ctx;
+}
+
+static void test_many_tasks(void) {
+	static scheduler_task_t tasks[NUM_MANY_TASKS];
+
+	// Scheduled in reverse, each must run exactly once in deadline order
+	for (int i = 0; i < NUM_MANY_TASKS; i++) {
+		scheduler_task_init(&tasks[i], "many");
+	}
+	for (int i = NUM_MANY_TASKS - 1; i >= 0; i--) {
+		scheduler_schedule_task(&tasks[i], record_run, (void *)(uintptr_t)i, now_us + 10 + i);
+	}
+	while (timer.armed) {
+		run_next_wakeup();
+	}
+	CHECK_EQ(num_runs, NUM_MANY_TASKS);
+	for (int i = 0; i < NUM_MANY_TASKS; i++) {
+		CHECK_EQ(run_order[i], i);
+		CHECK_EQ(tasks[i].stats.invocations, 1);
+		CHECK_EQ(tasks[i].heap_idx, SCHEDULER_TASK_NOT_QUEUED);
+	}
+}
+
+static scheduler_task_t *drift_task;
+static int64_t drift_start_us;
+static int64_t drift_prev_deadline_us;
+
+static void drift_catch_up_cb(void *ctx) {
+	// Requeued before running, one period past the deadline of this run
+	int64_t deadline_us = drift_task->deadline_us - DRIFT_PERIOD_US;
+	CHECK_EQ(deadline_us, drift_prev_deadline_us + DRIFT_PERIOD_US);
+	drift_prev_deadline_us = deadline_us;
+	now_us += DRIFT_RUNTIME_US;
+}
+
+static void drift_skip_cb(void *ctx) {
+	// Next deadline on the grid and in the future, no back to back runs
+	CHECK_EQ((drift_task->deadline_us - drift_start_us) % DRIFT_PERIOD_US, 0);
+	CHECK(drift_task->deadline_us > now_us);
+	CHECK(drift_task->deadline_us > drift_prev_deadline_us);
+	drift_prev_deadline_us = drift_task->deadline_us;
+	now_us += DRIFT_RUNTIME_US;
+}
+
+static void drift_relative_cb(void *ctx) {
+	now_us += DRIFT_RUNTIME_US;
+	scheduler_schedule_task_relative(drift_task, drift_relative_cb, NULL, DRIFT_PERIOD_US);
+}
+
+// Runs the drift task for DRIFT_PERIODS periods of its nominal grid
+static void run_drift(scheduler_task_t *task, scheduler_cb_f cb, scheduler_periodic_policy_t policy) {
+	drift_task = task;
+	scheduler_task_init(drift_task, "drift");
+	drift_start_us = now_us;
+	drift_prev_deadline_us = now_us;
+	num_wakeups = 0;
+	num_stalls = 0;
+	if (cb == drift_relative_cb) {
+		scheduler_schedule_task_relative(drift_task, cb, NULL, DRIFT_PERIOD_US);
+	} else {
+		scheduler_schedule_periodic(drift_task, cb, NULL, DRIFT_PERIOD_US, DRIFT_PERIOD_US, policy);
+	}
+
+	int64_t end_us = drift_start_us + (int64_t)DRIFT_PERIODS * DRIFT_PERIOD_US;
+	while (drift_task->deadline_us <= end_us) {
+		run_next_wakeup_late();
+	}
+	scheduler_cancel(drift_task);
+}
+
+static void test_periodic_catch_up_no_drift(void) {
+	static scheduler_task_t task;
+
+	run_drift(&task, drift_catch_up_cb, SCHEDULER_PERIODIC_CATCH_UP);
+	// Every period ran, the next deadline is exactly on the grid
+	CHECK_EQ(drift_task->stats.invocations, DRIFT_PERIODS);
+	CHECK_EQ(drift_task->deadline_us - drift_start_us, (int64_t)(DRIFT_PERIODS + 1) * DRIFT_PERIOD_US);
+	CHECK(num_stalls > 0);
+	CHECK(drift_task->stats.lateness_max_us < DRIFT_STALL_US + DRIFT_MAX_LATENCY_US);
+}
+
+static void test_periodic_skip_no_drift(void) {
+	static scheduler_task_t task;
+
+	run_drift(&task, drift_skip_cb, SCHEDULER_PERIODIC_SKIP);
+	// Each stall drops exactly five periods, everything else ran on the grid
+	CHECK_EQ(drift_task->stats.invocations, DRIFT_PERIODS - 5 * num_stalls);
+	CHECK_EQ(drift_task->deadline_us - drift_start_us, (int64_t)(DRIFT_PERIODS + 1) * DRIFT_PERIOD_US);
+	CHECK(num_stalls > 0);
+}
+
+static void test_relative_rearm_drifts(void) {
+	static scheduler_task_t task;
+
+	// The former pattern, re-arming relative to the end of the callback
+	run_drift(&task, drift_relative_cb, SCHEDULER_PERIODIC_CATCH_UP);
+	int64_t expected_us = (int64_t)DRIFT_PERIODS * DRIFT_PERIOD_US;
+	int64_t actual_us = (int64_t)drift_task->stats.invocations * DRIFT_PERIOD_US;
+	printf("    relative re-arming: %u of %u periods run, %.1f s behind\n",
+	       drift_task->stats.invocations, DRIFT_PERIODS, (expected_us - actual_us) / 1e6);
+	CHECK(drift_task->stats.invocations < DRIFT_PERIODS);
+}
+
+typedef struct sim_task {
+	const char *name;
+	int64_t delay_us;
+	int64_t period_us;
+	int64_t slack_us;
+} sim_task_t;
+
+// Periodic tasks of the firmware as set up by their modules' init functions
+static const sim_task_t sim_tasks[] = {
+	{ "render_frame", MS_TO_US(10), MS_TO_US(10), MS_TO_US(2) },
+	{ "bonk", MS_TO_US(100), MS_TO_US(20), MS_TO_US(5) },
+	{ "squish", MS_TO_US(100), MS_TO_US(20), MS_TO_US(5) },
+	{ "power_control", MS_TO_US(100), MS_TO_US(250), MS_TO_US(50) },
+	{ "ota", 0, MS_TO_US(1000), MS_TO_US(100) },
+	{ "neighbour_static_info", 0, MS_TO_US(1000), MS_TO_US(100) },
+	{ "neighbour_status", 0, MS_TO_US(1000), MS_TO_US(100) },
+	{ "default_color", MS_TO_US(1000), MS_TO_US(1000), MS_TO_US(100) },
+	{ "rainbow_fade", MS_TO_US(1000), MS_TO_US(1000), MS_TO_US(100) },
+	{ "state_of_charge", MS_TO_US(1000), MS_TO_US(1000), MS_TO_US(100) },
+	{ "neighbour_housekeeping", 0, MS_TO_US(2000), MS_TO_US(200) },
+	{ "ap_scan", MS_TO_US(2500), MS_TO_US(5000), MS_TO_US(500) },
+	{ "usb", MS_TO_US(100), MS_TO_US(10000), MS_TO_US(1000) },
+};
+
+static void sim_task_cb(void *ctx) {
+}
+
+// Returns timer wakeups per second for the firmware task set
+static double simulate_wakeups(scheduler_task_t *tasks, bool use_slack) {
+	int64_t start_us = now_us;
+	int64_t first_deadline_us[ARRAY_SIZE(sim_tasks)];
+	int64_t boot_us = 0;
+
+	// Modules initialize one after another during boot, same spacing for both runs
+	rand_state = 1;
+	for (int i = 0; i < ARRAY_SIZE(sim_tasks); i++) {
+		const sim_task_t *sim = &sim_tasks[i];
+		boot_us += rand_u32() % MS_TO_US(5);
+		first_deadline_us[i] = start_us + boot_us + sim->delay_us;
+		scheduler_task_init(&tasks[i], sim->name);
+		scheduler_task_set_slack(&tasks[i], use_slack ? sim->slack_us : 0);
+		scheduler_schedule_periodic(&tasks[i], sim_task_cb, NULL, boot_us + sim->delay_us, sim->period_us,
+					    SCHEDULER_PERIODIC_SKIP);
+	}
+
+	unsigned int wakeups = 0;
+	while (timer.deadline_us < start_us + COALESCE_DURATION_US) {
+		run_next_wakeup();
+		wakeups++;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(sim_tasks); i++) {
+		// Every period ran and no task ran past its slack
+		int64_t runs = (now_us - first_deadline_us[i]) / sim_tasks[i].period_us + 1;
+		CHECK(tasks[i].stats.invocations == runs || tasks[i].stats.invocations == runs - 1);
+		CHECK(tasks[i].stats.lateness_max_us <= tasks[i].slack_us);
+		scheduler_cancel(&tasks[i]);
+	}
+	return wakeups / (COALESCE_DURATION_US / 1e6);
+}
+
+static void test_slack_coalescing(void) {
+	static scheduler_task_t tasks_strict[ARRAY_SIZE(sim_tasks)];
+	static scheduler_task_t tasks_slack[ARRAY_SIZE(sim_tasks)];
+
+	// Let a stale timer from earlier tests fire first
+	while (timer.armed) {
+		run_next_wakeup();
+	}
+	double strict_per_s = simulate_wakeups(tasks_strict, false);
+	double slack_per_s = simulate_wakeups(tasks_slack, true);
+	printf("    wakeups/s without slack %.1f, with slack %.1f\n", strict_per_s, slack_per_s);
+	CHECK(slack_per_s < strict_per_s);
+}
+
+static unsigned int num_dispatches;
+
+static void count_dispatch(void *ctx) {
+	num_dispatches++;
+}
+
+static double bench_heap(scheduler_task_t *tasks, unsigned int num_tasks) {
+	int64_t period_us = (int64_t)num_tasks * BENCH_STAGGER_US;
+	for (unsigned int i = 0; i < num_tasks; i++) {
+		scheduler_schedule_periodic(&tasks[i], count_dispatch, NULL, (i + 1) * BENCH_STAGGER_US,
+					    period_us, SCHEDULER_PERIODIC_CATCH_UP);
+	}
+
+	num_dispatches = 0;
+	int64_t start_ns = test_get_time_ns();
+	while (num_dispatches < BENCH_DISPATCHES) {
+		run_next_wakeup();
+	}
+	double ns = (double)(test_get_time_ns() - start_ns) / num_dispatches;
+
+	for (unsigned int i = 0; i < num_tasks; i++) {
+		scheduler_cancel(&tasks[i]);
+	}
+	return ns;
+}
+
+static double bench_list(list_task_t *tasks, unsigned int num_tasks) {
+	int64_t period_us = (int64_t)num_tasks * BENCH_STAGGER_US;
+	for (unsigned int i = 0; i < num_tasks; i++) {
+		tasks[i].deadline_us = now_us + (i + 1) * BENCH_STAGGER_US;
+		tasks[i].period_us = period_us;
+		list_enqueue(&tasks[i]);
+	}
+
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < BENCH_DISPATCHES; i++) {
+		list_run_next();
+	}
+	double ns = (double)(test_get_time_ns() - start_ns) / BENCH_DISPATCHES;
+
+	INIT_LIST_HEAD(list_tasks);
+	return ns;
+}
+
+static void test_benchmark(void) {
+	static scheduler_task_t heap_tasks[MAX_BENCH_TASKS];
+	static list_task_t list_tasks_storage[MAX_BENCH_TASKS];
+	static const unsigned int task_counts[] = { 10, 100, 1000, MAX_BENCH_TASKS };
+
+	for (int i = 0; i < MAX_BENCH_TASKS; i++) {
+		scheduler_task_init(&heap_tasks[i], "bench");
+	}
+
+	// Periodic tasks on a mock clock, each dispatch requeues one task
+	printf("    Tasks  list       heap (ns/dispatch)\n");
+	for (int i = 0; i < ARRAY_SIZE(task_counts); i++) {
+		unsigned int num_tasks = task_counts[i];
+		double list_ns = bench_list(list_tasks_storage, num_tasks);
+		double heap_ns = bench_heap(heap_tasks, num_tasks);
+		printf("    %-6u %-10.1f %-10.1f\n", num_tasks, list_ns, heap_ns);
+	}
+}
+
+int main(void) {
+	scheduler_init();
+	TEST_RUN(test_many_tasks);
+	TEST_RUN(test_periodic_catch_up_no_drift);
+	TEST_RUN(test_periodic_skip_no_drift);
+	TEST_RUN(test_relative_rearm_drifts);
+	TEST_RUN(test_slack_coalescing);
+	TEST_RUN(test_benchmark);
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Stresses the SPSC ring with a producer and a consumer thread. Checks
+ * that items arrive complete and in order, including across the wrap of
+ * the 32 bit indices. Threads yield while the ring is full or empty,
+ * spinning alone would waste whole time slices on single core hosts.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spsc_ring.h"
+#include "util.h"
+
+#include "test.h"
+
+// Small enough to be full most of the time
+#define RING_SIZE		8
+#define STRESS_ITEMS		(1 << 24)
+#define POOL_ITEMS		(1 << 22)
+
+static void *slots[RING_SIZE];
+static spsc_ring_t ring;
+
+static void test_full_empty(void) {
+	spsc_ring_init(&ring, slots, RING_SIZE);
+	CHECK(!spsc_ring_pop(&ring));
+	for (uintptr_t i = 1; i <= RING_SIZE; i++) {
+		CHECK(spsc_ring_push(&ring, (void *)i));
+	}
+	CHECK(!spsc_ring_push(&ring, (void *)1));
+	CHECK_EQ(spsc_ring_count(&ring), RING_SIZE);
+	for (uintptr_t i = 1; i <= RING_SIZE; i++) {
+		CHECK_EQ((uintptr_t)spsc_ring_pop(&ring), i);
+	}
+	CHECK(!spsc_ring_pop(&ring));
+	CHECK_EQ(spsc_ring_count(&ring), 0);
+}
+
+static void *stress_producer(void *arg) {
+	for (uintptr_t i = 1; i <= STRESS_ITEMS; i++) {
+		while (!spsc_ring_push(&ring, (void *)i)) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void test_stress(void) {
+	// Start just before the indices wrap
+	spsc_ring_init(&ring, slots, RING_SIZE);
+	ring.head = ring.tail = UINT32_MAX - STRESS_ITEMS / 2;
+
+	pthread_t producer;
+	int64_t start_ns = test_get_time_ns();
+	CHECK_EQ(pthread_create(&producer, NULL, stress_producer, NULL), 0);
+	for (uintptr_t expected = 1; expected <= STRESS_ITEMS; expected++) {
+		void *ptr;
+		while (!(ptr = spsc_ring_pop(&ring))) {
+			sched_yield();
+		}
+		CHECK_EQ((uintptr_t)ptr, expected);
+	}
+	CHECK_EQ(pthread_join(producer, NULL), 0);
+	int64_t elapsed_ns = test_get_time_ns() - start_ns;
+
+	CHECK(!spsc_ring_pop(&ring));
+	printf("    %u items, %.1f M items/s\n", STRESS_ITEMS, STRESS_ITEMS * 1e3 / elapsed_ns);
+}
+
+/*
+ * Buffers circulating between a free ring and a queue ring like the
+ * wireless RX pool. The payload written before the push must be visible
+ * after the pop.
+ */
+typedef struct pool_item {
+	uint32_t seq;
+	uint32_t check;
+} pool_item_t;
+
+static pool_item_t pool[RING_SIZE];
+static void *free_slots[RING_SIZE];
+static void *queue_slots[RING_SIZE];
+static spsc_ring_t free_ring;
+static spsc_ring_t queue_ring;
+
+static void *pool_producer(void *arg) {
+	for (uint32_t seq = 0; seq < POOL_ITEMS; seq++) {
+		pool_item_t *item;
+		while (!(item = spsc_ring_pop(&free_ring))) {
+			sched_yield();
+		}
+		item->seq = seq;
+		item->check = ~seq;
+		CHECK(spsc_ring_push(&queue_ring, item));
+	}
+	return NULL;
+}
+
+static void test_buffer_pool(void) {
+	spsc_ring_init(&free_ring, free_slots, RING_SIZE);
+	spsc_ring_init(&queue_ring, queue_slots, RING_SIZE);
+	for (int i = 0; i < RING_SIZE; i++) {
+		CHECK(spsc_ring_push(&free_ring, &pool[i]));
+	}
+
+	pthread_t producer;
+	CHECK_EQ(pthread_create(&producer, NULL, pool_producer, NULL), 0);
+	for (uint32_t seq = 0; seq < POOL_ITEMS; seq++) {
+		pool_item_t *item;
+		while (!(item = spsc_ring_pop(&queue_ring))) {
+			sched_yield();
+		}
+		CHECK_EQ(item->seq, seq);
+		CHECK_EQ(item->check, ~seq);
+		// The producer may only reuse the buffer once it is back on the free ring
+		item->seq = UINT32_MAX;
+		CHECK(spsc_ring_push(&free_ring, item));
+	}
+	CHECK_EQ(pthread_join(producer, NULL), 0);
+
+	// No buffer lost
+	CHECK_EQ(spsc_ring_count(&free_ring), RING_SIZE);
+	CHECK_EQ(spsc_ring_count(&queue_ring), 0);
+}
+
+int main(void) {
+	TEST_RUN(test_full_empty);
+	TEST_RUN(test_stress);
+	TEST_RUN(test_buffer_pool);
+	return 0;
+}
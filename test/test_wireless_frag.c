@@ -0,0 +1,308 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mock_scheduler.h"
+#include "util.h"
+#include "wireless.h"
+#include "wireless_frag.h"
+#include "wireless_tx.h"
+
+#include "test.h"
+
+#define MESSAGE_TYPE		3
+// Fragment header as on air: type, message ID, index, count, length
+#define FRAG_HDR_SIZE		7
+#define FRAG_MESSAGE_ID_OFFSET	1
+#define MAX_FRAGMENTS		DIV_ROUND_UP(WIRELESS_FRAG_MAX_MESSAGE_SIZE, WIRELESS_MAX_PACKET_SIZE - FRAG_HDR_SIZE)
+
+/* Mocks */
+uint32_t esp_random(void) {
+	static uint32_t state = 1;
+	state = state * 1103515245 + 12345;
+	return state >> 8;
+}
+
+static wireless_rx_handler_f fragment_rx;
+
+esp_err_t wireless_register_handler(uint8_t packet_type, wireless_rx_handler_f fn, void *ctx, unsigned int flags) {
+	CHECK_EQ(packet_type, WIRELESS_PACKET_TYPE_FRAGMENT);
+	fragment_rx = fn;
+	return ESP_OK;
+}
+
+// Fragments of the last message as handed to the radio, other packets are not kept
+typedef struct message_frames {
+	unsigned int num_frames;
+	size_t len[MAX_FRAGMENTS];
+	uint8_t data[MAX_FRAGMENTS][WIRELESS_MAX_PACKET_SIZE];
+} message_frames_t;
+
+static message_frames_t sent;
+
+esp_err_t wireless_broadcast(const uint8_t *data, size_t len) {
+	if (data[0] != WIRELESS_PACKET_TYPE_FRAGMENT) {
+		return ESP_OK;
+	}
+	CHECK(sent.num_frames < MAX_FRAGMENTS);
+	sent.len[sent.num_frames] = len;
+	memcpy(sent.data[sent.num_frames], data, len);
+	sent.num_frames++;
+	return ESP_OK;
+}
+
+/* Receiving side */
+static unsigned int num_delivered;
+static uint8_t delivered_src[ESP_NOW_ETH_ALEN];
+static size_t delivered_len;
+static uint8_t delivered_data[WIRELESS_FRAG_MAX_MESSAGE_SIZE];
+
+static esp_err_t message_rx(const uint8_t *src_addr, const uint8_t *data, size_t len, void *ctx) {
+	num_delivered++;
+	memcpy(delivered_src, src_addr, sizeof(delivered_src));
+	delivered_len = len;
+	memcpy(delivered_data, data, len);
+	return ESP_OK;
+}
+
+static void make_message(uint8_t *data, size_t len, uint8_t seed) {
+	data[0] = MESSAGE_TYPE;
+	for (size_t i = 1; i < len; i++) {
+		data[i] = seed + i * 7;
+	}
+}
+
+// Sends a message and collects its fragments from the radio
+static void send_message(message_frames_t *frames, size_t len, uint8_t seed) {
+	uint8_t data[WIRELESS_FRAG_MAX_MESSAGE_SIZE];
+	make_message(data, len, seed);
+	sent.num_frames = 0;
+	CHECK_EQ(wireless_frag_send(data, len, WIRELESS_TX_PRIORITY_BULK), ESP_OK);
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(1000));
+	*frames = sent;
+}
+
+static void receive(const message_frames_t *frames, unsigned int idx, uint8_t sender) {
+	wireless_packet_t packet = {
+		.rx_timestamp = mock_now_us,
+		.src_addr = { 0x02, 0x00, 0x00, 0x00, 0x00, sender },
+		.len = frames->len[idx]
+	};
+	memcpy(packet.data, frames->data[idx], frames->len[idx]);
+	fragment_rx(&packet, NULL, NULL);
+}
+
+static bool delivered_matches(size_t len, uint8_t seed, uint8_t sender) {
+	uint8_t expected[WIRELESS_FRAG_MAX_MESSAGE_SIZE];
+	make_message(expected, len, seed);
+	return delivered_len == len && !memcmp(delivered_data, expected, len) && delivered_src[5] == sender;
+}
+
+static uint16_t message_id(const message_frames_t *frames) {
+	uint16_t id;
+	memcpy(&id, &frames->data[0][FRAG_MESSAGE_ID_OFFSET], sizeof(id));
+	return id;
+}
+
+static void set_message_id(message_frames_t *frames, uint16_t id) {
+	for (int i = 0; i < frames->num_frames; i++) {
+		memcpy(&frames->data[i][FRAG_MESSAGE_ID_OFFSET], &id, sizeof(id));
+	}
+}
+
+static wireless_frag_stats_t stats_before;
+
+static uint32_t stat_delta(size_t offset) {
+	wireless_frag_stats_t stats;
+	wireless_frag_get_stats(&stats);
+	return *(uint32_t *)((uint8_t *)&stats + offset) - *(uint32_t *)((uint8_t *)&stats_before + offset);
+}
+
+#define STAT_DELTA(field) stat_delta(offsetof(wireless_frag_stats_t, field))
+
+static void reset(void) {
+	// Past the reassembly timeout, nothing from earlier tests is still pending
+	mock_now_us += MS_TO_US(WIRELESS_FRAG_REASSEMBLY_TIMEOUT_MS * 2);
+	num_delivered = 0;
+	wireless_frag_get_stats(&stats_before);
+}
+
+static void test_single_fragment(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, 10, 1);
+	CHECK_EQ(frames.num_frames, 1);
+	receive(&frames, 0, 1);
+	CHECK_EQ(num_delivered, 1);
+	CHECK(delivered_matches(10, 1, 1));
+}
+
+static void test_in_order(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, WIRELESS_FRAG_MAX_MESSAGE_SIZE, 2);
+	CHECK_EQ(frames.num_frames, MAX_FRAGMENTS);
+	for (int i = 0; i < frames.num_frames; i++) {
+		CHECK_EQ(num_delivered, 0);
+		receive(&frames, i, 1);
+	}
+	CHECK_EQ(num_delivered, 1);
+	CHECK(delivered_matches(WIRELESS_FRAG_MAX_MESSAGE_SIZE, 2, 1));
+	CHECK_EQ(STAT_DELTA(messages_sent), 1);
+	CHECK_EQ(STAT_DELTA(messages_reassembled), 1);
+}
+
+static void test_reordering(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, 600, 3);
+	CHECK_EQ(frames.num_frames, 3);
+	receive(&frames, 2, 1);
+	receive(&frames, 0, 1);
+	CHECK_EQ(num_delivered, 0);
+	receive(&frames, 1, 1);
+	CHECK_EQ(num_delivered, 1);
+	CHECK(delivered_matches(600, 3, 1));
+}
+
+static void test_duplicates(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, 600, 4);
+	receive(&frames, 0, 1);
+	receive(&frames, 0, 1);
+	receive(&frames, 1, 1);
+	receive(&frames, 2, 1);
+	// Late duplicates of a complete message
+	receive(&frames, 1, 1);
+	receive(&frames, 2, 1);
+	CHECK_EQ(num_delivered, 1);
+	CHECK(delivered_matches(600, 4, 1));
+	CHECK_EQ(STAT_DELTA(fragments_duplicate), 3);
+}
+
+static void test_loss_times_out(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, 600, 5);
+	receive(&frames, 0, 1);
+	receive(&frames, 2, 1);
+	mock_now_us += MS_TO_US(WIRELESS_FRAG_REASSEMBLY_TIMEOUT_MS + 1);
+	// The lost fragment arrives too late to complete the message
+	receive(&frames, 1, 1);
+	CHECK_EQ(num_delivered, 0);
+	CHECK_EQ(STAT_DELTA(messages_timed_out), 1);
+
+	// A retransmission is reassembled from scratch
+	receive(&frames, 0, 1);
+	receive(&frames, 2, 1);
+	CHECK_EQ(num_delivered, 1);
+	CHECK(delivered_matches(600, 5, 1));
+}
+
+static void test_same_message_from_different_senders(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, 600, 6);
+	for (int i = 0; i < frames.num_frames; i++) {
+		receive(&frames, i, 1);
+		receive(&frames, i, 2);
+	}
+	CHECK_EQ(num_delivered, 2);
+	CHECK(delivered_matches(600, 6, 2));
+}
+
+static void test_many_concurrent_partial_messages(void) {
+	reset();
+	message_frames_t frames;
+	send_message(&frames, WIRELESS_FRAG_MAX_MESSAGE_SIZE, 7);
+
+	// More senders than reassembly buffers, each missing its last fragment
+	const unsigned int num_senders = WIRELESS_FRAG_NUM_REASSEMBLY_BUFFERS * 8;
+	for (int i = 0; i < frames.num_frames - 1; i++) {
+		for (unsigned int sender = 0; sender < num_senders; sender++) {
+			receive(&frames, i, sender);
+		}
+	}
+	CHECK_EQ(num_delivered, 0);
+	CHECK(STAT_DELTA(messages_evicted) >= num_senders - WIRELESS_FRAG_NUM_REASSEMBLY_BUFFERS);
+
+	// Memory is bounded by the buffer count, only the newest partial messages survive
+	for (unsigned int sender = 0; sender < num_senders; sender++) {
+		receive(&frames, frames.num_frames - 1, sender);
+	}
+	CHECK(num_delivered <= WIRELESS_FRAG_NUM_REASSEMBLY_BUFFERS);
+
+	// Complete messages still get through once the flood is over
+	reset();
+	for (int i = 0; i < frames.num_frames; i++) {
+		receive(&frames, i, 0xff);
+	}
+	CHECK_EQ(num_delivered, 1);
+	CHECK(delivered_matches(WIRELESS_FRAG_MAX_MESSAGE_SIZE, 7, 0xff));
+}
+
+static void test_sender_reboot_reuses_message_id(void) {
+	reset();
+	message_frames_t first, second;
+	send_message(&first, 600, 8);
+	send_message(&second, 600, 9);
+	CHECK(message_id(&first) != message_id(&second));
+	for (int i = 0; i < first.num_frames; i++) {
+		receive(&first, i, 1);
+	}
+	CHECK_EQ(num_delivered, 1);
+
+	// After a reboot the sender starts over and hits the ID of the first message
+	mock_now_us += MS_TO_US(WIRELESS_FRAG_REASSEMBLY_TIMEOUT_MS + 1);
+	set_message_id(&second, message_id(&first));
+	for (int i = 0; i < second.num_frames; i++) {
+		receive(&second, i, 1);
+	}
+	CHECK_EQ(num_delivered, 2);
+	CHECK(delivered_matches(600, 9, 1));
+}
+
+static void test_queue_full_sends_nothing(void) {
+	reset();
+	// Occupy all but a few slots with paced packets of a single type
+	for (int i = 0; i < WIRELESS_TX_QUEUE_SIZE - 2; i++) {
+		uint8_t packet[] = { WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO, i };
+		CHECK_EQ(wireless_tx_queue(packet, sizeof(packet), WIRELESS_TX_PRIORITY_BULK, 0, 1), ESP_OK);
+	}
+	wireless_tx_stats_t tx_stats_before, tx_stats;
+	wireless_tx_get_stats(&tx_stats_before);
+
+	uint8_t data[WIRELESS_FRAG_MAX_MESSAGE_SIZE];
+	make_message(data, sizeof(data), 10);
+	CHECK_EQ(wireless_frag_send(data, sizeof(data), WIRELESS_TX_PRIORITY_NORMAL), ESP_ERR_NO_MEM);
+	wireless_tx_get_stats(&tx_stats);
+	CHECK_EQ(tx_stats.packets_queued, tx_stats_before.packets_queued);
+	CHECK_EQ(tx_stats.packets_dropped, tx_stats_before.packets_dropped);
+	CHECK_EQ(STAT_DELTA(messages_sent), 0);
+
+	// Fits once the queue drained
+	sent.num_frames = 0;
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(1000));
+	message_frames_t frames;
+	send_message(&frames, sizeof(data), 10);
+	CHECK_EQ(frames.num_frames, MAX_FRAGMENTS);
+}
+
+int main(void) {
+	wireless_tx_init();
+	wireless_frag_init();
+	CHECK_EQ(wireless_frag_register_handler(MESSAGE_TYPE, message_rx, NULL), ESP_OK);
+
+	TEST_RUN(test_single_fragment);
+	TEST_RUN(test_in_order);
+	TEST_RUN(test_reordering);
+	TEST_RUN(test_duplicates);
+	TEST_RUN(test_loss_times_out);
+	TEST_RUN(test_same_message_from_different_senders);
+	TEST_RUN(test_many_concurrent_partial_messages);
+	TEST_RUN(test_sender_reboot_reuses_message_id);
+	TEST_RUN(test_queue_full_sends_nothing);
+	return 0;
+}
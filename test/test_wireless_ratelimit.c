@@ -0,0 +1,198 @@
+/*
+ * Flood simulations for the per-source rate limits. A group of 100
+ * nodes exchanges its usual traffic while single or spoofed sources
+ * flood, legitimate bonks must keep getting through.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+#include "wireless.h"
+#include "wireless_ratelimit.h"
+
+#include "test.h"
+
+#define GROUP_SIZE		100
+#define SIM_DURATION_US		MS_TO_US(10000)
+#define TICK_US			100
+// Budgets from wireless_ratelimit.c
+#define TYPE_REALTIME_RATE	60
+#define TYPE_REALTIME_BURST	20
+
+/* Mocks */
+static int64_t now_us;
+
+int64_t esp_timer_get_time(void) {
+	return now_us;
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t sim_random(void) {
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+typedef struct node {
+	uint8_t address[ESP_NOW_ETH_ALEN];
+	int64_t next_status_us;
+	int64_t next_bonk_us;
+	unsigned int bonks_sent;
+	unsigned int bonks_admitted;
+	unsigned int packets_dropped;
+} node_t;
+
+typedef struct flooder {
+	unsigned int num_addresses;
+	// Frames per second over all addresses
+	unsigned int rate;
+	unsigned int frames_sent;
+	unsigned int frames_admitted;
+} flooder_t;
+
+static node_t nodes[GROUP_SIZE];
+
+static void make_address(uint8_t *address, uint8_t prefix, unsigned int idx) {
+	address[0] = 0x02;
+	address[1] = prefix;
+	address[2] = 0;
+	address[3] = idx >> 16;
+	address[4] = idx >> 8;
+	address[5] = idx;
+}
+
+// Same order of checks as recv_cb(), minus the crypto in between
+static bool receive(const uint8_t *address, uint8_t packet_type, bool realtime) {
+	wireless_ratelimit_source_t *source;
+	if (!wireless_ratelimit_admit(address, now_us, &source)) {
+		return false;
+	}
+	return wireless_ratelimit_admit_type(source, packet_type, realtime, now_us);
+}
+
+static void node_tick(node_t *node) {
+	// Status and advertisement once a second
+	if (now_us >= node->next_status_us) {
+		node->next_status_us = now_us + MS_TO_US(1000);
+		if (!receive(node->address, WIRELESS_PACKET_TYPE_NEIGHBOUR_ADVERTISEMENT, false)) {
+			node->packets_dropped++;
+		}
+		if (!receive(node->address, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, false)) {
+			node->packets_dropped++;
+		}
+	}
+	// Bonks come in short bursts of repeats every few hundred ms
+	if (now_us >= node->next_bonk_us) {
+		node->next_bonk_us = now_us + MS_TO_US(200) + sim_random() % MS_TO_US(600);
+		for (int i = 0; i < 3; i++) {
+			node->bonks_sent++;
+			if (receive(node->address, WIRELESS_PACKET_TYPE_BONK, true)) {
+				node->bonks_admitted++;
+			} else {
+				node->packets_dropped++;
+			}
+		}
+	}
+}
+
+static void flooder_tick(flooder_t *flooder, int64_t elapsed_us) {
+	unsigned int frames_due = elapsed_us * flooder->rate / 1000000;
+	while (flooder->frames_sent < frames_due) {
+		uint8_t address[ESP_NOW_ETH_ALEN];
+		make_address(address, 0xba, flooder->frames_sent % flooder->num_addresses);
+		flooder->frames_sent++;
+		if (receive(address, WIRELESS_PACKET_TYPE_BONK, true)) {
+			flooder->frames_admitted++;
+		}
+	}
+}
+
+// Runs the group and an optional flooder for SIM_DURATION_US
+static void simulate(flooder_t *flooder) {
+	int64_t start_us = now_us;
+	for (int i = 0; i < ARRAY_SIZE(nodes); i++) {
+		node_t *node = &nodes[i];
+		memset(node, 0, sizeof(*node));
+		make_address(node->address, 0x00, i);
+		node->next_status_us = start_us + sim_random() % MS_TO_US(1000);
+		node->next_bonk_us = start_us + sim_random() % MS_TO_US(1000);
+	}
+
+	while (now_us - start_us < SIM_DURATION_US) {
+		now_us += TICK_US;
+		for (int i = 0; i < ARRAY_SIZE(nodes); i++) {
+			node_tick(&nodes[i]);
+		}
+		if (flooder) {
+			flooder_tick(flooder, now_us - start_us);
+		}
+	}
+	// Leave all buckets full for the next simulation
+	now_us += MS_TO_US(10000);
+}
+
+static void check_group_unaffected(void) {
+	unsigned int bonks_sent = 0;
+	unsigned int bonks_admitted = 0;
+	for (int i = 0; i < ARRAY_SIZE(nodes); i++) {
+		CHECK_EQ(nodes[i].packets_dropped, 0);
+		bonks_sent += nodes[i].bonks_sent;
+		bonks_admitted += nodes[i].bonks_admitted;
+	}
+	CHECK(bonks_sent > GROUP_SIZE * 10);
+	CHECK_EQ(bonks_admitted, bonks_sent);
+	printf("    %u of %u bonks from %u nodes admitted\n", bonks_admitted, bonks_sent, GROUP_SIZE);
+}
+
+// Upper bound for what a flooder may get admitted over the simulation
+static unsigned int flood_budget(unsigned int num_addresses) {
+	return num_addresses * (TYPE_REALTIME_RATE * SIM_DURATION_US / 1000000 + TYPE_REALTIME_BURST);
+}
+
+static void test_group_without_flood(void) {
+	simulate(NULL);
+	check_group_unaffected();
+}
+
+static void test_single_source_flood(void) {
+	flooder_t flooder = {
+		.num_addresses = 1,
+		.rate = 5000
+	};
+	simulate(&flooder);
+	check_group_unaffected();
+	printf("    flooder: %u of %u frames admitted\n", flooder.frames_admitted, flooder.frames_sent);
+	CHECK(flooder.frames_admitted <= flood_budget(1));
+}
+
+static void test_spoofed_sources_within_table(void) {
+	// Together with the group this just fits the source table
+	flooder_t flooder = {
+		.num_addresses = WIRELESS_RATELIMIT_NUM_SOURCES - GROUP_SIZE,
+		.rate = 10000
+	};
+	simulate(&flooder);
+	check_group_unaffected();
+	printf("    %u flooder addresses: %u of %u frames admitted\n",
+	       flooder.num_addresses, flooder.frames_admitted, flooder.frames_sent);
+	CHECK(flooder.frames_admitted <= flood_budget(flooder.num_addresses));
+}
+
+static void test_spoofed_sources_beyond_table(void) {
+	// Limiting gets lenient once the table thrashes, but never stricter for the group
+	flooder_t flooder = {
+		.num_addresses = WIRELESS_RATELIMIT_NUM_SOURCES * 2,
+		.rate = 10000
+	};
+	simulate(&flooder);
+	check_group_unaffected();
+}
+
+int main(void) {
+	TEST_RUN(test_group_without_flood);
+	TEST_RUN(test_single_source_flood);
+	TEST_RUN(test_spoofed_sources_within_table);
+	TEST_RUN(test_spoofed_sources_beyond_table);
+	return 0;
+}
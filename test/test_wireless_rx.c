@@ -0,0 +1,778 @@
+/*
+ * Runs the ESP-NOW receive callback of wireless.c against floods of bad
+ * frames. Each flood reports the host CPU time per rejected frame, and
+ * checks that the rejecting stage did not decrypt anything. Also checks
+ * ChaCha20-Poly1305 frames end to end against RFC 8439, compares packet
+ * rates with the legacy ChaCha20 + HMAC-SHA1 mode and measures realtime
+ * dispatch latency while bulk traffic saturates the bulk queue.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+#include "mock_wifi.h"
+#include "neighbour.h"
+#include "poly1305.h"
+#include "replay_window.h"
+#include "util.h"
+#include "wireless.h"
+
+#include "test.h"
+
+#define FLOOD_FRAMES		20000
+#define HDR_LEN			20
+#define HDR_TAG_OFFSET		12
+#define HDR_TAG_LEN		8
+// Most significant byte of the little endian packet counter, holds the AEAD flag
+#define HDR_AEAD_FLAG_OFFSET	7
+#define FRAME_LEN		(HDR_LEN + WIRELESS_MAX_PACKET_SIZE)
+#define BENCH_FRAMES		5000
+// Slower than any of the rate limits, so that only the stage under test rejects
+#define FRAME_SPACING_US	MS_TO_US(60)
+
+// Bulk senders within their rate limits, together faster than the main loop handles
+#define SATURATE_NODES		20
+#define SATURATE_INTERVAL_US	MS_TO_US(100)
+#define SATURATE_BULK_COST_US	MS_TO_US(10)
+#define SATURATE_RT_COST_US	100
+#define SATURATE_RT_INTERVAL_US	MS_TO_US(50)
+#define SATURATE_DURATION_US	MS_TO_US(10000)
+#define SATURATE_STEP_US	MS_TO_US(1)
+
+/* Mocks */
+static int64_t now_us = MS_TO_US(1000);
+static bool has_neighbours;
+static replay_window_t neighbour_replay_window;
+
+int64_t esp_timer_get_time(void) {
+	return now_us;
+}
+
+uint32_t esp_random(void) {
+	static uint32_t state = 1;
+	state = state * 1103515245 + 12345;
+	return state >> 8;
+}
+
+void post_event(EventBits_t bits) { }
+
+int64_t neighbour_get_global_clock(void) {
+	return now_us;
+}
+
+bool neighbour_has_neighbours(void) {
+	return has_neighbours;
+}
+
+const neighbour_t *neighbour_find_by_address(const uint8_t *address) {
+	return NULL;
+}
+
+// The local node is its own only known neighbour
+esp_err_t neighbour_replay_check(const uint8_t *address, uint32_t random_id, uint32_t packet_cnt, uint32_t timestamp) {
+	if (memcmp(address, mock_wifi_mac, sizeof(mock_wifi_mac))) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	return replay_window_check(&neighbour_replay_window, random_id, packet_cnt, timestamp) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t neighbour_replay_update(const uint8_t *address, uint32_t random_id, uint32_t packet_cnt, uint32_t timestamp) {
+	if (memcmp(address, mock_wifi_mac, sizeof(mock_wifi_mac))) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	replay_window_update(&neighbour_replay_window, random_id, packet_cnt, timestamp);
+	return ESP_OK;
+}
+
+/*
+ * Linked with --wrap, counts payload decryptions. Poly1305 key derivation
+ * runs in place over a single block and is not counted.
+ */
+static unsigned int num_decrypts;
+
+void __real_chacha20_xor(chacha20_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len);
+
+void __wrap_chacha20_xor(chacha20_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len) {
+	if (dst != src) {
+		num_decrypts++;
+	}
+	__real_chacha20_xor(ctx, dst, src, len);
+}
+
+static uint8_t sent_frame[FRAME_LEN];
+static size_t sent_len;
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len) {
+	CHECK(len <= sizeof(sent_frame));
+	memcpy(sent_frame, data, len);
+	sent_len = len;
+	return ESP_OK;
+}
+
+typedef struct latency_rec {
+	unsigned int packets;
+	int64_t total_us;
+	int64_t max_us;
+} latency_rec_t;
+
+static latency_rec_t bonk_latency;
+static latency_rec_t squish_latency;
+// Main loop is busy with a handler until then
+static int64_t main_loop_busy_until_us;
+
+static void record_dispatch(latency_rec_t *rec, const wireless_packet_t *packet, int64_t cost_us) {
+	int64_t latency_us = now_us - packet->rx_timestamp;
+	rec->packets++;
+	rec->total_us += latency_us;
+	rec->max_us = MAX(rec->max_us, latency_us);
+	main_loop_busy_until_us = now_us + cost_us;
+}
+
+static esp_err_t bonk_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	record_dispatch(&bonk_latency, packet, SATURATE_RT_COST_US);
+	return ESP_OK;
+}
+
+static esp_err_t squish_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	record_dispatch(&squish_latency, packet, SATURATE_RT_COST_US);
+	return ESP_OK;
+}
+
+static esp_err_t status_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	main_loop_busy_until_us = now_us + SATURATE_BULK_COST_US;
+	return ESP_OK;
+}
+
+// Last sub-message handed to capture_rx by the aggregate handler
+static unsigned int num_captured;
+static wireless_packet_t captured;
+
+static esp_err_t capture_rx(const wireless_packet_t *packet, const neighbour_t *neigh, void *ctx) {
+	captured = *packet;
+	num_captured++;
+	return ESP_OK;
+}
+
+static uint8_t legit_address[ESP_NOW_ETH_ALEN];
+static uint8_t attacker_address[ESP_NOW_ETH_ALEN] = { 0x02, 0xba, 0xdb, 0xad, 0xba, 0xd0 };
+
+// Encrypted frame from the local node, which doubles as the legitimate sender
+static size_t make_frame(uint8_t *frame, uint8_t packet_type, size_t len) {
+	uint8_t payload[WIRELESS_MAX_PACKET_SIZE] = { packet_type };
+	CHECK_EQ(wireless_broadcast(payload, len), ESP_OK);
+	memcpy(frame, sent_frame, sent_len);
+	return sent_len;
+}
+
+static void receive(const uint8_t *src_addr, const uint8_t *frame, size_t len) {
+	esp_now_recv_info_t info = {
+		.src_addr = (uint8_t *)src_addr
+	};
+	mock_wifi_recv_cb(&info, frame, len);
+}
+
+static unsigned int drain(void) {
+	unsigned int num_packets = 0;
+	wireless_packet_t *packet;
+	while ((packet = wireless_rx_dequeue())) {
+		wireless_packet_release(packet);
+		num_packets++;
+	}
+	return num_packets;
+}
+
+static uint32_t rejected(wireless_rx_reject_t stage) {
+	wireless_rx_stats_t stats;
+	wireless_get_rx_stats(&stats);
+	return stats.rejected[stage];
+}
+
+static int64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+typedef void (*flood_frame_f)(uint8_t *frame, size_t len, unsigned int i);
+
+/*
+ * Feeds FLOOD_FRAMES variants of a frame to the receive callback and
+ * returns the average time spent per frame.
+ */
+static double flood(const char *name, const uint8_t *src_addr, const uint8_t *frame, size_t len,
+		    flood_frame_f mutate, int64_t spacing_us) {
+	uint8_t flood_frame[FRAME_LEN];
+	memcpy(flood_frame, frame, len);
+	int64_t elapsed_ns = 0;
+	for (unsigned int i = 0; i < FLOOD_FRAMES; i++) {
+		now_us += spacing_us;
+		if (mutate) {
+			mutate(flood_frame, len, i);
+		}
+		int64_t start_ns = get_time_ns();
+		receive(src_addr, flood_frame, len);
+		elapsed_ns += get_time_ns() - start_ns;
+		drain();
+	}
+	double ns_per_frame = (double)elapsed_ns / FLOOD_FRAMES;
+	printf("    %-22s %8.0f ns/frame\n", name, ns_per_frame);
+	return ns_per_frame;
+}
+
+static void forge_tag(uint8_t *frame, size_t len, unsigned int i) {
+	memcpy(&frame[HDR_TAG_OFFSET], &i, sizeof(i));
+}
+
+static void test_flood_short(void) {
+	uint8_t frame[FRAME_LEN] = { 0 };
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_LENGTH);
+	unsigned int decrypts_before = num_decrypts;
+	flood("length", attacker_address, frame, 8, NULL, FRAME_SPACING_US);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_LENGTH) - rejected_before, FLOOD_FRAMES);
+	CHECK_EQ(num_decrypts, decrypts_before);
+}
+
+static void test_flood_over_rate(void) {
+	uint8_t frame[FRAME_LEN];
+	size_t len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, WIRELESS_MAX_PACKET_SIZE);
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_RATELIMIT);
+	unsigned int decrypts_before = num_decrypts;
+	// Back to back, all but the burst budget of the source is shed
+	flood("source rate limit", attacker_address, frame, len, forge_tag, 0);
+	CHECK(rejected(WIRELESS_RX_REJECT_RATELIMIT) - rejected_before >= FLOOD_FRAMES - 40);
+	CHECK_EQ(num_decrypts, decrypts_before);
+	now_us += MS_TO_US(1000);
+}
+
+static void test_flood_stale(void) {
+	uint8_t frame[FRAME_LEN];
+	size_t len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, WIRELESS_MAX_PACKET_SIZE);
+	has_neighbours = true;
+	now_us += MS_TO_US(1000);
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_TIMESTAMP);
+	unsigned int decrypts_before = num_decrypts;
+	flood("stale timestamp", legit_address, frame, len, NULL, FRAME_SPACING_US);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_TIMESTAMP) - rejected_before, FLOOD_FRAMES);
+	CHECK_EQ(num_decrypts, decrypts_before);
+	has_neighbours = false;
+}
+
+static void test_flood_replay(void) {
+	uint8_t frame[FRAME_LEN];
+	size_t len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, WIRELESS_MAX_PACKET_SIZE);
+	receive(legit_address, frame, len);
+	CHECK_EQ(drain(), 1);
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_REPLAY);
+	unsigned int decrypts_before = num_decrypts;
+	flood("replay", legit_address, frame, len, NULL, FRAME_SPACING_US);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_REPLAY) - rejected_before, FLOOD_FRAMES);
+	CHECK_EQ(num_decrypts, decrypts_before);
+}
+
+static void flood_forged(bool aead) {
+	wireless_set_aead_enable(aead);
+	uint8_t frame[FRAME_LEN];
+	size_t len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, WIRELESS_MAX_PACKET_SIZE);
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_AUTH);
+	unsigned int decrypts_before = num_decrypts;
+	flood(aead ? "forged tag (AEAD)" : "forged tag (legacy)", attacker_address, frame, len, forge_tag,
+	      FRAME_SPACING_US);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_AUTH) - rejected_before, FLOOD_FRAMES);
+	// Legacy mode authenticates the plaintext and has to decrypt first
+	CHECK_EQ(num_decrypts - decrypts_before, aead ? 0 : FLOOD_FRAMES);
+
+	// Reference: frames that authenticate and get decrypted
+	static uint8_t frames[FLOOD_FRAMES][FRAME_LEN];
+	for (int i = 0; i < FLOOD_FRAMES; i++) {
+		make_frame(frames[i], WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, WIRELESS_MAX_PACKET_SIZE);
+	}
+	wireless_rx_stats_t stats_before, stats;
+	wireless_get_rx_stats(&stats_before);
+	decrypts_before = num_decrypts;
+	int64_t elapsed_ns = 0;
+	for (int i = 0; i < FLOOD_FRAMES; i++) {
+		now_us += FRAME_SPACING_US;
+		int64_t start_ns = get_time_ns();
+		receive(legit_address, frames[i], len);
+		elapsed_ns += get_time_ns() - start_ns;
+		drain();
+	}
+	double valid_ns = (double)elapsed_ns / FLOOD_FRAMES;
+	printf("    %-22s %8.0f ns/frame\n", aead ? "valid (AEAD)" : "valid (legacy)", valid_ns);
+	wireless_get_rx_stats(&stats);
+	CHECK_EQ(stats.packets_received - stats_before.packets_received, FLOOD_FRAMES);
+	CHECK_EQ(num_decrypts - decrypts_before, FLOOD_FRAMES);
+}
+
+static void test_flood_forged(void) {
+	flood_forged(false);
+	flood_forged(true);
+}
+
+static void test_pool_exhausted_without_decrypt(void) {
+	now_us += MS_TO_US(10000);
+	uint8_t frame[FRAME_LEN];
+	size_t len;
+
+	// A bonk marks the legitimate sender as a realtime source
+	len = make_frame(frame, WIRELESS_PACKET_TYPE_BONK, 1);
+	receive(legit_address, frame, len);
+	CHECK_EQ(drain(), 1);
+
+	// Occupy the whole bulk pool, spread over types to stay within their budgets
+	static const uint8_t bulk_types[] = {
+		WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS,
+		WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO
+	};
+	for (int i = 0; i < 16; i++) {
+		len = make_frame(frame, bulk_types[i % ARRAY_SIZE(bulk_types)], 1);
+		receive(legit_address, frame, len);
+	}
+
+	wireless_rx_stats_t stats_before, stats;
+	wireless_get_rx_stats(&stats_before);
+	len = make_frame(frame, WIRELESS_PACKET_TYPE_BONK, WIRELESS_MAX_PACKET_SIZE);
+	unsigned int decrypts_before = num_decrypts;
+	for (unsigned int i = 0; i < 20; i++) {
+		forge_tag(frame, len, i);
+		receive(attacker_address, frame, len);
+	}
+	wireless_get_rx_stats(&stats);
+	CHECK_EQ(stats.pool_exhausted[WIRELESS_NUM_PACKET_TYPES] - stats_before.pool_exhausted[WIRELESS_NUM_PACKET_TYPES], 20);
+	CHECK_EQ(num_decrypts, decrypts_before);
+
+	// Bulk frames of the realtime sender must not hold on to reserved buffers
+	for (int i = 0; i < 2 * 8; i++) {
+		len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 1);
+		receive(legit_address, frame, len);
+	}
+	wireless_get_rx_stats(&stats);
+	CHECK_EQ(stats.pool_exhausted[WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS] -
+		 stats_before.pool_exhausted[WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS], 2 * 8);
+	CHECK_EQ(stats.packets_received, stats_before.packets_received);
+
+	// Reserved buffers still take the realtime sender's frames
+	len = make_frame(frame, WIRELESS_PACKET_TYPE_BONK, 1);
+	receive(legit_address, frame, len);
+	wireless_get_rx_stats(&stats);
+	CHECK_EQ(stats.packets_received - stats_before.packets_received, 1);
+	wireless_packet_t *packet = wireless_rx_dequeue();
+	CHECK(packet);
+	CHECK_EQ(packet->data[0], WIRELESS_PACKET_TYPE_BONK);
+	wireless_packet_release(packet);
+	CHECK_EQ(drain(), 16);
+}
+
+/*
+ * AEAD construction of RFC 8439 section 2.8 in one piece, independent of
+ * the incremental one in wireless.c.
+ */
+static void reference_aead_tag(uint8_t tag[POLY1305_TAG_SIZE], const uint8_t key[CHACHA20_KEY_SIZE],
+			       const uint8_t nonce[12], const uint8_t *aad, size_t aad_len,
+			       const uint8_t *ciphertext, size_t len) {
+	uint8_t poly1305_key[CHACHA20_BLOCK_SIZE] = { 0 };
+	chacha20_ctx_t chacha20;
+	chacha20_init(&chacha20, key, nonce, 0);
+	chacha20_xor_inplace(&chacha20, poly1305_key, sizeof(poly1305_key));
+
+	uint8_t mac_data[512] = { 0 };
+	size_t pos = 0;
+	memcpy(&mac_data[pos], aad, aad_len);
+	pos += DIV_ROUND_UP(aad_len, 16) * 16;
+	memcpy(&mac_data[pos], ciphertext, len);
+	pos += DIV_ROUND_UP(len, 16) * 16;
+	for (int i = 0; i < 8; i++) {
+		mac_data[pos + i] = (uint64_t)aad_len >> (i * 8);
+		mac_data[pos + 8 + i] = (uint64_t)len >> (i * 8);
+	}
+	pos += 16;
+	CHECK(pos <= sizeof(mac_data));
+
+	poly1305_ctx_t poly1305;
+	poly1305_init(&poly1305, poly1305_key);
+	poly1305_update(&poly1305, mac_data, pos);
+	poly1305_finish(&poly1305, tag);
+}
+
+static void test_aead_reference_vector(void) {
+	// RFC 8439 section 2.8.2
+	static const uint8_t key[CHACHA20_KEY_SIZE] = {
+		0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+		0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f
+	};
+	static const uint8_t nonce[12] = {
+		0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47
+	};
+	static const uint8_t aad[] = {
+		0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7
+	};
+	static const char plaintext[] =
+		"Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+		"sunscreen would be it.";
+	static const uint8_t expected_tag[POLY1305_TAG_SIZE] = {
+		0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91
+	};
+
+	uint8_t ciphertext[sizeof(plaintext) - 1];
+	chacha20_ctx_t chacha20;
+	chacha20_init(&chacha20, key, nonce, 1);
+	chacha20_xor(&chacha20, ciphertext, (const uint8_t *)plaintext, sizeof(ciphertext));
+	uint8_t tag[POLY1305_TAG_SIZE];
+	reference_aead_tag(tag, key, nonce, aad, sizeof(aad), ciphertext, sizeof(ciphertext));
+	CHECK(!memcmp(tag, expected_tag, sizeof(tag)));
+}
+
+static void test_aead_round_trip(void) {
+	// Ciphertext lengths around the Poly1305 block padding
+	static const size_t lengths[] = { 1, 2, 15, 16, 17, 31, 32, 64, 100, WIRELESS_MAX_PACKET_SIZE };
+	now_us += MS_TO_US(10000);
+	for (int i = 0; i < ARRAY_SIZE(lengths); i++) {
+		size_t len = lengths[i];
+		uint8_t payload[WIRELESS_MAX_PACKET_SIZE] = { WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS };
+		for (size_t pos = 1; pos < len; pos++) {
+			payload[pos] = esp_random();
+		}
+		CHECK_EQ(wireless_broadcast(payload, len), ESP_OK);
+		CHECK_EQ(sent_len, HDR_LEN + len);
+		CHECK(sent_frame[HDR_AEAD_FLAG_OFFSET] & 0x80);
+		CHECK(memcmp(&sent_frame[HDR_LEN], payload, len));
+
+		// Tag as specified, truncated to the header field
+		uint8_t tag[POLY1305_TAG_SIZE];
+		reference_aead_tag(tag, mock_wifi_key, sent_frame, mock_wifi_mac, sizeof(mock_wifi_mac),
+				   &sent_frame[HDR_LEN], len);
+		CHECK(!memcmp(&sent_frame[HDR_TAG_OFFSET], tag, HDR_TAG_LEN));
+
+		now_us += FRAME_SPACING_US;
+		receive(legit_address, sent_frame, sent_len);
+		wireless_packet_t *packet = wireless_rx_dequeue();
+		CHECK(packet);
+		CHECK_EQ(packet->len, len);
+		CHECK(!memcmp(packet->data, payload, len));
+		CHECK(!memcmp(packet->src_addr, legit_address, sizeof(legit_address)));
+		wireless_packet_release(packet);
+	}
+}
+
+static void test_aead_flipped_bits(void) {
+	uint8_t frame[FRAME_LEN];
+	size_t len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 24);
+	now_us += MS_TO_US(10000);
+
+	// Any single flipped bit in nonce, tag or ciphertext must be rejected
+	for (size_t bit = 0; bit < len * 8; bit++) {
+		uint8_t flipped[FRAME_LEN];
+		memcpy(flipped, frame, len);
+		flipped[bit / 8] ^= 1 << (bit % 8);
+		now_us += FRAME_SPACING_US;
+		receive(legit_address, flipped, len);
+		CHECK(!wireless_rx_dequeue());
+	}
+
+	now_us += FRAME_SPACING_US;
+	receive(legit_address, frame, len);
+	CHECK_EQ(drain(), 1);
+}
+
+static void test_key_change(void) {
+	uint8_t old_frame[FRAME_LEN], frame[FRAME_LEN];
+	size_t old_len = make_frame(old_frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 16);
+	uint8_t key[WIRELESS_ENCRYPTION_KEY_SIZE];
+	memset(key, 0x5a, sizeof(key));
+	CHECK_EQ(wireless_set_encryption_key(key, sizeof(key) - 1), ESP_ERR_INVALID_ARG);
+	CHECK_EQ(wireless_set_encryption_key(key, sizeof(key)), ESP_OK);
+	now_us += MS_TO_US(10000);
+
+	for (int aead = 0; aead < 2; aead++) {
+		wireless_set_aead_enable(aead);
+		size_t len = make_frame(frame, WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 16);
+		now_us += FRAME_SPACING_US;
+		receive(legit_address, frame, len);
+		CHECK_EQ(drain(), 1);
+	}
+
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_AUTH);
+	now_us += FRAME_SPACING_US;
+	receive(legit_address, old_frame, old_len);
+	CHECK_EQ(drain(), 0);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_AUTH) - rejected_before, 1);
+
+	CHECK_EQ(wireless_set_encryption_key(mock_wifi_key, sizeof(mock_wifi_key)), ESP_OK);
+}
+
+// Sends an aggregate from the legitimate sender, returns the number of packets queued for it
+static unsigned int receive_aggregate(const uint8_t *payload, size_t len) {
+	CHECK_EQ(wireless_broadcast(payload, len), ESP_OK);
+	now_us += FRAME_SPACING_US;
+	receive(legit_address, sent_frame, sent_len);
+	unsigned int num_packets = 0;
+	wireless_packet_t *packet;
+	while ((packet = wireless_rx_dequeue())) {
+		wireless_dispatch(packet);
+		wireless_packet_release(packet);
+		num_packets++;
+	}
+	return num_packets;
+}
+
+static void test_aggregate_split(void) {
+	now_us += MS_TO_US(10000);
+	num_captured = 0;
+	static const uint8_t aggregate[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 3, 0x11, 0x12, 0x13,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 0,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x21
+	};
+	CHECK_EQ(receive_aggregate(aggregate, sizeof(aggregate)), 1);
+	CHECK_EQ(num_captured, 3);
+	CHECK_EQ(captured.len, 2);
+	CHECK_EQ(captured.data[0], WIRELESS_PACKET_TYPE_DEFAULT_COLOR);
+	CHECK_EQ(captured.data[1], 0x21);
+	CHECK(!memcmp(captured.src_addr, legit_address, sizeof(legit_address)));
+
+	// Empty aggregates are valid, if pointless
+	static const uint8_t empty[] = { WIRELESS_PACKET_TYPE_AGGREGATE };
+	CHECK_EQ(receive_aggregate(empty, sizeof(empty)), 1);
+	CHECK_EQ(num_captured, 3);
+}
+
+static void test_aggregate_max_length(void) {
+	now_us += MS_TO_US(10000);
+	num_captured = 0;
+	// A single sub-message filling the whole frame
+	uint8_t aggregate[WIRELESS_MAX_PACKET_SIZE] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE, WIRELESS_PACKET_TYPE_DEFAULT_COLOR, WIRELESS_MAX_PACKET_SIZE - 3
+	};
+	for (int i = 3; i < sizeof(aggregate); i++) {
+		aggregate[i] = i;
+	}
+	CHECK_EQ(receive_aggregate(aggregate, sizeof(aggregate)), 1);
+	CHECK_EQ(num_captured, 1);
+	CHECK_EQ(captured.len, WIRELESS_MAX_PACKET_SIZE - 2);
+	CHECK(!memcmp(&captured.data[1], &aggregate[3], WIRELESS_MAX_PACKET_SIZE - 3));
+
+	// One byte more than the frame holds
+	aggregate[2]++;
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_AGGREGATE);
+	CHECK_EQ(receive_aggregate(aggregate, sizeof(aggregate)), 0);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_AGGREGATE) - rejected_before, 1);
+	CHECK_EQ(num_captured, 1);
+}
+
+static void test_aggregate_malformed(void) {
+	now_us += MS_TO_US(10000);
+	num_captured = 0;
+	// Valid sub-messages ahead of the defect must not be dispatched either
+	static const uint8_t truncated_value[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x11,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 3, 0x21, 0x22
+	};
+	static const uint8_t truncated_header[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x11,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR
+	};
+	static const uint8_t nested[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x11,
+		WIRELESS_PACKET_TYPE_AGGREGATE, 3, WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x21
+	};
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_AGGREGATE);
+	CHECK_EQ(receive_aggregate(truncated_value, sizeof(truncated_value)), 0);
+	CHECK_EQ(receive_aggregate(truncated_header, sizeof(truncated_header)), 0);
+	CHECK_EQ(receive_aggregate(nested, sizeof(nested)), 0);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_AGGREGATE) - rejected_before, 3);
+	CHECK_EQ(num_captured, 0);
+}
+
+static void test_aggregate_type_budget(void) {
+	now_us += MS_TO_US(10000);
+	num_captured = 0;
+	// Each sub-message counts against the budget of its own type
+	static const uint8_t aggregate[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x11,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x12,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x13,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x14
+	};
+	uint32_t rejected_before = rejected(WIRELESS_RX_REJECT_RATELIMIT_TYPE);
+	unsigned int num_aggregates = 0;
+	for (int i = 0; i < 10; i++) {
+		num_aggregates += receive_aggregate(aggregate, sizeof(aggregate));
+	}
+	// Bulk budget is a burst of 10 plus what trickles in over 10 frame spacings
+	CHECK(num_aggregates <= 4);
+	CHECK_EQ(rejected(WIRELESS_RX_REJECT_RATELIMIT_TYPE) - rejected_before, 10 - num_aggregates);
+	CHECK_EQ(num_captured, num_aggregates * 4);
+
+	// Realtime types inside aggregates use the realtime budget, but never the realtime queue
+	now_us += MS_TO_US(10000);
+	static const uint8_t bonk_aggregate[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_BONK, 1, 0x01,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 0x11
+	};
+	unsigned int bonks_before = bonk_latency.packets;
+	CHECK_EQ(wireless_broadcast(bonk_aggregate, sizeof(bonk_aggregate)), ESP_OK);
+	now_us += FRAME_SPACING_US;
+	receive(legit_address, sent_frame, sent_len);
+	wireless_packet_t *packet = wireless_rx_dequeue();
+	CHECK(packet);
+	CHECK_EQ(packet->data[0], WIRELESS_PACKET_TYPE_AGGREGATE);
+	wireless_dispatch(packet);
+	wireless_packet_release(packet);
+	CHECK_EQ(bonk_latency.packets - bonks_before, 1);
+	CHECK(!wireless_rx_dequeue());
+}
+
+typedef struct bench_result {
+	double tx_ns;
+	double rx_ns;
+} bench_result_t;
+
+static bench_result_t bench_mode(bool aead, size_t len) {
+	static uint8_t frames[BENCH_FRAMES][FRAME_LEN];
+	uint8_t payload[WIRELESS_MAX_PACKET_SIZE] = { WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS };
+	bench_result_t result;
+	wireless_set_aead_enable(aead);
+
+	int64_t start_ns = get_time_ns();
+	for (int i = 0; i < BENCH_FRAMES; i++) {
+		wireless_broadcast(payload, len);
+		memcpy(frames[i], sent_frame, sent_len);
+	}
+	result.tx_ns = (double)(get_time_ns() - start_ns) / BENCH_FRAMES;
+
+	now_us += MS_TO_US(10000);
+	wireless_rx_stats_t stats_before, stats;
+	wireless_get_rx_stats(&stats_before);
+	int64_t elapsed_ns = 0;
+	for (int i = 0; i < BENCH_FRAMES; i++) {
+		now_us += FRAME_SPACING_US;
+		start_ns = get_time_ns();
+		receive(legit_address, frames[i], HDR_LEN + len);
+		elapsed_ns += get_time_ns() - start_ns;
+		drain();
+	}
+	result.rx_ns = (double)elapsed_ns / BENCH_FRAMES;
+	wireless_get_rx_stats(&stats);
+	CHECK_EQ(stats.packets_received - stats_before.packets_received, BENCH_FRAMES);
+	return result;
+}
+
+static void test_aead_vs_legacy_rate(void) {
+	static const size_t lengths[] = { 16, 64, WIRELESS_MAX_PACKET_SIZE };
+	printf("    Bytes  TX legacy   TX AEAD     RX legacy   RX AEAD (packets/s)\n");
+	for (int i = 0; i < ARRAY_SIZE(lengths); i++) {
+		bench_result_t legacy = bench_mode(false, lengths[i]);
+		bench_result_t aead = bench_mode(true, lengths[i]);
+		printf("    %-6zu %-11.0f %-11.0f %-11.0f %-11.0f\n", lengths[i],
+		       1e9 / legacy.tx_ns, 1e9 / aead.tx_ns, 1e9 / legacy.rx_ns, 1e9 / aead.rx_ns);
+	}
+	wireless_set_aead_enable(true);
+}
+
+/*
+ * Plaintext frames so that any node address can send them, the queueing
+ * path is the same as for encrypted frames. A group of nodes floods status
+ * packets, one node sends a bonk (realtime) and a squish, which stands in
+ * for the same packet handled in the bulk class. The main loop dispatches
+ * one packet at a time and stays busy for the handler's cost.
+ */
+static void test_realtime_latency_bulk_saturated(void) {
+	wireless_set_encryption_enable(false);
+	now_us += MS_TO_US(10000);
+	memset(&bonk_latency, 0, sizeof(bonk_latency));
+	memset(&squish_latency, 0, sizeof(squish_latency));
+	wireless_rx_stats_t stats_before, stats;
+	wireless_get_rx_stats(&stats_before);
+
+	uint8_t bonk_node[ESP_NOW_ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+	uint8_t status_frame[WIRELESS_MAX_PACKET_SIZE] = { WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS };
+	uint8_t bonk_frame[] = { WIRELESS_PACKET_TYPE_BONK, 0x42 };
+	uint8_t squish_frame[] = { WIRELESS_PACKET_TYPE_SQUISH, 0x42 };
+	unsigned int num_bonks = 0, num_squishes = 0;
+	int64_t start_us = now_us;
+	main_loop_busy_until_us = now_us;
+	for (int64_t t_us = 0; t_us < SATURATE_DURATION_US; t_us += SATURATE_STEP_US) {
+		now_us = start_us + t_us;
+		for (int node = 0; node < SATURATE_NODES; node++) {
+			// Nodes send at staggered offsets
+			if ((t_us + node * SATURATE_INTERVAL_US / SATURATE_NODES) % SATURATE_INTERVAL_US == 0) {
+				uint8_t node_address[ESP_NOW_ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x01, node };
+				receive(node_address, status_frame, sizeof(status_frame));
+			}
+		}
+		if (t_us % SATURATE_RT_INTERVAL_US == MS_TO_US(3)) {
+			receive(bonk_node, bonk_frame, sizeof(bonk_frame));
+			num_bonks++;
+		}
+		if (t_us % SATURATE_RT_INTERVAL_US == MS_TO_US(28)) {
+			receive(bonk_node, squish_frame, sizeof(squish_frame));
+			num_squishes++;
+		}
+
+		wireless_packet_t *packet;
+		while (now_us >= main_loop_busy_until_us && (packet = wireless_rx_dequeue())) {
+			wireless_dispatch(packet);
+			wireless_packet_release(packet);
+		}
+	}
+	drain();
+
+	wireless_get_rx_stats(&stats);
+	uint32_t bulk_dropped = stats.pool_exhausted[WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS] -
+				stats_before.pool_exhausted[WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS];
+	uint32_t squish_dropped = stats.pool_exhausted[WIRELESS_PACKET_TYPE_SQUISH] -
+				  stats_before.pool_exhausted[WIRELESS_PACKET_TYPE_SQUISH];
+	printf("    bulk dropped %lu of %u\n", (unsigned long)bulk_dropped,
+	       SATURATE_NODES * (unsigned int)(SATURATE_DURATION_US / SATURATE_INTERVAL_US));
+	printf("    realtime class  %4u of %4u dispatched, latency avg %6ld us, max %6ld us\n",
+	       bonk_latency.packets, num_bonks, (long)(bonk_latency.total_us / bonk_latency.packets),
+	       (long)bonk_latency.max_us);
+	printf("    bulk class      %4u of %4u dispatched, latency avg %6ld us, max %6ld us\n",
+	       squish_latency.packets, num_squishes,
+	       squish_latency.packets ? (long)(squish_latency.total_us / squish_latency.packets) : 0,
+	       (long)squish_latency.max_us);
+
+	// The bulk queue was saturated, yet every bonk waited for one bulk handler at most
+	CHECK(bulk_dropped > 0);
+	CHECK(squish_dropped > 0);
+	CHECK_EQ(bonk_latency.packets, num_bonks);
+	CHECK(bonk_latency.max_us <= SATURATE_BULK_COST_US + SATURATE_STEP_US);
+	CHECK(squish_latency.max_us > bonk_latency.max_us);
+	wireless_set_encryption_enable(true);
+}
+
+int main(void) {
+	CHECK_EQ(wireless_init(), ESP_OK);
+	wireless_set_aead_enable(true);
+	CHECK_EQ(wireless_register_handler(WIRELESS_PACKET_TYPE_BONK, bonk_rx, NULL, WIRELESS_HANDLER_FLAG_REALTIME), ESP_OK);
+	CHECK_EQ(wireless_register_handler(WIRELESS_PACKET_TYPE_SQUISH, squish_rx, NULL, 0), ESP_OK);
+	CHECK_EQ(wireless_register_handler(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, status_rx, NULL, 0), ESP_OK);
+	CHECK_EQ(wireless_register_handler(WIRELESS_PACKET_TYPE_DEFAULT_COLOR, capture_rx, NULL, 0), ESP_OK);
+	memcpy(legit_address, mock_wifi_mac, sizeof(legit_address));
+
+	TEST_RUN(test_flood_short);
+	TEST_RUN(test_flood_over_rate);
+	TEST_RUN(test_flood_stale);
+	TEST_RUN(test_flood_replay);
+	TEST_RUN(test_flood_forged);
+	TEST_RUN(test_pool_exhausted_without_decrypt);
+	TEST_RUN(test_aead_reference_vector);
+	TEST_RUN(test_aead_round_trip);
+	TEST_RUN(test_aead_flipped_bits);
+	TEST_RUN(test_key_change);
+	TEST_RUN(test_aggregate_split);
+	TEST_RUN(test_aggregate_max_length);
+	TEST_RUN(test_aggregate_malformed);
+	TEST_RUN(test_aggregate_type_budget);
+	TEST_RUN(test_aead_vs_legacy_rate);
+	TEST_RUN(test_realtime_latency_bulk_saturated);
+	return 0;
+}
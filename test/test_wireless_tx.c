@@ -0,0 +1,362 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mock_scheduler.h"
+#include "neighbour.h"
+#include "util.h"
+#include "wireless.h"
+#include "wireless_tx.h"
+
+#include "test.h"
+
+#define TX_MIN_GAP_US		MS_TO_US(2)
+#define TX_TYPE_INTERVAL_US	MS_TO_US(20)
+#define TX_JITTER_US		MS_TO_US(10)
+
+/*
+ * Airtime of an ESP-NOW broadcast at the default 1 Mbit/s: long DSSS
+ * preamble and PLCP header, 802.11 action frame with the ESP-NOW vendor
+ * element and FCS, the 20 byte wireless header, plus DIFS and the average
+ * initial backoff (CWmin 31 at 20 us slots).
+ */
+#define AIRTIME_PREAMBLE_US		192
+#define AIRTIME_FRAME_OVERHEAD_BYTES	(24 + 15 + 4 + 20)
+#define AIRTIME_US_PER_BYTE		8
+#define AIRTIME_CONTENTION_US		(50 + 31 * 20 / 2)
+#define MODEL_NODES			100
+#define MODEL_DURATION_US		MS_TO_US(60000)
+
+/* Mocks */
+uint32_t esp_random(void) {
+	static uint32_t state = 1;
+	state = state * 1103515245 + 12345;
+	return state >> 8;
+}
+
+typedef struct sent_frame {
+	int64_t timestamp_us;
+	size_t len;
+	uint8_t data[WIRELESS_MAX_PACKET_SIZE];
+} sent_frame_t;
+
+static sent_frame_t sent[512];
+static unsigned int num_sent;
+
+// Stands in for the encrypting wrapper around esp_now_send()
+esp_err_t wireless_broadcast(const uint8_t *data, size_t len) {
+	CHECK(num_sent < ARRAY_SIZE(sent));
+	sent_frame_t *frame = &sent[num_sent++];
+	frame->timestamp_us = mock_now_us;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+	return ESP_OK;
+}
+
+static void queue(uint8_t type, uint8_t payload, wireless_tx_priority_t priority,
+		  unsigned int flags, unsigned int repeats) {
+	uint8_t packet[] = { type, payload };
+	CHECK_EQ(wireless_tx_queue(packet, sizeof(packet), priority, flags, repeats), ESP_OK);
+}
+
+static void reset(void) {
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(1000));
+	num_sent = 0;
+}
+
+static void test_priority_order(void) {
+	reset();
+	// Occupies the pacing gap, everything below has to wait for it
+	queue(WIRELESS_PACKET_TYPE_RAINBOW_FADE, 0, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 1, WIRELESS_TX_PRIORITY_BULK, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 2, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_USB_CONFIG, 3, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_BONK, 4, WIRELESS_TX_PRIORITY_REALTIME, 0, 1);
+	int64_t start_us = mock_now_us;
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(100));
+
+	static const uint8_t expected_order[] = { 0, 4, 2, 3, 1 };
+	CHECK_EQ(num_sent, ARRAY_SIZE(expected_order));
+	for (int i = 0; i < ARRAY_SIZE(expected_order); i++) {
+		CHECK_EQ(sent[i].data[1], expected_order[i]);
+	}
+
+	// Realtime goes out at once, paced packets keep the minimum gap
+	CHECK_EQ(sent[1].timestamp_us, start_us);
+	for (int i = 2; i < num_sent; i++) {
+		CHECK(sent[i].timestamp_us - sent[i - 1].timestamp_us >= TX_MIN_GAP_US);
+	}
+}
+
+static void test_repeat_pacing(void) {
+	reset();
+	queue(WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 0, WIRELESS_TX_PRIORITY_NORMAL, 0, 3);
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(200));
+
+	CHECK_EQ(num_sent, 3);
+	for (int i = 1; i < num_sent; i++) {
+		int64_t gap_us = sent[i].timestamp_us - sent[i - 1].timestamp_us;
+		CHECK(gap_us >= TX_TYPE_INTERVAL_US);
+		CHECK(gap_us < TX_TYPE_INTERVAL_US + TX_JITTER_US);
+	}
+}
+
+static void test_type_interval_between_packets(void) {
+	reset();
+	queue(WIRELESS_PACKET_TYPE_STATE_OF_CHARGE, 0, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_STATE_OF_CHARGE, 1, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(100));
+
+	CHECK_EQ(num_sent, 2);
+	CHECK(sent[1].timestamp_us - sent[0].timestamp_us >= TX_TYPE_INTERVAL_US);
+}
+
+static void test_supersede(void) {
+	reset();
+	wireless_tx_stats_t stats_before, stats;
+	wireless_tx_get_stats(&stats_before);
+
+	queue(WIRELESS_PACKET_TYPE_POWER_CONTROL, 1, WIRELESS_TX_PRIORITY_NORMAL, WIRELESS_TX_FLAG_SUPERSEDE, 3);
+	queue(WIRELESS_PACKET_TYPE_POWER_CONTROL, 2, WIRELESS_TX_PRIORITY_NORMAL, WIRELESS_TX_FLAG_SUPERSEDE, 3);
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(200));
+
+	// First copy of the old config was already on air, the rest is replaced
+	wireless_tx_get_stats(&stats);
+	CHECK_EQ(stats.packets_coalesced - stats_before.packets_coalesced, 1);
+	CHECK_EQ(num_sent, 4);
+	CHECK_EQ(sent[0].data[1], 1);
+	for (int i = 1; i < num_sent; i++) {
+		CHECK_EQ(sent[i].data[1], 2);
+	}
+}
+
+static void test_full_queue_drops_lower_priority(void) {
+	reset();
+	wireless_tx_stats_t stats_before, stats;
+	wireless_tx_get_stats(&stats_before);
+
+	// The first one goes out right away, the rest fills the queue
+	for (int i = 0; i < WIRELESS_TX_QUEUE_SIZE + 1; i++) {
+		queue(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO, i, WIRELESS_TX_PRIORITY_BULK, 0, 1);
+	}
+	queue(WIRELESS_PACKET_TYPE_COLOR_OVERRIDE, 0xff, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	uint8_t packet[] = { WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO, 0xfe };
+	CHECK_EQ(wireless_tx_queue(packet, sizeof(packet), WIRELESS_TX_PRIORITY_BULK, 0, 1), ESP_ERR_NO_MEM);
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(1000));
+
+	wireless_tx_get_stats(&stats);
+	CHECK_EQ(stats.packets_dropped - stats_before.packets_dropped, 2);
+	CHECK_EQ(num_sent, WIRELESS_TX_QUEUE_SIZE + 1);
+	// Normal priority overtakes the queued bulk packets, the newest bulk one made room
+	CHECK_EQ(sent[1].data[1], 0xff);
+	CHECK_EQ(sent[num_sent - 1].data[1], WIRELESS_TX_QUEUE_SIZE - 1);
+	CHECK_EQ(stats.queue_depth, 0);
+}
+
+static void test_aggregation(void) {
+	reset();
+	wireless_tx_set_aggregation_enable(true);
+	queue(WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_RAINBOW_FADE, 2, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 3, WIRELESS_TX_PRIORITY_BULK, 0, 1);
+	mock_scheduler_run_until(mock_now_us);
+	wireless_tx_set_aggregation_enable(false);
+
+	static const uint8_t expected[] = {
+		WIRELESS_PACKET_TYPE_AGGREGATE,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, 1,
+		WIRELESS_PACKET_TYPE_RAINBOW_FADE, 1, 2,
+		WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 1, 3
+	};
+	CHECK_EQ(num_sent, 1);
+	CHECK_EQ(sent[0].len, sizeof(expected));
+	CHECK(!memcmp(sent[0].data, expected, sizeof(expected)));
+}
+
+static void queue_len(uint8_t type, size_t len, wireless_tx_priority_t priority, unsigned int flags) {
+	uint8_t packet[WIRELESS_MAX_PACKET_SIZE] = { type };
+	CHECK(len <= sizeof(packet));
+	memset(&packet[1], type, len - 1);
+	CHECK_EQ(wireless_tx_queue(packet, len, priority, flags, 1), ESP_OK);
+}
+
+// Splits an aggregate back into its sub-messages, returns their number or -1 if malformed
+static int count_sub_messages(const sent_frame_t *frame, unsigned int *total_len) {
+	int num_sub_messages = 0;
+	size_t pos = 1;
+	while (pos < frame->len) {
+		if (frame->len - pos < 2) {
+			return -1;
+		}
+		uint8_t type = frame->data[pos];
+		uint8_t len = frame->data[pos + 1];
+		pos += 2;
+		if (type == WIRELESS_PACKET_TYPE_AGGREGATE || len > frame->len - pos) {
+			return -1;
+		}
+		pos += len;
+		*total_len += len + 1;
+		num_sub_messages++;
+	}
+	return num_sub_messages;
+}
+
+static void test_aggregation_frame_limit(void) {
+	reset();
+	wireless_tx_set_aggregation_enable(true);
+	// Five 100 byte packets, two fit into a frame
+	static const uint8_t types[] = {
+		WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS,
+		WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO,
+		WIRELESS_PACKET_TYPE_NEIGHBOUR_RSSI_REPORT,
+		WIRELESS_PACKET_TYPE_USB_CONFIG,
+		WIRELESS_PACKET_TYPE_DEFAULT_COLOR
+	};
+	for (int i = 0; i < ARRAY_SIZE(types); i++) {
+		queue_len(types[i], 100, WIRELESS_TX_PRIORITY_BULK, 0);
+	}
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(100));
+	wireless_tx_set_aggregation_enable(false);
+
+	CHECK_EQ(num_sent, 3);
+	unsigned int total_len = 0;
+	for (int i = 0; i < num_sent; i++) {
+		CHECK(sent[i].len <= WIRELESS_MAX_PACKET_SIZE);
+		if (sent[i].data[0] == WIRELESS_PACKET_TYPE_AGGREGATE) {
+			CHECK_EQ(count_sub_messages(&sent[i], &total_len), 2);
+		} else {
+			// A lone packet is sent as it is
+			CHECK_EQ(sent[i].len, 100);
+			total_len += sent[i].len;
+		}
+	}
+	CHECK_EQ(total_len, ARRAY_SIZE(types) * 100);
+}
+
+static void test_aggregation_full_frame(void) {
+	reset();
+	wireless_tx_set_aggregation_enable(true);
+	// Too large to share a frame, must go out unwrapped
+	queue_len(WIRELESS_PACKET_TYPE_OTA, WIRELESS_MAX_PACKET_SIZE, WIRELESS_TX_PRIORITY_BULK, 0);
+	// Fill an aggregate to the last byte, 1 + (2 + 200) + (2 + 25) = 230
+	queue_len(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO, 201, WIRELESS_TX_PRIORITY_BULK, 0);
+	queue_len(WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, 26, WIRELESS_TX_PRIORITY_BULK, 0);
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(100));
+	wireless_tx_set_aggregation_enable(false);
+
+	CHECK_EQ(num_sent, 2);
+	CHECK_EQ(sent[0].data[0], WIRELESS_PACKET_TYPE_OTA);
+	CHECK_EQ(sent[0].len, WIRELESS_MAX_PACKET_SIZE);
+	unsigned int total_len = 0;
+	CHECK_EQ(sent[1].data[0], WIRELESS_PACKET_TYPE_AGGREGATE);
+	CHECK_EQ(sent[1].len, WIRELESS_MAX_PACKET_SIZE);
+	CHECK_EQ(count_sub_messages(&sent[1], &total_len), 2);
+}
+
+static void test_aggregation_skips_realtime(void) {
+	reset();
+	wireless_tx_set_aggregation_enable(true);
+	queue(WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_BONK, 2, WIRELESS_TX_PRIORITY_REALTIME, 0, 1);
+	queue(WIRELESS_PACKET_TYPE_RAINBOW_FADE, 3, WIRELESS_TX_PRIORITY_NORMAL, 0, 1);
+	int64_t start_us = mock_now_us;
+	mock_scheduler_run_until(mock_now_us + MS_TO_US(100));
+	wireless_tx_set_aggregation_enable(false);
+
+	// Realtime went out inline, the paced ones waited for the pump
+	CHECK_EQ(num_sent, 2);
+	CHECK_EQ(sent[0].data[0], WIRELESS_PACKET_TYPE_BONK);
+	CHECK_EQ(sent[0].timestamp_us, start_us);
+	unsigned int total_len = 0;
+	CHECK_EQ(sent[1].data[0], WIRELESS_PACKET_TYPE_AGGREGATE);
+	CHECK_EQ(count_sub_messages(&sent[1], &total_len), 2);
+}
+
+typedef struct model_packet {
+	uint8_t packet_type;
+	size_t len;
+	wireless_tx_priority_t priority;
+	int64_t interval_us;
+} model_packet_t;
+
+static int64_t frame_airtime_us(size_t len) {
+	return AIRTIME_PREAMBLE_US + (AIRTIME_FRAME_OVERHEAD_BYTES + len) * AIRTIME_US_PER_BYTE +
+	       AIRTIME_CONTENTION_US;
+}
+
+/*
+ * Periodic traffic of one node, all generated from tasks ticking once per
+ * second or every two seconds since boot. Every node of a group sends the
+ * same, so a group is a multiple of a single node.
+ */
+static void model_node(bool aggregate, unsigned int *frames, int64_t *airtime_us) {
+	static const model_packet_t traffic[] = {
+		{ WIRELESS_PACKET_TYPE_NEIGHBOUR_ADVERTISEMENT, 1 + 2 * 8, WIRELESS_TX_PRIORITY_REALTIME, MS_TO_US(3000) },
+		{ WIRELESS_PACKET_TYPE_NEIGHBOUR_STATUS, sizeof(neighbour_status_packet_t),
+		  WIRELESS_TX_PRIORITY_BULK, MS_TO_US(10000) },
+		{ WIRELESS_PACKET_TYPE_NEIGHBOUR_STATIC_INFO, sizeof(neighbour_static_info_packet_t),
+		  WIRELESS_TX_PRIORITY_BULK, MS_TO_US(60000) },
+		{ WIRELESS_PACKET_TYPE_NEIGHBOUR_RSSI_REPORT,
+		  sizeof(neighbour_rssi_info_packet_t) + 8 * sizeof(neighbour_rssi_info_t),
+		  WIRELESS_TX_PRIORITY_BULK, MS_TO_US(10000) },
+		// Shared configs, type, a few bytes of settings and the config timestamp
+		{ WIRELESS_PACKET_TYPE_BONK, 1 + 16 + 8, WIRELESS_TX_PRIORITY_NORMAL, MS_TO_US(10000) },
+		{ WIRELESS_PACKET_TYPE_STATE_OF_CHARGE, 1 + 1 + 8, WIRELESS_TX_PRIORITY_NORMAL, MS_TO_US(10000) },
+		{ WIRELESS_PACKET_TYPE_DEFAULT_COLOR, 1 + 6 + 8, WIRELESS_TX_PRIORITY_NORMAL, MS_TO_US(10000) },
+		{ WIRELESS_PACKET_TYPE_RAINBOW_FADE, 1 + 4 + 8, WIRELESS_TX_PRIORITY_NORMAL, MS_TO_US(10000) },
+		{ WIRELESS_PACKET_TYPE_POWER_CONTROL, 1 + 1 + 8, WIRELESS_TX_PRIORITY_NORMAL, MS_TO_US(10000) },
+	};
+
+	reset();
+	wireless_tx_set_aggregation_enable(aggregate);
+	int64_t start_us = mock_now_us;
+	for (int64_t t_us = 0; t_us < MODEL_DURATION_US; t_us += MS_TO_US(1000)) {
+		mock_scheduler_run_until(start_us + t_us);
+		for (int i = 0; i < ARRAY_SIZE(traffic); i++) {
+			const model_packet_t *packet = &traffic[i];
+			if (t_us % packet->interval_us == 0) {
+				queue_len(packet->packet_type, packet->len, packet->priority, WIRELESS_TX_FLAG_SUPERSEDE);
+			}
+		}
+	}
+	mock_scheduler_run_until(start_us + MODEL_DURATION_US);
+	wireless_tx_set_aggregation_enable(false);
+
+	*frames = num_sent;
+	*airtime_us = 0;
+	for (int i = 0; i < num_sent; i++) {
+		*airtime_us += frame_airtime_us(sent[i].len);
+	}
+}
+
+static void test_group_airtime_model(void) {
+	unsigned int frames_plain, frames_aggregated;
+	int64_t airtime_plain_us, airtime_aggregated_us;
+	model_node(false, &frames_plain, &airtime_plain_us);
+	model_node(true, &frames_aggregated, &airtime_aggregated_us);
+
+	double seconds = MODEL_DURATION_US / 1e6;
+	printf("    %u nodes         frames/s  airtime\n", MODEL_NODES);
+	printf("    separate         %-9.1f %.2f%%\n", MODEL_NODES * frames_plain / seconds,
+	       MODEL_NODES * airtime_plain_us / (seconds * 1e4));
+	printf("    aggregated       %-9.1f %.2f%%\n", MODEL_NODES * frames_aggregated / seconds,
+	       MODEL_NODES * airtime_aggregated_us / (seconds * 1e4));
+	CHECK(frames_aggregated < frames_plain);
+	CHECK(airtime_aggregated_us < airtime_plain_us);
+}
+
+int main(void) {
+	wireless_tx_init();
+
+	TEST_RUN(test_priority_order);
+	TEST_RUN(test_repeat_pacing);
+	TEST_RUN(test_type_interval_between_packets);
+	TEST_RUN(test_supersede);
+	TEST_RUN(test_full_queue_drops_lower_priority);
+	TEST_RUN(test_aggregation);
+	TEST_RUN(test_aggregation_frame_limit);
+	TEST_RUN(test_aggregation_full_frame);
+	TEST_RUN(test_aggregation_skips_realtime);
+	TEST_RUN(test_group_airtime_model);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Checks the table-driven WS2812 encoder bit-exact against the former
+ * bit-by-bit encoder and the decoder, and compares their speed.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+#include "ws2812.h"
+
+#include "test.h"
+
+#define MAX_LEDS		4096
+// LEDs encoded per benchmark run, spread over frames of the size under test
+#define BENCH_TOTAL_LEDS	(1 << 22)
+
+// led_set_color_component() and led_set_color() as they were in main.c
+static uint8_t *reference_set_color_component(uint8_t *data, uint8_t val) {
+	for (int i = 0; i < 8; i++) {
+		bool bit = !!(val & (1 << (7 - i)));
+		if (i % 2 == 0) {
+			*data &= ~0xf;
+			*data |= bit ? WS2812_SYMBOL_ONE : WS2812_SYMBOL_ZERO;
+		} else {
+			*data &= ~0xf0;
+			*data |= (bit ? WS2812_SYMBOL_ONE : WS2812_SYMBOL_ZERO) << 4;
+			data++;
+		}
+	}
+	return data;
+}
+
+static uint8_t *reference_set_color(uint8_t *data, uint8_t r, uint8_t g, uint8_t b) {
+	data = reference_set_color_component(data, g);
+	data = reference_set_color_component(data, r);
+	data = reference_set_color_component(data, b);
+	return data;
+}
+
+static uint32_t encoded[MAX_LEDS * WS2812_WORDS_PER_LED];
+static uint8_t reference[MAX_LEDS * WS2812_BYTES_PER_LED];
+static uint8_t colors[MAX_LEDS][3];
+
+static uint32_t rand_state = 1;
+
+static uint8_t rand_byte(void) {
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 16;
+}
+
+static void encode(unsigned int num_leds) {
+	uint32_t *dst = encoded;
+	for (unsigned int i = 0; i < num_leds; i++) {
+		dst = ws2812_encode(dst, colors[i][0], colors[i][1], colors[i][2]);
+	}
+}
+
+static void encode_reference(unsigned int num_leds) {
+	uint8_t *dst = reference;
+	for (unsigned int i = 0; i < num_leds; i++) {
+		dst = reference_set_color(dst, colors[i][0], colors[i][1], colors[i][2]);
+	}
+}
+
+static void test_all_bytes(void) {
+	// Every byte value in every color position
+	for (int i = 0; i < 256; i++) {
+		colors[i][0] = i;
+		colors[i][1] = 255 - i;
+		colors[i][2] = i * 7;
+	}
+	encode(256);
+	encode_reference(256);
+	CHECK(!memcmp(encoded, reference, 256 * WS2812_BYTES_PER_LED));
+
+	uint8_t grb[256][3];
+	CHECK_EQ(ws2812_decode((const uint8_t *)encoded, sizeof(encoded), &grb[0][0], 256), 256);
+	for (int i = 0; i < 256; i++) {
+		CHECK_EQ(grb[i][0], colors[i][1]);
+		CHECK_EQ(grb[i][1], colors[i][0]);
+		CHECK_EQ(grb[i][2], colors[i][2]);
+	}
+}
+
+static void test_random_frames(void) {
+	for (int i = 0; i < MAX_LEDS; i++) {
+		colors[i][0] = rand_byte();
+		colors[i][1] = rand_byte();
+		colors[i][2] = rand_byte();
+	}
+	encode(MAX_LEDS);
+	encode_reference(MAX_LEDS);
+	CHECK(!memcmp(encoded, reference, sizeof(reference)));
+}
+
+static void test_decode_bounds(void) {
+	uint8_t grb[4][3];
+	// Stops at the end of the buffer and at the requested number of LEDs
+	CHECK_EQ(ws2812_decode((const uint8_t *)encoded, 2 * WS2812_BYTES_PER_LED + 1, &grb[0][0], 4), 2);
+	CHECK_EQ(ws2812_decode((const uint8_t *)encoded, sizeof(encoded), &grb[0][0], 1), 1);
+
+	// Anything but the two symbols is rejected
+	uint8_t corrupt[WS2812_BYTES_PER_LED];
+	memcpy(corrupt, encoded, sizeof(corrupt));
+	corrupt[5] = 0xff;
+	CHECK_EQ(ws2812_decode(corrupt, sizeof(corrupt), &grb[0][0], 1), -1);
+}
+
+typedef void (*encode_f)(unsigned int num_leds);
+
+static double bench(encode_f fn, unsigned int num_leds) {
+	unsigned int rounds = BENCH_TOTAL_LEDS / num_leds;
+	int64_t start_ns = test_get_time_ns();
+	for (unsigned int i = 0; i < rounds; i++) {
+		fn(num_leds);
+		// Keep the compiler from merging rounds
+		__asm__ volatile("" : : "r"(encoded), "r"(reference) : "memory");
+	}
+	return (double)(test_get_time_ns() - start_ns) / rounds;
+}
+
+static void test_benchmark(void) {
+	static const unsigned int led_counts[] = { 16, 256, MAX_LEDS };
+	printf("    LEDs   bit-by-bit  table       speedup (ns/frame)\n");
+	for (int i = 0; i < ARRAY_SIZE(led_counts); i++) {
+		double reference_ns = bench(encode_reference, led_counts[i]);
+		double table_ns = bench(encode, led_counts[i]);
+		printf("    %-6u %-11.0f %-11.0f %.1fx\n", led_counts[i], reference_ns, table_ns, reference_ns / table_ns);
+	}
+}
+
+int main(void) {
+	ws2812_init();
+	TEST_RUN(test_all_bytes);
+	TEST_RUN(test_random_frames);
+	TEST_RUN(test_decode_bounds);
+	TEST_RUN(test_benchmark);
+	return 0;
+}